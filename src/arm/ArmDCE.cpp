@@ -19,6 +19,8 @@ bool ArmDCE::isImpure(Op *op) {
     IMPURE(StrFROp)
     IMPURE(StrWROp)
     IMPURE(StrXROp)
+    IMPURE(St1Op)
+    IMPURE(StrQOp)
     IMPURE(BlOp)
     IMPURE(BgtOp)
     IMPURE(BltOp)
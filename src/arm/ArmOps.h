@@ -41,6 +41,8 @@
 #define ARMOP(Ty) ARMOPBASE(Value::i32, Ty)
 #define ARMOPL(Ty) ARMOPBASE(Value::i64, Ty)
 #define ARMOPF(Ty) ARMOPBASE(Value::f32, Ty)
+#define ARMOPV(Ty) ARMOPBASE(Value::i128, Ty)
+#define ARMOPVF(Ty) ARMOPBASE(Value::f128, Ty)
 
 namespace sys::arm {
 
@@ -181,17 +183,114 @@ ARMOPF(FsubOp);
 ARMOPF(FmulOp);
 ARMOPF(FdivOp);
 
+// ==== NEON, always on 4 lanes of 32 bits ====
+// The vector registers are the same as fp registers.
+ARMOPE(Ld1Op); // ld1 {vd.4s}, [xn]
+ARMOP(St1Op); // st1 {vs.4s}, [xn]
+ARMOPV(LdrQOp); // Load a whole q register; only for spilling.
+ARMOP(StrQOp); // Store a whole q register; only for spilling.
+ARMOPV(AddVOp);
+ARMOPV(SubVOp);
+ARMOPV(MulVOp);
+ARMOPVF(FaddVOp);
+ARMOPVF(FsubVOp);
+ARMOPVF(FmulVOp);
+ARMOPV(DupOp); // Splat a w-register.
+ARMOPVF(DupFOp); // Splat the lowest lane of a fp register.
+ARMOPF(AddvOp); // Sum of all lanes, into a fp register.
+ARMOP(FmovSOp); // Move from a fp register to a 32-bit w-register.
+ARMOPV(MovVOp); // Move a whole vector register.
+
 // ==== Pseudo Ops ====
 ARMOP(ReadRegOp);
 ARMOP(WriteRegOp);
 ARMOP(PlaceHolderOp);
 ARMOP(SubSpOp);
 
+// Ops that only compute a value from their operands and attributes,
+// so that they can be freely merged or moved before register allocation.
+// Compares are fused into csets, so none of these touch the flags across ops.
+inline bool isPure(Op *op) {
+  return
+    isa<MovIOp>(op) ||
+    isa<MovnOp>(op) ||
+    isa<FmovWOp>(op) ||
+    isa<FmovFOp>(op) ||
+    isa<AdrOp>(op) ||
+    isa<AddWOp>(op) ||
+    isa<AddWIOp>(op) ||
+    isa<AddXOp>(op) ||
+    isa<AddXIOp>(op) ||
+    isa<SubWOp>(op) ||
+    isa<RsbWOp>(op) ||
+    isa<SubWIOp>(op) ||
+    isa<SubXOp>(op) ||
+    isa<MulWOp>(op) ||
+    isa<MulXOp>(op) ||
+    isa<SdivWOp>(op) ||
+    isa<SdivXOp>(op) ||
+    isa<UdivWOp>(op) ||
+    isa<MlaOp>(op) ||
+    isa<MsubWOp>(op) ||
+    isa<MsubXOp>(op) ||
+    isa<NegOp>(op) ||
+    isa<FnegOp>(op) ||
+    isa<SmulhOp>(op) ||
+    isa<UmulhOp>(op) ||
+    isa<AndOp>(op) ||
+    isa<OrOp>(op) ||
+    isa<EorOp>(op) ||
+    isa<AndIOp>(op) ||
+    isa<OrIOp>(op) ||
+    isa<EorIOp>(op) ||
+    isa<LslWOp>(op) ||
+    isa<LslXOp>(op) ||
+    isa<LsrWOp>(op) ||
+    isa<LsrXOp>(op) ||
+    isa<AsrWOp>(op) ||
+    isa<AsrXOp>(op) ||
+    isa<LslWIOp>(op) ||
+    isa<LslXIOp>(op) ||
+    isa<LsrWIOp>(op) ||
+    isa<LsrXIOp>(op) ||
+    isa<AsrWIOp>(op) ||
+    isa<AsrXIOp>(op) ||
+    isa<CsetNeOp>(op) ||
+    isa<CsetEqOp>(op) ||
+    isa<CsetLtOp>(op) ||
+    isa<CsetLeOp>(op) ||
+    isa<CsetGtOp>(op) ||
+    isa<CsetGeOp>(op) ||
+    isa<CsetNeFOp>(op) ||
+    isa<CsetEqFOp>(op) ||
+    isa<CsetLtFOp>(op) ||
+    isa<CsetLeFOp>(op) ||
+    isa<CsetGtFOp>(op) ||
+    isa<CsetGeFOp>(op) ||
+    isa<CsetNeTstOp>(op) ||
+    isa<CsetEqTstOp>(op) ||
+    isa<CsetNeFcmpZOp>(op) ||
+    isa<CsetEqFcmpZOp>(op) ||
+    isa<ScvtfOp>(op) ||
+    isa<FcvtzsOp>(op) ||
+    isa<FaddOp>(op) ||
+    isa<FsubOp>(op) ||
+    isa<FmulOp>(op) ||
+    isa<FdivOp>(op);
+}
+
+inline bool isVector(Op *op) {
+  auto ty = op->getResultType();
+  return ty == Value::i128 || ty == Value::f128;
+}
+
 inline bool hasRd(Op *op) {
   return !(
     isa<StrWOp>(op) ||
     isa<StrXOp>(op) ||
     isa<StrFOp>(op) ||
+    isa<St1Op>(op) ||
+    isa<StrQOp>(op) ||
     isa<BOp>(op) ||
     isa<BlOp>(op) ||
     isa<BeqOp>(op) ||
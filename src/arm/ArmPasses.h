@@ -2,12 +2,19 @@
 #define ARM_PASSES_H
 
 #include "../opt/Pass.h"
+#include "../opt/MachineCSE.h"
 #include "../codegen/CodeGen.h"
 #include "../codegen/Ops.h"
 #include "../codegen/Attrs.h"
 #include "ArmOps.h"
 #include "ArmAttrs.h"
 
+namespace sys {
+
+class LoopInfo;
+
+}
+
 namespace sys::arm {
 
 class Lower : public Pass {
@@ -45,6 +52,28 @@ public:
   void run() override;
 };
 
+class MachineCSE : public MachineCSEImpl<isPure> {
+public:
+  MachineCSE(ModuleOp *module): MachineCSEImpl(module) {}
+
+  std::string name() override { return "arm-cse"; };
+};
+
+// Hoists loop invariants out of loops, unless the loop is running out of registers.
+class MachineLICM : public Pass {
+  int hoisted = 0;
+  int kept = 0;
+
+  std::pair<int, int> pressure(LoopInfo *info);
+  void runImpl(LoopInfo *info);
+public:
+  MachineLICM(ModuleOp *module): Pass(module) {}
+
+  std::string name() override { return "arm-licm"; };
+  std::map<std::string, int> stats() override;
+  void run() override;
+};
+
 class RegAlloc : public Pass {
   int spilled = 0;
   int convertedTotal = 0;
@@ -54,6 +83,12 @@ class RegAlloc : public Pass {
 
   void runImpl(Region *region, bool isLeaf);
   void proEpilogue(FuncOp *funcOp, bool isLeaf);
+  // Shrink-wrapping; finds the block to set up the stack frame.
+  static BasicBlock *findSaveBlock(Region *region, const std::function<bool(BasicBlock*)> &needsFrame);
+  // Duplicates return blocks into their predecessors.
+  void splitReturns(Region *region);
+  // Splits live ranges that flow into the frame region (see `findSaveBlock`).
+  void splitLiveIns(Region *region);
   int latePeephole(Op *funcOp);
   void tidyup(Region *region);
 public:
@@ -65,6 +100,37 @@ public:
   void run() override;
 };
 
+// Global copy propagation on physical registers after register allocation.
+// Removes moves whose destination already holds the source (mostly from phi resolution),
+// and reloads of stack slots whose value is still in a register.
+class CopyProp : public Pass {
+  int removedMov = 0;
+  int removedFmov = 0;
+  int removedLdr = 0;
+
+  void runImpl(FuncOp *func);
+public:
+  CopyProp(ModuleOp *module): Pass(module) {}
+
+  std::string name() override { return "arm-copy-prop"; };
+  std::map<std::string, int> stats() override;
+  void run() override;
+};
+
+// A list scheduler after register allocation.
+// Spill reloads, address arithmetic and constants are all visible here.
+class PostSchedule : public Pass {
+  int reordered = 0;
+
+  bool runImpl(const std::vector<Op*> &ops, Op *stop, BasicBlock *bb);
+public:
+  PostSchedule(ModuleOp *module): Pass(module) {}
+
+  std::string name() override { return "arm-post-schedule"; };
+  std::map<std::string, int> stats() override;
+  void run() override;
+};
+
 class LateLegalize : public Pass {
 public:
   LateLegalize(ModuleOp *module): Pass(module) {}
@@ -0,0 +1,378 @@
+#include "ArmPasses.h"
+#include "Regs.h"
+
+using namespace sys::arm;
+using namespace sys;
+
+#define CREATE_MV(fp, rd, rs) \
+  if (!fp) \
+    builder.create<MovROp>({ RDC(rd), RSC(rs) }); \
+  else \
+    builder.create<FmovOp>({ RDC(rd), RSC(rs) });
+
+std::map<std::string, int> CopyProp::stats() {
+  return {
+    { "removed-mov", removedMov },
+    { "removed-fmov", removedFmov },
+    { "removed-ldr", removedLdr },
+  };
+}
+
+namespace {
+
+// A stack slot relative to `sp`, as (offset, size).
+using Slot = std::pair<int, int>;
+
+struct State {
+  // Unvisited blocks are "everything holds".
+  bool top = true;
+  // Pairs of registers holding the same value. The first is always the smaller one.
+  std::set<std::pair<Reg, Reg>> copies;
+  // Registers holding the value of a stack slot.
+  std::set<std::pair<Slot, Reg>> slots;
+
+  bool operator==(const State &other) const {
+    return top == other.top && copies == other.copies && slots == other.slots;
+  }
+};
+
+std::pair<Reg, Reg> ordered(Reg a, Reg b) {
+  return a < b ? std::make_pair(a, b) : std::make_pair(b, a);
+}
+
+template<class T>
+void intersect(std::set<T> &x, const std::set<T> &y) {
+  for (auto it = x.begin(); it != x.end();) {
+    if (!y.count(*it))
+      it = x.erase(it);
+    else
+      ++it;
+  }
+}
+
+// `reg` is overwritten.
+void kill(State &state, Reg reg) {
+  for (auto it = state.copies.begin(); it != state.copies.end();) {
+    if (it->first == reg || it->second == reg)
+      it = state.copies.erase(it);
+    else
+      ++it;
+  }
+  for (auto it = state.slots.begin(); it != state.slots.end();) {
+    if (it->second == reg)
+      it = state.slots.erase(it);
+    else
+      ++it;
+  }
+}
+
+// Memory in [offset, offset + size) relative to `sp` is overwritten.
+void clobber(State &state, int offset, int size) {
+  for (auto it = state.slots.begin(); it != state.slots.end();) {
+    auto [off, sz] = it->first;
+    if (off < offset + size && offset < off + sz)
+      it = state.slots.erase(it);
+    else
+      ++it;
+  }
+}
+
+bool isLoad(Op *op) {
+  return isa<LdrWOp>(op) || isa<LdrXOp>(op) || isa<LdrFOp>(op) ||
+    isa<LdrWROp>(op) || isa<LdrXROp>(op) || isa<LdrFROp>(op) ||
+    isa<Ld1Op>(op) || isa<LdrQOp>(op);
+}
+
+bool isStore(Op *op) {
+  return isa<StrWOp>(op) || isa<StrXOp>(op) || isa<StrFOp>(op) ||
+    isa<StrWROp>(op) || isa<StrXROp>(op) || isa<StrFROp>(op) ||
+    isa<St1Op>(op) || isa<StrQOp>(op);
+}
+
+// Whether the address is (register + immediate).
+// `ld1` and `st1` always have an offset of 0.
+bool hasImmOffset(Op *op) {
+  return isa<LdrWOp>(op) || isa<LdrXOp>(op) || isa<LdrFOp>(op) ||
+    isa<StrWOp>(op) || isa<StrXOp>(op) || isa<StrFOp>(op) ||
+    isa<Ld1Op>(op) || isa<St1Op>(op) || isa<LdrQOp>(op) || isa<StrQOp>(op);
+}
+
+int accessSize(Op *op) {
+  if (isa<Ld1Op>(op) || isa<St1Op>(op) || isa<LdrQOp>(op) || isa<StrQOp>(op))
+    return 16;
+  return isa<LdrXOp>(op) || isa<StrXOp>(op) ? 8 : 4;
+}
+
+// `rd` now holds the same value as `rs`.
+void copy(State &state, Reg rd, Reg rs) {
+  kill(state, rd);
+
+  std::vector<std::pair<Reg, Reg>> newCopies { ordered(rd, rs) };
+  for (auto [a, b] : state.copies) {
+    if (a == rs)
+      newCopies.push_back(ordered(rd, b));
+    if (b == rs)
+      newCopies.push_back(ordered(rd, a));
+  }
+  // Moves are at most 64 bits wide, so they don't copy vectors.
+  std::vector<Slot> newSlots;
+  for (auto [slot, reg] : state.slots) {
+    if (reg == rs && slot.second <= 8)
+      newSlots.push_back(slot);
+  }
+
+  for (auto x : newCopies)
+    state.copies.insert(x);
+  for (auto slot : newSlots)
+    state.slots.insert({ slot, rd });
+}
+
+// Whether the address of the stack frame is taken,
+// i.e. whether `sp` is read by anything other than the base of a load/store.
+// If not, then calls and stores through other pointers can never touch stack slots.
+bool addressTaken(FuncOp *func) {
+  for (auto bb : func->getRegion()->getBlocks()) {
+    for (auto op : bb->getOps()) {
+      if (hasRd(op) && op->has<RdAttr>() && RD(op) == Reg::sp)
+        continue;
+      if (isStore(op)) {
+        if (RS(op) == Reg::sp)
+          return true;
+        continue;
+      }
+      if (isLoad(op))
+        continue;
+      if ((op->has<RsAttr>() && RS(op) == Reg::sp) ||
+          (op->has<Rs2Attr>() && RS2(op) == Reg::sp) ||
+          (op->has<Rs3Attr>() && RS3(op) == Reg::sp))
+        return true;
+    }
+  }
+  return false;
+}
+
+// After `tidyup`, blocks fall through to the next one, and a branch might be followed by a `j`.
+std::vector<BasicBlock*> getSuccs(BasicBlock *bb) {
+  std::vector<BasicBlock*> succs;
+  for (auto op : bb->getOps()) {
+    if (auto target = op->find<TargetAttr>())
+      succs.push_back(target->bb);
+    if (auto ifnot = op->find<ElseAttr>())
+      succs.push_back(ifnot->bb);
+  }
+
+  auto last = bb->getOpCount() ? bb->getLastOp() : nullptr;
+  bool fallthrough = !last || !(isa<BOp>(last) || isa<RetOp>(last) || last->has<ElseAttr>());
+  if (fallthrough && bb != bb->getParent()->getLastBlock())
+    succs.push_back(bb->nextBlock());
+  return succs;
+}
+
+// Blocks whose only ops were redundant are empty now. They fall through,
+// so whatever jumps to them can go to the next non-empty block instead.
+// The last block ends with a return or a jump, so it never becomes empty.
+void removeEmptyBlocks(Region *region) {
+  std::vector<BasicBlock*> empty;
+  for (auto bb : region->getBlocks()) {
+    if (!bb->getOpCount())
+      empty.push_back(bb);
+  }
+  if (empty.empty())
+    return;
+
+  const auto forward = [](BasicBlock *bb) {
+    while (!bb->getOpCount())
+      bb = bb->nextBlock();
+    return bb;
+  };
+
+  for (auto bb : region->getBlocks()) {
+    for (auto op : bb->getOps()) {
+      if (auto target = op->find<TargetAttr>())
+        target->bb = forward(target->bb);
+      if (auto ifnot = op->find<ElseAttr>())
+        ifnot->bb = forward(ifnot->bb);
+    }
+  }
+
+  for (auto bb : empty)
+    bb->forceErase();
+}
+
+enum Removed {
+  None, Mov, Fmov, Ldr,
+};
+
+// Runs the transfer function of a single op.
+// When `rewrite` is set, redundant moves and reloads are removed on the way.
+Removed transfer(Op *op, State &state, bool escaped, bool rewrite) {
+  Builder builder;
+
+  if (isa<MovROp>(op) || isa<FmovOp>(op)) {
+    auto rd = RD(op), rs = RS(op);
+    if (rewrite && (rd == rs || state.copies.count(ordered(rd, rs)))) {
+      auto removed = isa<MovROp>(op) ? Mov : Fmov;
+      op->erase();
+      return removed;
+    }
+    if (rd != rs)
+      copy(state, rd, rs);
+    return None;
+  }
+
+  if (hasImmOffset(op) && isLoad(op) && RS(op) == Reg::sp) {
+    auto rd = RD(op);
+    Slot slot { V(op), accessSize(op) };
+    if (state.slots.count({ slot, rd })) {
+      if (!rewrite)
+        return None;
+      op->erase();
+      return Ldr;
+    }
+
+    // The value is already in another register of the same kind.
+    for (auto [s, reg] : state.slots) {
+      if (s != slot || s.second > 8 || isFP(reg) != isFP(rd))
+        continue;
+
+      copy(state, rd, reg);
+      if (!rewrite)
+        return None;
+      builder.setBeforeOp(op);
+      CREATE_MV(isFP(rd), rd, reg);
+      op->erase();
+      return Ldr;
+    }
+
+    kill(state, rd);
+    state.slots.insert({ slot, rd });
+    return None;
+  }
+
+  if (isStore(op)) {
+    if (RS2(op) != Reg::sp || !hasImmOffset(op)) {
+      if (escaped || RS2(op) == Reg::sp)
+        state.slots.clear();
+      return None;
+    }
+    Slot slot { V(op), accessSize(op) };
+    clobber(state, slot.first, slot.second);
+    state.slots.insert({ slot, RS(op) });
+    return None;
+  }
+
+  if (isa<BlOp>(op)) {
+    // Be conservative: everything that isn't preserved by the callee is lost,
+    // including the scratch registers (x16-x18) and the link register.
+    std::vector<Reg> lost;
+    for (auto [a, b] : state.copies) {
+      lost.push_back(a);
+      lost.push_back(b);
+    }
+    for (auto [_, reg] : state.slots)
+      lost.push_back(reg);
+    for (auto reg : lost) {
+      if (!calleeSaved.count(reg) && reg != Reg::sp && reg != Reg::xzr)
+        kill(state, reg);
+    }
+    if (escaped) {
+      state.slots.clear();
+      return None;
+    }
+    // The callee's frame lives below `sp`.
+    for (auto it = state.slots.begin(); it != state.slots.end();) {
+      if (it->first.first < 0)
+        it = state.slots.erase(it);
+      else
+        ++it;
+    }
+    return None;
+  }
+
+  if (isa<SubSpOp>(op)) {
+    state.slots.clear();
+    return None;
+  }
+
+  if (hasRd(op) && op->has<RdAttr>()) {
+    auto rd = RD(op);
+    kill(state, rd);
+    if (rd == Reg::sp)
+      state.slots.clear();
+  }
+  return None;
+}
+
+}
+
+void CopyProp::runImpl(FuncOp *func) {
+  auto region = func->getRegion();
+  bool escaped = addressTaken(func);
+
+  std::map<BasicBlock*, std::vector<BasicBlock*>> preds;
+  for (auto bb : region->getBlocks()) {
+    for (auto succ : getSuccs(bb))
+      preds[succ].push_back(bb);
+  }
+
+  // Forward dataflow; the meet is intersection.
+  std::map<BasicBlock*, State> in, out;
+  auto entry = region->getFirstBlock();
+  bool changed;
+  do {
+    changed = false;
+    for (auto bb : region->getBlocks()) {
+      State state;
+      if (bb != entry) {
+        for (auto pred : preds[bb]) {
+          const auto &predOut = out[pred];
+          if (predOut.top)
+            continue;
+          if (state.top) {
+            state = predOut;
+            continue;
+          }
+          intersect(state.copies, predOut.copies);
+          intersect(state.slots, predOut.slots);
+        }
+      }
+      // Unreachable blocks and the entry block know nothing.
+      if (bb == entry || preds[bb].empty())
+        state.top = false;
+      if (state.top)
+        continue;
+
+      in[bb] = state;
+      for (auto op : bb->getOps())
+        transfer(op, state, escaped, false);
+
+      if (!(out[bb] == state)) {
+        out[bb] = state;
+        changed = true;
+      }
+    }
+  } while (changed);
+
+  for (auto bb : region->getBlocks()) {
+    if (!in.count(bb))
+      continue;
+    auto state = in[bb];
+    // Copy the list, as ops get erased.
+    auto ops = bb->getOps();
+    for (auto op : ops) {
+      switch (transfer(op, state, escaped, true)) {
+      case Mov: removedMov++; break;
+      case Fmov: removedFmov++; break;
+      case Ldr: removedLdr++; break;
+      default: break;
+      }
+    }
+  }
+  removeEmptyBlocks(region);
+}
+
+void CopyProp::run() {
+  auto funcs = collectFuncs();
+  for (auto func : funcs)
+    runImpl(func);
+}
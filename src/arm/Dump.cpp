@@ -61,6 +61,7 @@ using namespace sys::arm;
 #define UNARY_W(Ty, name) UNARY(Ty, name, wreg)
 #define UNARY_X(Ty, name) UNARY(Ty, name, xreg)
 #define UNARY_F(Ty, name) UNARY(Ty, name, freg)
+#define BINARY_V(Ty, name) BINARY(Ty, name, vreg)
 
 namespace {
 
@@ -89,27 +90,52 @@ std::string freg(Reg reg) {
   return name;
 }
 
+std::string qreg(Reg reg) {
+  auto name = showReg(reg);
+  name[0] = 'q';
+  return name;
+}
+
+std::string vreg(Reg reg) {
+  return showReg(reg) + ".4s";
+}
+
 }
 
 void Dump::dumpOp(Op *op, std::ostream &os) {
   switch (op->opid) {
   TERNARY_W(MlaOp, "mla");
   TERNARY_W(MsubWOp, "msub");
+  TERNARY_X(MsubXOp, "msub");
 
   BINARY_W(AddWOp, "add");
   BINARY_W(SubWOp, "sub");
   BINARY_W(MulWOp, "mul");
   BINARY_W(SdivWOp, "sdiv");
+  BINARY_W(AndOp, "and");
+  BINARY_W(OrOp, "orr");
+  BINARY_W(AsrWOp, "asr");
 
   BINARY_F(FaddOp, "fadd");
   BINARY_F(FsubOp, "fsub");
   BINARY_F(FmulOp, "fmul");
   BINARY_F(FdivOp, "fdiv");
 
+  BINARY_V(AddVOp, "add");
+  BINARY_V(SubVOp, "sub");
+  BINARY_V(MulVOp, "mul");
+  BINARY_V(FaddVOp, "fadd");
+  BINARY_V(FsubVOp, "fsub");
+  BINARY_V(FmulVOp, "fmul");
+
   BINARY_X(AddXOp, "add");
   BINARY_X(MulXOp, "mul");
+  BINARY_X(SdivXOp, "sdiv");
 
   UNARY_I_W(AddWIOp, "add");
+  UNARY_I_W(AsrWIOp, "asr");
+  UNARY_I_W(AndIOp, "and");
+  UNARY_I_W(OrIOp, "orr");
 
   UNARY_I_X(AddXIOp, "add");
 
@@ -173,28 +199,29 @@ void Dump::dumpOp(Op *op, std::ostream &os) {
     os << "cmp " << wreg(RS(op)) << ", " << wreg(RS2(op)) << "\n";
     os << "cset " << wreg(RD(op)) << ", eq\n";
     break;
+  // `mi` and `ls` are false when either operand is NaN, unlike `lt` and `le`.
   case CsetLtFOp::id:
-    os << "cmp " << freg(RS(op)) << ", " << freg(RS2(op)) << "\n";
-    os << "cset " << wreg(RD(op)) << ", lt\n";
+    os << "fcmp " << freg(RS(op)) << ", " << freg(RS2(op)) << "\n";
+    os << "cset " << wreg(RD(op)) << ", mi\n";
     break;
   case CsetLeFOp::id:
-    os << "cmp " << freg(RS(op)) << ", " << freg(RS2(op)) << "\n";
-    os << "cset " << wreg(RD(op)) << ", le\n";
+    os << "fcmp " << freg(RS(op)) << ", " << freg(RS2(op)) << "\n";
+    os << "cset " << wreg(RD(op)) << ", ls\n";
     break;
   case CsetNeFOp::id:
-    os << "cmp " << freg(RS(op)) << ", " << freg(RS2(op)) << "\n";
+    os << "fcmp " << freg(RS(op)) << ", " << freg(RS2(op)) << "\n";
     os << "cset " << wreg(RD(op)) << ", ne\n";
     break;
   case CsetEqFOp::id:
-    os << "cmp " << freg(RS(op)) << ", " << freg(RS2(op)) << "\n";
+    os << "fcmp " << freg(RS(op)) << ", " << freg(RS2(op)) << "\n";
     os << "cset " << wreg(RD(op)) << ", eq\n";
     break;
   case CsetEqFcmpZOp::id:
-    os << "fcmpz " << freg(RS(op)) << "\n";
+    os << "fcmp " << freg(RS(op)) << ", #0.0\n";
     os << "cset " << wreg(RD(op)) << ", eq\n";
     break;
   case CsetNeFcmpZOp::id:
-    os << "fcmpz " << freg(RS(op)) << "\n";
+    os << "fcmp " << freg(RS(op)) << ", #0.0\n";
     os << "cset " << wreg(RD(op)) << ", ne\n";
     break;
   case CsetNeTstOp::id:
@@ -214,6 +241,33 @@ void Dump::dumpOp(Op *op, std::ostream &os) {
   case FcvtzsOp::id:
     os << "fcvtzs " << wreg(RD(op)) << ", " << freg(RS(op)) << "\n";
     break;
+  case Ld1Op::id:
+    os << "ld1 {" << vreg(RD(op)) << "}, [" << xreg(RS(op)) << "]\n";
+    break;
+  case St1Op::id:
+    os << "st1 {" << vreg(RS(op)) << "}, [" << xreg(RS2(op)) << "]\n";
+    break;
+  case LdrQOp::id:
+    os << "ldr " << qreg(RD(op)) << ", [" << xreg(RS(op)) << ", #" << V(op) << "]\n";
+    break;
+  case StrQOp::id:
+    os << "str " << qreg(RS(op)) << ", [" << xreg(RS2(op)) << ", #" << V(op) << "]\n";
+    break;
+  case DupOp::id:
+    os << "dup " << vreg(RD(op)) << ", " << wreg(RS(op)) << "\n";
+    break;
+  case DupFOp::id:
+    os << "dup " << vreg(RD(op)) << ", " << showReg(RS(op)) << ".s[0]\n";
+    break;
+  case AddvOp::id:
+    os << "addv " << freg(RD(op)) << ", " << vreg(RS(op)) << "\n";
+    break;
+  case FmovSOp::id:
+    os << "fmov " << wreg(RD(op)) << ", " << freg(RS(op)) << "\n";
+    break;
+  case MovVOp::id:
+    os << "mov " << showReg(RD(op)) << ".16b, " << showReg(RS(op)) << ".16b\n";
+    break;
   case MovIOp::id:
     os << "mov " << wreg(RD(op)) << ", " << V(op) << "\n";
     break;
@@ -237,18 +291,197 @@ void Dump::dumpBody(Region *region, std::ostream &os) {
   }
 }
 
+// Fork-join runtime for calls with ParallelAttr; see rv/Dump.cpp for how it works.
+// Here the worker comes in x16. Helper threads keep the state in x19 and their index in x20.
+static const char *parallelRuntime = R"(
+__sysc_parallel_for:
+  sxtw x9, w0
+  sxtw x10, w1
+  sub x9, x10, x9
+  cmp x9, #$MIN
+  b.ge __sysc_par_fork
+  br x16
+__sysc_par_fork:
+  stp x29, x30, [sp, #-32]!
+  stp x19, x20, [sp, #16]
+  ldr x19, =__sysc_par_state
+  str x16, [x19]
+  stp x0, x1, [x19, #8]
+  stp x2, x3, [x19, #24]
+  stp x4, x5, [x19, #40]
+  stp x6, x7, [x19, #56]
+  stp s0, s1, [x19, #72]
+  stp s2, s3, [x19, #80]
+  stp s4, s5, [x19, #88]
+  stp s6, s7, [x19, #96]
+  ldr w9, [x19, #112]
+  cbnz w9, __sysc_par_start
+  mov w9, #1
+  str w9, [x19, #112]
+  mov x20, #1
+__sysc_par_spawn:
+  ldr x1, =__sysc_par_stacks
+  ldr x9, =$STACK
+  madd x1, x9, x20, x1
+  ldr x0, =0x50f00
+  mov x2, #0
+  mov x3, #0
+  mov x4, #0
+  mov x8, #220
+  svc #0
+  cbz x0, __sysc_par_thread
+  add x20, x20, #1
+  cmp x20, #$T
+  b.lt __sysc_par_spawn
+__sysc_par_start:
+  mov w9, #$HELPERS
+  str w9, [x19, #108]
+  dmb ish
+  add x0, x19, #104
+__sysc_par_bump:
+  ldaxr w9, [x0]
+  add w9, w9, #1
+  stlxr w10, w9, [x0]
+  cbnz w10, __sysc_par_bump
+  mov x1, #129
+  mov x2, #$HELPERS
+  mov x8, #98
+  svc #0
+  mov w0, #0
+  bl __sysc_par_run
+__sysc_par_wait:
+  ldr w2, [x19, #108]
+  cbz w2, __sysc_par_done
+  add x0, x19, #108
+  mov x1, #128
+  mov x3, #0
+  mov x8, #98
+  svc #0
+  b __sysc_par_wait
+__sysc_par_done:
+  dmb ish
+  ldp x19, x20, [sp, #16]
+  ldp x29, x30, [sp], #32
+  ret
+
+__sysc_par_thread:
+  mov w21, #0
+__sysc_par_idle:
+  ldr w9, [x19, #104]
+  cmp w9, w21
+  b.ne __sysc_par_work
+  add x0, x19, #104
+  mov x1, #128
+  mov w2, w21
+  mov x3, #0
+  mov x8, #98
+  svc #0
+  b __sysc_par_idle
+__sysc_par_work:
+  mov w21, w9
+  dmb ish
+  mov w0, w20
+  bl __sysc_par_run
+  dmb ish
+  add x0, x19, #108
+__sysc_par_finish:
+  ldaxr w9, [x0]
+  sub w9, w9, #1
+  stlxr w10, w9, [x0]
+  cbnz w10, __sysc_par_finish
+  cbnz w9, __sysc_par_idle
+  mov x1, #129
+  mov x2, #1
+  mov x8, #98
+  svc #0
+  b __sysc_par_idle
+
+__sysc_par_run:
+  stp x29, x30, [sp, #-16]!
+  ldr x9, [x19, #8]
+  sxtw x9, w9
+  ldr x10, [x19, #16]
+  sxtw x10, w10
+  sub x11, x10, x9
+  add x11, x11, #$HELPERS
+  mov x12, #$T
+  sdiv x11, x11, x12
+  sxtw x13, w0
+  madd x0, x11, x13, x9
+  add x1, x0, x11
+  cmp x1, x10
+  csel x1, x1, x10, le
+  cmp x0, x1
+  b.ge __sysc_par_empty
+  ldp x2, x3, [x19, #24]
+  ldp x4, x5, [x19, #40]
+  ldp x6, x7, [x19, #56]
+  ldp s0, s1, [x19, #72]
+  ldp s2, s3, [x19, #80]
+  ldp s4, s5, [x19, #88]
+  ldp s6, s7, [x19, #96]
+  ldr x16, [x19]
+  blr x16
+__sysc_par_empty:
+  ldp x29, x30, [sp], #16
+  ret
+
+.ltorg
+
+.section .bss
+.balign 16
+__sysc_par_state:
+  .skip 128
+__sysc_par_stacks:
+  .skip $STACKS
+
+.text
+)";
+
+// Each helper thread gets a stack of this many bytes.
+constexpr int parallelStack = 256 * 1024;
+
+static void dumpParallelRuntime(std::ostream &os) {
+  std::string text = parallelRuntime;
+  std::map<std::string, int> values = {
+    { "$MIN", parallelMinTrips },
+    { "$STACKS", (parallelThreads - 1) * parallelStack },
+    { "$STACK", parallelStack },
+    { "$HELPERS", parallelThreads - 1 },
+    { "$T", parallelThreads },
+  };
+  // `values` is sorted so that "$STACKS" is replaced before "$STACK".
+  for (auto it = values.rbegin(); it != values.rend(); it++) {
+    const auto &[key, value] = *it;
+    for (size_t pos; (pos = text.find(key)) != std::string::npos;)
+      text.replace(pos, key.size(), std::to_string(value));
+  }
+  os << text << "\n";
+}
+
 void Dump::dump(std::ostream &os) {
   os << ".global main\n\n";
 
   auto funcs = collectFuncs();
+  bool parallel = false;
   for (auto func : funcs) {
     os << NAME(func) << ":\n";
 
     auto region = func->getRegion();
     dumpBody(region, os);
     os << "\n\n";
+
+    if (func->has<ParallelAttr>()) {
+      os << NAME(func) << ".fork:\n";
+      os << "  ldr x16, =" << NAME(func) << "\n";
+      os << "  b __sysc_parallel_for\n\n\n";
+      parallel = true;
+    }
   }
 
+  if (parallel)
+    dumpParallelRuntime(os);
+
   auto globals = collectGlobals();
   if (globals.empty())
     return;
@@ -63,4 +63,17 @@ void InstCombine::run() {
 
     combined += folded;
   } while (folded);
+
+  // An `and` that clears only bits already known to be 0 does nothing.
+  runRewriter([&](AndIOp *op) {
+    auto x = op->getOperand().defining;
+    auto known = x->find<KnownBitsAttr>();
+    if (!known || (~(uint32_t) V(op) & ~known->zeros))
+      return false;
+
+    combined++;
+    op->replaceAllUsesWith(x);
+    op->erase();
+    return true;
+  });
 }
@@ -23,7 +23,7 @@ void LateLegalize::run() {
 
   // Use `mov` and `movk` for an out-of-range `mov`.
   runRewriter([&](MovIOp *op) {
-    if (V(op) >= 16384) {
+    if (V(op) >= 16384 || V(op) < -65536) {
       int v = V(op);
 
       builder.setBeforeOp(op);
@@ -51,6 +51,24 @@ static void rewriteAlloca(FuncOp *func) {
 void Lower::run() {
   Builder builder;
 
+  // Shifts and masks by constants take them as immediates.
+  runRewriter([&](RShiftOp *op) {
+    auto y = op->DEF(1);
+    if (!isa<IntOp>(y) || V(y) < 0 || V(y) > 31)
+      return false;
+    builder.replace<AsrWIOp>(op, { op->getOperand(0) }, { new IntAttr(V(y)) });
+    return true;
+  });
+
+  runRewriter([&](sys::AndIOp *op) {
+    // Only masks of the lower bits are certainly encodable as a logical immediate.
+    auto y = op->DEF(1);
+    if (!isa<IntOp>(y) || V(y) <= 0 || (V(y) & ((unsigned) V(y) + 1)))
+      return false;
+    builder.replace<AndIOp>(op, { op->getOperand(0) }, { new IntAttr(V(y)) });
+    return true;
+  });
+
   REPLACE(GetGlobalOp, AdrOp);
   REPLACE(AddIOp, AddWOp);
   REPLACE(AddLOp, AddXOp);
@@ -61,9 +79,9 @@ void Lower::run() {
   REPLACE(LShiftLOp, LslXOp);
   REPLACE(LShiftOp, LslWOp);
   REPLACE(RShiftLOp, AsrXIOp);
-  REPLACE(RShiftOp, AsrWIOp);
-  REPLACE(AndIOp, AndOp);
-  REPLACE(OrIOp, OrOp);
+  REPLACE(RShiftOp, AsrWOp);
+  REPLACE(sys::AndIOp, AndOp);
+  REPLACE(sys::OrIOp, OrOp);
   REPLACE(XorIOp, EorOp);
   REPLACE(GotoOp, BOp);
   REPLACE(BranchOp, CbnzOp);
@@ -84,6 +102,27 @@ void Lower::run() {
   REPLACE(NeFOp, CsetNeFOp);
   REPLACE(LtFOp, CsetLtFOp);
   REPLACE(LeFOp, CsetLeFOp);
+  REPLACE(VAddIOp, AddVOp);
+  REPLACE(VSubIOp, SubVOp);
+  REPLACE(VMulIOp, MulVOp);
+  REPLACE(VAddFOp, FaddVOp);
+  REPLACE(VSubFOp, FsubVOp);
+  REPLACE(VMulFOp, FmulVOp);
+
+  runRewriter([&](VSplatOp *op) {
+    if (op->DEF()->getResultType() == Value::f32)
+      builder.replace<DupFOp>(op, op->getOperands(), op->getAttrs());
+    else
+      builder.replace<DupOp>(op, op->getOperands(), op->getAttrs());
+    return true;
+  });
+
+  runRewriter([&](VReduceAddIOp *op) {
+    builder.setBeforeOp(op);
+    auto addv = builder.create<AddvOp>(op->getOperands());
+    builder.replace<FmovSOp>(op, { addv });
+    return true;
+  });
 
   runRewriter([&](FloatOp *op) {
     float value = F(op);
@@ -137,33 +176,55 @@ void Lower::run() {
     return false;
   });
 
+  // The addresses are lowered to plain arithmetic, so alias info is lost afterwards.
+  // Keep it on the memory access itself for the post-RA scheduler.
+  const auto memAttrs = [](Op *addr) -> std::vector<Attr*> {
+    auto alias = addr->find<AliasAttr>();
+    if (alias && !alias->unknown)
+      return { new IntAttr(0), new AliasAttr(alias->location) };
+    return { new IntAttr(0) };
+  };
+
   runRewriter([&](StoreOp *op) {
+    auto attrs = memAttrs(op->DEF(1));
     if (op->DEF(0)->getResultType() == Value::f32) {
-      builder.replace<StrFOp>(op, op->getOperands(), { new IntAttr(0) });
+      builder.replace<StrFOp>(op, op->getOperands(), attrs);
       return false;
     }
 
     if (SIZE(op) == 8) {
-      builder.replace<StrXOp>(op, op->getOperands(), { new IntAttr(0) });
+      builder.replace<StrXOp>(op, op->getOperands(), attrs);
       return false;
     }
 
-    builder.replace<StrWOp>(op, op->getOperands(), { new IntAttr(0) });
+    builder.replace<StrWOp>(op, op->getOperands(), attrs);
     return false;
   });
 
   runRewriter([&](LoadOp *op) {
+    auto attrs = memAttrs(op->DEF(0));
     if (op->getResultType() == Value::f32) {
-      builder.replace<LdrFOp>(op, op->getOperands(), { new IntAttr(0) });
+      builder.replace<LdrFOp>(op, op->getOperands(), attrs);
       return false;
     }
 
     if (SIZE(op) == 8) {
-      builder.replace<LdrXOp>(op, op->getOperands(), { new IntAttr(0) });
+      builder.replace<LdrXOp>(op, op->getOperands(), attrs);
       return false;
     }
 
-    builder.replace<LdrWOp>(op, op->getOperands(), { new IntAttr(0) });
+    builder.replace<LdrWOp>(op, op->getOperands(), attrs);
+    return false;
+  });
+
+  // SLP puts the alias of all 4 lanes on the access itself; the address only covers the first lane.
+  runRewriter([&](VStoreOp *op) {
+    builder.replace<St1Op>(op, op->getOperands(), memAttrs(op->has<AliasAttr>() ? op : op->DEF(1)));
+    return false;
+  });
+
+  runRewriter([&](VLoadOp *op) {
+    builder.replace<Ld1Op>(op, op->getResultType(), op->getOperands(), memAttrs(op->has<AliasAttr>() ? op : op->DEF(0)));
     return false;
   });
 
@@ -213,8 +274,10 @@ void Lower::run() {
       builder.create<StoreOp>({ spilled[i], sp }, { new SizeAttr(8), new IntAttr(i * 8) });
     }
 
+    // Parallel calls go through a stub that hands the callee to the runtime (see Dump).
+    auto name = op->has<ParallelAttr>() ? new NameAttr(NAME(op) + ".fork") : op->get<NameAttr>();
     builder.create<BlOp>(argsNew, { 
-      op->get<NameAttr>(),
+      name,
       new ArgCountAttr(args.size())
     });
 
@@ -223,8 +286,9 @@ void Lower::run() {
       builder.create<SubSpOp>({ new IntAttr(-stackOffset) });
 
     // Read result from a0.
+    // Keep the type, as later calls taking this value decide their argument registers by it.
     if (op->getResultType() == Value::f32)
-      builder.replace<ReadRegOp>(op, { new RegAttr(Reg::v0) });
+      builder.replace<ReadRegOp>(op, { new RegAttr(Reg::v0) })->setResultType(Value::f32);
     else
       builder.replace<ReadRegOp>(op, { new RegAttr(Reg::x0) });
     return true;
@@ -0,0 +1,151 @@
+#include "ArmPasses.h"
+#include "Regs.h"
+#include "../opt/LoopPasses.h"
+
+using namespace sys::arm;
+using namespace sys;
+
+std::map<std::string, int> MachineLICM::stats() {
+  return {
+    { "hoisted", hoisted },
+    { "kept-for-pressure", kept },
+  };
+}
+
+namespace {
+
+// Leave some room for values RegAlloc creates itself.
+constexpr int pressureMargin = 2;
+
+// Vectors live in the fp registers too.
+bool isFloat(Op *op) {
+  return op->getResultType() == Value::f32 || isVector(op);
+}
+
+}
+
+// The maximum number of simultaneously live values in the loop.
+std::pair<int, int> MachineLICM::pressure(LoopInfo *info) {
+  int intMax = 0, floatMax = 0;
+
+  for (auto bb : info->getBlocks()) {
+    auto live = bb->getLiveOut();
+    int intLive = 0, floatLive = 0;
+    for (auto op : live)
+      ++(isFloat(op) ? floatLive : intLive);
+
+    intMax = std::max(intMax, intLive);
+    floatMax = std::max(floatMax, floatLive);
+
+    auto ops = bb->getOps();
+    for (auto it = ops.rbegin(); it != ops.rend(); it++) {
+      auto op = *it;
+      if (live.erase(op))
+        --(isFloat(op) ? floatLive : intLive);
+
+      // Operands of phis are live out of predecessors instead.
+      if (isa<PhiOp>(op))
+        continue;
+
+      for (auto operand : op->getOperands()) {
+        auto def = operand.defining;
+        if (live.insert(def).second)
+          ++(isFloat(def) ? floatLive : intLive);
+      }
+      intMax = std::max(intMax, intLive);
+      floatMax = std::max(floatMax, floatLive);
+    }
+  }
+  return { intMax, floatMax };
+}
+
+void MachineLICM::runImpl(LoopInfo *info) {
+  // Hoist inner loops first, so that their invariants can go further out.
+  for (auto subloop : info->getSubloops())
+    runImpl(subloop);
+
+  auto preheader = info->getPreheader();
+  if (!preheader)
+    return;
+
+  // Find invariants in the order they're defined;
+  // so an op always comes after its operands.
+  std::vector<Op*> invariants;
+  std::set<Op*> invariant;
+  bool changed;
+  do {
+    changed = false;
+    for (auto bb : info->getBlocks()) {
+      for (auto op : bb->getOps()) {
+        if (!isPure(op) || invariant.count(op))
+          continue;
+
+        bool good = true;
+        for (auto operand : op->getOperands()) {
+          auto def = operand.defining;
+          if (info->contains(def->getParent()) && !invariant.count(def)) {
+            good = false;
+            break;
+          }
+        }
+        if (good) {
+          invariant.insert(op);
+          invariants.push_back(op);
+          changed = true;
+        }
+      }
+    }
+  } while (changed);
+
+  if (invariants.empty())
+    return;
+
+  // A hoisted value stays live through the whole loop.
+  auto region = preheader->getParent();
+  region->updateLiveness();
+  auto [intPressure, floatPressure] = pressure(info);
+
+  std::set<Op*> skipped;
+  auto term = preheader->getLastOp();
+  for (auto op : invariants) {
+    bool blocked = false;
+    for (auto operand : op->getOperands()) {
+      if (skipped.count(operand.defining)) {
+        blocked = true;
+        break;
+      }
+    }
+
+    if (!blocked) {
+      if (isFloat(op))
+        blocked = floatPressure + 1 > normalRegCntf - pressureMargin;
+      else
+        blocked = intPressure + 1 > normalRegCnt - pressureMargin;
+    }
+
+    if (blocked) {
+      kept++;
+      skipped.insert(op);
+      continue;
+    }
+
+    ++(isFloat(op) ? floatPressure : intPressure);
+    op->moveBefore(term);
+    hoisted++;
+  }
+}
+
+void MachineLICM::run() {
+  LoopAnalysis loop(module);
+  loop.run();
+  auto forests = loop.getResult();
+
+  auto funcs = collectFuncs();
+  for (auto func : funcs) {
+    const auto &forest = forests[func];
+    for (auto info : forest.getLoops()) {
+      if (!info->getParent())
+        runImpl(info);
+    }
+  }
+}
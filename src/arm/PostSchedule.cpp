@@ -0,0 +1,308 @@
+#include "ArmPasses.h"
+#include <unordered_set>
+
+using namespace sys::arm;
+using namespace sys;
+
+std::map<std::string, int> PostSchedule::stats() {
+  return {
+    { "reordered-regions", reordered },
+  };
+}
+
+namespace {
+
+// Latencies of Cortex-A72 (the cores on Raspberry Pi 4).
+// Ops not listed here have a latency of 1.
+const std::unordered_map<int, int> a72 = {
+  { LdrWOp::id, 4 },
+  { LdrXOp::id, 4 },
+  { LdrFOp::id, 5 },
+  { LdrWROp::id, 4 },
+  { LdrXROp::id, 4 },
+  { LdrFROp::id, 5 },
+
+  { MulWOp::id, 3 },
+  { MulXOp::id, 3 },
+  { MlaOp::id, 3 },
+  { MsubWOp::id, 3 },
+  { MsubXOp::id, 3 },
+  { SmulhOp::id, 6 },
+  { UmulhOp::id, 6 },
+
+  { SdivWOp::id, 12 },
+  { SdivXOp::id, 20 },
+  { UdivWOp::id, 12 },
+
+  { FaddOp::id, 4 },
+  { FsubOp::id, 4 },
+  { FmulOp::id, 4 },
+  { FdivOp::id, 11 },
+  { ScvtfOp::id, 5 },
+  { FcvtzsOp::id, 5 },
+  { FmovWOp::id, 5 },
+
+  { Ld1Op::id, 5 },
+  { LdrQOp::id, 5 },
+  { AddVOp::id, 3 },
+  { SubVOp::id, 3 },
+  { MulVOp::id, 4 },
+  { FaddVOp::id, 4 },
+  { FsubVOp::id, 4 },
+  { FmulVOp::id, 4 },
+  { DupOp::id, 8 },
+  { AddvOp::id, 6 },
+  { FmovSOp::id, 5 },
+};
+
+int latency(Op *op) {
+  auto it = a72.find(op->opid);
+  return it == a72.end() ? 1 : it->second;
+}
+
+// Nothing can move across these ops.
+// Note that compares are always fused with the branch or cset reading the flags,
+// so flags never live across ops.
+bool isBarrier(Op *op) {
+  return isa<BlOp>(op) || isa<RetOp>(op) || isa<BOp>(op) ||
+    isa<BeqOp>(op) || isa<BneOp>(op) || isa<BltOp>(op) ||
+    isa<BgeOp>(op) || isa<BleOp>(op) || isa<BgtOp>(op) ||
+    isa<BmiOp>(op) || isa<BplOp>(op) ||
+    isa<CbzOp>(op) || isa<CbnzOp>(op);
+}
+
+void getDefUse(Op *op, std::vector<Reg> &defs, std::vector<Reg> &uses) {
+  if (hasRd(op) && op->has<RdAttr>())
+    defs.push_back(RD(op));
+  // `movk` keeps the other bits of rd.
+  if (isa<MovkOp>(op))
+    uses.push_back(RD(op));
+  if (op->has<RsAttr>())
+    uses.push_back(RS(op));
+  if (op->has<Rs2Attr>())
+    uses.push_back(RS2(op));
+  if (op->has<Rs3Attr>())
+    uses.push_back(RS3(op));
+}
+
+bool isLoad(Op *op) {
+  return isa<LdrWOp>(op) || isa<LdrXOp>(op) || isa<LdrFOp>(op) ||
+    isa<LdrWROp>(op) || isa<LdrXROp>(op) || isa<LdrFROp>(op) ||
+    isa<Ld1Op>(op) || isa<LdrQOp>(op);
+}
+
+bool isStore(Op *op) {
+  return isa<StrWOp>(op) || isa<StrXOp>(op) || isa<StrFOp>(op) ||
+    isa<StrWROp>(op) || isa<StrXROp>(op) || isa<StrFROp>(op) ||
+    isa<St1Op>(op) || isa<StrQOp>(op);
+}
+
+// Whether the address is (register + immediate).
+// `ld1` and `st1` always have an offset of 0.
+bool hasImmOffset(Op *op) {
+  return isa<LdrWOp>(op) || isa<LdrXOp>(op) || isa<LdrFOp>(op) ||
+    isa<StrWOp>(op) || isa<StrXOp>(op) || isa<StrFOp>(op) ||
+    isa<Ld1Op>(op) || isa<St1Op>(op) || isa<LdrQOp>(op) || isa<StrQOp>(op);
+}
+
+int accessSize(Op *op) {
+  if (isa<Ld1Op>(op) || isa<St1Op>(op) || isa<LdrQOp>(op) || isa<StrQOp>(op))
+    return 16;
+  return isa<LdrXOp>(op) || isa<StrXOp>(op) ? 8 : 4;
+}
+
+struct Access {
+  Op *op;
+  int index;
+  bool store;
+  // The base register, and how many times it has been written before this access.
+  // Two accesses with the same (base, version) are relative to the same address.
+  Reg base;
+  int version;
+  // Offset is unknown when the address is (register + register).
+  bool known;
+  int offset;
+  int size;
+};
+
+bool mayConflict(const Access &a, const Access &b) {
+  if (!a.store && !b.store)
+    return false;
+
+  if (a.known && b.known && a.base == b.base && a.version == b.version)
+    return a.offset < b.offset + b.size && b.offset < a.offset + a.size;
+
+  auto aa = a.op->find<AliasAttr>();
+  auto ab = b.op->find<AliasAttr>();
+  if (aa && ab && aa->neverAlias(ab))
+    return false;
+  return true;
+}
+
+}
+
+// A list scheduler on a single region between barriers,
+// assuming an in-order core that issues one instruction per cycle.
+// The priority is the length of the critical path to the end of the region.
+bool PostSchedule::runImpl(const std::vector<Op*> &ops, Op *stop, BasicBlock *bb) {
+  if (ops.size() <= 2)
+    return false;
+
+  int n = ops.size();
+  // Edges with latencies.
+  std::vector<std::vector<std::pair<int, int>>> succs(n);
+  std::vector<int> degree(n);
+
+  const auto addEdge = [&](int from, int to, int lat) {
+    succs[from].push_back({ to, lat });
+    degree[to]++;
+  };
+
+  std::unordered_map<Reg, int> lastDef, version;
+  std::unordered_map<Reg, std::vector<int>> lastUses;
+  std::vector<Access> accesses;
+
+  for (int i = 0; i < n; i++) {
+    auto op = ops[i];
+    std::vector<Reg> defs, uses;
+    getDefUse(op, defs, uses);
+
+    for (auto reg : uses) {
+      if (reg == Reg::xzr)
+        continue;
+      // Read after write.
+      if (lastDef.count(reg))
+        addEdge(lastDef[reg], i, latency(ops[lastDef[reg]]));
+    }
+
+    if (isLoad(op) || isStore(op)) {
+      bool store = isStore(op);
+      Reg base = store ? RS2(op) : RS(op);
+      bool known = hasImmOffset(op);
+      int size = accessSize(op);
+      Access access { op, i, store, base, version[base], known, known ? V(op) : 0, size };
+      for (const auto &other : accesses) {
+        if (mayConflict(other, access))
+          addEdge(other.index, i, 1);
+      }
+      accesses.push_back(access);
+    }
+
+    for (auto reg : defs) {
+      if (reg == Reg::xzr)
+        continue;
+      // Write after read.
+      for (auto use : lastUses[reg]) {
+        if (use != i)
+          addEdge(use, i, 0);
+      }
+      // Write after write.
+      if (lastDef.count(reg))
+        addEdge(lastDef[reg], i, 1);
+
+      lastDef[reg] = i;
+      lastUses[reg].clear();
+      version[reg]++;
+    }
+
+    for (auto reg : uses)
+      lastUses[reg].push_back(i);
+  }
+
+  // Length of the critical path, computed in reverse order.
+  std::vector<int> height(n);
+  for (int i = n - 1; i >= 0; i--) {
+    height[i] = latency(ops[i]);
+    for (auto [succ, lat] : succs[i])
+      height[i] = std::max(height[i], height[succ] + lat);
+  }
+
+  // The earliest cycle that an op can be issued.
+  std::vector<int> earliest(n);
+  std::vector<int> ready;
+  for (int i = 0; i < n; i++) {
+    if (!degree[i])
+      ready.push_back(i);
+  }
+
+  std::vector<int> order;
+  int cycle = 0;
+  while (!ready.empty()) {
+    // Prefer ops that can issue now; among them, the one on the critical path.
+    // If nothing can issue now, pick the one that stalls the least.
+    int best = -1;
+    for (auto i : ready) {
+      if (best == -1) {
+        best = i;
+        continue;
+      }
+
+      bool issuable = earliest[i] <= cycle;
+      bool bestIssuable = earliest[best] <= cycle;
+      if (issuable != bestIssuable) {
+        if (issuable)
+          best = i;
+        continue;
+      }
+
+      if (!issuable && earliest[i] != earliest[best]) {
+        if (earliest[i] < earliest[best])
+          best = i;
+        continue;
+      }
+
+      // Keep the original order when tied.
+      if (height[i] > height[best] || (height[i] == height[best] && i < best))
+        best = i;
+    }
+
+    ready.erase(std::find(ready.begin(), ready.end(), best));
+    order.push_back(best);
+    cycle = std::max(cycle, earliest[best]) + 1;
+
+    for (auto [succ, lat] : succs[best]) {
+      earliest[succ] = std::max(earliest[succ], cycle - 1 + lat);
+      if (!--degree[succ])
+        ready.push_back(succ);
+    }
+  }
+  assert(order.size() == ops.size());
+
+  bool changed = false;
+  for (int i = 0; i < n; i++) {
+    if (order[i] != i)
+      changed = true;
+  }
+  if (!changed)
+    return false;
+
+  for (auto i : order) {
+    if (stop)
+      ops[i]->moveBefore(stop);
+    else
+      ops[i]->moveToEnd(bb);
+  }
+  return true;
+}
+
+void PostSchedule::run() {
+  auto funcs = collectFuncs();
+
+  for (auto func : funcs) {
+    for (auto bb : func->getRegion()->getBlocks()) {
+      std::vector<Op*> ops;
+      // Copy the list, as the ops are moved around.
+      auto all = bb->getOps();
+      for (auto op : all) {
+        if (!isBarrier(op)) {
+          ops.push_back(op);
+          continue;
+        }
+
+        reordered += runImpl(ops, op, bb);
+        ops.clear();
+      }
+      reordered += runImpl(ops, nullptr, bb);
+    }
+  }
+}
@@ -1,4 +1,5 @@
 #include "ArmPasses.h"
+#include "Regs.h"
 #include <unordered_set>
 
 using namespace sys;
@@ -10,46 +11,56 @@ class SpilledRdAttr : public AttrImpl<SpilledRdAttr, ARMLINE + 4194304> {
 public:
   bool fp;
   int offset;
+  // Vectors take a whole q register, and 16 bytes on the stack.
+  bool vec;
 
-  SpilledRdAttr(bool fp, int offset): fp(fp), offset(offset) {}
+  SpilledRdAttr(bool fp, int offset, bool vec = false): fp(fp), offset(offset), vec(vec) {}
 
-  std::string toString() override { return "<rd = " + std::to_string(offset) + (fp ? "f" : "") + ">"; }
-  SpilledRdAttr *clone() override { return new SpilledRdAttr(fp, offset); }
+  std::string toString() override { return "<rd = " + std::to_string(offset) + (fp ? "f" : "") + (vec ? "v" : "") + ">"; }
+  SpilledRdAttr *clone() override { return new SpilledRdAttr(fp, offset, vec); }
 };
 
 class SpilledRsAttr : public AttrImpl<SpilledRsAttr, ARMLINE + 4194304> {
 public:
   bool fp;
   int offset;
+  bool vec;
 
-  SpilledRsAttr(bool fp, int offset): fp(fp), offset(offset) {}
+  SpilledRsAttr(bool fp, int offset, bool vec = false): fp(fp), offset(offset), vec(vec) {}
 
-  std::string toString() override { return "<rs = " + std::to_string(offset) + (fp ? "f" : "") + ">"; }
-  SpilledRsAttr *clone() override { return new SpilledRsAttr(fp, offset); }
+  std::string toString() override { return "<rs = " + std::to_string(offset) + (fp ? "f" : "") + (vec ? "v" : "") + ">"; }
+  SpilledRsAttr *clone() override { return new SpilledRsAttr(fp, offset, vec); }
 };
 
 class SpilledRs2Attr : public AttrImpl<SpilledRs2Attr, ARMLINE + 4194304> {
 public:
   bool fp;
   int offset;
+  bool vec;
 
-  SpilledRs2Attr(bool fp, int offset): fp(fp), offset(offset) {}
+  SpilledRs2Attr(bool fp, int offset, bool vec = false): fp(fp), offset(offset), vec(vec) {}
 
-  std::string toString() override { return "<rs2 = " + std::to_string(offset) + + (fp ? "f" : "") + ">"; }
-  SpilledRs2Attr *clone() override { return new SpilledRs2Attr(fp, offset); }
+  std::string toString() override { return "<rs2 = " + std::to_string(offset) + + (fp ? "f" : "") + (vec ? "v" : "") + ">"; }
+  SpilledRs2Attr *clone() override { return new SpilledRs2Attr(fp, offset, vec); }
 };
 
 class SpilledRs3Attr : public AttrImpl<SpilledRs3Attr, ARMLINE + 4194304> {
 public:
   bool fp;
   int offset;
+  bool vec;
 
-  SpilledRs3Attr(bool fp, int offset): fp(fp), offset(offset) {}
+  SpilledRs3Attr(bool fp, int offset, bool vec = false): fp(fp), offset(offset), vec(vec) {}
 
-  std::string toString() override { return "<rs3 = " + std::to_string(offset) + + (fp ? "f" : "") + ">"; }
-  SpilledRs3Attr *clone() override { return new SpilledRs3Attr(fp, offset); }
+  std::string toString() override { return "<rs3 = " + std::to_string(offset) + + (fp ? "f" : "") + (vec ? "v" : "") + ">"; }
+  SpilledRs3Attr *clone() override { return new SpilledRs3Attr(fp, offset, vec); }
 };
 
+// Floats and vectors share the v-registers.
+bool inFPRegs(Op *op) {
+  return op->getResultType() == Value::f32 || isVector(op);
+}
+
 }
 
 std::map<std::string, int> RegAlloc::stats() {
@@ -76,10 +87,10 @@ std::map<std::string, int> RegAlloc::stats() {
   if (!spillOffset.count(v##Index)) \
     op->add<AttrTy>(getReg(v##Index)); \
   else \
-    op->add<Spilled##AttrTy>(v##Index->getResultType() == Value::f32, spillOffset[v##Index]);
+    op->add<Spilled##AttrTy>(inFPRegs(v##Index), spillOffset[v##Index], isVector(v##Index));
 
 #define GET_SPILLED_ARGS(op) \
-  (op->getResultType() == Value::f32, spillOffset[op])
+  (inFPRegs(op), spillOffset[op], isVector(op))
 
 #define NULLARY
 #define UNARY ADD_ATTR(0, RsAttr)
@@ -142,114 +153,131 @@ std::map<std::string, int> RegAlloc::stats() {
   else \
     builder.create<FmovOp>({ RDC(rd), RSC(rs) });
 
-// We use dedicated registers as the "spill" register, for simplicity.
-static const Reg fargRegs[] = {
-  Reg::v0, Reg::v1, Reg::v2, Reg::v3,
-  Reg::v4, Reg::v5, Reg::v6, Reg::v7,
-};
-static const Reg argRegs[] = {
-  Reg::x0, Reg::x1, Reg::x2, Reg::x3,
-  Reg::x4, Reg::x5, Reg::x6, Reg::x7,
-};
-
-static const Reg spillReg = Reg::x28;
-static const Reg spillReg2 = Reg::x15;
-static const Reg spillReg3 = Reg::x14;
-static const Reg fspillReg = Reg::v31;
-static const Reg fspillReg2 = Reg::v15;
-static const Reg fspillReg3 = Reg::v30;
-
-// Order for leaf functions. Prioritize temporaries.
-static const Reg leafOrder[] = {
-  Reg::x0, Reg::x1, Reg::x2, Reg::x3,
-  Reg::x4, Reg::x5, Reg::x6, Reg::x7,
-
-  Reg::x8, Reg::x9, Reg::x10, Reg::x11,
-  Reg::x12, Reg::x13,
-
-  Reg::x19, Reg::x20, Reg::x21, Reg::x22,
-  Reg::x23, Reg::x24, Reg::x25, Reg::x26,
-  Reg::x27,
+// Used in constructing interference graph.
+struct Event {
+  int timestamp;
+  bool start;
+  Op *op;
 };
-// Order for non-leaf functions.
-static const Reg normalOrder[] = {
-  Reg::x19, Reg::x20, Reg::x21, Reg::x22,
-  Reg::x23, Reg::x24, Reg::x25, Reg::x26,
-  Reg::x27,
 
-  Reg::x0, Reg::x1, Reg::x2, Reg::x3,
-  Reg::x4, Reg::x5, Reg::x6, Reg::x7,
+// Defined in rv/RegAlloc.cpp.
+void dumpInterf(Region *region, const std::unordered_map<Op*, std::set<Op*>> &interf);
 
-  Reg::x8, Reg::x9, Reg::x10, Reg::x11,
-  Reg::x12, Reg::x13,
-};
+// See the RISC-V counterpart.
+void RegAlloc::splitReturns(Region *region) {
+  Builder builder;
+  region->updatePreds();
 
-// The same, but for floating point registers.
-static const Reg leafOrderf[] = {
-  Reg::v0, Reg::v1, Reg::v2, Reg::v3,
-  Reg::v4, Reg::v5, Reg::v6, Reg::v7,
+  std::vector<BasicBlock*> rets;
+  for (auto bb : region->getBlocks()) {
+    if (!isa<RetOp>(bb->getLastOp()))
+      continue;
 
-  Reg::v8, Reg::v9, Reg::v10, Reg::v11,
-  Reg::v12, Reg::v13, Reg::v14,
+    bool simple = true;
+    for (auto op : bb->getOps()) {
+      if (!isa<PhiOp>(op) && !isa<WriteRegOp>(op) && !isa<RetOp>(op))
+        simple = false;
+    }
+    if (simple)
+      rets.push_back(bb);
+  }
 
-  Reg::v16, Reg::v17, Reg::v18,
-  Reg::v19, Reg::v20, Reg::v21, Reg::v22,
-  Reg::v23, Reg::v24, Reg::v25, Reg::v26,
-  Reg::v27, Reg::v28, Reg::v29,
-};
-// Order for non-leaf functions.
-static const Reg normalOrderf[] = {
-  Reg::v16, Reg::v17, Reg::v18,
-  Reg::v19, Reg::v20, Reg::v21, Reg::v22,
-  Reg::v23, Reg::v24, Reg::v25, Reg::v26,
-  Reg::v27, Reg::v28, Reg::v29,
-
-  Reg::v0, Reg::v1, Reg::v2, Reg::v3,
-  Reg::v4, Reg::v5, Reg::v6, Reg::v7,
-
-  Reg::v8, Reg::v9, Reg::v10, Reg::v11,
-  Reg::v12, Reg::v13, Reg::v14,
-};
+  for (auto bb : rets) {
+    auto phis = bb->getPhis();
+    auto preds = bb->preds;
+    for (auto pred : preds) {
+      auto term = pred->getLastOp();
+      if (!isa<BOp>(term))
+        continue;
 
-static const std::set<Reg> callerSaved = {
-  Reg::x0, Reg::x1, Reg::x2, Reg::x3,
-  Reg::x4, Reg::x5, Reg::x6, Reg::x7,
+      std::unordered_map<Op*, Op*> phiValue;
+      for (auto phi : phis) {
+        const auto &attrs = phi->getAttrs();
+        for (size_t i = 0; i < attrs.size(); i++) {
+          if (FROM(attrs[i]) == pred) {
+            phiValue[phi] = phi->getOperand(i).defining;
+            phi->removeOperand(i);
+            phi->removeAttribute(i);
+            break;
+          }
+        }
+      }
 
-  Reg::x8, Reg::x9, Reg::x10, Reg::x11,
-  Reg::x12, Reg::x13, Reg::x14, Reg::x15,
+      builder.setBeforeOp(term);
+      std::vector<Value> writes;
+      for (auto op : bb->getOps()) {
+        if (!isa<WriteRegOp>(op))
+          continue;
 
-  Reg::v0, Reg::v1, Reg::v2, Reg::v3,
-  Reg::v4, Reg::v5, Reg::v6, Reg::v7,
+        auto def = op->DEF(0);
+        if (phiValue.count(def))
+          def = phiValue[def];
+        writes.push_back(builder.create<WriteRegOp>({ def }, { new RegAttr(REG(op)) }));
+      }
+      builder.create<RetOp>(writes);
+      term->erase();
+    }
 
-  Reg::v8, Reg::v9, Reg::v10, Reg::v11,
-  Reg::v12, Reg::v13, Reg::v14, Reg::v15,
-};
+    region->updatePreds();
+    if (bb->preds.empty())
+      bb->forceErase();
+  }
+  region->updatePreds();
+}
 
-static const std::set<Reg> calleeSaved = {
-  Reg::x19, Reg::x20, Reg::x21, Reg::x22,
-  Reg::x23, Reg::x24, Reg::x25, Reg::x26,
-  Reg::x27, Reg::x28,
+// See the RISC-V counterpart.
+void RegAlloc::splitLiveIns(Region *region) {
+  auto entry = region->getFirstBlock();
+  auto save = findSaveBlock(region, [](BasicBlock *bb) {
+    for (auto op : bb->getOps()) {
+      if (isa<BlOp>(op) || isa<GetArgOp>(op))
+        return true;
+      if (isa<ReadRegOp>(op) && REG(op) == Reg::sp)
+        return true;
+    }
+    return false;
+  });
+  if (!save || save == entry)
+    return;
 
-  Reg::v16, Reg::v17, Reg::v18,
-  Reg::v19, Reg::v20, Reg::v21, Reg::v22,
-  Reg::v23, Reg::v24, Reg::v25, Reg::v26,
-  Reg::v27, Reg::v28, Reg::v29, Reg::v30,
-};
+  region->updateLiveness();
+  Builder builder;
+  auto phis = save->getPhis();
+  if (phis.size())
+    builder.setAfterOp(phis.back());
+  else
+    builder.setToBlockStart(save);
+
+  auto liveIn = save->getLiveIn();
+  for (auto def : liveIn) {
+    // Vectors never live across calls.
+    if (isa<PlaceHolderOp>(def) || isVector(def))
+      continue;
 
-constexpr int leafRegCnt = 23;
-constexpr int leafRegCntf = 29;
-constexpr int normalRegCnt = 23;
-constexpr int normalRegCntf = 29;
+    Op *copy;
+    if (isa<MovIOp>(def) || isa<AdrOp>(def))
+      copy = builder.copy(def);
+    else if (def->getResultType() == Value::f32)
+      copy = builder.create<FmovOp>({ def });
+    else
+      copy = builder.create<MovROp>({ def });
+    copy->setResultType(def->getResultType());
 
-// Used in constructing interference graph.
-struct Event {
-  int timestamp;
-  bool start;
-  Op *op;
-};
+    auto uses = def->getUses();
+    for (auto use : uses) {
+      if (use == copy || !use->getParent()->dominatedBy(save))
+        continue;
+      // Phis at `save` take values from outside.
+      if (use->getParent() == save && isa<PhiOp>(use))
+        continue;
 
-// Defined in rv/RegAlloc.cpp.
-void dumpInterf(Region *region, const std::unordered_map<Op*, std::set<Op*>> &interf);
+      for (int i = 0; i < use->getOperandCount(); i++) {
+        if (use->getOperand(i).defining == def)
+          use->setOperand(i, copy);
+      }
+    }
+  }
+}
 
 void RegAlloc::runImpl(Region *region, bool isLeaf) {
   const Reg *order = isLeaf ? leafOrder : normalOrder;
@@ -263,13 +291,17 @@ void RegAlloc::runImpl(Region *region, bool isLeaf) {
 
   auto funcOp = region->getParent();
 
+  splitReturns(region);
+
   // First of all, add 35 precolored placeholders before each call.
   // This denotes that a call clobbers those registers.
+  std::unordered_set<Op*> clobbers;
   runRewriter(funcOp, [&](BlOp *op) {
     builder.setBeforeOp(op);
     for (auto reg : callerSaved) {
       auto placeholder = builder.create<PlaceHolderOp>();
       assignment[placeholder] = reg;
+      clobbers.insert(placeholder);
       // Make floating point respect the placeholders.
       if (isFP(reg))
         placeholder->setResultType(Value::f32);
@@ -335,6 +367,9 @@ void RegAlloc::runImpl(Region *region, bool isLeaf) {
     return false;
   });
 
+  if (!isLeaf)
+    splitLiveIns(region);
+
   region->updateLiveness();
 
   // Interference graph.
@@ -418,7 +453,7 @@ void RegAlloc::runImpl(Region *region, bool isLeaf) {
         for (Op* activeOp : active) {
           // FP and int are using different registers.
           // However, they use the same stack frame.
-          if (activeOp->getResultType() == Value::f32 ^ op->getResultType() == Value::f32) {
+          if (inFPRegs(activeOp) ^ inFPRegs(op)) {
             spillInterf[op].insert(activeOp);
             spillInterf[activeOp].insert(op);
             continue;
@@ -448,6 +483,28 @@ void RegAlloc::runImpl(Region *region, bool isLeaf) {
     return pa == pb ? interf[a].size() > interf[b].size() : pa > pb;
   });
 
+  // Phis would like to share the register with their operands,
+  // so group them together to see whether any one of them lives across a call.
+  std::unordered_map<Op*, Op*> group;
+  std::function<Op*(Op*)> find = [&](Op *x) {
+    if (!group.count(x) || group[x] == x)
+      return x;
+    return group[x] = find(group[x]);
+  };
+  for (auto [phi, operands] : phiOperand) {
+    for (auto x : operands)
+      group[find(x)] = find(phi);
+  }
+  std::unordered_set<Op*> acrossCall;
+  for (auto [op, v] : interf) {
+    for (auto x : v) {
+      if (clobbers.count(x)) {
+        acrossCall.insert(find(op));
+        break;
+      }
+    }
+  }
+
   std::unordered_map<Op*, int> spillOffset;
   int currentOffset = STACKOFF(funcOp);
   int highest = 0;
@@ -507,8 +564,13 @@ void RegAlloc::runImpl(Region *region, bool isLeaf) {
       continue;
     }
 
-    auto rcnt = op->getResultType() != Value::f32 ? regcount : regcountf;
-    auto rorder = op->getResultType() != Value::f32 ? order : orderf;
+    auto rcnt = !inFPRegs(op) ? regcount : regcountf;
+    auto rorder = !inFPRegs(op) ? order : orderf;
+
+    // A value that doesn't live across any call had better use temporaries,
+    // so that it doesn't need to be preserved.
+    if (!acrossCall.count(find(op)))
+      rorder = !inFPRegs(op) ? leafOrder : leafOrderf;
 
     for (int i = 0; i < rcnt; i++) {
       if (!bad.count(rorder[i]) && !unpreferred.count(rorder[i])) {
@@ -532,6 +594,7 @@ void RegAlloc::runImpl(Region *region, bool isLeaf) {
 
     spilled++;
     // Spilled. Try to see all spill offsets of conflicting ops.
+    // Slots are 8 bytes; a vector takes two of them.
     int desired = currentOffset;
     std::unordered_set<int> conflict;
     for (auto v : interf[op]) {
@@ -539,37 +602,50 @@ void RegAlloc::runImpl(Region *region, bool isLeaf) {
         continue;
 
       conflict.insert(spillOffset[v]);
+      if (isVector(v))
+        conflict.insert(spillOffset[v] + 8);
     }
     for (auto v : spillInterf[op]) {
       if (!spillOffset.count(v))
         continue;
 
       conflict.insert(spillOffset[v]);
+      if (isVector(v))
+        conflict.insert(spillOffset[v] + 8);
     }
 
     // Try find a space.
-    while (conflict.count(desired))
-      desired += 8;
+    // `ldr q` wants the offset to be a multiple of 16.
+    int size = isVector(op) ? 16 : 8;
+    if (isVector(op)) {
+      desired = (desired + 15) / 16 * 16;
+      while (conflict.count(desired) || conflict.count(desired + 8))
+        desired += 16;
+    } else {
+      while (conflict.count(desired))
+        desired += 8;
+    }
 
     spillOffset[op] = desired;
 
     // Update `highest`, which will indicate the size allocated.
-    if (desired > highest)
-      highest = desired;
+    if (desired + size > highest)
+      highest = desired + size;
   }
 
   // Allocate more stack space for it.
   if (spillOffset.size())
-    STACKOFF(funcOp) = highest + 8;
+    STACKOFF(funcOp) = highest;
 
   const auto getReg = [&](Op *op) {
     return assignment.count(op) ? assignment[op] :
-      op->getResultType() == Value::f32 ? orderf[0] : order[0];
+      inFPRegs(op) ? orderf[0] : order[0];
   };
 
   // Convert all operands to registers.
   LOWER(MlaOp, TERNARY);
   LOWER(MsubWOp, TERNARY);
+  LOWER(MsubXOp, TERNARY);
 
   LOWER(AddXOp, BINARY);
   LOWER(AddWOp, BINARY);
@@ -596,6 +672,13 @@ void RegAlloc::runImpl(Region *region, bool isLeaf) {
   LOWER(FsubOp, BINARY);
   LOWER(FmulOp, BINARY);
   LOWER(FdivOp, BINARY);
+  LOWER(St1Op, BINARY);
+  LOWER(AddVOp, BINARY);
+  LOWER(SubVOp, BINARY);
+  LOWER(MulVOp, BINARY);
+  LOWER(FaddVOp, BINARY);
+  LOWER(FsubVOp, BINARY);
+  LOWER(FmulVOp, BINARY);
   
   LOWER(BltOp, BINARY);
   LOWER(BleOp, BINARY);
@@ -634,10 +717,17 @@ void RegAlloc::runImpl(Region *region, bool isLeaf) {
   LOWER(ScvtfOp, UNARY);
   LOWER(FcvtzsOp, UNARY);
   LOWER(FmovWOp, UNARY);
+  LOWER(MovROp, UNARY);
+  LOWER(FmovOp, UNARY);
   LOWER(NegOp, UNARY);
   LOWER(FnegOp, UNARY);
   LOWER(CsetEqFcmpZOp, UNARY);
   LOWER(CsetNeFcmpZOp, UNARY);
+  LOWER(Ld1Op, UNARY);
+  LOWER(DupOp, UNARY);
+  LOWER(DupFOp, UNARY);
+  LOWER(AddvOp, UNARY);
+  LOWER(FmovSOp, UNARY);
 
   // Note that some ops are dealt with later.
   // We can't remove all operands here.
@@ -767,7 +857,13 @@ void RegAlloc::runImpl(Region *region, bool isLeaf) {
         builder.setBeforeOp(term);
         auto def = ops[i].defining;
         Op *mv;
-        if (phi->getResultType() == Value::f32) {
+        if (isVector(phi)) {
+          mv = builder.create<MovVOp>({
+            new ImpureAttr,
+            spillOffset.count(phi) ? (Attr*) new SpilledRdAttr GET_SPILLED_ARGS(phi) : RDC(getReg(phi)),
+            spillOffset.count(def) ? (Attr*) new SpilledRsAttr GET_SPILLED_ARGS(def) : RSC(getReg(def))
+          });
+        } else if (phi->getResultType() == Value::f32) {
           mv = builder.create<FmovOp>({
             new ImpureAttr,
             spillOffset.count(phi) ? (Attr*) new SpilledRdAttr GET_SPILLED_ARGS(phi) : RDC(getReg(phi)),
@@ -863,41 +959,26 @@ void RegAlloc::runImpl(Region *region, bool isLeaf) {
       emitted.insert(dst);
     }
 
-    if (members.empty())
-      continue;
-
-    // Looks like still buggy? No idea why.
-    std::cerr << "remark: cycle detected\n";
-
-    // Now emit all cycles.
-    builder.setBeforeOp(term);
-
-    const auto createMv = [&](Reg dst, Reg src) {
-      bool fp = isFP(dst);
-
-      Attr *rd = int(dst) >= 0 ? (Attr*) RDC(dst) : new SpilledRdAttr(fp, -int(dst));
-      Attr *rs = int(src) >= 0 ? (Attr*) RSC(src) : new SpilledRsAttr(fp, -int(src));
-      Op *mv;
-      if (fp)
-        mv = builder.create<FmovOp>({ new ImpureAttr, rd, rs });
-      else
-        mv = builder.create<MovROp>({ new ImpureAttr, rd, rs });
-      return mv;
-    };
-
-    for (const auto &[header, members] : members) {
-      // If the phi is spilled we can't use s11,
-      // because it will be used for load/store instead.
-      Reg tmp = isFP(header) ? fspillReg2 : spillReg2;
-
-      createMv(tmp, header);
-      for (int i = 1; i < members.size(); i++) 
-        createMv(members[i - 1], members[i]);
-      createMv(members.back(), tmp);
-
-      // The old mv's must get erased.
-      for (auto dst : members)
-        revMap[bb][{ dst, moveGraph[dst] }]->erase();
+    // Break each cycle with a scratch register:
+    //   tmp = header; header = m1; m1 = m2; ...; last = tmp
+    // The moves are reused, so spilled operands stay as they are.
+    for (const auto &[header, cycle] : members) {
+      auto last = revMap[bb][{ cycle.back(), header }];
+      Reg tmp = isa<MovROp>(last) ? spillReg2 : fspillReg2;
+
+      builder.setBeforeOp(term);
+      auto save = builder.copy(last);
+      save->remove<RdAttr>();
+      save->remove<SpilledRdAttr>();
+      save->add<RdAttr>(tmp);
+
+      for (size_t i = 0; i + 1 < cycle.size(); i++)
+        revMap[bb][{ cycle[i], cycle[i + 1] }]->moveBefore(term);
+
+      last->remove<RsAttr>();
+      last->remove<SpilledRsAttr>();
+      last->add<RsAttr>(tmp);
+      last->moveBefore(term);
     }
   }
 
@@ -948,7 +1029,9 @@ void RegAlloc::runImpl(Region *region, bool isLeaf) {
 
         builder.setAfterOp(op);
         if (offset < 16384) {
-          if (fp)
+          if (rd->vec)
+            builder.create<StrQOp>({ RSC(reg), RS2C(Reg::sp), new IntAttr(offset) });
+          else if (fp)
             builder.create<StrFOp>({ RSC(reg), RS2C(Reg::sp), new IntAttr(offset) });
           else
             builder.create<StrXOp>({ RSC(reg), RS2C(Reg::sp), new IntAttr(offset) });
@@ -963,7 +1046,9 @@ void RegAlloc::runImpl(Region *region, bool isLeaf) {
 
         builder.setBeforeOp(op);
         if (offset < 16384) {
-          if (fp)
+          if (rs->vec)
+            builder.create<LdrQOp>({ RDC(reg), RSC(Reg::sp), new IntAttr(offset) });
+          else if (fp)
             builder.create<LdrFOp>({ RDC(reg), RSC(Reg::sp), new IntAttr(offset) });
           else
             builder.create<LdrXOp>({ RDC(reg), RSC(Reg::sp), new IntAttr(offset) });
@@ -978,7 +1063,9 @@ void RegAlloc::runImpl(Region *region, bool isLeaf) {
 
         builder.setBeforeOp(op);
         if (offset < 16384) {
-          if (fp)
+          if (rs2->vec)
+            builder.create<LdrQOp>({ RDC(reg), RSC(Reg::sp), new IntAttr(offset) });
+          else if (fp)
             builder.create<LdrFOp>({ RDC(reg), RSC(Reg::sp), new IntAttr(offset) });
           else
             builder.create<LdrXOp>({ RDC(reg), RSC(Reg::sp), new IntAttr(offset) });
@@ -993,7 +1080,9 @@ void RegAlloc::runImpl(Region *region, bool isLeaf) {
 
         builder.setBeforeOp(op);
         if (offset < 16384) {
-          if (fp)
+          if (rs2->vec)
+            builder.create<LdrQOp>({ RDC(reg), RSC(Reg::sp), new IntAttr(offset) });
+          else if (fp)
             builder.create<LdrFOp>({ RDC(reg), RSC(Reg::sp), new IntAttr(offset) });
           else
             builder.create<LdrXOp>({ RDC(reg), RSC(Reg::sp), new IntAttr(offset) });
@@ -1019,8 +1108,7 @@ int RegAlloc::latePeephole(Op *funcOp) {
     //   sw a0, N(addr)
     //   mv a1, a0
     auto next = op->nextOp();
-    if (isa<LdrWOp>(next) &&
-        RS(next) == RS2(op) && V(next) == V(op) && SIZE(next) == SIZE(op)) {
+    if (isa<LdrWOp>(next) && RS(next) == RS2(op) && V(next) == V(op)) {
       converted++;
       builder.setBeforeOp(next);
       CREATE_MV(isFP(RD(next)), RD(next), RS(op));
@@ -1147,6 +1235,84 @@ void load(Builder builder, const std::vector<Reg> &regs, int offset) {
   }
 }
 
+// A block needs the stack frame if it touches `sp` or a callee-saved register,
+// or if it calls another function (which clobbers `x30`).
+static bool needsFrame(BasicBlock *bb) {
+  const auto touches = [](Reg reg) {
+    return reg == Reg::sp || calleeSaved.count(reg);
+  };
+
+  for (auto op : bb->getOps()) {
+    if (isa<BlOp>(op) || isa<SubSpOp>(op) || isa<GetArgOp>(op))
+      return true;
+
+    if (op->has<RdAttr>() && touches(RD(op)))
+      return true;
+    if (op->has<RsAttr>() && touches(RS(op)))
+      return true;
+    if (op->has<Rs2Attr>() && touches(RS2(op)))
+      return true;
+    if (op->has<Rs3Attr>() && touches(RS3(op)))
+      return true;
+  }
+  return false;
+}
+
+// Shrink-wrapping; see the RISC-V counterpart for details.
+// Returns nullptr if no block needs the frame at all.
+BasicBlock *RegAlloc::findSaveBlock(Region *region, const std::function<bool(BasicBlock*)> &needsFrame) {
+  auto entry = region->getFirstBlock();
+  region->updateDoms();
+
+  std::vector<BasicBlock*> exits;
+  BasicBlock *save = nullptr;
+  for (auto bb : region->getBlocks()) {
+    if (isa<RetOp>(bb->getLastOp()))
+      exits.push_back(bb);
+
+    // Unreachable blocks don't matter.
+    if (!needsFrame(bb) || (bb != entry && !bb->getIdom()))
+      continue;
+
+    if (!save) {
+      save = bb;
+      continue;
+    }
+    while (!bb->dominatedBy(save))
+      save = save->getIdom();
+  }
+
+  if (!save)
+    return nullptr;
+
+  // The block must not be in a cycle, and must dominate every return it reaches.
+  while (save != entry) {
+    std::set<BasicBlock*> reachable;
+    std::vector<BasicBlock*> worklist(save->succs.begin(), save->succs.end());
+    while (!worklist.empty()) {
+      auto bb = worklist.back();
+      worklist.pop_back();
+      if (reachable.count(bb))
+        continue;
+
+      reachable.insert(bb);
+      for (auto succ : bb->succs)
+        worklist.push_back(succ);
+    }
+
+    bool good = !reachable.count(save);
+    for (auto exit : exits) {
+      if (reachable.count(exit) && !exit->dominatedBy(save))
+        good = false;
+    }
+
+    if (good)
+      break;
+    save = save->getIdom();
+  }
+  return save;
+}
+
 void RegAlloc::proEpilogue(FuncOp *funcOp, bool isLeaf) {
   Builder builder;
   auto usedRegs = usedRegisters[funcOp];
@@ -1171,19 +1337,27 @@ void RegAlloc::proEpilogue(FuncOp *funcOp, bool isLeaf) {
     offset = offset / 16 * 16 + 16;
 
   // Add function prologue, preserving the regs.
-  auto entry = region->getFirstBlock();
-  builder.setToBlockStart(entry);
-  if (offset != 0)
+  // If no block needs the frame, then we don't need to set it up at all.
+  auto saveBlock = findSaveBlock(region, needsFrame);
+  if (!saveBlock)
+    offset = 0;
+
+  if (offset != 0) {
+    builder.setToBlockStart(saveBlock);
     builder.create<SubSpOp>({ new IntAttr(offset) });
-  
-  save(builder, preserve, offset);
+    save(builder, preserve, offset);
+  }
 
   // Similarly add function epilogue.
   if (offset != 0) {
     auto rets = funcOp->findAll<RetOp>();
     auto bb = region->appendBlock();
-    for (auto ret : rets)
+    for (auto ret : rets) {
+      // This return never sees the frame. Leave it as-is.
+      if (!ret->getParent()->dominatedBy(saveBlock))
+        continue;
       builder.replace<BOp>(ret, { new TargetAttr(bb) });
+    }
 
     builder.setToBlockStart(bb);
 
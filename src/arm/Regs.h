@@ -0,0 +1,109 @@
+#ifndef ARM_REGS_H
+#define ARM_REGS_H
+
+#include "ArmAttrs.h"
+
+namespace sys::arm {
+
+// We use dedicated registers as the "spill" register, for simplicity.
+const Reg fargRegs[] = {
+  Reg::v0, Reg::v1, Reg::v2, Reg::v3,
+  Reg::v4, Reg::v5, Reg::v6, Reg::v7,
+};
+const Reg argRegs[] = {
+  Reg::x0, Reg::x1, Reg::x2, Reg::x3,
+  Reg::x4, Reg::x5, Reg::x6, Reg::x7,
+};
+
+const Reg spillReg = Reg::x28;
+const Reg spillReg2 = Reg::x15;
+const Reg spillReg3 = Reg::x14;
+const Reg fspillReg = Reg::v31;
+const Reg fspillReg2 = Reg::v15;
+const Reg fspillReg3 = Reg::v30;
+
+// Order for leaf functions. Prioritize temporaries.
+const Reg leafOrder[] = {
+  Reg::x0, Reg::x1, Reg::x2, Reg::x3,
+  Reg::x4, Reg::x5, Reg::x6, Reg::x7,
+
+  Reg::x8, Reg::x9, Reg::x10, Reg::x11,
+  Reg::x12, Reg::x13,
+
+  Reg::x19, Reg::x20, Reg::x21, Reg::x22,
+  Reg::x23, Reg::x24, Reg::x25, Reg::x26,
+  Reg::x27,
+};
+// Order for non-leaf functions.
+const Reg normalOrder[] = {
+  Reg::x19, Reg::x20, Reg::x21, Reg::x22,
+  Reg::x23, Reg::x24, Reg::x25, Reg::x26,
+  Reg::x27,
+
+  Reg::x0, Reg::x1, Reg::x2, Reg::x3,
+  Reg::x4, Reg::x5, Reg::x6, Reg::x7,
+
+  Reg::x8, Reg::x9, Reg::x10, Reg::x11,
+  Reg::x12, Reg::x13,
+};
+
+// The same, but for floating point registers.
+const Reg leafOrderf[] = {
+  Reg::v0, Reg::v1, Reg::v2, Reg::v3,
+  Reg::v4, Reg::v5, Reg::v6, Reg::v7,
+
+  Reg::v8, Reg::v9, Reg::v10, Reg::v11,
+  Reg::v12, Reg::v13, Reg::v14,
+
+  Reg::v16, Reg::v17, Reg::v18,
+  Reg::v19, Reg::v20, Reg::v21, Reg::v22,
+  Reg::v23, Reg::v24, Reg::v25, Reg::v26,
+  Reg::v27, Reg::v28, Reg::v29,
+};
+// Order for non-leaf functions.
+const Reg normalOrderf[] = {
+  Reg::v16, Reg::v17, Reg::v18,
+  Reg::v19, Reg::v20, Reg::v21, Reg::v22,
+  Reg::v23, Reg::v24, Reg::v25, Reg::v26,
+  Reg::v27, Reg::v28, Reg::v29,
+
+  Reg::v0, Reg::v1, Reg::v2, Reg::v3,
+  Reg::v4, Reg::v5, Reg::v6, Reg::v7,
+
+  Reg::v8, Reg::v9, Reg::v10, Reg::v11,
+  Reg::v12, Reg::v13, Reg::v14,
+};
+
+const std::set<Reg> callerSaved = {
+  Reg::x0, Reg::x1, Reg::x2, Reg::x3,
+  Reg::x4, Reg::x5, Reg::x6, Reg::x7,
+
+  Reg::x8, Reg::x9, Reg::x10, Reg::x11,
+  Reg::x12, Reg::x13, Reg::x14, Reg::x15,
+
+  Reg::v0, Reg::v1, Reg::v2, Reg::v3,
+  Reg::v4, Reg::v5, Reg::v6, Reg::v7,
+
+  Reg::v8, Reg::v9, Reg::v10, Reg::v11,
+  Reg::v12, Reg::v13, Reg::v14, Reg::v15,
+};
+
+const std::set<Reg> calleeSaved = {
+  Reg::x19, Reg::x20, Reg::x21, Reg::x22,
+  Reg::x23, Reg::x24, Reg::x25, Reg::x26,
+  Reg::x27, Reg::x28,
+
+  Reg::v16, Reg::v17, Reg::v18,
+  Reg::v19, Reg::v20, Reg::v21, Reg::v22,
+  Reg::v23, Reg::v24, Reg::v25, Reg::v26,
+  Reg::v27, Reg::v28, Reg::v29, Reg::v30,
+};
+
+constexpr int leafRegCnt = 23;
+constexpr int leafRegCntf = 29;
+constexpr int normalRegCnt = 23;
+constexpr int normalRegCntf = 29;
+
+}
+
+#endif
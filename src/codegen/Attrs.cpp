@@ -129,6 +129,16 @@ std::string RangeAttr::toString() {
   return ss.str();
 }
 
+std::string KnownBitsAttr::toString() {
+  // From the highest bit to the lowest.
+  std::string bits;
+  for (int i = 31; i >= 0; i--) {
+    uint32_t mask = 1u << i;
+    bits.push_back(zeros & mask ? '0' : ones & mask ? '1' : '?');
+  }
+  return "<bits = " + bits + ">";
+}
+
 bool AliasAttr::add(Op *base, int offset) {
   if (unknown)
     return false;
@@ -240,6 +250,10 @@ std::string IncreaseAttr::toString() {
   return ss.str();
 }
 
+std::string NoAliasAttr::toString() {
+  return "<noalias = " + std::to_string(scope) + ", " + std::to_string(group) + ">";
+}
+
 bool sys::mustAlias(Op *a, Op *b) {
   if (a->has<AliasAttr>() && b->has<AliasAttr>())
     return ALIAS(a)->mustAlias(ALIAS(b));
@@ -247,6 +261,11 @@ bool sys::mustAlias(Op *a, Op *b) {
 }
 
 bool sys::neverAlias(Op *a, Op *b) {
+  // This has been checked at runtime.
+  auto x = a->find<NoAliasAttr>(), y = b->find<NoAliasAttr>();
+  if (x && y && x->scope == y->scope && x->group != y->group)
+    return true;
+
   if (a->has<AliasAttr>() && b->has<AliasAttr>())
     return ALIAS(a)->neverAlias(ALIAS(b));
   return false;
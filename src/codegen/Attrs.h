@@ -124,6 +124,15 @@ public:
   AtMostOnceAttr *clone() override { return new AtMostOnceAttr; }
 };
 
+// On a function, marks a loop body outlined by Parallelize. Its first two
+// arguments are the range of iterations to run, so its signature can't change.
+// On a call, marks that the range is split among threads by the runtime.
+class ParallelAttr : public AttrImpl<ParallelAttr, __LINE__> {
+public:
+  std::string toString() override { return "<parallel>"; }
+  ParallelAttr *clone() override { return new ParallelAttr; }
+};
+
 class ArgCountAttr : public AttrImpl<ArgCountAttr, __LINE__> {
 public:
   int count;
@@ -197,6 +206,20 @@ public:
   RangeAttr *clone() override { return new RangeAttr(range); }
 };
 
+class KnownBitsAttr : public AttrImpl<KnownBitsAttr, __LINE__> {
+public:
+  // Semantics:
+  // The bits set in `zeros` are always 0 in the integer operation this Attr attaches to,
+  // and those set in `ones` are always 1.
+  uint32_t zeros;
+  uint32_t ones;
+
+  KnownBitsAttr(uint32_t zeros, uint32_t ones): zeros(zeros), ones(ones) {}
+
+  std::string toString() override;
+  KnownBitsAttr *clone() override { return new KnownBitsAttr(zeros, ones); }
+};
+
 // Marks whether an alloca is floating point.
 // This can't be deduced by return value because it's always i64.
 class FPAttr : public AttrImpl<FPAttr, __LINE__> {
@@ -249,6 +272,18 @@ public:
 };
 
 
+// Marks addresses in a loop copy guarded by runtime alias checks (see LoopVersioning).
+// Addresses with the same `scope` but different `group`s never alias.
+class NoAliasAttr : public AttrImpl<NoAliasAttr, __LINE__> {
+public:
+  int scope;
+  int group;
+
+  NoAliasAttr(int scope, int group): scope(scope), group(group) {}
+
+  std::string toString() override;
+  NoAliasAttr *clone() override { return new NoAliasAttr(scope, group); }
+};
 
 bool mustAlias(Op *a, Op *b);
 bool neverAlias(Op *a, Op *b);
@@ -265,7 +300,9 @@ bool mayAlias(Op *a, Op *b);
 #define CALLER(op) (op)->get<CallerAttr>()->callers
 #define ALIAS(op) (op)->get<AliasAttr>()
 #define RANGE(op) (op)->get<RangeAttr>()->range
+#define KNOWN(op) (op)->get<KnownBitsAttr>()
 #define FROM(attr) cast<FromAttr>(attr)->bb
 #define INCR(op) (op)->get<IncreaseAttr>()
+#define NOALIAS(op) (op)->get<NoAliasAttr>()
 
 #endif
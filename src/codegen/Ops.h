@@ -41,6 +41,8 @@
 #define OP(Ty) OPBASE(Value::i32, Ty)
 #define OPF(Ty) OPBASE(Value::f32, Ty)
 #define OPL(Ty) OPBASE(Value::i64, Ty)
+#define OPV(Ty) OPBASE(Value::i128, Ty)
+#define OPVF(Ty) OPBASE(Value::f128, Ty)
 
 namespace sys {
 
@@ -103,6 +105,18 @@ OP(BreakOp);
 OP(ContinueOp);
 OP(SelectOp);
 
+// Vector ops of 4 lanes, 32 bits each. Only created by Vectorize.
+OPE(VLoadOp);
+OP(VStoreOp); // Operand order: value, dst
+OPE(VSplatOp); // Broadcasts a scalar to all lanes.
+OPV(VAddIOp);
+OPV(VSubIOp);
+OPV(VMulIOp);
+OPVF(VAddFOp);
+OPVF(VSubFOp);
+OPVF(VMulFOp);
+OP(VReduceAddIOp); // Sums up all lanes.
+
 }
 
 #undef OP
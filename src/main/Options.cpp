@@ -22,6 +22,9 @@ Options::Options() {
   verify = false;
   sat = false;
   bv = false;
+  vectorize = false;
+  fastMath = false;
+  parallel = false;
 }
 
 Options sys::parseArgs(int argc, char **argv) {
@@ -64,6 +67,9 @@ Options sys::parseArgs(int argc, char **argv) {
     PARSEOPT("--verify", verify);
     PARSEOPT("--bv", bv);
     PARSEOPT("--sat", sat);
+    PARSEOPT("--vectorize", vectorize);
+    PARSEOPT("--fast-math", fastMath);
+    PARSEOPT("--parallel", parallel);
 
     if (opts.inputFile != "") {
       std::cerr << "error: multiple inputs\n";
@@ -20,6 +20,9 @@ struct Options {
     option verify : 1;
     option bv : 1;
     option sat : 1;
+    option vectorize : 1;
+    option fastMath : 1;
+    option parallel : 1;
   };
 
   std::string inputFile;
@@ -27,9 +27,13 @@ void initArmPipeline(sys::PassManager &pm) {
 
   pm.addPass<Lower>();
   pm.addPass<InstCombine>();
+  pm.addPass<MachineCSE>();
+  pm.addPass<MachineLICM>();
   pm.addPass<ArmDCE>();
   pm.addPass<RegAlloc>();
   pm.addPass<LateLegalize>();
+  pm.addPass<CopyProp>();
+  pm.addPass<PostSchedule>();
   pm.addPass<Dump>(opts.outputFile);
 }
 
@@ -39,8 +43,12 @@ void initRvPipeline(sys::PassManager &pm) {
   pm.addPass<Lower>();
   pm.addPass<StrengthReduct>();
   pm.addPass<InstCombine>();
+  pm.addPass<MachineCSE>();
+  pm.addPass<MachineLICM>();
   pm.addPass<RvDCE>();
   pm.addPass<RegAlloc>();
+  pm.addPass<CopyProp>();
+  pm.addPass<PostSchedule>();
   pm.addPass<Dump>(opts.outputFile);
 }
 
@@ -55,10 +63,16 @@ void initPipeline(sys::PassManager &pm) {
   pm.addPass<sys::Pureness>();
   pm.addPass<sys::EarlyConstFold>(/*beforePureness=*/ false);
   pm.addPass<sys::TCO>();
+  pm.addPass<sys::Memoize>();
   pm.addPass<sys::Remerge>();
   pm.addPass<sys::RaiseToFor>();
   pm.addPass<sys::DCE>(/*elimBlocks=*/ false);
   pm.addPass<sys::ArrayAccess>();
+  pm.addPass<sys::Fusion>();
+  pm.addPass<sys::LoopNest>();
+  pm.addPass<sys::LoopSplit>();
+  if (opts.parallel)
+    pm.addPass<sys::Parallelize>();
   pm.addPass<sys::Lower>();
 
   // ===== Flattened CFG =====
@@ -72,6 +86,9 @@ void initPipeline(sys::PassManager &pm) {
   pm.addPass<sys::Globalize>();
   pm.addPass<sys::Mem2Reg>();
   pm.addPass<sys::Alias>();
+  pm.addPass<sys::SCCP>();
+  pm.addPass<sys::Specialize>();
+  pm.addPass<sys::SCCP>();
   pm.addPass<sys::RegularFold>();
   pm.addPass<sys::DCE>();
   pm.addPass<sys::DAE>();
@@ -80,9 +97,14 @@ void initPipeline(sys::PassManager &pm) {
   pm.addPass<sys::LoopRotate>();
   pm.addPass<sys::CanonicalizeLoop>(/*lcssa=*/ false);
   pm.addPass<sys::LICM>();
+  pm.addPass<sys::LoopVersioning>();
+  pm.addPass<sys::LICM>();
+  pm.addPass<sys::LoopUnswitch>();
   pm.addPass<sys::ConstLoopUnroll>();
   pm.addPass<sys::SCEV>();
   pm.addPass<sys::GVN>();
+  pm.addPass<sys::Range>();
+  pm.addPass<sys::KnownBits>();
   pm.addPass<sys::RegularFold>();
   pm.addPass<sys::DCE>();
   pm.addPass<sys::GVN>();
@@ -113,7 +135,25 @@ void initPipeline(sys::PassManager &pm) {
   pm.addPass<sys::RegularFold>();
   pm.addPass<sys::AggressiveDCE>();
   pm.addPass<sys::SimplifyCFG>();
+  // The vectorizer only takes loops as they are here, so don't unroll them in that case.
+  if (!opts.vectorize) {
+    pm.addPass<sys::RuntimeUnroll>(/*fastMath=*/ opts.fastMath);
+    pm.addPass<sys::RegularFold>();
+    pm.addPass<sys::GVN>();
+    pm.addPass<sys::DCE>();
+  }
   pm.addPass<sys::InstSchedule>();
+  if (opts.vectorize) {
+    pm.addPass<sys::Vectorize>();
+    pm.addPass<sys::SLP>();
+  }
+  // Runtime unrolling leaves loops without preheaders, which the passes below need.
+  pm.addPass<sys::CanonicalizeLoop>(/*lcssa=*/ false);
+  pm.addPass<sys::ModuloSchedule>();
+  pm.addPass<sys::LSR>();
+  // Backends pick cheaper sequences for operands whose range or bits are known.
+  pm.addPass<sys::Range>();
+  pm.addPass<sys::KnownBits>();
   pm.addPass<sys::Verify>();
 
   if (opts.arm)
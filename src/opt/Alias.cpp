@@ -67,6 +67,10 @@ void Alias::runImpl(Region *region) {
         else
           op->add<AliasAttr>(alias->location);
         delete alias;
+
+        // Addresses derived from a no-alias one are also no-alias.
+        if (auto attr = x->find<NoAliasAttr>(); attr && !op->has<NoAliasAttr>())
+          op->add<NoAliasAttr>(attr->scope, attr->group);
         continue;
       }
     }
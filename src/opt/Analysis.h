@@ -44,17 +44,73 @@ public:
 };
 
 // Integer range analysis.
+// Gives a RangeAttr to integer ops whose values are bounded,
+// and folds comparisons that the ranges decide.
 class Range : public Pass {
+public:
+  // A closed interval, kept in 64 bits so that overflow can be seen before it wraps.
+  // It's empty when `low > high`, which means no value has reached it yet.
+  struct Interval {
+    int64_t low, high;
+
+    bool empty() const { return low > high; }
+    bool operator==(const Interval &other) const;
+  };
+private:
+  // A condition, and whether it holds.
+  using Fact = std::pair<Op*, bool>;
+
+  int foldedCmps = 0;
+  int reduced = 0;
+
+  std::map<Op*, Interval> ranges;
+  // The conditions known at each block, from the branches taken to reach it.
+  std::map<BasicBlock*, std::vector<Fact>> facts;
   // The set of all loop headers in a function.
   // We should apply widening at these blocks, otherwise it would take forever to converge.
   std::set<BasicBlock*> headers;
 
-  void runImpl(Region *region, const LoopForest &forest);
+  Interval get(Op *op);
+  Interval apply(Op *v, Interval r, Op *cond, bool holds);
+  Interval refine(Op *v, BasicBlock *bb);
+  Interval refineEdge(Op *v, BasicBlock *from, BasicBlock *to);
+  bool edgeFact(BasicBlock *from, BasicBlock *to, Fact &fact);
+  Interval evaluate(Op *op);
+  Interval widen(Op *phi, Interval old, Interval now);
+  Op *reduce(Op *op);
+  void runImpl(Region *region);
 public:
   Range(ModuleOp *module): Pass(module) {}
 
   std::string name() override { return "range"; }
-  std::map<std::string, int> stats() override { return {}; }
+  std::map<std::string, int> stats() override;
+  void run() override;
+};
+
+// Known-bits analysis.
+// Tracks the bits of integer ops that are always 0 or always 1, and gives them a KnownBitsAttr.
+// Unlike Range, this sees through masks and shifts rather than magnitudes.
+// Also removes masks that change no bits, and folds ops whose bits are all known.
+class KnownBits : public Pass {
+public:
+  struct Bits {
+    uint32_t zeros, ones;
+  };
+private:
+  int folded = 0;
+  int removedMasks = 0;
+  int reducedMods = 0;
+
+  std::map<Op*, Bits> bits;
+
+  Bits get(Op *op);
+  Bits evaluate(Op *op);
+  void runImpl(Region *region);
+public:
+  KnownBits(ModuleOp *module): Pass(module) {}
+
+  std::string name() override { return "known-bits"; }
+  std::map<std::string, int> stats() override;
   void run() override;
 };
 
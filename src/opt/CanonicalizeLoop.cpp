@@ -71,37 +71,39 @@ void CanonicalizeLoop::canonicalize(LoopInfo *loop) {
       }
       
       // Replace uses outside of the loop with phi.
+      // An op might use `op` more than once, so go through every operand.
       auto uses = op->getUses();
       for (auto use : uses) {
-        auto parent = use->getParent();
-        // Phi should be treated as from the place where that operands comes from.
-        // See 28.sy; consider:
-        //
-        // bb24:
-        //   %69 = phi %77 <from = bb25> ...
-        // bb27:
-        //   %77 = phi %69 <from = bb24> ...
-        //   goto <bb25>
-        // bb25:
-        //   goto <bb24>
-        //
-        // When we handle the loop { 27, 25 }, we need to treat `phi %77` as coming from bb25 rather than bb24.
-        // It's sensible because the phi is actually on the edge.
-        if (isa<PhiOp>(use)) {
-          for (size_t i = 0; i < use->getOperands().size(); i++) {
-            if (use->getOperand(i).defining == op) {
-              parent = cast<FromAttr>(use->getAttrs()[i])->bb;
-              break;
-            }
-          }
-        }
-
         // Don't replace the phi we've just created.
-        if (loop->contains(parent) || produced.count(use))
+        if (produced.count(use))
           continue;
 
-        auto replace = getValueFor(parent, loop, phiMap);
-        use->replaceOperand(op, replace);
+        for (size_t i = 0; i < use->getOperands().size(); i++) {
+          if (use->getOperand(i).defining != op)
+            continue;
+
+          auto parent = use->getParent();
+          // Phi should be treated as from the place where that operands comes from.
+          // See 28.sy; consider:
+          //
+          // bb24:
+          //   %69 = phi %77 <from = bb25> ...
+          // bb27:
+          //   %77 = phi %69 <from = bb24> ...
+          //   goto <bb25>
+          // bb25:
+          //   goto <bb24>
+          //
+          // When we handle the loop { 27, 25 }, we need to treat `phi %77` as coming from bb25 rather than bb24.
+          // It's sensible because the phi is actually on the edge.
+          if (isa<PhiOp>(use))
+            parent = cast<FromAttr>(use->getAttrs()[i])->bb;
+
+          if (loop->contains(parent))
+            continue;
+
+          use->setOperand(i, getValueFor(parent, loop, phiMap));
+        }
       }
     }
   }
@@ -61,6 +61,10 @@ void DAE::run() {
 
   auto funcs = collectFuncs();
   for (auto func : funcs) {
+    // The runtime decides the arguments of parallel workers.
+    if (func->has<ParallelAttr>())
+      continue;
+
     std::set<int, std::greater<int>> toRemove;
     std::set<int> visited;
     int &argcnt = func->get<ArgCountAttr>()->count;
@@ -21,6 +21,8 @@ bool GVN::Expr::operator<(const Expr &other) const {
     return vi < other.vi;
   if (vf != other.vf)
     return vf < other.vf;
+  if (noalias != other.noalias)
+    return noalias < other.noalias;
   return name < other.name;
 }
 
@@ -129,6 +131,8 @@ void GVN::dvnt(BasicBlock *bb, Domtree &domtree) {
       key.vf = attr->value;
     if (auto attr = op->find<NameAttr>())
       key.name = attr->name;
+    if (auto attr = op->find<NoAliasAttr>())
+      key.noalias = { attr->scope, attr->group };
 
     if (exprNum.count(key)) {
       assert(numOp.count(exprNum[key]));
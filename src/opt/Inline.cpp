@@ -48,6 +48,10 @@ void Inline::run() {
     if (isRecursive(func))
       return false;
 
+    // The body of a parallel call runs on other threads.
+    if (call->has<ParallelAttr>())
+      return false;
+
     // Maps old Op to new Op.
     std::map<Op*, Op*> cloneMap;
     std::map<BasicBlock*, BasicBlock*> retargetMap;
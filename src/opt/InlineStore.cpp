@@ -47,6 +47,13 @@ void InlineStore::run() {
     for (auto runner = entry; runner->succs.size();) {
       auto ops = runner->getOps();
       for (auto op : ops) {
+        // The callee might write the global through a pointer argument.
+        if (isa<CallOp>(op) && op->has<ImpureAttr>()) {
+          auto operands = op->getOperands();
+          if (std::any_of(operands.begin(), operands.end(), [](Value v) { return v.defining->has<AliasAttr>(); }))
+            BAD
+        }
+
         if (isa<LoadOp>(op)) {
           if (!op->DEF()->has<AliasAttr>())
             BAD
@@ -90,15 +97,16 @@ void InlineStore::run() {
             BAD
 
           auto offset = offsets[0];
+          // Later loads of this element would see the store, not the initializer.
           if (fp) {
             if (!isa<FloatOp>(op->DEF(0)))
-              continue;
+              BAD
 
             auto attr = glob->get<FloatArrayAttr>();
             attr->vf[offset / 4] = F(op->DEF(0));
           } else {
             if (!isa<IntOp>(op->DEF(0)))
-              continue;
+              BAD
 
             auto attr = glob->get<IntArrayAttr>();
             attr->vi[offset / 4] = V(op->DEF(0));
@@ -4,17 +4,87 @@
 
 using namespace sys;
 
+std::map<std::string, int> InstSchedule::stats() {
+  return {
+    { "pressure-picks", pressured },
+  };
+}
+
+// Registers available to the allocator. This is the smaller one of RISC-V and ARM.
+constexpr int intRegs = 23;
+constexpr int floatRegs = 29;
+// Switch to reducing pressure when this close to the limit.
+constexpr int pressureMargin = 3;
+
 void InstSchedule::runImpl(BasicBlock *bb) {
+  // Impure calls are pinned. They split the block into regions,
+  // and each region is scheduled on its own.
+  // Values defined in an earlier region are seen as live-in.
+  std::vector<Op*> barriers;
   for (auto op : bb->getOps()) {
-    // We can't reschedule if there is any pinned operations.
-    // TODO: Perhaps there's some way to mitigate this?
     if (isa<CallOp>(op) && op->has<ImpureAttr>())
-      return;
+      barriers.push_back(op);
+  }
+  auto term = bb->getLastOp();
+  barriers.push_back(term);
+
+  // Track register pressure. `usesLeft` is the number of unscheduled uses in this block.
+  // A value dies when that drops to zero, unless it's live-out.
+  //
+  // This must be done before the dependences between loads/stores are added.
+  const auto &liveOut = bb->getLiveOut();
+  std::unordered_map<Op*, int> usesLeft;
+  std::unordered_set<Op*> hasValue;
+  int intPressure = 0, floatPressure = 0;
+  for (auto op : bb->getOps()) {
+    if (op->getUses().size())
+      hasValue.insert(op);
+    if (isa<PhiOp>(op))
+      continue;
+    for (auto operand : op->getOperands())
+      usesLeft[operand.defining]++;
+  }
+
+  // Loads and stores get extra operands below. They don't count.
+  const auto realOperands = [](Op *op) {
+    std::vector<Op*> defs;
+    int count = isa<LoadOp>(op) ? 1 : isa<StoreOp>(op) ? 2 : op->getOperandCount();
+    for (int i = 0; i < count; i++)
+      defs.push_back(op->DEF(i));
+    return defs;
+  };
+  for (auto op : bb->getLiveIn()) {
+    if (usesLeft.count(op) || liveOut.count(op))
+      ++(op->getResultType() == Value::f32 ? floatPressure : intPressure);
   }
 
-  // First, we need to build a dependence graph between loads/stores.
+  // Returns (change of int pressure, change of float pressure) if `op` is scheduled now.
+  const auto pressureDelta = [&](Op *op) {
+    std::pair<int, int> delta { 0, 0 };
+    auto &[intDelta, floatDelta] = delta;
+    if (hasValue.count(op))
+      ++(op->getResultType() == Value::f32 ? floatDelta : intDelta);
+
+    std::unordered_map<Op*, int> count;
+    for (auto def : realOperands(op))
+      count[def]++;
+    for (auto [def, cnt] : count) {
+      if (usesLeft[def] == cnt && !liveOut.count(def))
+        --(def->getResultType() == Value::f32 ? floatDelta : intDelta);
+    }
+    return delta;
+  };
+
+  // Then, we need to build a dependence graph between loads/stores.
   std::vector<Op*> stores, loads;
   for (auto op : bb->getOps()) {
+    // Calls are barriers; no need to look across them.
+    if (isa<CallOp>(op) && op->has<ImpureAttr>()) {
+      stores.clear();
+      loads.clear();
+      continue;
+    }
+
     // Check against store, but no need to check loads.
     if (isa<LoadOp>(op)) {
       for (auto store : stores) {
@@ -40,6 +110,15 @@ void InstSchedule::runImpl(BasicBlock *bb) {
       stores.push_back(op);
     }
   }
+  // Loads and stores might be cleared above; collect them again for cleanup.
+  loads.clear();
+  stores.clear();
+  for (auto op : bb->getOps()) {
+    if (isa<LoadOp>(op))
+      loads.push_back(op);
+    if (isa<StoreOp>(op))
+      stores.push_back(op);
+  }
 
   // Now do a list scheduling.
 
@@ -105,8 +184,21 @@ void InstSchedule::runImpl(BasicBlock *bb) {
     }
     return result;
   };
-  // The priority queue pops the LARGEST element by default.
-  std::list<Op*> ready;
+
+  // Near the register limit, the op that frees the most registers goes first.
+  // Otherwise fall back to `goodness`.
+  auto priority = [&](Op *op) -> int {
+    bool highInt = intPressure >= intRegs - pressureMargin;
+    bool highFloat = floatPressure >= floatRegs - pressureMargin;
+    if (!highInt && !highFloat)
+      return goodness(op);
+
+    auto [intDelta, floatDelta] = pressureDelta(op);
+    int delta = (highInt ? intDelta : 0) + (highFloat ? floatDelta : 0);
+    return -delta * 10000 + goodness(op);
+  };
+
+  // Only ops in the current region can be scheduled.
   std::unordered_set<Op*> allowed;
 
   for (auto op : bb->getOps()) {
@@ -117,44 +209,78 @@ void InstSchedule::runImpl(BasicBlock *bb) {
     }
   }
 
-  auto term = bb->getLastOp();
-  for (auto op : bb->getOps()) {
-    if (op != term && !isa<PhiOp>(op)) {
+  auto it = bb->begin();
+  while (it != bb->end() && isa<PhiOp>(*it))
+    ++it;
+
+  for (auto barrier : barriers) {
+    std::list<Op*> ready;
+    allowed.clear();
+    for (; *it != barrier; ++it) {
+      auto op = *it;
       allowed.insert(op);
       if (!degree[op])
         ready.push_back(op);
     }
-  }
+    // Skip the barrier itself.
+    ++it;
 
-  while (!ready.empty()) {
-    // Find the best element.
-    decltype(ready)::iterator it;
-    int best = INT_MIN;
-    for (auto i = ready.begin(); i != ready.end(); i++) {
-      auto good = goodness(*i);
-      if (good > best) {
-        it = i;
-        best = good;
+    size_t scheduled = 0;
+    while (!ready.empty()) {
+      // Find the best element.
+      decltype(ready)::iterator best;
+      int bestPriority = INT_MIN;
+      for (auto i = ready.begin(); i != ready.end(); i++) {
+        auto good = priority(*i);
+        if (good > bestPriority) {
+          best = i;
+          bestPriority = good;
+        }
+      }
+      Op *op = *best;
+      ready.erase(best);
+
+      if (intPressure >= intRegs - pressureMargin || floatPressure >= floatRegs - pressureMargin)
+        pressured++;
+
+      auto [intDelta, floatDelta] = pressureDelta(op);
+      intPressure += intDelta;
+      floatPressure += floatDelta;
+      for (auto def : realOperands(op))
+        usesLeft[def]--;
+
+      op->moveBefore(barrier);
+      time[op] = index++;
+      scheduled++;
+
+      for (auto use : op->getUses()) {
+        // It's possible that a single operation refers to the same op more than once.
+        for (auto operand : use->getOperands()) {
+          if (operand.defining == op)
+            --degree[use];
+        }
+        
+        if (!degree[use] && allowed.count(use))
+          ready.push_back(use);
       }
     }
-    Op *op = *it;
-    ready.erase(it);
+    assert(scheduled == allowed.size());
 
-    op->moveBefore(term);
-    time[op] = index++;
+    // The barrier uses its operands as well.
+    auto [intDelta, floatDelta] = pressureDelta(barrier);
+    intPressure += intDelta;
+    floatPressure += floatDelta;
+    for (auto def : realOperands(barrier))
+      usesLeft[def]--;
 
-    for (auto use : op->getUses()) {
-      // It's possible that a single operation refers to the same op more than once.
+    // Ops after the barrier no longer wait for it.
+    for (auto use : barrier->getUses()) {
       for (auto operand : use->getOperands()) {
-        if (operand.defining == op)
+        if (operand.defining == barrier)
           --degree[use];
       }
-      
-      if (!degree[use] && allowed.count(use))
-        ready.push_back(use);
     }
   }
-  assert(index == allowed.size());
 
   // Don't forget to erase the introduced operands.
   for (auto load : loads) {
@@ -0,0 +1,278 @@
+#include "Analysis.h"
+
+using namespace sys;
+
+using Bits = KnownBits::Bits;
+
+std::map<std::string, int> KnownBits::stats() {
+  return {
+    { "folded-ops", folded },
+    { "removed-masks", removedMasks },
+    { "reduced-mods", reducedMods },
+  };
+}
+
+namespace {
+
+// Not reached yet. Every bit is both 0 and 1, which no value can be.
+constexpr Bits top = { ~0u, ~0u };
+constexpr Bits unknown = { 0, 0 };
+
+bool isTop(Bits b) {
+  return b.zeros & b.ones;
+}
+
+bool isConst(Bits b) {
+  return !isTop(b) && (b.zeros | b.ones) == ~0u;
+}
+
+// The bits known on both sides.
+Bits meet(Bits a, Bits b) {
+  if (isTop(a))
+    return b;
+  if (isTop(b))
+    return a;
+  return { a.zeros & b.zeros, a.ones & b.ones };
+}
+
+// The number of low bits known to be zero.
+int trailingZeros(Bits b) {
+  return ~b.zeros ? __builtin_ctz(~b.zeros) : 32;
+}
+
+uint32_t lowMask(int n) {
+  return n >= 32 ? ~0u : (1u << n) - 1;
+}
+
+Bits shiftLeft(Bits b, int n) {
+  return { (b.zeros << n) | lowMask(n), b.ones << n };
+}
+
+// Arithmetic shift. The copies of the sign bit are known if the sign is.
+Bits shiftRight(Bits b, int n) {
+  return { (uint32_t) ((int32_t) b.zeros >> n), (uint32_t) ((int32_t) b.ones >> n) };
+}
+
+bool isPowerOfTwo(Op *op) {
+  return isa<IntOp>(op) && V(op) > 1 && __builtin_popcount(V(op)) == 1;
+}
+
+// Ops whose value depends on nothing but their operands.
+bool isArithmetic(Op *op) {
+  return isa<AndIOp>(op) || isa<OrIOp>(op) || isa<XorIOp>(op) ||
+    isa<LShiftOp>(op) || isa<RShiftOp>(op) || isa<MulIOp>(op) ||
+    isa<AddIOp>(op) || isa<SubIOp>(op) || isa<ModIOp>(op) ||
+    isa<EqOp>(op) || isa<NeOp>(op) || isa<LtOp>(op) || isa<LeOp>(op) ||
+    isa<NotOp>(op) || isa<SetNotZeroOp>(op) || isa<SelectOp>(op);
+}
+
+}
+
+Bits KnownBits::get(Op *op) {
+  if (isa<IntOp>(op))
+    return { ~(uint32_t) V(op), (uint32_t) V(op) };
+  auto it = bits.find(op);
+  return it == bits.end() ? unknown : it->second;
+}
+
+Bits KnownBits::evaluate(Op *op) {
+  if (isa<PhiOp>(op)) {
+    auto result = top;
+    for (auto operand : op->getOperands())
+      result = meet(result, get(operand.defining));
+    return result;
+  }
+
+  std::vector<Bits> args;
+  for (auto operand : op->getOperands()) {
+    args.push_back(get(operand.defining));
+    if (isTop(args.back()))
+      return top;
+  }
+
+  auto result = unknown;
+
+  if (isa<AndIOp>(op))
+    result = { args[0].zeros | args[1].zeros, args[0].ones & args[1].ones };
+
+  if (isa<OrIOp>(op))
+    result = { args[0].zeros & args[1].zeros, args[0].ones | args[1].ones };
+
+  if (isa<XorIOp>(op)) {
+    auto [z1, o1] = args[0];
+    auto [z2, o2] = args[1];
+    result = { (z1 & z2) | (o1 & o2), (z1 & o2) | (o1 & z2) };
+  }
+
+  if (isa<LShiftOp>(op) || isa<RShiftOp>(op)) {
+    auto y = op->DEF(1);
+    if (isa<IntOp>(y) && V(y) >= 0 && V(y) <= 31) {
+      int n = V(y);
+      result = isa<LShiftOp>(op) ? shiftLeft(args[0], n) : shiftRight(args[0], n);
+    }
+  }
+
+  if (isa<MulIOp>(op)) {
+    // Multiplying by 2^n is a shift; otherwise only the trailing zeros add up.
+    auto x = op->DEF(0), y = op->DEF(1);
+    if (isPowerOfTwo(y))
+      result = shiftLeft(args[0], __builtin_ctz(V(y)));
+    else if (isPowerOfTwo(x))
+      result = shiftLeft(args[1], __builtin_ctz(V(x)));
+    else
+      result = { lowMask(trailingZeros(args[0]) + trailingZeros(args[1])), 0 };
+  }
+
+  if (isa<AddIOp>(op) || isa<SubIOp>(op)) {
+    // No carry or borrow comes out of the bits that are zero on both sides.
+    int n = std::min(trailingZeros(args[0]), trailingZeros(args[1]));
+    result = { lowMask(n), 0 };
+  }
+
+  if (isa<ModIOp>(op) && isPowerOfTwo(op->DEF(1))) {
+    // The remainder is congruent to the dividend, so the low bits stay the same.
+    // The rest are zero if the dividend isn't negative.
+    // As the remainder is also smaller than 2^n, it's zero when the low bits are.
+    auto mask = (uint32_t) V(op->DEF(1)) - 1;
+    auto [z, o] = args[0];
+    if ((z & mask) == mask)
+      result = { ~0u, 0 };
+    else if (z & 0x80000000u)
+      result = { z | ~mask, o & mask };
+    else
+      result = { z & mask, o & mask };
+  }
+
+  if (isa<EqOp>(op) || isa<NeOp>(op)) {
+    // A bit that is known to differ decides it.
+    auto [z1, o1] = args[0];
+    auto [z2, o2] = args[1];
+    if ((z1 & o2) | (o1 & z2)) {
+      uint32_t v = isa<NeOp>(op);
+      return { ~v, v };
+    }
+  }
+
+  if (isa<EqOp>(op) || isa<NeOp>(op) || isa<LtOp>(op) || isa<LeOp>(op) ||
+      isa<NotOp>(op) || isa<SetNotZeroOp>(op))
+    result = { ~1u, 0 };
+
+  if (isa<SelectOp>(op))
+    result = meet(args[1], args[2]);
+
+  // Bounds from range analysis give the leading bits.
+  if (auto range = op->find<RangeAttr>()) {
+    auto [low, high] = range->range;
+    if (low >= 0)
+      result.zeros |= ~lowMask(32 - __builtin_clz(high | 1));
+    if (high < 0)
+      result.ones |= 0x80000000u;
+  }
+  return result;
+}
+
+void KnownBits::runImpl(Region *region) {
+  auto tree = getDomTree(region);
+
+  // Preorder of the dominator tree, so that operands come before their users except through phis.
+  std::vector<BasicBlock*> order;
+  std::vector<BasicBlock*> worklist { region->getFirstBlock() };
+  while (!worklist.empty()) {
+    auto bb = worklist.back();
+    worklist.pop_back();
+    order.push_back(bb);
+    for (auto child : tree[bb])
+      worklist.push_back(child);
+  }
+
+  // Each bit can only go from "not reached" to known, and from known to unknown,
+  // so this converges quickly.
+  bits.clear();
+  for (auto bb : order) {
+    for (auto op : bb->getOps()) {
+      if (op->getResultType() == Value::i32 && (isa<PhiOp>(op) || isArithmetic(op)))
+        bits[op] = top;
+    }
+  }
+
+  bool changed;
+  do {
+    changed = false;
+    for (auto bb : order) {
+      for (auto op : bb->getOps()) {
+        if (!bits.count(op))
+          continue;
+
+        auto now = evaluate(op);
+        if (now.zeros != bits[op].zeros || now.ones != bits[op].ones) {
+          bits[op] = now;
+          changed = true;
+        }
+      }
+    }
+  } while (changed);
+
+  Builder builder;
+  for (auto bb : order) {
+    auto ops = bb->getOps();
+    for (auto op : ops) {
+      if (!bits.count(op))
+        continue;
+
+      auto b = bits[op];
+      if (isTop(b))
+        continue;
+
+      if (isConst(b) && !isa<PhiOp>(op)) {
+        builder.replace<IntOp>(op, { new IntAttr((int) b.ones) });
+        folded++;
+        continue;
+      }
+
+      // Masks that clear only bits that are already 0, or set only bits that are already 1.
+      if (isa<AndIOp>(op) || isa<OrIOp>(op)) {
+        auto x = op->DEF(0), y = op->DEF(1);
+        if (isa<IntOp>(x))
+          std::swap(x, y);
+        if (isa<IntOp>(y)) {
+          uint32_t mask = V(y);
+          auto known = get(x);
+          bool redundant = isa<AndIOp>(op) ? !(~mask & ~known.zeros) : !(mask & ~known.ones);
+          if (redundant) {
+            op->replaceAllUsesWith(x);
+            op->erase();
+            removedMasks++;
+            continue;
+          }
+        }
+      }
+
+      // x % 2^n is x & (2^n - 1) when x isn't negative.
+      if (isa<ModIOp>(op) && isPowerOfTwo(op->DEF(1)) && (get(op->DEF(0)).zeros & 0x80000000u)) {
+        builder.setBeforeOp(op);
+        auto mask = builder.create<IntOp>({ new IntAttr(V(op->DEF(1)) - 1) });
+        op = builder.replace<AndIOp>(op, { op->DEF(0), mask });
+        reducedMods++;
+      }
+
+      // Attributes of phis must all be FromAttr.
+      if (!isa<PhiOp>(op) && (b.zeros | b.ones))
+        op->add<KnownBitsAttr>(b.zeros, b.ones);
+    }
+  }
+}
+
+void KnownBits::run() {
+  auto funcs = collectFuncs();
+
+  // Bits from an earlier run might no longer hold.
+  for (auto func : funcs) {
+    for (auto bb : func->getRegion()->getBlocks()) {
+      for (auto op : bb->getOps())
+        op->remove<KnownBitsAttr>();
+    }
+  }
+
+  for (auto func : funcs)
+    runImpl(func->getRegion());
+}
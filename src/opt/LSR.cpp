@@ -0,0 +1,460 @@
+#include "LoopPasses.h"
+#include "CleanupPasses.h"
+#include <optional>
+
+using namespace sys;
+
+std::map<std::string, int> LSR::stats() {
+  return {
+    { "reduced-addresses", reduced },
+    { "counted-down", counted },
+  };
+}
+
+namespace {
+
+// Each of these costs a register throughout the loop.
+constexpr int maxPhis = 4;
+
+// An invariant of the loop: a constant plus a sum of invariant ops times constants.
+// The terms are kept in the order they're found, so the output is stable.
+struct Linear {
+  std::vector<std::pair<Op*, int64_t>> terms;
+  int64_t constant = 0;
+
+  bool isConstant() const { return terms.empty(); }
+  bool isZero() const { return terms.empty() && !constant; }
+
+  int64_t coeff(Op *op) const {
+    for (auto [x, v] : terms) {
+      if (x == op)
+        return v;
+    }
+    return 0;
+  }
+
+  // this += other * factor.
+  void add(const Linear &other, int64_t factor) {
+    if (!factor)
+      return;
+    for (auto [op, v] : other.terms) {
+      auto it = std::find_if(terms.begin(), terms.end(), [&](auto &term) { return term.first == op; });
+      if (it == terms.end())
+        terms.push_back({ op, v * factor });
+      else if (!(it->second += v * factor))
+        terms.erase(it);
+    }
+    constant += other.constant * factor;
+  }
+};
+
+// Whether the non-constant parts of `a` and `b` are the same.
+bool sameTerms(const Linear &a, const Linear &b) {
+  if (a.terms.size() != b.terms.size())
+    return false;
+  for (auto [op, v] : a.terms) {
+    if (b.coeff(op) != v)
+      return false;
+  }
+  return true;
+}
+
+bool fits(int64_t v) {
+  return v >= INT_MIN && v <= INT_MAX;
+}
+
+// The value `base + stride * iv`.
+struct Affine {
+  Linear base;
+  Linear stride;
+};
+
+class Evaluator {
+  LoopInfo *info;
+  Op *iv;
+  std::map<Op*, std::optional<Affine>> cache;
+
+  std::optional<Affine> evaluateImpl(Op *op);
+public:
+  Evaluator(LoopInfo *info): info(info), iv(info->getInduction()) {}
+
+  std::optional<Affine> evaluate(Op *op) {
+    if (!cache.count(op))
+      cache[op] = evaluateImpl(op);
+    return cache[op];
+  }
+};
+
+std::optional<Affine> Evaluator::evaluateImpl(Op *op) {
+  Affine result;
+  if (op == iv) {
+    result.stride.constant = 1;
+    return result;
+  }
+
+  if (isa<IntOp>(op)) {
+    result.base.constant = V(op);
+    return result;
+  }
+
+  if (!info->contains(op->getParent())) {
+    result.base.terms.push_back({ op, 1 });
+    return result;
+  }
+
+  if (isa<AddIOp>(op) || isa<SubIOp>(op)) {
+    auto x = evaluate(op->DEF(0));
+    auto y = evaluate(op->DEF(1));
+    if (!x || !y)
+      return std::nullopt;
+
+    int64_t sign = isa<SubIOp>(op) ? -1 : 1;
+    result = *x;
+    result.base.add(y->base, sign);
+    result.stride.add(y->stride, sign);
+    return result;
+  }
+
+  if (isa<MulIOp>(op)) {
+    auto x = evaluate(op->DEF(0));
+    auto y = evaluate(op->DEF(1));
+    if (!x || !y)
+      return std::nullopt;
+
+    // Make `y` the invariant side.
+    if (!y->stride.isZero())
+      std::swap(x, y);
+    if (!y->stride.isZero())
+      return std::nullopt;
+
+    // Multiplying by a constant scales everything.
+    if (y->base.isConstant()) {
+      result.base.add(x->base, y->base.constant);
+      result.stride.add(x->stride, y->base.constant);
+      return result;
+    }
+
+    // Otherwise `x` must be `c0 + c1 * iv` for constants c0 and c1,
+    // and the result is `y * c0 + y * c1 * iv`.
+    if (!x->base.isConstant() || !x->stride.isConstant())
+      return std::nullopt;
+    result.base.add(y->base, x->base.constant);
+    result.stride.add(y->base, x->stride.constant);
+    return result;
+  }
+
+  return std::nullopt;
+}
+
+// Emits i32 arithmetic before `before`, folding constants on the way.
+class Emitter {
+  Builder builder;
+public:
+  Emitter(Op *before) { builder.setBeforeOp(before); }
+
+  Op *constant(int v) {
+    return builder.create<IntOp>({ new IntAttr(v) });
+  }
+
+  Op *add(Op *a, Op *b) {
+    if (!a || !b)
+      return a ? a : b;
+    return builder.create<AddIOp>({ (Value) a, (Value) b });
+  }
+
+  Op *mul(Op *a, int64_t v) {
+    if (!a || !v)
+      return nullptr;
+    if (v == 1)
+      return a;
+    Value factor = constant(v);
+    return builder.create<MulIOp>({ (Value) a, factor });
+  }
+
+  Op *mul(Op *a, Op *b) {
+    if (!a || !b)
+      return nullptr;
+    if (isa<IntOp>(b))
+      return mul(a, V(b));
+    return builder.create<MulIOp>({ (Value) a, (Value) b });
+  }
+
+  Op *addl(Op *a, Op *b) {
+    if (!b)
+      return a;
+    return builder.create<AddLOp>({ (Value) a, (Value) b });
+  }
+
+  // Returns null for zero.
+  Op *emit(const Linear &l) {
+    Op *result = nullptr;
+    for (auto [op, v] : l.terms)
+      result = add(result, mul(op, v));
+    if (l.constant)
+      result = add(result, constant(l.constant));
+    return result;
+  }
+};
+
+// Looks through single-operand phis, like the ones CanonicalizeLoop leaves.
+Op *strip(Op *op) {
+  while (isa<PhiOp>(op) && op->getOperandCount() == 1)
+    op = op->DEF(0);
+  return op;
+}
+
+// Whether `l` can be emitted as i32 arithmetic.
+bool emittable(const Linear &l) {
+  if (!fits(l.constant))
+    return false;
+  for (auto [op, v] : l.terms) {
+    if (op->getResultType() != Value::i32 || !fits(v))
+      return false;
+  }
+  return true;
+}
+
+// Whether `op` is only used as an address of memory accesses.
+bool isAddress(Op *op) {
+  if (op->getUses().empty())
+    return false;
+  for (auto use : op->getUses()) {
+    bool load = (isa<LoadOp>(use) || isa<VLoadOp>(use)) && use->DEF(0) == op;
+    bool store = (isa<StoreOp>(use) || isa<VStoreOp>(use)) && use->DEF(1) == op && use->DEF(0) != op;
+    if (!load && !store)
+      return false;
+  }
+  return true;
+}
+
+// Erases `op` if nothing uses it anymore, and then its operands in the same way.
+void removeDead(Op *op, LoopInfo *info) {
+  if (!op->getUses().empty() || !info->contains(op->getParent()))
+    return;
+  if (!isa<AddIOp>(op) && !isa<AddLOp>(op) && !isa<SubIOp>(op) && !isa<MulIOp>(op) && !isa<IntOp>(op))
+    return;
+
+  std::set<Op*> operands;
+  for (auto operand : op->getOperands())
+    operands.insert(operand.defining);
+  op->erase();
+
+  for (auto x : operands)
+    removeDead(x, info);
+}
+
+// Addresses whose offsets move by the same stride, and only differ by constants.
+struct Group {
+  Affine affine;
+  // The pointers added to the offsets, in the order they're found.
+  std::vector<Op*> ptrs;
+  // The addresses, and the constant parts of their offsets.
+  std::vector<std::pair<Op*, int64_t>> members;
+};
+
+}
+
+// Replaces
+//
+//   for (i = start; i < stop; i++) load(a + (i * m + k) * 4)
+//
+// with
+//
+//   p = a + (start * m + k) * 4
+//   for (i = start; i < stop; i++, p += m * 4) load(p)
+//
+bool LSR::runImpl(LoopInfo *info) {
+  auto preheader = info->getPreheader();
+  auto iv = info->getInduction();
+  if (!preheader || !iv || info->getLatches().size() != 1)
+    return false;
+
+  auto header = info->getHeader();
+  auto latch = info->getLatch();
+  if (iv->getParent() != header || !isa<BranchOp>(latch->getLastOp()))
+    return false;
+
+  // Only a constant step keeps the stride invariant.
+  auto next = Op::getPhiFrom(iv, latch);
+  if (!isa<AddIOp>(next) || next->DEF(0) != iv || !isa<IntOp>(next->DEF(1)))
+    return false;
+  int step = V(next->DEF(1));
+  auto start = strip(Op::getPhiFrom(iv, preheader));
+
+  // Go in the order of blocks to keep the output stable.
+  Evaluator evaluator(info);
+  std::vector<Group> groups;
+  for (auto bb : header->getParent()->getBlocks()) {
+    if (!info->contains(bb))
+      continue;
+
+    for (auto op : bb->getOps()) {
+      if (!isa<AddLOp>(op) || !isAddress(op))
+        continue;
+
+      // The address must be `ptr + offset`, where `ptr` is invariant.
+      auto ptr = op->DEF(0);
+      if (info->contains(ptr->getParent()))
+        continue;
+
+      auto affine = evaluator.evaluate(op->DEF(1));
+      if (!affine || affine->stride.isZero())
+        continue;
+      if (!emittable(affine->base) || !emittable(affine->stride))
+        continue;
+
+      auto it = std::find_if(groups.begin(), groups.end(), [&](const Group &group) {
+        return sameTerms(group.affine.base, affine->base)
+          && sameTerms(group.affine.stride, affine->stride)
+          && group.affine.stride.constant == affine->stride.constant;
+      });
+      if (it == groups.end()) {
+        groups.push_back(Group { *affine, {}, {} });
+        it = groups.end() - 1;
+      }
+      if (std::find(it->ptrs.begin(), it->ptrs.end(), ptr) == it->ptrs.end())
+        it->ptrs.push_back(ptr);
+      it->members.push_back({ op, affine->base.constant });
+    }
+  }
+
+  Builder builder;
+  Emitter em(preheader->getLastOp());
+  int phis = 0;
+  bool changed = false;
+  for (auto &group : groups) {
+    // A constant stride is cheap to compute, and the offset is shared among the pointers.
+    // Giving each of them a phi only makes the register pressure higher.
+    bool shared = group.ptrs.size() > 1;
+    if (shared && group.affine.stride.isConstant())
+      continue;
+    if (phis == maxPhis)
+      break;
+    phis++;
+
+    // Start from the lowest address in the group, so the others are at non-negative offsets.
+    int64_t lowest = group.members[0].second;
+    for (auto [_, offset] : group.members)
+      lowest = std::min(lowest, offset);
+    auto &base = group.affine.base;
+    base.constant = lowest;
+
+    auto stride = em.emit(group.affine.stride);
+    auto offset = em.add(em.emit(base), em.mul(stride, start));
+    Value incr = em.mul(stride, step);
+
+    // With a single pointer, walk the pointer itself. Otherwise walk the offset.
+    Op *init = shared ? (offset ? offset : em.constant(0)) : em.addl(group.ptrs[0], offset);
+    builder.setToBlockStart(header);
+    auto phi = builder.create<PhiOp>({ init }, { new FromAttr(preheader) });
+    builder.setBeforeOp(latch->getLastOp());
+    Op *add = shared
+      ? (Op*) builder.create<AddIOp>({ phi, incr })
+      : (Op*) builder.create<AddLOp>({ phi, incr });
+    phi->pushOperand(add);
+    phi->add<FromAttr>(latch);
+
+    for (auto [op, constant] : group.members) {
+      builder.setBeforeOp(op);
+      Op *addr = phi;
+      if (shared)
+        addr = builder.create<AddLOp>({ (Value) op->DEF(0), (Value) phi });
+      if (constant != lowest) {
+        Value delta = builder.create<IntOp>({ new IntAttr(constant - lowest) });
+        addr = builder.create<AddLOp>({ (Value) addr, delta });
+      }
+      op->replaceAllUsesWith(addr);
+      removeDead(op, info);
+      reduced++;
+    }
+    changed = true;
+  }
+  return changed;
+}
+
+// Replaces the exit test `i + step < stop` with a counter running down to zero,
+// when the induction variable isn't used otherwise. With a step of 1, the backends
+// branch on the counter directly with `bnez` or `cbnz`.
+void LSR::replaceExitTest(LoopInfo *info) {
+  auto preheader = info->getPreheader();
+  auto iv = info->getInduction();
+  if (!preheader || !iv || info->getLatches().size() != 1)
+    return;
+
+  auto header = info->getHeader();
+  auto latch = info->getLatch();
+  auto term = latch->getLastOp();
+  if (iv->getParent() != header || !isa<BranchOp>(term) || TARGET(term) != header)
+    return;
+
+  auto cond = term->DEF(0);
+  if (!isa<LtOp>(cond))
+    return;
+
+  auto next = cond->DEF(0), stop = cond->DEF(1);
+  if (!isa<AddIOp>(next) || next->DEF(0) != iv || !isa<IntOp>(next->DEF(1)))
+    return;
+  if (Op::getPhiFrom(iv, latch) != next || info->contains(stop->getParent()))
+    return;
+
+  int step = V(next->DEF(1));
+  if (step <= 0)
+    return;
+
+  // The induction variable must only be feeding the exit test.
+  if (iv->getUses().size() != 1 || next->getUses().size() != 2 || cond->getUses().size() != 1)
+    return;
+
+  Builder builder;
+  builder.setBeforeOp(preheader->getLastOp());
+  auto start = strip(Op::getPhiFrom(iv, preheader));
+  Op *init = stop;
+  if (!isa<IntOp>(start) || V(start))
+    init = builder.create<SubIOp>({ Value(stop), start });
+
+  builder.setToBlockStart(header);
+  auto counter = builder.create<PhiOp>({ init }, { new FromAttr(preheader) });
+  builder.setBeforeOp(term);
+  Value vi = builder.create<IntOp>({ new IntAttr(-step) });
+  auto rest = builder.create<AddIOp>({ counter, vi });
+  counter->pushOperand(rest);
+  counter->add<FromAttr>(latch);
+
+  // When the loop runs at least once, the counter reaches exactly zero.
+  // Otherwise it might start out negative.
+  if (step == 1 && guarded(info))
+    term->setOperand(0, rest);
+  else {
+    Value zero = builder.create<IntOp>({ new IntAttr(0) });
+    term->setOperand(0, builder.create<LtOp>({ zero, rest }));
+  }
+
+  cond->erase();
+  iv->removeAllOperands();
+  next->erase();
+  iv->erase();
+  counted++;
+}
+
+void LSR::run() {
+  // The preheaders just made by CanonicalizeLoop aren't in the preds yet.
+  auto funcs = collectFuncs();
+  for (auto func : funcs)
+    func->getRegion()->updatePreds();
+
+  LoopAnalysis analysis(module);
+  analysis.run();
+  auto forests = analysis.getResult();
+
+  for (auto func : funcs) {
+    const auto &forest = forests[func];
+
+    for (auto loop : forest.getLoops()) {
+      if (!loop->getSubloops().empty())
+        continue;
+
+      runImpl(loop);
+      replaceExitTest(loop);
+    }
+  }
+}
@@ -117,9 +117,13 @@ LoopForest LoopAnalysis::runImpl(Region *region) {
   }
 
   // Try to find the induction variable.
+  // Pointers walking through arrays (after SCEV) are only taken when there's no
+  // integer one, or when only the pointer is tested by the exit condition.
   Rule addi("(add x 'a)");
+  Rule addl("(addl x 'a)");
   Rule br("(br (lt x y))");
   Rule brRotated("(br (lt (add x 'a) y))");
+  Rule brRotatedL("(br (lt (addl x 'a) y))");
   for (auto loop : forest.getLoops()) {
     auto header = loop->getHeader();
     auto phis = header->getPhis();
@@ -131,11 +135,12 @@ LoopForest LoopAnalysis::runImpl(Region *region) {
       continue;
 
     auto latch = loop->getLatch();
-    for (auto phi : phis) {
+    // Returns true if `phi` is an induction variable, incremented by `incr`.
+    const auto tryInduction = [&](Op *phi, Rule &incr, Rule &rotated) {
       const auto &ops = phi->getOperands();
       const auto &attrs = phi->getAttrs();
       if (ops.size() != 2)
-        continue;
+        return false;
 
       auto bb1 = cast<FromAttr>(attrs[0])->bb;
       auto bb2 = cast<FromAttr>(attrs[1])->bb;
@@ -146,41 +151,61 @@ LoopForest LoopAnalysis::runImpl(Region *region) {
         std::swap(bb1, bb2);
         std::swap(def1, def2);
       }
-      if (bb1 == preheader && bb2 == latch) {
-        // Now this is a candidate of induction variable.
-        // See if `def2` is of form `%phi + 'a`.
-
-        // addi: (add x 'a)
-        if (addi.match(def2, { { "x", phi } })) {
-          auto step = addi.extract("'a");
-
-          // OK, now this is definitely an induction variable.
-          loop->induction = phi;
-          loop->start = def1;
-          loop->step = V(step);
-
-          // Try to identify the stop condition by looking at header.
-          auto term = header->getLastOp();
-          if (isa<GotoOp>(term)) {
-            // Already rotated. Check latch instead.
-            // brRotated: (br (lt (add x 'a) y))
-            term = latch->getLastOp();
-            if (!brRotated.match(term,  { { "x", loop->induction } }))
-              break;
-
-            loop->stop = brRotated.extract("y");
-            break;
-          }
-
-          // br: (br (lt x y))
-          if (!br.match(term, { { "x", loop->induction } }))
-            break;
+      if (bb1 != preheader || bb2 != latch)
+        return false;
+
+      // Now this is a candidate of induction variable.
+      // See if `def2` is of form `%phi + 'a`.
+      if (!incr.match(def2, { { "x", phi } }))
+        return false;
+
+      auto step = incr.extract("'a");
+
+      // OK, now this is definitely an induction variable.
+      loop->induction = phi;
+      loop->start = def1;
+      loop->step = V(step);
+
+      // Try to identify the stop condition by looking at header.
+      auto term = header->getLastOp();
+      if (isa<GotoOp>(term) || header == latch && !br.match(term, { { "x", phi } })) {
+        // Already rotated. Check latch instead.
+        // brRotated: (br (lt (add x 'a) y))
+        term = latch->getLastOp();
+        if (rotated.match(term, { { "x", phi } }))
+          loop->stop = rotated.extract("y");
+        return true;
+      }
 
-          loop->stop = br.extract("y");
-          break;
-        }
+      // br: (br (lt x y))
+      if (br.match(term, { { "x", phi } }))
+        loop->stop = br.extract("y");
+      return true;
+    };
+
+    // Prefer the one tested by the exit condition, so that the trip count is known.
+    // That can be a pointer even if there's an integer one, when the integer one
+    // is still used for something else in the loop.
+    const auto findTested = [&](Rule &incr, Rule &rotated) {
+      for (auto phi : phis) {
+        if (tryInduction(phi, incr, rotated) && loop->stop)
+          return true;
+        loop->induction = loop->start = loop->stop = nullptr;
       }
-    }
+      return false;
+    };
+    const auto findAny = [&](Rule &incr, Rule &rotated) {
+      for (auto phi : phis) {
+        if (tryInduction(phi, incr, rotated))
+          return true;
+      }
+      return false;
+    };
+
+    if (findTested(addi, brRotated) || findTested(addl, brRotatedL))
+      continue;
+    if (!findAny(addi, brRotated))
+      findAny(addl, brRotatedL);
   }
 
   return forest;
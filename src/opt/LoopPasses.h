@@ -94,6 +94,36 @@ public:
   auto getResult() { return info; }
 };
 
+// Whether `loop` can be copied by `versionLoop`.
+bool canVersion(LoopInfo *loop);
+
+// Copies `loop`, and makes the preheader run the original if `cond` holds, or the copy otherwise.
+// `cond` must be available at the end of the preheader.
+// The copied ops and blocks are recorded in `cloneMap` and `rewireMap`.
+void versionLoop(LoopInfo *loop, Op *cond, std::map<Op*, Op*> &cloneMap, std::map<BasicBlock*, BasicBlock*> &rewireMap);
+
+// Whether the preheader of `loop` only runs when `start < stop`.
+bool guarded(LoopInfo *loop);
+
+// A value accumulated over the iterations of a loop:
+//   %phi = phi %init %update
+//   %update = <op> %phi %operand
+// where nothing else in the loop reads `%phi` or `%update`.
+// The iterations can then be split among several partial results.
+struct Reduction {
+  Op *phi;
+  Op *update;
+  Op *operand;
+};
+
+// Finds the reductions among the phis in the header of `loop`.
+// Float reductions are only taken with `fastMath`, as reassociating them changes the result.
+std::map<Op*, Reduction> findReductions(LoopInfo *loop, bool fastMath);
+// Creates the value a partial result of `reduction` starts from.
+Op *identity(Builder &builder, const Reduction &reduction);
+// Combines two partial results of `reduction`.
+Op *combine(Builder &builder, const Reduction &reduction, Op *x, Op *y);
+
 // Canonicalize loops. Ensures:
 //   1) A single preheader;
 //   2) In LCSSA, if it's constructed with `lcssa = true`.
@@ -141,8 +171,31 @@ public:
   void run() override;
 };
 
+// Unrolls single-block loops with a runtime trip count.
+// The original loop is kept to run the remaining iterations.
+class RuntimeUnroll : public Pass {
+  int unrolled = 0;
+  int split = 0;
+
+  // Whether float reductions can be split.
+  bool fastMath;
+
+  bool runImpl(LoopInfo *info);
+public:
+  RuntimeUnroll(ModuleOp *module, bool fastMath): Pass(module), fastMath(fastMath) {}
+
+  std::string name() override { return "runtime-unroll"; }
+  std::map<std::string, int> stats() override;
+  void run() override;
+};
+
+// Moves branches on loop-invariant conditions out of innermost loops,
+// by making a copy of the loop for each direction.
 class LoopUnswitch : public Pass {
   int unswitched = 0;
+
+  // Returns true if changed. `budget` is the number of ops that can still be copied.
+  bool runImpl(LoopInfo *info, int &budget);
 public:
   LoopUnswitch(ModuleOp *module): Pass(module) {}
 
@@ -151,8 +204,26 @@ public:
   void run() override;
 };
 
+// Copies loops that access arrays through pointers which might alias,
+// and runs the copy only if a runtime check finds the accessed ranges disjoint.
+// Addresses in the copy are marked with NoAliasAttr.
+class LoopVersioning : public Pass {
+  int versioned = 0;
+
+  // Returns true if changed. `budget` is the number of ops that can still be copied.
+  bool runImpl(LoopInfo *info, int &budget);
+public:
+  LoopVersioning(ModuleOp *module): Pass(module) {}
+
+  std::string name() override { return "loop-versioning"; }
+  std::map<std::string, int> stats() override;
+  void run() override;
+};
+
 class SCEV : public Pass {
   int expanded = 0;
+  int replaced = 0;
+  int deleted = 0;
 
   // All addresses stored inside current loop.
   // We need this because we need to find variants as well,
@@ -167,6 +238,9 @@ class SCEV : public Pass {
   void rewrite(BasicBlock *bb, LoopInfo *info);
   void runImpl(LoopInfo *info);
   void discardIv(LoopInfo *info);
+  // Computes the values used after the loop in closed form.
+  // Returns true if the loop became dead and got removed.
+  bool finalValues(LoopInfo *info);
 public:
   SCEV(ModuleOp *module): Pass(module) {}
 
@@ -175,6 +249,50 @@ public:
   void run() override;
 };
 
+// Vectorizes innermost unit-stride loops by 4 lanes.
+// The original loop is kept for the remaining iterations.
+class Vectorize : public Pass {
+  int vectorized = 0;
+
+  bool runImpl(LoopInfo *info);
+public:
+  Vectorize(ModuleOp *module): Pass(module) {}
+
+  std::string name() override { return "vectorize"; }
+  std::map<std::string, int> stats() override;
+  void run() override;
+};
+
+// Software pipelining for rotated, single-block loops. Iterations are overlapped
+// by iterative modulo scheduling; the original loop runs the iterations left over.
+class ModuloSchedule : public Pass {
+  int pipelined = 0;
+
+  bool runImpl(LoopInfo *info);
+public:
+  ModuloSchedule(ModuleOp *module): Pass(module) {}
+
+  std::string name() override { return "modulo-schedule"; }
+  std::map<std::string, int> stats() override;
+  void run() override;
+};
+
+// Loop strength reduction. Addresses that move by an invariant stride
+// become pointer phis, and the exit test counts down to zero.
+class LSR : public Pass {
+  int reduced = 0;
+  int counted = 0;
+
+  bool runImpl(LoopInfo *info);
+  void replaceExitTest(LoopInfo *info);
+public:
+  LSR(ModuleOp *module): Pass(module) {}
+
+  std::string name() override { return "lsr"; }
+  std::map<std::string, int> stats() override;
+  void run() override;
+};
+
 class LICM : public Pass {
   int hoisted = 0;
   DomTree domtree;
@@ -9,6 +9,23 @@ std::map<std::string, int> ConstLoopUnroll::stats() {
   };
 }
 
+std::map<std::string, int> RuntimeUnroll::stats() {
+  return {
+    { "unrolled", unrolled },
+    { "split-reductions", split },
+  };
+}
+
+// Makes a copied op refer to the copies of its operands, if there are any.
+static void remap(Op *op, std::map<Op*, Op*> &cloneMap) {
+  auto operands = op->getOperands();
+  op->removeAllOperands();
+  for (auto operand : operands) {
+    auto def = operand.defining;
+    op->pushOperand(cloneMap.count(def) ? cloneMap[def] : def);
+  }
+}
+
 BasicBlock *ConstLoopUnroll::copyLoop(LoopInfo *loop, BasicBlock *bb, int unroll) {
   std::map<Op*, Op*> cloneMap, revcloneMap, prevLatch;
   std::map<BasicBlock*, BasicBlock*> rewireMap;
@@ -45,14 +62,8 @@ BasicBlock *ConstLoopUnroll::copyLoop(LoopInfo *loop, BasicBlock *bb, int unroll
     }
 
     // Rewire operands.
-    for (auto op : created) {
-      auto operands = op->getOperands();
-      op->removeAllOperands();
-      for (auto operand : operands) {
-        auto def = operand.defining;
-        op->pushOperand(cloneMap.count(def) ? cloneMap[def] : def);
-      }
-    }
+    for (auto op : created)
+      remap(op, cloneMap);
 
     // Rewire blocks.
     for (auto [k, v] : rewireMap) {
@@ -301,3 +312,279 @@ void ConstLoopUnroll::run() {
     } while (changed);
   }
 }
+
+// Registers available to the allocator. This is the smaller one of RISC-V and ARM.
+constexpr int intRegs = 23;
+constexpr int floatRegs = 29;
+
+// Runs the loop `unroll` iterations at a time while that many are left:
+//
+//   preheader:
+//     %lim = addi %stop, -(unroll - 1) * step
+//     branch (and (lt %start, %lim) (lt %lim, %stop)) <ubb> <else = bb>
+//   ubb:
+//     (the body, `unroll` times, without the checks in between)
+//     branch (lt %inc, %lim) <ubb> <else = mid>
+//   mid:
+//     branch (lt %inc, %stop) <bb> <else = exit>
+//   bb:
+//     (the original loop, which runs the rest)
+//
+// Reductions on slow ops get a partial result for each copy, so that
+// the copies don't wait on each other. They're combined in `mid`.
+bool RuntimeUnroll::runImpl(LoopInfo *loop) {
+  if (!loop->getSubloops().empty() || loop->getBlocks().size() != 1)
+    return false;
+
+  auto bb = loop->getHeader();
+  auto preheader = loop->getPreheader();
+  auto iv = loop->getInduction();
+  auto stop = loop->getStop();
+  int step = loop->getStep();
+  if (!preheader || !iv || !stop || step <= 0 || stop->getParent() == bb)
+    return false;
+
+  if (loop->getExits().size() != 1)
+    return false;
+
+  auto exit = loop->getExit();
+  auto term = bb->getLastOp();
+  if (!isa<BranchOp>(term) || TARGET(term) != bb || ELSE(term) != exit)
+    return false;
+
+  auto preterm = preheader->getLastOp();
+  if (!isa<GotoOp>(preterm))
+    return false;
+
+  // The check must be on the incremented induction variable,
+  // so that the loop runs while `%iv + step < %stop`.
+  auto inc = Op::getPhiFrom(iv, bb);
+  auto cond = term->DEF(0);
+  if (cond->DEF(0) != inc || cond->DEF(1) != stop)
+    return false;
+
+  auto phis = bb->getPhis();
+  for (auto phi : phis) {
+    if (phi->getOperandCount() != 2 || !Op::getPhiFrom(phi, preheader) || !Op::getPhiFrom(phi, bb))
+      return false;
+  }
+
+  // The checks in between are dropped.
+  std::vector<Op*> body;
+  for (auto op : bb->getOps()) {
+    if (isa<CallOp>(op))
+      return false;
+    if (isa<PhiOp>(op) || op == term || op == cond && cond->getUses().size() == 1)
+      continue;
+    body.push_back(op);
+  }
+
+  // Values leaving the loop through anything but a phi at `exit` need a new phi there.
+  std::map<Op*, std::vector<Op*>> escapes;
+  for (auto op : bb->getOps()) {
+    for (auto use : op->getUses()) {
+      if (use->getParent() == bb || use->getParent() == exit && isa<PhiOp>(use))
+        continue;
+      if (exit->preds.size() != 1)
+        return false;
+      escapes[op].push_back(use);
+    }
+  }
+
+  // Integer ops other than multiplication take a single cycle; there's nothing to gain there.
+  std::map<Op*, Reduction> reductions;
+  for (const auto &[phi, reduction] : findReductions(loop, fastMath)) {
+    auto update = reduction.update;
+    if (isa<MulIOp>(update) || update->getResultType() == Value::f32)
+      reductions[phi] = reduction;
+  }
+
+  // Pick the factor by the size of the body, and by how many values it keeps alive at once.
+  // Invariants and phis are live throughout; the temporaries of each copy might overlap
+  // after scheduling, so they count `unroll` times.
+  int unroll = 4;
+  while (unroll > 1 && unroll * body.size() > 64)
+    unroll /= 2;
+
+  std::set<Op*> invariants;
+  std::map<Op*, int> lastUse;
+  for (int i = 0; i < body.size(); i++) {
+    for (auto operand : body[i]->getOperands()) {
+      auto def = operand.defining;
+      if (def->getParent() != bb)
+        invariants.insert(def);
+      lastUse[def] = i;
+    }
+  }
+  int fixedInt = 0, fixedFloat = 0;
+  for (auto op : invariants)
+    ++(op->getResultType() == Value::f32 ? fixedFloat : fixedInt);
+  for (auto phi : phis)
+    ++(phi->getResultType() == Value::f32 ? fixedFloat : fixedInt);
+  // Each copy but the first has its own partial result of a reduction.
+  int partInt = 0, partFloat = 0;
+  for (const auto &[phi, _] : reductions)
+    ++(phi->getResultType() == Value::f32 ? partFloat : partInt);
+
+  int liveInt = 0, liveFloat = 0, maxInt = 0, maxFloat = 0;
+  for (int i = 0; i < body.size(); i++) {
+    auto op = body[i];
+    for (auto operand : op->getOperands()) {
+      auto def = operand.defining;
+      if (def->getParent() == bb && !isa<PhiOp>(def) && lastUse[def] == i)
+        --(def->getResultType() == Value::f32 ? liveFloat : liveInt);
+    }
+    // Values only used by phis or outside live till the end.
+    if (op->getUses().size())
+      ++(op->getResultType() == Value::f32 ? liveFloat : liveInt);
+    maxInt = std::max(maxInt, liveInt);
+    maxFloat = std::max(maxFloat, liveFloat);
+  }
+  const auto pressure = [&](int fixed, int part, int max) {
+    return fixed + (unroll - 1) * part + unroll * max;
+  };
+  while (unroll > 1 && (pressure(fixedInt, partInt, maxInt) > intRegs || pressure(fixedFloat, partFloat, maxFloat) > floatRegs))
+    unroll /= 2;
+
+  if (unroll == 1)
+    return false;
+
+  Builder builder;
+  auto region = bb->getParent();
+  // Like in Vectorize, the unrolled loop goes after the original one.
+  auto mid = region->insertAfter(bb);
+  auto ubb = region->insertAfter(bb);
+
+  builder.setBeforeOp(preterm);
+  auto back = builder.create<IntOp>({ new IntAttr(-(unroll - 1) * step) });
+  Op *lim;
+  if (isa<AddLOp>(inc))
+    lim = builder.create<AddLOp>({ (Value) stop, back });
+  else
+    lim = builder.create<AddIOp>({ (Value) stop, back });
+  // `lim` wraps around when `stop` is close to INT_MIN; then it isn't below `stop`.
+  Value inRange = builder.create<LtOp>({ (Value) Op::getPhiFrom(iv, preheader), lim });
+  Value noWrap = builder.create<LtOp>({ (Value) lim, stop });
+  auto enter = builder.create<AndIOp>({ inRange, noWrap });
+  builder.replace<BranchOp>(preterm, { enter }, { new TargetAttr(ubb), new ElseAttr(bb) });
+
+  // The unrolled loop. Each copy takes the phis from the values of the previous one.
+  builder.setToBlockEnd(ubb);
+  std::map<Op*, Op*> cloneMap, uphis;
+  for (auto phi : phis) {
+    auto uphi = builder.create<PhiOp>({ Op::getPhiFrom(phi, preheader) }, { new FromAttr(preheader) });
+    uphi->setResultType(phi->getResultType());
+    uphis[phi] = cloneMap[phi] = uphi;
+  }
+
+  // The phis of the partial results, and their values after each copy.
+  std::map<Op*, std::vector<Op*>> parts, partials;
+  for (const auto &[phi, reduction] : reductions) {
+    parts[phi].push_back(uphis[phi]);
+    for (int i = 1; i < unroll; i++) {
+      Op *init;
+      {
+        Builder::Guard guard(builder);
+        builder.setBeforeOp(preheader->getLastOp());
+        init = identity(builder, reduction);
+      }
+      auto part = builder.create<PhiOp>({ init }, { new FromAttr(preheader) });
+      part->setResultType(phi->getResultType());
+      parts[phi].push_back(part);
+    }
+  }
+
+  const auto latest = [&](Op *op) {
+    return cloneMap.count(op) ? cloneMap[op] : op;
+  };
+  for (int i = 0; i < unroll; i++) {
+    if (i > 0) {
+      std::map<Op*, Op*> next;
+      for (auto phi : phis)
+        next[phi] = reductions.count(phi) ? parts[phi][i] : latest(Op::getPhiFrom(phi, bb));
+      for (auto [phi, value] : next)
+        cloneMap[phi] = value;
+    }
+    for (auto op : body) {
+      auto copied = builder.copy(op);
+      remap(copied, cloneMap);
+      cloneMap[op] = copied;
+    }
+    for (const auto &[phi, reduction] : reductions)
+      partials[phi].push_back(latest(reduction.update));
+  }
+
+  for (auto phi : phis) {
+    if (reductions.count(phi))
+      continue;
+    uphis[phi]->pushOperand(latest(Op::getPhiFrom(phi, bb)));
+    uphis[phi]->add<FromAttr>(ubb);
+  }
+  for (const auto &[phi, _] : reductions) {
+    for (int i = 0; i < unroll; i++) {
+      parts[phi][i]->pushOperand(partials[phi][i]);
+      parts[phi][i]->add<FromAttr>(ubb);
+    }
+  }
+  auto uinc = latest(inc);
+  auto again = builder.create<LtOp>({ (Value) uinc, lim });
+  builder.create<BranchOp>({ again }, { new TargetAttr(ubb), new ElseAttr(mid) });
+
+  builder.setToBlockEnd(mid);
+  for (const auto &[phi, reduction] : reductions) {
+    auto total = partials[phi][0];
+    for (int i = 1; i < unroll; i++)
+      total = combine(builder, reduction, total, partials[phi][i]);
+    cloneMap[reduction.update] = total;
+  }
+  auto rest = builder.create<LtOp>({ (Value) uinc, stop });
+  builder.create<BranchOp>({ rest }, { new TargetAttr(bb), new ElseAttr(exit) });
+
+  // The original loop and the exit can now also be reached from `mid`.
+  std::map<Op*, Op*> fromMid;
+  for (auto phi : phis)
+    fromMid[phi] = latest(Op::getPhiFrom(phi, bb));
+  for (auto [phi, value] : fromMid) {
+    phi->pushOperand(value);
+    phi->add<FromAttr>(mid);
+  }
+  for (auto phi : exit->getPhis()) {
+    phi->pushOperand(latest(Op::getPhiFrom(phi, bb)));
+    phi->add<FromAttr>(mid);
+  }
+
+  builder.setToBlockStart(exit);
+  for (const auto &[op, uses] : escapes) {
+    auto phi = builder.create<PhiOp>({ (Value) op, latest(op) }, { new FromAttr(bb), new FromAttr(mid) });
+    phi->setResultType(op->getResultType());
+    for (auto use : uses) {
+      for (int i = 0; i < use->getOperandCount(); i++) {
+        if (use->DEF(i) == op)
+          use->setOperand(i, phi);
+      }
+    }
+  }
+  split += reductions.size();
+  return true;
+}
+
+void RuntimeUnroll::run() {
+  LoopAnalysis analysis(module);
+  analysis.run();
+  auto forests = analysis.getResult();
+
+  auto funcs = collectFuncs();
+  for (auto func : funcs) {
+    const auto &forest = forests[func];
+    bool changed = false;
+    for (auto loop : forest.getLoops()) {
+      if (runImpl(loop)) {
+        unrolled++;
+        changed = true;
+      }
+    }
+
+    if (changed)
+      func->getRegion()->updatePreds();
+  }
+}
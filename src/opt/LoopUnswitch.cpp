@@ -0,0 +1,125 @@
+#include "LoopPasses.h"
+#include "CleanupPasses.h"
+
+using namespace sys;
+
+std::map<std::string, int> LoopUnswitch::stats() {
+  return {
+    { "unswitched", unswitched }
+  };
+}
+
+// Loops larger than this aren't copied.
+static constexpr int maxLoopSize = 100;
+// The total number of ops a function can grow by.
+static constexpr int maxGrowth = 400;
+
+// Removes the incoming value of `phi` from `from`.
+static void removeIncoming(Op *phi, BasicBlock *from) {
+  const auto &attrs = phi->getAttrs();
+  for (int i = 0; i < attrs.size(); i++) {
+    if (FROM(attrs[i]) == from) {
+      phi->removeOperand(i);
+      phi->removeAttribute(i);
+      return;
+    }
+  }
+}
+
+// Finds a branch in the loop whose condition is defined outside it.
+// LICM has hoisted all invariants to the preheader by now, so these are
+// exactly the branches on loop-invariant conditions.
+static Op *findInvariantBranch(LoopInfo *loop) {
+  for (auto bb : loop->getBlocks()) {
+    auto term = bb->getLastOp();
+    if (!isa<BranchOp>(term))
+      continue;
+
+    auto cond = term->DEF(0);
+    if (isa<IntOp>(cond) || loop->contains(cond->getParent()))
+      continue;
+
+    // Exiting branches are left alone.
+    auto ifso = TARGET(term), ifnot = ELSE(term);
+    if (ifso == ifnot || !loop->contains(ifso) || !loop->contains(ifnot))
+      continue;
+    return term;
+  }
+  return nullptr;
+}
+
+// Turns
+//
+//   for (...) { if (c) A else B }
+//
+// into
+//
+//   if (c) for (...) A else for (...) B
+//
+// where `c` is invariant in the loop.
+bool LoopUnswitch::runImpl(LoopInfo *loop, int &budget) {
+  if (!canVersion(loop))
+    return false;
+
+  int size = 0;
+  for (auto bb : loop->getBlocks())
+    size += bb->getOpCount();
+  if (size > maxLoopSize || size > budget)
+    return false;
+
+  auto branch = findInvariantBranch(loop);
+  if (!branch)
+    return false;
+  budget -= size;
+
+  std::map<Op*, Op*> cloneMap;
+  std::map<BasicBlock*, BasicBlock*> rewireMap;
+  versionLoop(loop, branch->DEF(0), cloneMap, rewireMap);
+
+  // The original version takes the true branch, and the copy takes the false one.
+  Builder builder;
+  auto from = branch->getParent();
+  auto target = TARGET(branch), other = ELSE(branch);
+  for (auto phi : other->getPhis())
+    removeIncoming(phi, from);
+  builder.replace<GotoOp>(branch, { new TargetAttr(target) });
+
+  auto copiedFrom = rewireMap[from];
+  auto copiedBranch = copiedFrom->getLastOp();
+  for (auto phi : rewireMap[target]->getPhis())
+    removeIncoming(phi, copiedFrom);
+  builder.replace<GotoOp>(copiedBranch, { new TargetAttr(rewireMap[other]) });
+  return true;
+}
+
+void LoopUnswitch::run() {
+  LoopAnalysis analysis(module);
+  analysis.run();
+  auto forests = analysis.getResult();
+
+  auto funcs = collectFuncs();
+  for (auto func : funcs) {
+    const auto &forest = forests[func];
+    int budget = maxGrowth;
+    bool changed = false;
+
+    // Only innermost loops are unswitched, each at most once.
+    // Copying a loop doesn't invalidate the info of other loops.
+    for (auto loop : forest.getLoops()) {
+      if (!loop->getSubloops().empty())
+        continue;
+
+      if (runImpl(loop, budget)) {
+        unswitched++;
+        changed = true;
+      }
+    }
+
+    if (changed)
+      func->getRegion()->updatePreds();
+  }
+
+  // Clean up the blocks that became unreachable.
+  if (unswitched)
+    DCE(module).run();
+}
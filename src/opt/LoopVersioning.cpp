@@ -0,0 +1,485 @@
+#include "LoopPasses.h"
+#include "Analysis.h"
+
+#include <optional>
+
+using namespace sys;
+
+std::map<std::string, int> LoopVersioning::stats() {
+  return {
+    { "versioned", versioned }
+  };
+}
+
+// Loops larger than this aren't copied.
+static constexpr int maxLoopSize = 100;
+// The total number of ops a function can grow by.
+static constexpr int maxGrowth = 400;
+// At most this many pairs of accesses are checked at runtime.
+static constexpr int maxChecks = 8;
+
+// Each versioned loop gets its own scope of NoAliasAttr's.
+static int scopes = 0;
+
+// Makes a copied op refer to the copies of its operands, if there are any.
+static void remap(Op *op, std::map<Op*, Op*> &cloneMap) {
+  auto operands = op->getOperands();
+  op->removeAllOperands();
+  for (auto operand : operands) {
+    auto def = operand.defining;
+    op->pushOperand(cloneMap.count(def) ? cloneMap[def] : def);
+  }
+}
+
+// Values defined in the loop and used after it.
+// Uses in the phis of the exit aren't included.
+static std::map<Op*, std::vector<Op*>> escaping(LoopInfo *loop) {
+  auto exit = loop->getExit();
+  std::map<Op*, std::vector<Op*>> escapes;
+  for (auto bb : loop->getBlocks()) {
+    for (auto op : bb->getOps()) {
+      for (auto use : op->getUses()) {
+        auto parent = use->getParent();
+        if (!loop->contains(parent) && !(parent == exit && isa<PhiOp>(use)))
+          escapes[op].push_back(use);
+      }
+    }
+  }
+  return escapes;
+}
+
+bool sys::canVersion(LoopInfo *loop) {
+  auto preheader = loop->getPreheader();
+  if (!preheader || !isa<GotoOp>(preheader->getLastOp()))
+    return false;
+
+  if (loop->getExits().size() != 1)
+    return false;
+
+  // Escaping values need a phi at the exit merging the two versions,
+  // which only works if the exit is reached from the loop alone.
+  // (It might also be reached from the guard of a rotated loop.)
+  if (escaping(loop).empty())
+    return true;
+
+  for (auto pred : loop->getExit()->preds) {
+    if (!loop->contains(pred))
+      return false;
+  }
+  return true;
+}
+
+void sys::versionLoop(LoopInfo *loop, Op *cond, std::map<Op*, Op*> &cloneMap, std::map<BasicBlock*, BasicBlock*> &rewireMap) {
+  auto preheader = loop->getPreheader();
+  auto header = loop->getHeader();
+  auto exit = loop->getExit();
+  auto region = header->getParent();
+  auto escapes = escaping(loop);
+
+  // Copy the loop after its last block, keeping the order of the blocks.
+  std::vector<BasicBlock*> blocks;
+  for (auto bb : region->getBlocks()) {
+    if (loop->contains(bb))
+      blocks.push_back(bb);
+  }
+
+  Builder builder;
+  std::vector<Op*> created;
+  auto bb = blocks.back();
+  for (auto block : blocks) {
+    bb = region->insertAfter(bb);
+    builder.setToBlockStart(bb);
+    for (auto op : block->getOps()) {
+      auto copied = builder.copy(op);
+      cloneMap[op] = copied;
+      created.push_back(copied);
+    }
+    rewireMap[block] = bb;
+  }
+
+  for (auto op : created)
+    remap(op, cloneMap);
+
+  // Guard the two versions with the condition.
+  auto ifso = region->insertAfter(preheader);
+  auto ifnot = region->insertAfter(ifso);
+  builder.setToBlockEnd(ifso);
+  builder.create<GotoOp>({ new TargetAttr(header) });
+  builder.setToBlockEnd(ifnot);
+  builder.create<GotoOp>({ new TargetAttr(rewireMap[header]) });
+  builder.replace<BranchOp>(preheader->getLastOp(), { cond }, {
+    new TargetAttr(ifso),
+    new ElseAttr(ifnot)
+  });
+
+  // Rewire the blocks of the copy.
+  for (auto [_, v] : rewireMap) {
+    auto term = v->getLastOp();
+    if (auto attr = term->find<TargetAttr>(); attr && rewireMap.count(attr->bb))
+      attr->bb = rewireMap[attr->bb];
+    if (auto attr = term->find<ElseAttr>(); attr && rewireMap.count(attr->bb))
+      attr->bb = rewireMap[attr->bb];
+
+    for (auto phi : v->getPhis()) {
+      for (auto attr : phi->getAttrs())
+        FROM(attr) = rewireMap.count(FROM(attr)) ? rewireMap[FROM(attr)] : ifnot;
+    }
+  }
+  for (auto phi : header->getPhis()) {
+    for (auto attr : phi->getAttrs()) {
+      if (FROM(attr) == preheader)
+        FROM(attr) = ifso;
+    }
+  }
+
+  // The exit now has predecessors from both versions.
+  for (auto phi : exit->getPhis()) {
+    auto ops = phi->getOperands();
+    std::vector<BasicBlock*> froms;
+    for (auto attr : phi->getAttrs())
+      froms.push_back(FROM(attr));
+
+    for (int i = 0; i < ops.size(); i++) {
+      if (!loop->contains(froms[i]))
+        continue;
+
+      auto def = ops[i].defining;
+      phi->pushOperand(cloneMap.count(def) ? cloneMap[def] : def);
+      phi->add<FromAttr>(rewireMap[froms[i]]);
+    }
+  }
+
+  // Merge the two versions of escaping values at the exit.
+  builder.setToBlockStart(exit);
+  for (const auto &[op, uses] : escapes) {
+    auto phi = builder.create<PhiOp>();
+    for (auto pred : exit->preds) {
+      phi->pushOperand(op);
+      phi->add<FromAttr>(pred);
+      phi->pushOperand(cloneMap[op]);
+      phi->add<FromAttr>(rewireMap[pred]);
+    }
+    phi->setResultType(op->getResultType());
+    for (auto use : uses) {
+      for (int i = 0; i < use->getOperandCount(); i++) {
+        if (use->DEF(i) == op)
+          use->setOperand(i, phi);
+      }
+    }
+  }
+}
+
+namespace {
+
+struct Access {
+  Op *op;
+  // The array the address starts from. It's defined outside the loop.
+  Op *root;
+  // The (32-bit) offsets added to `root`.
+  std::vector<Op*> terms;
+  // The number of bytes the address moves by in an iteration.
+  int stride;
+  int size;
+  bool store;
+
+  Op *addr() const { return store ? op->DEF(1) : op->DEF(0); }
+};
+
+bool sameRoot(Op *x, Op *y) {
+  if (isa<GetGlobalOp>(x) && isa<GetGlobalOp>(y))
+    return NAME(x) == NAME(y);
+  return x == y;
+}
+
+// Returns how much `op` increases by when the induction variable increases by 1.
+std::optional<int> stride(Op *op, LoopInfo *loop) {
+  if (!loop->contains(op->getParent()) || isa<IntOp>(op))
+    return 0;
+
+  if (op == loop->getInduction())
+    return 1;
+
+  if (isa<AddIOp>(op) || isa<SubIOp>(op)) {
+    auto x = stride(op->DEF(0), loop);
+    auto y = stride(op->DEF(1), loop);
+    if (!x || !y)
+      return std::nullopt;
+    return isa<AddIOp>(op) ? *x + *y : *x - *y;
+  }
+
+  if (isa<MulIOp>(op)) {
+    auto x = stride(op->DEF(0), loop);
+    auto y = stride(op->DEF(1), loop);
+    if (!x || !y)
+      return std::nullopt;
+    if (*x == 0 && *y == 0)
+      return 0;
+    if (*x == 0 && isa<IntOp>(op->DEF(0)))
+      return V(op->DEF(0)) * *y;
+    if (*y == 0 && isa<IntOp>(op->DEF(1)))
+      return V(op->DEF(1)) * *x;
+  }
+
+  return std::nullopt;
+}
+
+// Splits the address of `op` into a root and linear offsets.
+bool analyze(Op *op, LoopInfo *loop, Access &acc) {
+  acc.op = op;
+  acc.store = isa<StoreOp>(op);
+  acc.size = op->has<SizeAttr>() ? SIZE(op) : 4;
+  acc.stride = 0;
+
+  auto addr = acc.addr();
+  while (isa<AddLOp>(addr)) {
+    auto x = addr->DEF(0), y = addr->DEF(1);
+    if (y->getResultType() == Value::i64)
+      std::swap(x, y);
+
+    auto s = stride(y, loop);
+    if (!s)
+      return false;
+    acc.stride += *s;
+    acc.terms.push_back(y);
+    addr = x;
+  }
+
+  if (!isa<GetArgOp>(addr) && !isa<GetGlobalOp>(addr) && !isa<AllocaOp>(addr))
+    return false;
+
+  acc.root = addr;
+  return !loop->contains(addr->getParent());
+}
+
+// Computes `op` at the builder's position, with the induction variable replaced by `iv`.
+Op *evaluate(Builder &builder, Op *op, LoopInfo *loop, Op *iv) {
+  if (!loop->contains(op->getParent()))
+    return op;
+
+  if (op == loop->getInduction())
+    return iv;
+
+  std::vector<Op*> operands;
+  for (auto operand : op->getOperands())
+    operands.push_back(evaluate(builder, operand.defining, loop, iv));
+
+  auto copy = builder.copy(op);
+  for (int i = 0; i < operands.size(); i++)
+    copy->setOperand(i, operands[i]);
+  return copy;
+}
+
+// The total offset of `acc` when the induction variable is `iv`.
+Op *offset(Builder &builder, const Access &acc, LoopInfo *loop, Op *iv) {
+  Op *result = nullptr;
+  for (auto term : acc.terms) {
+    Value value = evaluate(builder, term, loop, iv);
+    result = result ? builder.create<AddIOp>({ result, value }) : value.defining;
+  }
+  return result ? result : builder.create<IntOp>({ new IntAttr(0) });
+}
+
+}
+
+// Only rotated loops are handled, where the body runs with the induction
+// variable in [start, stop - 1] as long as `start < stop`.
+bool LoopVersioning::runImpl(LoopInfo *loop, int &budget) {
+  auto iv = loop->getInduction();
+  auto stop = loop->getStop();
+  if (!iv || !stop || iv->getResultType() != Value::i32 || loop->getStep() <= 0)
+    return false;
+
+  if (!canVersion(loop) || loop->contains(stop->getParent()))
+    return false;
+
+  auto header = loop->getHeader();
+  auto latch = loop->getLatch();
+  auto term = latch->getLastOp();
+  if (!isa<BranchOp>(term) || TARGET(term) != header)
+    return false;
+
+  auto cond = term->DEF(0);
+  if (!isa<LtOp>(cond) || cond->DEF(1) != stop || !isa<AddIOp>(cond->DEF(0)) || cond->DEF(0)->DEF(0) != iv)
+    return false;
+
+  int size = 0;
+  for (auto bb : loop->getBlocks())
+    size += bb->getOpCount();
+  if (size > maxLoopSize || size > budget)
+    return false;
+
+  // All accesses must be understood.
+  std::vector<Access> accesses;
+  for (auto bb : loop->getBlocks()) {
+    for (auto op : bb->getOps()) {
+      if (isa<CallOp>(op) && op->has<ImpureAttr>())
+        return false;
+
+      if (!isa<LoadOp>(op) && !isa<StoreOp>(op))
+        continue;
+
+      Access acc;
+      if (!analyze(op, loop, acc))
+        return false;
+      accesses.push_back(acc);
+    }
+  }
+
+  // Find the pairs that might alias. A pair from the same array is left alone.
+  std::vector<std::pair<int, int>> pairs;
+  for (int i = 0; i < accesses.size(); i++) {
+    for (int j = i + 1; j < accesses.size(); j++) {
+      auto &x = accesses[i], &y = accesses[j];
+      if ((x.store || y.store) && !sameRoot(x.root, y.root) && mayAlias(x.addr(), y.addr()))
+        pairs.push_back({ i, j });
+    }
+  }
+  if (pairs.empty() || pairs.size() > maxChecks)
+    return false;
+  budget -= size;
+
+  // The roots involved each become a group.
+  std::vector<Op*> roots;
+  std::map<int, int> groupOf;
+  for (auto [i, j] : pairs) {
+    for (auto k : { i, j }) {
+      int group = 0;
+      while (group < roots.size() && !sameRoot(roots[group], accesses[k].root))
+        group++;
+      if (group == roots.size())
+        roots.push_back(accesses[k].root);
+      groupOf[k] = group;
+    }
+  }
+
+  // Compute the ranges of bytes accessed, [lo, hi), in the preheader.
+  // The check goes wrong when two arrays are over 2GB apart, but then they can't overlap.
+  Builder builder;
+  auto preheader = loop->getPreheader();
+  builder.setBeforeOp(preheader->getLastOp());
+  auto start = loop->getStart();
+  Value zero = builder.create<IntOp>({ new IntAttr(0) });
+  Value one = builder.create<IntOp>({ new IntAttr(1) });
+  Value last = builder.create<SubIOp>({ stop, one });
+
+  std::map<int, std::pair<Op*, Op*>> ranges;
+  for (auto [k, _] : groupOf) {
+    auto &acc = accesses[k];
+    Value first = offset(builder, acc, loop, start);
+    Value final = acc.stride ? offset(builder, acc, loop, last.defining) : first;
+    if (acc.stride < 0)
+      std::swap(first, final);
+
+    Value width = builder.create<IntOp>({ new IntAttr(acc.size) });
+    ranges[k] = { first.defining, builder.create<AddIOp>({ final, width }) };
+  }
+
+  // The copy runs only if the loop does, and no pair overlaps.
+  Value bad = builder.create<LeOp>({ (Value) stop, start });
+  for (auto [i, j] : pairs) {
+    Value loX = ranges[i].first, hiX = ranges[i].second;
+    Value loY = ranges[j].first, hiY = ranges[j].second;
+    Value rootX = accesses[i].root;
+    Value rootY = accesses[j].root;
+
+    // (rootY + loY) - (rootX + hiX) and (rootX + loX) - (rootY + hiY).
+    Value base = builder.create<SubIOp>({ rootY, rootX });
+    Value gapY = builder.create<SubIOp>({ loY, hiX });
+    Value gapX = builder.create<SubIOp>({ loX, hiY });
+    Value d1 = builder.create<AddIOp>({ base, gapY });
+    Value d2 = builder.create<SubIOp>({ gapX, base });
+    Value before = builder.create<LtOp>({ d1, zero });
+    Value after = builder.create<LtOp>({ d2, zero });
+    Value overlap = builder.create<AndIOp>({ before, after });
+    bad = builder.create<OrIOp>({ bad, overlap });
+  }
+
+  std::map<Op*, Op*> cloneMap;
+  std::map<BasicBlock*, BasicBlock*> rewireMap;
+  versionLoop(loop, bad.defining, cloneMap, rewireMap);
+
+  // In the copy, let the addresses start from marked copies of the roots.
+  auto fast = ELSE(preheader->getLastOp());
+  builder.setBeforeOp(fast->getLastOp());
+  int scope = scopes++;
+  std::vector<Op*> marked;
+  for (int i = 0; i < roots.size(); i++) {
+    Value root = roots[i];
+    Value zero = builder.create<IntOp>({ new IntAttr(0) });
+    auto copy = builder.create<AddLOp>({ root, zero });
+    copy->add<NoAliasAttr>(scope, i);
+    marked.push_back(copy);
+  }
+
+  std::set<Op*> copied;
+  for (auto [_, v] : cloneMap)
+    copied.insert(v);
+
+  std::map<Op*, Op*> rebased;
+  const auto rebase = [&](auto &&self, Op *addr) -> Op* {
+    if (rebased.count(addr))
+      return rebased[addr];
+
+    for (int i = 0; i < roots.size(); i++) {
+      if (sameRoot(addr, roots[i]))
+        return rebased[addr] = marked[i];
+    }
+    if (!isa<AddLOp>(addr))
+      return addr;
+
+    int i = addr->DEF(0)->getResultType() == Value::i64 ? 0 : 1;
+    auto base = self(self, addr->DEF(i));
+    // An invariant address is shared by both versions. Make a copy of it.
+    auto result = copied.count(addr) ? addr : builder.copy(addr);
+    result->setOperand(i, base);
+    return rebased[addr] = result;
+  };
+
+  // All accesses from these roots are marked, including those not in any pair;
+  // any pair of them that might alias has been checked.
+  for (auto &acc : accesses) {
+    bool grouped = false;
+    for (auto root : roots)
+      grouped |= sameRoot(acc.root, root);
+    if (!grouped)
+      continue;
+
+    auto op = cloneMap[acc.op];
+    int i = acc.store ? 1 : 0;
+    op->setOperand(i, rebase(rebase, op->DEF(i)));
+  }
+  return true;
+}
+
+void LoopVersioning::run() {
+  Alias(module).run();
+
+  LoopAnalysis analysis(module);
+  analysis.run();
+  auto forests = analysis.getResult();
+
+  auto funcs = collectFuncs();
+  for (auto func : funcs) {
+    const auto &forest = forests[func];
+    int budget = maxGrowth;
+    bool changed = false;
+
+    // Only innermost loops are versioned.
+    for (auto loop : forest.getLoops()) {
+      if (!loop->getSubloops().empty())
+        continue;
+
+      if (runImpl(loop, budget)) {
+        versioned++;
+        changed = true;
+      }
+    }
+
+    if (changed)
+      func->getRegion()->updatePreds();
+  }
+
+  // Spread the marks to all addresses derived from the roots.
+  if (versioned)
+    Alias(module).run();
+}
@@ -18,13 +18,32 @@ public:
 
 // A weak scheduler that only works on basic blocks.
 // This can't be in backend, because backends require that writereg-call-readreg must stay together.
+// Impure calls split a block into regions that are scheduled separately.
+// When the register pressure gets high, it schedules to reduce the pressure instead.
 class InstSchedule : public Pass {
+  int pressured = 0;
+
   void runImpl(BasicBlock *bb);
 public:
   InstSchedule(ModuleOp *module): Pass(module) {}
 
   std::string name() override { return "inst-schedule"; };
-  std::map<std::string, int> stats() override { return {}; }
+  std::map<std::string, int> stats() override;
+  void run() override;
+};
+
+// Superword-level parallelism: packs stores to 4 adjacent words in a block into vector ops.
+// Runs after InstSchedule, which doesn't order vector loads and stores.
+class SLP : public Pass {
+  int packed = 0;
+
+  bool tryPack(BasicBlock *bb, const std::vector<Op*> &stores);
+  void runImpl(BasicBlock *bb);
+public:
+  SLP(ModuleOp *module): Pass(module) {}
+
+  std::string name() override { return "slp"; };
+  std::map<std::string, int> stats() override;
   void run() override;
 };
 
@@ -0,0 +1,88 @@
+#ifndef MACHINE_CSE_H
+#define MACHINE_CSE_H
+
+#include "Pass.h"
+
+namespace sys {
+
+// Lowering expands constants, global addresses and address arithmetic
+// after the mid-level GVN has run; this merges the copies that appear.
+// It is shared by the backends, which tell which of their ops are pure.
+template<bool (*isPure)(Op*)>
+class MachineCSEImpl : public Pass {
+  int elim = 0;
+
+  struct Expr {
+    int id;
+    Value::Type ty;
+    std::vector<Op*> operands;
+    std::vector<std::string> attrs;
+
+    bool operator<(const Expr &other) const {
+      if (id != other.id)
+        return id < other.id;
+      if (ty != other.ty)
+        return ty < other.ty;
+      if (operands != other.operands)
+        return operands < other.operands;
+      return attrs < other.attrs;
+    }
+  };
+  // Exprs available in the current block, from its dominators.
+  std::map<Expr, Op*> exprs;
+
+  // Walks the dominator tree; an op is replaced by an identical one that dominates it.
+  void runImpl(BasicBlock *bb, DomTree &domtree) {
+    std::vector<Expr> added;
+
+    auto ops = bb->getOps();
+    for (auto op : ops) {
+      if (!isPure(op))
+        continue;
+
+      Expr key { op->opid, op->getResultType(), {}, {} };
+      for (auto operand : op->getOperands())
+        key.operands.push_back(operand.defining);
+      for (auto attr : op->getAttrs())
+        key.attrs.push_back(attr->toString());
+
+      if (exprs.count(key)) {
+        elim++;
+        op->replaceAllUsesWith(exprs[key]);
+        op->erase();
+        continue;
+      }
+      exprs[key] = op;
+      added.push_back(key);
+    }
+
+    for (auto child : domtree[bb])
+      runImpl(child, domtree);
+
+    // Leaving the scope of `bb`.
+    for (const auto &key : added)
+      exprs.erase(key);
+  }
+public:
+  MachineCSEImpl(ModuleOp *module): Pass(module) {}
+
+  std::map<std::string, int> stats() override {
+    return {
+      { "eliminated-ops", elim },
+    };
+  }
+
+  void run() override {
+    auto funcs = collectFuncs();
+
+    for (auto func : funcs) {
+      auto region = func->getRegion();
+      auto domtree = getDomTree(region);
+      runImpl(region->getFirstBlock(), domtree);
+    }
+  }
+};
+
+}
+
+#endif
@@ -0,0 +1,658 @@
+#include "LoopPasses.h"
+
+#include <algorithm>
+
+using namespace sys;
+
+std::map<std::string, int> ModuloSchedule::stats() {
+  return {
+    { "pipelined", pipelined }
+  };
+}
+
+namespace {
+
+// Registers available to the allocator, as in InstSchedule.
+constexpr int intRegs = 23;
+constexpr int floatRegs = 29;
+constexpr int pressureMargin = 3;
+// Loops with more ops than this aren't pipelined.
+constexpr int maxOps = 48;
+// At most this many iterations are in flight at once.
+constexpr int maxStages = 4;
+// The kernel is copied at most this many times for modulo variable expansion.
+constexpr int maxCopies = 4;
+// The total number of ops in the copies of the kernel.
+constexpr int maxKernelSize = 96;
+
+// Same as the ones used by the post-RA schedulers in the backends.
+// Ops not listed here have a latency of 1.
+const std::unordered_map<int, int> latencies = {
+  { LoadOp::id, 3 },
+  { VLoadOp::id, 3 },
+
+  { MulIOp::id, 3 },
+  { MulLOp::id, 3 },
+  { MulshOp::id, 3 },
+  { MuluhOp::id, 3 },
+  { VMulIOp::id, 3 },
+
+  { DivIOp::id, 20 },
+  { ModIOp::id, 20 },
+  { ModLOp::id, 20 },
+
+  { AddFOp::id, 5 },
+  { SubFOp::id, 5 },
+  { MulFOp::id, 5 },
+  { VAddFOp::id, 5 },
+  { VSubFOp::id, 5 },
+  { VMulFOp::id, 5 },
+  { DivFOp::id, 20 },
+  { EqFOp::id, 4 },
+  { NeFOp::id, 4 },
+  { LtFOp::id, 4 },
+  { LeFOp::id, 4 },
+  { I2FOp::id, 4 },
+  { F2IOp::id, 4 },
+};
+
+int latency(Op *op) {
+  // Division by a constant becomes a multiplication and a few shifts.
+  if ((isa<DivIOp>(op) || isa<ModIOp>(op)) && isa<IntOp>(op->DEF(1)))
+    return 4;
+
+  auto it = latencies.find(op->opid);
+  return it == latencies.end() ? 1 : it->second;
+}
+
+bool isMemory(Op *op) {
+  return isa<LoadOp>(op) || isa<StoreOp>(op) || isa<VLoadOp>(op) || isa<VStoreOp>(op);
+}
+
+bool isWrite(Op *op) {
+  return isa<StoreOp>(op) || isa<VStoreOp>(op);
+}
+
+Op *address(Op *op) {
+  return isWrite(op) ? op->DEF(1) : op->DEF(0);
+}
+
+// Vector values live in the float registers on ARM.
+bool isFloat(Op *op) {
+  auto ty = op->getResultType();
+  return ty == Value::f32 || ty == Value::f128 || ty == Value::i128;
+}
+
+// `to` must issue at least `latency` cycles after `from` of `distance` iterations earlier.
+struct Edge {
+  int from, to;
+  int latency;
+  int distance;
+};
+
+// Iterative modulo scheduling (Rau, 1994) with a single-issue machine model:
+// each slot of the kernel holds one op.
+class Scheduler {
+  const std::vector<Edge> &edges;
+  // This op is scheduled first, at time 0, and never evicted.
+  int pinned;
+  int n;
+
+  std::vector<std::vector<int>> preds, succs;
+
+  // Whether no recurrence is longer than `ii` cycles per iteration.
+  bool feasible(int ii);
+  bool schedule(int ii);
+public:
+  int ii;
+  std::vector<int> time;
+
+  Scheduler(int n, const std::vector<Edge> &edges, int pinned);
+
+  // Tries II's from the minimum one up to (and excluding) `limit`.
+  // Each one that succeeds is passed to `accept`, until it returns true.
+  template<class F>
+  bool run(int limit, F accept);
+};
+
+Scheduler::Scheduler(int n, const std::vector<Edge> &edges, int pinned):
+  edges(edges), pinned(pinned), n(n), preds(n), succs(n) {
+  for (int i = 0; i < edges.size(); i++) {
+    preds[edges[i].to].push_back(i);
+    succs[edges[i].from].push_back(i);
+  }
+}
+
+bool Scheduler::feasible(int ii) {
+  // Bellman-Ford on the longest paths. It converges within `n` rounds,
+  // unless there's a cycle with a positive length.
+  std::vector<int> dist(n, 0);
+  for (int round = 0; round <= n; round++) {
+    bool changed = false;
+    for (auto [from, to, lat, d] : edges) {
+      if (dist[from] + lat - ii * d > dist[to]) {
+        dist[to] = dist[from] + lat - ii * d;
+        changed = true;
+      }
+    }
+    if (!changed)
+      return true;
+  }
+  return false;
+}
+
+bool Scheduler::schedule(int ii) {
+  // Ops with longer paths to the end of the iteration go first.
+  std::vector<int> height(n, 0);
+  for (int round = 0; round < n; round++) {
+    for (auto [from, to, lat, d] : edges)
+      height[from] = std::max(height[from], height[to] + lat - ii * d);
+  }
+
+  std::vector<int> order(n);
+  for (int i = 0; i < n; i++)
+    order[i] = i;
+  std::stable_sort(order.begin(), order.end(), [&](int x, int y) {
+    if ((x == pinned) != (y == pinned))
+      return x == pinned;
+    return height[x] > height[y];
+  });
+
+  time.assign(n, -1);
+  std::vector<int> last(n, -1);
+  std::vector<int> owner(ii, -1);
+
+  const auto evict = [&](int op) {
+    owner[time[op] % ii] = -1;
+    time[op] = -1;
+  };
+
+  int budget = 4 * n;
+  for (;;) {
+    int op = -1;
+    for (auto x : order) {
+      if (time[x] < 0) {
+        op = x;
+        break;
+      }
+    }
+    if (op < 0)
+      return true;
+    if (budget-- <= 0)
+      return false;
+
+    int estart = 0;
+    for (auto e : preds[op]) {
+      auto [from, _, lat, d] = edges[e];
+      if (from != op && time[from] >= 0)
+        estart = std::max(estart, time[from] + lat - ii * d);
+    }
+
+    int t = -1;
+    for (int x = estart; x < estart + ii; x++) {
+      if (owner[x % ii] < 0) {
+        t = x;
+        break;
+      }
+    }
+    // No free slot. Take one anyway, and evict whatever is there.
+    if (t < 0) {
+      t = last[op] < 0 || estart > last[op] ? estart : last[op] + 1;
+      while (owner[t % ii] == pinned)
+        t++;
+      evict(owner[t % ii]);
+    }
+
+    time[op] = last[op] = t;
+    owner[t % ii] = op;
+
+    // Successors that are now too early have to be placed again.
+    for (auto e : succs[op]) {
+      auto [_, to, lat, d] = edges[e];
+      if (to != op && time[to] >= 0 && time[to] < t + lat - ii * d) {
+        if (to == pinned)
+          return false;
+        evict(to);
+      }
+    }
+  }
+}
+
+template<class F>
+bool Scheduler::run(int limit, F accept) {
+  // A single-issue machine needs at least `n` cycles per iteration.
+  for (ii = n; ii < limit; ii++) {
+    if (feasible(ii) && schedule(ii) && accept())
+      return true;
+  }
+  return false;
+}
+
+// Issues two iterations in order on a single-issue machine.
+// Returns the cycles taken by the second one.
+int sequentialCost(const std::vector<Op*> &body, BasicBlock *bb) {
+  std::unordered_map<Op*, int> ready, prev;
+  int cycle = 0, first = 0;
+  for (int iter = 0; iter < 2; iter++) {
+    for (auto op : body) {
+      int start = cycle;
+      for (auto operand : op->getOperands()) {
+        auto def = operand.defining;
+        if (isa<PhiOp>(def) && def->getParent() == bb)
+          start = std::max(start, prev[Op::getPhiFrom(def, bb)]);
+        else if (ready.count(def))
+          start = std::max(start, ready[def]);
+      }
+      ready[op] = start + latency(op);
+      cycle = start + 1;
+    }
+    prev = ready;
+    ready.clear();
+    if (iter == 0)
+      first = cycle;
+  }
+  return cycle - first;
+}
+
+// Makes a copied op refer to `lookup(operand)` for each of its operands.
+template<class F>
+void remap(Op *op, F lookup) {
+  auto operands = op->getOperands();
+  op->removeAllOperands();
+  for (auto operand : operands)
+    op->pushOperand(lookup(operand.defining));
+}
+
+}
+
+// Overlaps iterations of a rotated, single-block loop:
+//
+//   preheader:
+//     br (lt start (stop - (S + U - 2) * step)) prologue bb
+//   prologue:
+//     <starts the first S - 1 iterations>
+//   kernel:
+//     <U copies of one step; each step starts an iteration, and finishes another>
+//     br (lt iv' (stop - (U - 1) * step)) kernel epilogue
+//   epilogue:
+//     <finishes the iterations in flight>
+//     br (lt iv' stop) bb exit
+//
+// where S is the number of stages in the schedule, and U is the number of
+// copies of the kernel. The original loop runs the iterations left over.
+//
+// An iteration `i` issues the ops of stage `s` at step `i + s`.
+// A value used `d` steps after it's defined has `d` instances alive at once.
+// With the kernel copied `U` times (no less than the largest `d`), each of them
+// is a separate SSA value, and the phis carrying them around the backedge
+// don't need moves.
+bool ModuloSchedule::runImpl(LoopInfo *loop) {
+  if (!loop->getSubloops().empty() || loop->getBlocks().size() != 1)
+    return false;
+
+  auto bb = loop->getHeader();
+  auto preheader = loop->getPreheader();
+  auto iv = loop->getInduction();
+  auto stop = loop->getStop();
+  int step = loop->getStep();
+  if (!preheader || !iv || !stop || step <= 0 || stop->getParent() == bb)
+    return false;
+
+  if (loop->getExits().size() != 1)
+    return false;
+
+  auto exit = loop->getExit();
+  auto term = bb->getLastOp();
+  if (!isa<BranchOp>(term) || TARGET(term) != bb || ELSE(term) != exit)
+    return false;
+
+  auto preterm = preheader->getLastOp();
+  if (!isa<GotoOp>(preterm))
+    return false;
+
+  // Loops entered from more than one place are usually the remainders
+  // of unrolled loops, which only run a few iterations.
+  if (preheader->preds.size() != 1)
+    return false;
+
+  auto inc = Op::getPhiFrom(iv, bb);
+  auto cond = term->DEF(0);
+  if (cond->DEF(0) != inc || cond->DEF(1) != stop)
+    return false;
+
+  // The value each phi takes in the next iteration.
+  std::map<Op*, Op*> update;
+  auto phis = bb->getPhis();
+  for (auto phi : phis) {
+    if (phi->getOperandCount() != 2 || !Op::getPhiFrom(phi, preheader))
+      return false;
+    auto next = Op::getPhiFrom(phi, bb);
+    if (!next || next->getParent() != bb || isa<PhiOp>(next))
+      return false;
+    update[phi] = next;
+  }
+
+  // The exit test is redone for the kernel and the epilogue.
+  std::vector<Op*> body;
+  std::unordered_map<Op*, int> index;
+  for (auto op : bb->getOps()) {
+    if (isa<CallOp>(op))
+      return false;
+    if (isa<PhiOp>(op) || op == term || op == cond && cond->getUses().size() == 1)
+      continue;
+    index[op] = body.size();
+    body.push_back(op);
+  }
+  int n = body.size();
+  if (n > maxOps)
+    return false;
+
+  // Values leaving the loop through anything but a phi at `exit` need a new phi there.
+  std::map<Op*, std::vector<Op*>> escapes;
+  for (auto op : bb->getOps()) {
+    for (auto use : op->getUses()) {
+      if (use->getParent() == bb || use->getParent() == exit && isa<PhiOp>(use))
+        continue;
+      if (exit->preds.size() != 1)
+        return false;
+      escapes[op].push_back(use);
+    }
+  }
+
+  // Build the dependence graph. Uses of a phi depend on its update
+  // from the previous iteration.
+  const auto inLoop = [&](Op *op) {
+    return op->getParent() == bb;
+  };
+  std::vector<Edge> edges;
+  for (auto op : body) {
+    for (auto operand : op->getOperands()) {
+      auto def = operand.defining;
+      if (isa<PhiOp>(def) && inLoop(def)) {
+        auto next = update[def];
+        edges.push_back({ index[next], index[op], latency(next), 1 });
+      } else if (index.count(def))
+        edges.push_back({ index[def], index[op], latency(def), 0 });
+    }
+  }
+
+  // Memory accesses keep their order, both in an iteration and across iterations.
+  // Edges of distance 1 are enough, as the schedule repeats every II cycles.
+  for (int i = 0; i < n; i++) {
+    for (int j = i + 1; j < n; j++) {
+      auto x = body[i], y = body[j];
+      if (!isMemory(x) || !isMemory(y) || !isWrite(x) && !isWrite(y))
+        continue;
+      if (!mayAlias(address(x), address(y)))
+        continue;
+      edges.push_back({ i, j, 1, 0 });
+      edges.push_back({ j, i, 1, 1 });
+    }
+  }
+
+  // Invariants stay in registers throughout.
+  std::set<Op*> invariants;
+  for (auto op : body) {
+    for (auto operand : op->getOperands()) {
+      auto def = operand.defining;
+      if (!inLoop(def))
+        invariants.insert(def);
+    }
+  }
+  int fixedInt = 0, fixedFloat = 0;
+  for (auto op : invariants)
+    ++(isFloat(op) ? fixedFloat : fixedInt);
+
+  // Only an II below the cycles an iteration takes now is worth it.
+  // The update of the induction variable is pinned to the first stage,
+  // so that each step knows whether the iteration it starts exists.
+  int cost = sequentialCost(body, bb);
+  Scheduler sched(n, edges, index[inc]);
+  int ii, stages, copies;
+  std::vector<int> stage(n);
+
+  const auto accept = [&]() {
+    ii = sched.ii;
+    const auto &time = sched.time;
+    stages = 0;
+    for (int i = 0; i < n; i++) {
+      stage[i] = time[i] / ii;
+      stages = std::max(stages, stage[i] + 1);
+    }
+    if (stages == 1 || stages > maxStages)
+      return false;
+
+    // Modulo variable expansion. A value alive for longer than II cycles would be
+    // overwritten by the next iteration before its last use, unless each iteration
+    // in flight has its own copy of the kernel.
+    copies = 1;
+    int lifeInt = 0, lifeFloat = 0;
+    for (int i = 0; i < n; i++) {
+      int end = time[i];
+      for (auto use : body[i]->getUses()) {
+        if (!inLoop(use))
+          continue;
+        if (isa<PhiOp>(use)) {
+          for (auto user : use->getUses()) {
+            if (index.count(user))
+              end = std::max(end, time[index[user]] + ii);
+          }
+        } else if (index.count(use))
+          end = std::max(end, time[index[use]]);
+      }
+      int life = end - time[i];
+      copies = std::max(copies, (life + ii - 1) / ii);
+      (isFloat(body[i]) ? lifeFloat : lifeInt) += life;
+    }
+    if (copies > maxCopies || copies * n > maxKernelSize)
+      return false;
+
+    // On average, this many values are alive in each cycle.
+    int liveInt = fixedInt + (lifeInt + ii - 1) / ii;
+    int liveFloat = fixedFloat + (lifeFloat + ii - 1) / ii;
+    return liveInt <= intRegs - pressureMargin && liveFloat <= floatRegs - pressureMargin;
+  };
+  if (!sched.run(cost, accept))
+    return false;
+
+  const auto &time = sched.time;
+  const auto stageOf = [&](Op *op) { return stage[index[op]]; };
+
+  // Ops of a step, in the order they're issued.
+  std::vector<Op*> slots = body;
+  std::sort(slots.begin(), slots.end(), [&](Op *x, Op *y) {
+    return time[index[x]] % ii < time[index[y]] % ii;
+  });
+
+  Builder builder;
+  auto region = bb->getParent();
+  auto kernel = region->insertAfter(bb);
+  auto prologue = region->insertAfter(bb);
+  auto epilogue = region->insertAfter(kernel);
+
+  const auto offset = [&](Op *value, int steps) -> Op* {
+    if (!steps)
+      return value;
+    Value delta = builder.create<IntOp>({ new IntAttr(-steps * step) });
+    if (isa<AddLOp>(inc))
+      return builder.create<AddLOp>({ (Value) value, delta });
+    return builder.create<AddIOp>({ (Value) value, delta });
+  };
+
+  builder.setBeforeOp(preterm);
+  auto start = Op::getPhiFrom(iv, preheader);
+  auto enter = builder.create<LtOp>({ (Value) start, offset(stop, stages + copies - 2) });
+  auto lim = offset(stop, copies - 1);
+  builder.replace<BranchOp>(preterm, { enter }, { new TargetAttr(prologue), new ElseAttr(bb) });
+
+  // Values in the prologue, by iteration.
+  std::map<std::pair<Op*, int>, Op*> early;
+  const auto earlyValue = [&](auto &&self, Op *op, int iter) -> Op* {
+    if (!inLoop(op))
+      return op;
+    if (isa<PhiOp>(op))
+      return iter ? self(self, update[op], iter - 1) : Op::getPhiFrom(op, preheader);
+    assert(early.count({ op, iter }));
+    return early[{ op, iter }];
+  };
+
+  // Instances of ops, ordered by the time they're issued. No two of them
+  // share the same time, as they'd have to be in the same slot.
+  std::vector<std::tuple<int, int, Op*>> instances;
+  for (auto op : body) {
+    for (int iter = 0; iter + stageOf(op) <= stages - 2; iter++)
+      instances.push_back({ iter * ii + time[index[op]], iter, op });
+  }
+  std::sort(instances.begin(), instances.end());
+
+  builder.setToBlockEnd(prologue);
+  for (auto [_, iter, op] : instances) {
+    auto copied = builder.copy(op);
+    remap(copied, [&](Op *def) { return earlyValue(earlyValue, def, iter); });
+    early[{ op, iter }] = copied;
+  }
+  builder.create<GotoOp>({ new TargetAttr(kernel) });
+
+  // The kernel. Iterations are numbered relative to the one before the first
+  // copy, and copy `c` issues step `c`.
+  std::vector<std::map<Op*, Op*>> steady(copies + 1);
+  // Phis holding values from the previous run of the kernel, by iteration.
+  std::map<std::pair<Op*, int>, Op*> carried;
+  std::vector<std::pair<Op*, int>> pending;
+
+  const auto steadyValue = [&](Op *op, int iter) -> Op* {
+    if (!inLoop(op))
+      return op;
+
+    auto def = op;
+    int defIter = iter;
+    if (isa<PhiOp>(op)) {
+      def = update[op];
+      defIter = iter - 1;
+    }
+    int at = defIter + stageOf(def);
+    if (at >= 1) {
+      assert(steady[at].count(def));
+      return steady[at][def];
+    }
+
+    // In the first run of the kernel, this refers to the initial value of the phi.
+    std::pair<Op*, int> key = { def, defIter };
+    if (isa<PhiOp>(op) && stages - 2 + iter == 0)
+      key = { op, iter };
+    if (!carried.count(key)) {
+      Builder::Guard guard(builder);
+      builder.setToBlockStart(kernel);
+      auto phi = builder.create<PhiOp>();
+      phi->setResultType(op->getResultType());
+      carried[key] = phi;
+      pending.push_back(key);
+    }
+    return carried[key];
+  };
+
+  builder.setToBlockEnd(kernel);
+  for (int c = 1; c <= copies; c++) {
+    for (auto op : slots) {
+      int iter = c - stageOf(op);
+      auto copied = builder.copy(op);
+      remap(copied, [&](Op *def) { return steadyValue(def, iter); });
+      steady[c][op] = copied;
+    }
+  }
+  auto again = builder.create<LtOp>({ (Value) steady[copies][inc], lim });
+  builder.create<BranchOp>({ again }, { new TargetAttr(kernel), new ElseAttr(epilogue) });
+
+  // The epilogue finishes everything started up to iteration `copies`.
+  std::map<std::pair<Op*, int>, Op*> late;
+  const auto lateValue = [&](auto &&self, Op *op, int iter) -> Op* {
+    if (!inLoop(op))
+      return op;
+    if (isa<PhiOp>(op))
+      return self(self, update[op], iter - 1);
+    if (iter + stageOf(op) <= copies)
+      return steadyValue(op, iter);
+    assert(late.count({ op, iter }));
+    return late[{ op, iter }];
+  };
+
+  instances.clear();
+  for (auto op : body) {
+    for (int iter = copies + 1 - stageOf(op); iter <= copies; iter++)
+      instances.push_back({ iter * ii + time[index[op]], iter, op });
+  }
+  std::sort(instances.begin(), instances.end());
+
+  builder.setToBlockEnd(epilogue);
+  for (auto [_, iter, op] : instances) {
+    auto copied = builder.copy(op);
+    remap(copied, [&](Op *def) { return lateValue(lateValue, def, iter); });
+    late[{ op, iter }] = copied;
+  }
+  auto rest = builder.create<LtOp>({ (Value) lateValue(lateValue, inc, copies), stop });
+  builder.create<BranchOp>({ rest }, { new TargetAttr(bb), new ElseAttr(exit) });
+
+  // The original loop and the exit can now also be reached from the epilogue.
+  std::map<Op*, Op*> fromEpilogue;
+  for (auto phi : phis)
+    fromEpilogue[phi] = lateValue(lateValue, update[phi], copies);
+  for (auto [phi, value] : fromEpilogue) {
+    phi->pushOperand(value);
+    phi->add<FromAttr>(epilogue);
+  }
+  for (auto phi : exit->getPhis()) {
+    phi->pushOperand(lateValue(lateValue, Op::getPhiFrom(phi, bb), copies));
+    phi->add<FromAttr>(epilogue);
+  }
+
+  builder.setToBlockStart(exit);
+  for (const auto &[op, uses] : escapes) {
+    auto value = lateValue(lateValue, op, copies);
+    auto phi = builder.create<PhiOp>({ (Value) op, value }, { new FromAttr(bb), new FromAttr(epilogue) });
+    phi->setResultType(op->getResultType());
+    for (auto use : uses) {
+      for (int i = 0; i < use->getOperandCount(); i++) {
+        if (use->DEF(i) == op)
+          use->setOperand(i, phi);
+      }
+    }
+  }
+
+  // A phi carries the value of the iteration `copies` later around the backedge.
+  // That might need another phi, so this is a worklist.
+  for (int i = 0; i < pending.size(); i++) {
+    auto [op, iter] = pending[i];
+    auto phi = carried[pending[i]];
+    phi->pushOperand(earlyValue(earlyValue, op, stages - 2 + iter));
+    phi->add<FromAttr>(prologue);
+    phi->pushOperand(steadyValue(op, iter + copies));
+    phi->add<FromAttr>(kernel);
+  }
+  return true;
+}
+
+// Relies on the AliasAttr's given in InstSchedule.
+// Addresses created since then don't have them, and are taken as aliasing anything.
+void ModuloSchedule::run() {
+  auto funcs = collectFuncs();
+  for (auto func : funcs)
+    func->getRegion()->updatePreds();
+
+  LoopAnalysis analysis(module);
+  analysis.run();
+  auto forests = analysis.getResult();
+
+  for (auto func : funcs) {
+    const auto &forest = forests[func];
+    bool changed = false;
+    for (auto loop : forest.getLoops()) {
+      if (runImpl(loop)) {
+        pipelined++;
+        changed = true;
+      }
+    }
+
+    if (changed)
+      func->getRegion()->updatePreds();
+  }
+}
@@ -16,6 +16,11 @@ using DomTree = std::unordered_map<BasicBlock*, std::vector<BasicBlock*>>;
 
 bool isExtern(const std::string &name);
 
+// The fork-join runtime behind Parallelize splits loops among this many threads.
+// Loops with fewer iterations than `parallelMinTrips` are run by the calling thread alone.
+constexpr int parallelThreads = 4;
+constexpr int parallelMinTrips = 64;
+
 class Pass {
   template<typename F, typename Ret, typename A>
   static A helper(Ret (F::*)(A) const);
@@ -53,6 +53,7 @@ class GVN : public Pass {
     int vi = 0;
     float vf = 0;
     std::string name;
+    std::pair<int, int> noalias { -1, -1 };
 
     bool operator<(const Expr &other) const;
   };
@@ -155,6 +156,53 @@ public:
   void run() override;
 };
 
+// Sparse conditional constant propagation, across functions.
+// Unlike RegularFold, it follows only the edges that can be taken,
+// so that phis merging a constant with values from dead paths still fold.
+class SCCP : public Pass {
+public:
+  // Either undetermined (top), a single constant, or not a constant (bottom).
+  struct Lattice {
+    enum { Top, Const, Bottom } kind = Top;
+    bool fp = false;
+    int vi = 0;
+    float vf = 0;
+
+    bool operator==(const Lattice &other) const;
+  };
+private:
+  int folded = 0;
+  int foldedBranches = 0;
+
+  // What each function returns, and the arguments it's called with,
+  // as found by the previous round. The current round fills `nextReturns` and `nextArgs`.
+  std::map<std::string, Lattice> returns, nextReturns;
+  std::map<std::string, std::vector<Lattice>> args, nextArgs;
+
+  void runImpl(FuncOp *func, bool rewrite);
+public:
+  SCCP(ModuleOp *module): Pass(module) {}
+
+  std::string name() override { return "sccp"; };
+  std::map<std::string, int> stats() override;
+  void run() override;
+};
+
+// Clones functions for call sites passing constant arguments,
+// when SCCP can't fold them because other call sites pass different values.
+class Specialize : public Pass {
+  int cloned = 0;
+  int specialized = 0;
+
+  FuncOp *cloneFunc(FuncOp *func, const std::string &name);
+public:
+  Specialize(ModuleOp *module): Pass(module) {}
+
+  std::string name() override { return "specialize"; };
+  std::map<std::string, int> stats() override;
+  void run() override;
+};
+
 class LateInline : public Pass {
   int inlined = 0;
   int threshold;
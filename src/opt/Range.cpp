@@ -1,191 +1,466 @@
-#include "LoopPasses.h"
 #include "Analysis.h"
 
 using namespace sys;
 
-int clamp(int64_t x) {
-  if (x > INT_MAX)
-    return INT_MAX;
-  if (x < INT_MIN)
-    return INT_MIN;
-  return x;
-}
-
-using IRange = std::pair<int, int>;
-
-IRange join(IRange l, IRange r, bool widen) {
-  auto [a1, b1] = l;
-  auto [a2, b2] = r;
-  if (widen)
-    return std::make_pair(a2 < a1 ? INT_MIN : a1, b1 < b2 ? INT_MAX : b1);
-  return std::make_pair(std::max(a1, a2), std::max(b1, b2));
-}
-
-#define UPDATE_RANGE(Ty, Low, High) \
-  if (isa<Ty>(op)) { \
-    auto l = op->getOperand(0).defining; \
-    auto r = op->getOperand(1).defining; \
-    if (l->has<RangeAttr>() && r->has<RangeAttr>()) { \
-      auto [a1, b1] = RANGE(l); \
-      auto [a2, b2] = RANGE(r); \
-      auto range = std::make_pair(clamp(Low), clamp(High)); \
-      if (auto rangeAttr = op->find<RangeAttr>()) { \
-        auto xrange = join(range, rangeAttr->range, false); \
-        if (xrange.first == range.first && xrange.second == range.second) \
-          return false; \
-        op->remove<RangeAttr>(); \
-      } \
-      op->add<RangeAttr>(range); \
-      return true; \
-    } \
-  }
-
-#define UPDATE_BOOL_RANGE(Ty) \
-  if (isa<Ty>(op)) { \
-    if (!op->has<RangeAttr>()) { \
-      op->add<RangeAttr>(0, 1); \
-    } \
-  }
-
-int64_t minmul(int a1, int b1, int a2, int b2) {
-  __int128_t x[] = { ((__int128_t) a1) * a2, ((__int128_t) a1) * b2, ((__int128_t) b1) * a2, ((__int128_t) b1) * b2 };
-  auto min = *std::min_element(x, x + 4);
-  if (min < INT_MIN)
-    return INT_MIN;
-  return min;
-}
-
-int64_t maxmul(int a1, int b1, int a2, int b2) {
-  __int128_t x[] = { ((__int128_t) a1) * a2, ((__int128_t) a1) * b2, ((__int128_t) b1) * a2, ((__int128_t) b1) * b2 };
-  auto max = *std::max_element(x, x + 4);
-  if (max > INT_MAX)
-    return INT_MAX;
-  return max;
-}
-
-int64_t mindiv(int64_t a1, int64_t b1, int64_t a2, int64_t b2) {
-  int64_t x[] = { a1 / a2, a1 / b2, b1 / a2, b1 / b2 };
-  return *std::min_element(x, x + 4);
-}
-
-int64_t maxdiv(int64_t a1, int64_t b1, int64_t a2, int64_t b2) {
-  int64_t x[] = { a1 / a2, a1 / b2, b1 / a2, b1 / b2 };
-  return *std::max_element(x, x + 4);
-}
-
-int minmod(int a1, int b1, int a2, int b2) {
-  if (a1 >= 0 && a2 > 0)
-    return 0;
-  if (a1 >= 0 && a2 > b1)
-    return a1;
-  return -std::max(std::abs(a2), std::abs(b2)) + 1;
-}
-
-int maxmod(int a1, int b1, int a2, int b2) {
-  if (a1 >= 0 && a2 > b1)
-    return b1;
-  return std::max(std::abs(a2), std::abs(b2)) - 1;
-}
-
-bool calculateRange(Op *op, bool widen) {
-  if (isa<IntOp>(op)) {
-    if (op->has<RangeAttr>())
-      return false;
-
-    int value = V(op);
-    op->add<RangeAttr>(value, value);
-    return true;
-  }
-
-  UPDATE_RANGE(AddIOp, ((int64_t) a1) + a2, ((int64_t) b1) + b2);
-  UPDATE_RANGE(SubIOp, ((int64_t) a1) - a2, ((int64_t) b1) - b2);
-  UPDATE_RANGE(MulIOp, minmul(a1, b1, a2, b2), maxmul(a1, b1, a2, b2));
-  UPDATE_RANGE(DivIOp, mindiv(a1, b1, a2, b2), maxdiv(a1, b1, a2, b2));
-  UPDATE_RANGE(ModIOp, minmod(a1, b1, a2, b2), maxmod(a1, b1, a2, b2));
-
-  UPDATE_BOOL_RANGE(EqOp);
-  UPDATE_BOOL_RANGE(LeOp);
-  UPDATE_BOOL_RANGE(LtOp);
-  UPDATE_BOOL_RANGE(NeOp);
-  UPDATE_BOOL_RANGE(NotOp);
-  UPDATE_BOOL_RANGE(SetNotZeroOp);
-  
+using Interval = Range::Interval;
+
+std::map<std::string, int> Range::stats() {
+  return {
+    { "folded-compares", foldedCmps },
+    { "reduced-divisions", reduced },
+  };
+}
+
+bool Range::Interval::operator==(const Interval &other) const {
+  if (empty() || other.empty())
+    return empty() && other.empty();
+  return low == other.low && high == other.high;
+}
+
+namespace {
+
+constexpr Interval emptyRange = { 1, 0 };
+constexpr Interval fullRange = { INT_MIN, INT_MAX };
+
+// An op whose range keeps changing after this many rounds is given up on.
+constexpr int maxUpdates = 16;
+
+// Arithmetic wraps around on overflow, so anything out of bounds might be any value.
+Interval make(int64_t low, int64_t high) {
+  if (low < INT_MIN || high > INT_MAX)
+    return fullRange;
+  return { low, high };
+}
+
+Interval join(Interval a, Interval b) {
+  if (a.empty())
+    return b;
+  if (b.empty())
+    return a;
+  return { std::min(a.low, b.low), std::max(a.high, b.high) };
+}
+
+Interval intersect(Interval a, Interval b) {
+  return { std::max(a.low, b.low), std::min(a.high, b.high) };
+}
+
+bool isCompare(Op *op) {
+  return isa<EqOp>(op) || isa<NeOp>(op) || isa<LtOp>(op) || isa<LeOp>(op);
+}
+
+// The outcome of comparing values in `a` and `b`, or -1 if it isn't known.
+int decide(Op *op, Interval a, Interval b) {
+  if (isa<LtOp>(op)) {
+    if (a.high < b.low)
+      return 1;
+    if (a.low >= b.high)
+      return 0;
+  }
+  if (isa<LeOp>(op)) {
+    if (a.high <= b.low)
+      return 1;
+    if (a.low > b.high)
+      return 0;
+  }
+  if (isa<EqOp>(op) || isa<NeOp>(op)) {
+    bool eq = isa<EqOp>(op);
+    if (a.low == a.high && b.low == b.high && a.low == b.low)
+      return eq;
+    if (a.high < b.low || b.high < a.low)
+      return !eq;
+  }
+  return -1;
+}
+
+int bitWidth(int64_t x) {
+  return x <= 0 ? 0 : 64 - __builtin_clzll(x);
+}
+
+}
+
+Interval Range::get(Op *op) {
+  if (isa<IntOp>(op))
+    return { V(op), V(op) };
+  auto it = ranges.find(op);
+  return it == ranges.end() ? fullRange : it->second;
+}
+
+// Narrows `r`, the range of `v`, with what `cond` being `holds` tells about it.
+Interval Range::apply(Op *v, Interval r, Op *cond, bool holds) {
+  if (r.empty())
+    return r;
+
+  // Branching on the value itself.
+  if (cond == v) {
+    if (!holds)
+      return intersect(r, { 0, 0 });
+    if (r.low == 0)
+      r.low++;
+    if (r.high == 0)
+      r.high--;
+    return r;
+  }
+
+  if (!isCompare(cond))
+    return r;
+  auto a = cond->DEF(0), b = cond->DEF(1);
+  if ((a != v && b != v) || a == b)
+    return r;
+
+  bool lhs = a == v;
+  auto other = get(lhs ? b : a);
+  if (other.empty())
+    return emptyRange;
+
+  if (isa<LtOp>(cond)) {
+    // a < b when it holds, otherwise b <= a.
+    if (holds == lhs)
+      r.high = std::min(r.high, holds ? other.high - 1 : other.high);
+    else
+      r.low = std::max(r.low, holds ? other.low + 1 : other.low);
+    return r;
+  }
+
+  if (isa<LeOp>(cond)) {
+    // a <= b when it holds, otherwise b < a.
+    if (holds == lhs)
+      r.high = std::min(r.high, holds ? other.high : other.high - 1);
+    else
+      r.low = std::max(r.low, holds ? other.low : other.low + 1);
+    return r;
+  }
+
+  // Equality.
+  if (holds == isa<EqOp>(cond))
+    return intersect(r, other);
+
+  if (other.low == other.high) {
+    if (r.low == other.low)
+      r.low++;
+    if (r.high == other.low)
+      r.high--;
+  }
+  return r;
+}
+
+Interval Range::refine(Op *v, BasicBlock *bb) {
+  auto r = get(v);
+  for (auto [cond, holds] : facts[bb])
+    r = apply(v, r, cond, holds);
+  return r;
+}
+
+bool Range::edgeFact(BasicBlock *from, BasicBlock *to, Fact &fact) {
+  auto term = from->getLastOp();
+  if (!isa<BranchOp>(term) || TARGET(term) == ELSE(term))
+    return false;
+  fact = { term->DEF(), TARGET(term) == to };
+  return true;
+}
+
+Interval Range::refineEdge(Op *v, BasicBlock *from, BasicBlock *to) {
+  auto r = refine(v, from);
+  Fact fact;
+  if (edgeFact(from, to, fact))
+    r = apply(v, r, fact.first, fact.second);
+  return r;
+}
+
+Interval Range::evaluate(Op *op) {
+  auto bb = op->getParent();
+
   if (isa<PhiOp>(op)) {
-    int min = INT_MAX, max = INT_MIN;
-    for (auto operand : op->getOperands()) {
-      auto def = operand.defining;
-      if (auto range = def->find<RangeAttr>()) {
-        auto [a1, b1] = range->range;
-        min = std::min(min, a1);
-        max = std::max(max, b1);
-      }
-    }
-    if (auto range = op->find<RangeAttr>()) {
-      auto [a1, b1] = range->range;
-      if (a1 == min && b1 == max)
-        return false;
-      range->range = join(range->range, { min, max }, /*widen=*/true);
-      return true;
+    auto result = emptyRange;
+    const auto &attrs = op->getAttrs();
+    for (int i = 0; i < op->getOperandCount(); i++)
+      result = join(result, refineEdge(op->DEF(i), FROM(attrs[i]), bb));
+    return result;
+  }
+
+  if (isa<IntOp>(op))
+    return get(op);
+
+  std::vector<Interval> args;
+  for (auto operand : op->getOperands()) {
+    args.push_back(refine(operand.defining, bb));
+    if (args.back().empty())
+      return emptyRange;
+  }
+
+  if (isCompare(op)) {
+    int result = decide(op, args[0], args[1]);
+    return result == -1 ? Interval { 0, 1 } : Interval { result, result };
+  }
+
+  if (isa<NotOp>(op) || isa<SetNotZeroOp>(op)) {
+    if (op->DEF()->getResultType() == Value::f32)
+      return { 0, 1 };
+    auto x = args[0];
+    bool snz = isa<SetNotZeroOp>(op);
+    if (x.low == 0 && x.high == 0)
+      return { !snz, !snz };
+    if (x.low > 0 || x.high < 0)
+      return { snz, snz };
+    return { 0, 1 };
+  }
+
+  if (isa<EqFOp>(op) || isa<NeFOp>(op) || isa<LtFOp>(op) || isa<LeFOp>(op))
+    return { 0, 1 };
+
+  if (isa<SelectOp>(op))
+    return join(args[1], args[2]);
+
+  if (isa<MinusOp>(op))
+    return make(-args[0].high, -args[0].low);
+
+  if (args.size() != 2)
+    return fullRange;
+
+  auto [a1, b1] = args[0];
+  auto [a2, b2] = args[1];
+
+  if (isa<AddIOp>(op))
+    return make(a1 + a2, b1 + b2);
+
+  if (isa<SubIOp>(op))
+    return make(a1 - b2, b1 - a2);
+
+  if (isa<MulIOp>(op)) {
+    int64_t x[] = { a1 * a2, a1 * b2, b1 * a2, b1 * b2 };
+    return make(*std::min_element(x, x + 4), *std::max_element(x, x + 4));
+  }
+
+  if (isa<DivIOp>(op)) {
+    // Division by zero is undefined, so only the magnitude is bounded.
+    if (a2 <= 0 && b2 >= 0) {
+      auto m = std::max(std::abs(a1), std::abs(b1));
+      return make(-m, m);
     }
-    // Unknown.
-    if (min == INT_MAX && max == INT_MIN)
-      return false;
-    else
-      op->add<RangeAttr>(min, max);
+    // Truncating division is monotonic in both operands when the divisor keeps its sign.
+    int64_t x[] = { a1 / a2, a1 / b2, b1 / a2, b1 / b2 };
+    return make(*std::min_element(x, x + 4), *std::max_element(x, x + 4));
+  }
+
+  if (isa<ModIOp>(op)) {
+    // The result takes the sign of the dividend, and is smaller than the divisor in magnitude.
+    auto m = std::max(std::abs(a2), std::abs(b2)) - 1;
+    if (m < 0)
+      return fullRange;
+    Interval result = { std::max(a1, -m), std::min(b1, m) };
+    if (a1 >= 0)
+      result.low = 0;
+    if (b1 <= 0)
+      result.high = 0;
+    return result;
   }
 
-  return false;
+  if (isa<AndIOp>(op)) {
+    if (a1 >= 0 && a2 >= 0)
+      return { 0, std::min(b1, b2) };
+    if (a1 >= 0)
+      return { 0, b1 };
+    if (a2 >= 0)
+      return { 0, b2 };
+    return fullRange;
+  }
+
+  if (isa<OrIOp>(op) || isa<XorIOp>(op)) {
+    if (a1 < 0 || a2 < 0)
+      return fullRange;
+    int64_t mask = (1ll << bitWidth(std::max(b1, b2))) - 1;
+    return { isa<OrIOp>(op) ? std::max(a1, a2) : 0, mask };
+  }
+
+  if (isa<LShiftOp>(op)) {
+    if (a2 != b2 || a2 < 0 || a2 > 31)
+      return fullRange;
+    return make(a1 * (1ll << a2), b1 * (1ll << a2));
+  }
+
+  if (isa<RShiftOp>(op)) {
+    if (a2 == b2 && a2 >= 0 && a2 <= 31)
+      return { a1 >> a2, b1 >> a2 };
+    if (a1 >= 0)
+      return { 0, b1 };
+    return fullRange;
+  }
+
+  return fullRange;
 }
 
-void Range::runImpl(Region *region, const LoopForest &forest) {
-  // First make sure the region has only a single exit.
-  std::vector<BasicBlock*> exits;
-  for (auto bb : region->getBlocks()) {
-    if (isa<ReturnOp>(bb->getLastOp()))
-      exits.push_back(bb);
+// Widens `now`, the new range of a phi at a loop header, so that the loop converges quickly.
+// A growing bound goes to the nearest bound that the conditions on incoming edges impose,
+// which usually is the loop's exit test.
+Interval Range::widen(Op *phi, Interval old, Interval now) {
+  auto bb = phi->getParent();
+  std::vector<int64_t> lows = { INT_MIN }, highs = { INT_MAX };
+  const auto &attrs = phi->getAttrs();
+  for (int i = 0; i < phi->getOperandCount(); i++) {
+    auto v = phi->DEF(i);
+    auto from = FROM(attrs[i]);
+
+    auto cap = fullRange;
+    for (auto [cond, holds] : facts[from])
+      cap = apply(v, cap, cond, holds);
+    Fact fact;
+    if (edgeFact(from, bb, fact))
+      cap = apply(v, cap, fact.first, fact.second);
+
+    lows.push_back(cap.low);
+    highs.push_back(cap.high);
   }
-  if (exits.size() > 1) {
-    Builder builder;
-    auto exit = region->appendBlock();
-    builder.setToBlockStart(exit);
 
-    // We have a return value. Create a phi to record it.
-    if (exits[0]->getLastOp()->getOperands().size() > 0) {
-      auto phi = builder.create<PhiOp>();
-      for (auto bb : exits) {
-        auto ret = bb->getLastOp()->getOperand();
-        phi->pushOperand(ret);
-        phi->add<FromAttr>(bb);
+  now = join(old, now);
+  if (now.low < old.low) {
+    int64_t low = INT_MIN;
+    for (auto x : lows) {
+      if (x <= now.low)
+        low = std::max(low, x);
+    }
+    now.low = low;
+  }
+  if (now.high > old.high) {
+    int64_t high = INT_MAX;
+    for (auto x : highs) {
+      if (x >= now.high)
+        high = std::min(high, x);
+    }
+    now.high = high;
+  }
+  return now;
+}
+
+void Range::runImpl(Region *region) {
+  auto tree = getDomTree(region);
+  auto entry = region->getFirstBlock();
+
+  // Blocks in preorder of the dominator tree, so that definitions come before their uses,
+  // except through phis.
+  std::vector<BasicBlock*> order;
+  std::vector<BasicBlock*> worklist { entry };
+  while (!worklist.empty()) {
+    auto bb = worklist.back();
+    worklist.pop_back();
+    order.push_back(bb);
+    for (auto child : tree[bb])
+      worklist.push_back(child);
+  }
+
+  // A block knows what its dominators know, and the branch taken to enter it if it's the only way in.
+  facts.clear();
+  headers.clear();
+  for (auto bb : order) {
+    if (bb != entry)
+      facts[bb] = facts[bb->getIdom()];
+    if (bb->preds.size() == 1) {
+      Fact fact;
+      if (edgeFact(*bb->preds.begin(), bb, fact))
+        facts[bb].push_back(fact);
+    }
+
+    for (auto pred : bb->preds) {
+      if (bb->dominates(pred))
+        headers.insert(bb);
+    }
+  }
+
+  // Start from empty ranges and grow them until nothing changes.
+  ranges.clear();
+  std::map<Op*, int> updates;
+  for (auto bb : order) {
+    for (auto op : bb->getOps()) {
+      if (op->getResultType() == Value::i32 && !isa<IntOp>(op))
+        ranges[op] = emptyRange;
+    }
+  }
+
+  bool changed;
+  do {
+    changed = false;
+    for (auto bb : order) {
+      for (auto op : bb->getOps()) {
+        if (!ranges.count(op))
+          continue;
+
+        auto old = ranges[op];
+        auto now = evaluate(op);
+        if (now == old)
+          continue;
+
+        if (!old.empty()) {
+          if (++updates[op] > maxUpdates)
+            now = fullRange;
+          else if (isa<PhiOp>(op) && headers.count(bb))
+            now = widen(op, old, now);
+          if (now == old)
+            continue;
+        }
+        ranges[op] = now;
+        changed = true;
       }
-      builder.create<ReturnOp>({ phi });
-    } else {
-      // Just a normal return.
-      builder.create<ReturnOp>();
     }
+  } while (changed);
+
+  Builder builder;
+  for (auto bb : order) {
+    auto ops = bb->getOps();
+    for (auto op : ops) {
+      if (!ranges.count(op))
+        continue;
 
-    // Rewire all exits to the new exit.
-    for (auto bb : exits)
-      builder.replace<GotoOp>(bb->getLastOp(), { new TargetAttr(exit) });
+      auto r = ranges[op];
+      if (r.empty())
+        continue;
+
+      if (isCompare(op) && r.low == r.high) {
+        builder.replace<IntOp>(op, { new IntAttr(r.low) });
+        foldedCmps++;
+        continue;
+      }
+
+      if (isa<DivIOp>(op) || isa<ModIOp>(op))
+        op = reduce(op);
+
+      // Attributes of phis must all be FromAttr.
+      if (!isa<PhiOp>(op) && (r.low != INT_MIN || r.high != INT_MAX))
+        op->add<RangeAttr>(r.low, r.high);
+    }
   }
+}
+
+// A non-negative dividend rounds the same toward zero and toward negative infinity,
+// so division and modulo by a power of two become a shift and a mask.
+Op *Range::reduce(Op *op) {
+  auto x = op->DEF(0), y = op->DEF(1);
+  if (!isa<IntOp>(y))
+    return op;
 
-  // Now we can calculate the post-domination tree.
-  region->updatePDoms();
+  int i = V(y);
+  if (i <= 1 || __builtin_popcount(i) != 1 || refine(x, op->getParent()).low < 0)
+    return op;
 
-  // Convert to extended SSA.
-  // E-SSA is first described here: https://dl.acm.org/doi/pdf/10.1145/358438.349342
-  // Also refer to the SSA book, Chapter 13.
-  //
-  // First we need to find out the variables used for condition.
-  
+  reduced++;
+  Builder builder;
+  builder.setBeforeOp(op);
+  if (isa<DivIOp>(op)) {
+    auto amount = builder.create<IntOp>({ new IntAttr(__builtin_ctz(i)) });
+    return builder.replace<RShiftOp>(op, { x, amount });
+  }
+  auto mask = builder.create<IntOp>({ new IntAttr(i - 1) });
+  return builder.replace<AndIOp>(op, { x, mask });
 }
 
 void Range::run() {
-  LoopAnalysis loop(module);
-  loop.run();
-  auto forests = loop.getResult();
-
   auto funcs = collectFuncs();
 
+  // Ranges from an earlier run might no longer hold.
+  for (auto func : funcs) {
+    for (auto bb : func->getRegion()->getBlocks()) {
+      for (auto op : bb->getOps())
+        op->remove<RangeAttr>();
+    }
+  }
+
   for (auto func : funcs)
-    runImpl(func->getRegion(), forests[func]);
+    runImpl(func->getRegion());
 }
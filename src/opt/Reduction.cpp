@@ -0,0 +1,88 @@
+#include "LoopPasses.h"
+
+using namespace sys;
+
+// Integer arithmetic wraps around, so it can be reassociated freely.
+// Float arithmetic can't; it's only taken when `fastMath` is set.
+static bool associative(Op *op, bool fastMath) {
+  if (isa<AddIOp>(op) || isa<SubIOp>(op) || isa<MulIOp>(op) ||
+      isa<AndIOp>(op) || isa<OrIOp>(op) || isa<XorIOp>(op))
+    return true;
+  return fastMath && (isa<AddFOp>(op) || isa<SubFOp>(op) || isa<MulFOp>(op));
+}
+
+std::map<Op*, Reduction> sys::findReductions(LoopInfo *loop, bool fastMath) {
+  std::map<Op*, Reduction> result;
+  auto header = loop->getHeader();
+  if (loop->getLatches().size() != 1)
+    return result;
+
+  auto latch = loop->getLatch();
+  for (auto phi : header->getPhis()) {
+    // SCEV has a closed form for these.
+    if (phi->has<IncreaseAttr>() || phi->getOperandCount() != 2)
+      continue;
+
+    auto update = Op::getPhiFrom(phi, latch);
+    if (!update || !loop->contains(update->getParent()) || !associative(update, fastMath))
+      continue;
+
+    // `phi - x` is a sum of negated values; `x - phi` alternates signs.
+    auto x = update->DEF(0), y = update->DEF(1);
+    if (isa<SubIOp>(update) || isa<SubFOp>(update)) {
+      if (x != phi || y == phi)
+        continue;
+    } else if ((x == phi) == (y == phi))
+      continue;
+
+    // The partial results can't be observed in the middle of the loop.
+    if (phi->getUses().size() != 1)
+      continue;
+    bool observed = false;
+    for (auto use : update->getUses())
+      observed |= use != phi && loop->contains(use->getParent());
+    if (observed)
+      continue;
+
+    result[phi] = Reduction { phi, update, x == phi ? y : x };
+  }
+  return result;
+}
+
+Op *sys::identity(Builder &builder, const Reduction &reduction) {
+  auto op = reduction.update;
+  if (isa<AddFOp>(op) || isa<SubFOp>(op))
+    return builder.create<FloatOp>({ new FloatAttr(0) });
+  if (isa<MulFOp>(op))
+    return builder.create<FloatOp>({ new FloatAttr(1) });
+
+  int value = 0;
+  if (isa<MulIOp>(op))
+    value = 1;
+  if (isa<AndIOp>(op))
+    value = -1;
+  return builder.create<IntOp>({ new IntAttr(value) });
+}
+
+#define COMBINE(Ty) \
+  if (isa<Ty>(op)) \
+    return builder.create<Ty>({ (Value) x, y })
+
+Op *sys::combine(Builder &builder, const Reduction &reduction, Op *x, Op *y) {
+  auto op = reduction.update;
+  // Each part has already subtracted its own values.
+  if (isa<SubIOp>(op))
+    return builder.create<AddIOp>({ (Value) x, y });
+  if (isa<SubFOp>(op))
+    return builder.create<AddFOp>({ (Value) x, y });
+
+  COMBINE(AddIOp);
+  COMBINE(MulIOp);
+  COMBINE(AndIOp);
+  COMBINE(OrIOp);
+  COMBINE(XorIOp);
+  COMBINE(AddFOp);
+
+  assert(isa<MulFOp>(op));
+  return builder.create<MulFOp>({ (Value) x, y });
+}
@@ -252,6 +252,10 @@ void RegularFold::run() {
       for (auto bb : region->getBlocks()) {
         auto ops = bb->getOps();
         for (auto op : ops) {
+          // Folding would drop the mark on no-alias addresses.
+          if (op->has<NoAliasAttr>())
+            continue;
+
           for (auto &rule : rules) {
             bool success = rule.rewrite(op);
             if (success) {
@@ -266,6 +270,31 @@ void RegularFold::run() {
     // Also, run some extra folds.
     Builder builder;
 
+    // (eq (mod x 2^n) 0) becomes (eq (and x 2^n-1) 0), and the same for `ne`.
+    // The remainder is zero exactly when the low bits are, whatever the sign of x.
+    const auto bitTest = [&](Op *op) {
+      auto x = op->DEF(0), y = op->DEF(1);
+      if (isa<IntOp>(x))
+        std::swap(x, y);
+      if (!isa<IntOp>(y) || V(y) != 0 || !isa<ModIOp>(x))
+        return false;
+
+      auto divisor = x->DEF(1);
+      if (!isa<IntOp>(divisor) || V(divisor) <= 1 || __builtin_popcount(V(divisor)) != 1)
+        return false;
+
+      folded++;
+      builder.setBeforeOp(op);
+      auto mask = builder.create<IntOp>({ new IntAttr(V(divisor) - 1) });
+      auto test = builder.create<AndIOp>({ x->DEF(0), mask });
+      op->removeAllOperands();
+      op->pushOperand(test);
+      op->pushOperand(y);
+      return true;
+    };
+    runRewriter([&](EqOp *op) { return bitTest(op); });
+    runRewriter([&](NeOp *op) { return bitTest(op); });
+
     runRewriter([&](BranchOp *op) {
       auto cond = op->DEF();
 
@@ -0,0 +1,396 @@
+#include "Passes.h"
+#include <cstring>
+
+using namespace sys;
+
+using Lattice = SCCP::Lattice;
+
+std::map<std::string, int> SCCP::stats() {
+  return {
+    { "folded-ops", folded },
+    { "folded-branches", foldedBranches },
+  };
+}
+
+bool Lattice::operator==(const Lattice &other) const {
+  if (kind != other.kind)
+    return false;
+  if (kind != Const)
+    return true;
+  if (fp != other.fp)
+    return false;
+  // Compare the bits, so that 0.0 and -0.0 stay apart.
+  return fp ? !memcmp(&vf, &other.vf, sizeof(float)) : vi == other.vi;
+}
+
+namespace {
+
+Lattice bottom() {
+  Lattice x;
+  x.kind = Lattice::Bottom;
+  return x;
+}
+
+Lattice constant(int v) {
+  Lattice x;
+  x.kind = Lattice::Const;
+  x.vi = v;
+  return x;
+}
+
+Lattice constant(float v) {
+  Lattice x;
+  x.kind = Lattice::Const;
+  x.fp = true;
+  x.vf = v;
+  return x;
+}
+
+Lattice meet(const Lattice &a, const Lattice &b) {
+  if (a.kind == Lattice::Top)
+    return b;
+  if (b.kind == Lattice::Top)
+    return a;
+  return a == b ? a : bottom();
+}
+
+#define INT_BINARY(Ty, expr) \
+  if (isa<Ty>(op)) { \
+    int a = v[0].vi, b = v[1].vi; \
+    return constant((int) (expr)); \
+  }
+
+#define FLOAT_BINARY(Ty, expr) \
+  if (isa<Ty>(op)) { \
+    float a = v[0].vf, b = v[1].vf; \
+    return constant(expr); \
+  }
+
+#define FLOAT_CMP(Ty, expr) \
+  if (isa<Ty>(op)) { \
+    float a = v[0].vf, b = v[1].vf; \
+    return constant((int) (expr)); \
+  }
+
+// Folds `op` given the constant values of its operands.
+// Anything that isn't well-defined on the target is left alone.
+Lattice fold(Op *op, const std::vector<Lattice> &v) {
+  // Wrap around like the hardware does.
+  INT_BINARY(AddIOp, (unsigned) a + (unsigned) b);
+  INT_BINARY(SubIOp, (unsigned) a - (unsigned) b);
+  INT_BINARY(MulIOp, (unsigned) a * (unsigned) b);
+  INT_BINARY(AndIOp, a & b);
+  INT_BINARY(OrIOp, a | b);
+  INT_BINARY(XorIOp, a ^ b);
+  INT_BINARY(EqOp, a == b);
+  INT_BINARY(NeOp, a != b);
+  INT_BINARY(LtOp, a < b);
+  INT_BINARY(LeOp, a <= b);
+
+  if (isa<DivIOp>(op) || isa<ModIOp>(op)) {
+    int a = v[0].vi, b = v[1].vi;
+    if (b == 0 || (a == INT_MIN && b == -1))
+      return bottom();
+    return constant(isa<DivIOp>(op) ? a / b : a % b);
+  }
+
+  if (isa<LShiftOp>(op) || isa<RShiftOp>(op)) {
+    int a = v[0].vi, b = v[1].vi;
+    if (b < 0 || b >= 32)
+      return bottom();
+    return constant(isa<LShiftOp>(op) ? (int) ((unsigned) a << b) : a >> b);
+  }
+
+  FLOAT_BINARY(AddFOp, a + b);
+  FLOAT_BINARY(SubFOp, a - b);
+  FLOAT_BINARY(MulFOp, a * b);
+  FLOAT_BINARY(DivFOp, a / b);
+  FLOAT_CMP(EqFOp, a == b);
+  FLOAT_CMP(NeFOp, a != b);
+  FLOAT_CMP(LtFOp, a < b);
+  FLOAT_CMP(LeFOp, a <= b);
+
+  if (isa<MinusOp>(op))
+    return constant((int) (0u - (unsigned) v[0].vi));
+  if (isa<MinusFOp>(op))
+    return constant(-v[0].vf);
+  if (isa<NotOp>(op))
+    return constant((int) (v[0].fp ? v[0].vf == 0 : v[0].vi == 0));
+  if (isa<SetNotZeroOp>(op))
+    return constant((int) (v[0].fp ? v[0].vf != 0 : v[0].vi != 0));
+  if (isa<I2FOp>(op))
+    return constant((float) v[0].vi);
+
+  if (isa<F2IOp>(op)) {
+    // This also rules out NaN.
+    float a = v[0].vf;
+    if (!(a > -2147483904.0f && a < 2147483648.0f))
+      return bottom();
+    return constant((int) a);
+  }
+
+  return bottom();
+}
+
+bool foldable(Op *op) {
+  return
+    isa<AddIOp>(op) || isa<SubIOp>(op) || isa<MulIOp>(op) ||
+    isa<DivIOp>(op) || isa<ModIOp>(op) || isa<AndIOp>(op) ||
+    isa<OrIOp>(op) || isa<XorIOp>(op) || isa<LShiftOp>(op) ||
+    isa<RShiftOp>(op) || isa<EqOp>(op) || isa<NeOp>(op) ||
+    isa<LtOp>(op) || isa<LeOp>(op) || isa<AddFOp>(op) ||
+    isa<SubFOp>(op) || isa<MulFOp>(op) || isa<DivFOp>(op) ||
+    isa<EqFOp>(op) || isa<NeFOp>(op) || isa<LtFOp>(op) ||
+    isa<LeFOp>(op) || isa<MinusOp>(op) || isa<MinusFOp>(op) ||
+    isa<NotOp>(op) || isa<SetNotZeroOp>(op) || isa<I2FOp>(op) ||
+    isa<F2IOp>(op);
+}
+
+// Removes the incoming value of `phi` from `from`.
+void removeIncoming(Op *phi, BasicBlock *from) {
+  const auto &attrs = phi->getAttrs();
+  for (int i = 0; i < attrs.size(); i++) {
+    if (FROM(attrs[i]) == from) {
+      phi->removeOperand(i);
+      phi->removeAttribute(i);
+      return;
+    }
+  }
+}
+
+}
+
+// The algorithm is from Wegman and Zadeck, "Constant Propagation with Conditional Branches".
+// A block is only looked at once an edge into it is found executable,
+// and a phi only merges the values coming through executable edges.
+void SCCP::runImpl(FuncOp *func, bool rewrite) {
+  auto region = func->getRegion();
+
+  std::map<Op*, Lattice> value;
+  std::set<BasicBlock*> reachable;
+  std::set<std::pair<BasicBlock*, BasicBlock*>> executable;
+  std::vector<std::pair<BasicBlock*, BasicBlock*>> cfgWorklist;
+  std::vector<Op*> ssaWorklist;
+
+  const auto evaluate = [&](Op *op) -> Lattice {
+    if (isa<IntOp>(op))
+      return constant(V(op));
+    if (isa<FloatOp>(op))
+      return constant(F(op));
+    if (isa<GetArgOp>(op))
+      return args[NAME(func)][V(op)];
+
+    if (isa<PhiOp>(op)) {
+      Lattice result;
+      const auto &attrs = op->getAttrs();
+      for (int i = 0; i < op->getOperandCount(); i++) {
+        if (executable.count({ FROM(attrs[i]), op->getParent() }))
+          result = meet(result, value[op->DEF(i)]);
+      }
+      return result;
+    }
+
+    if (isa<SelectOp>(op)) {
+      auto cond = value[op->DEF(0)];
+      if (cond.kind == Lattice::Top)
+        return cond;
+      if (cond.kind == Lattice::Const)
+        return value[op->DEF(cond.vi ? 1 : 2)];
+      return meet(value[op->DEF(1)], value[op->DEF(2)]);
+    }
+
+    // The call itself stays; only its result is known.
+    if (isa<CallOp>(op)) {
+      auto it = returns.find(NAME(op));
+      return it == returns.end() ? bottom() : it->second;
+    }
+
+    if (!foldable(op))
+      return bottom();
+
+    std::vector<Lattice> operands;
+    bool top = false;
+    for (auto operand : op->getOperands()) {
+      auto x = value[operand.defining];
+      if (x.kind == Lattice::Bottom)
+        return x;
+      top |= x.kind == Lattice::Top;
+      operands.push_back(x);
+    }
+    if (top)
+      return Lattice();
+    return fold(op, operands);
+  };
+
+  const auto visit = [&](Op *op) {
+    auto bb = op->getParent();
+    if (isa<GotoOp>(op)) {
+      cfgWorklist.push_back({ bb, TARGET(op) });
+      return;
+    }
+    if (isa<BranchOp>(op)) {
+      // An undetermined condition can only come from an undefined value,
+      // which might still be anything at runtime.
+      auto cond = value[op->DEF(0)];
+      if (cond.kind != Lattice::Const || cond.vi)
+        cfgWorklist.push_back({ bb, TARGET(op) });
+      if (cond.kind != Lattice::Const || !cond.vi)
+        cfgWorklist.push_back({ bb, ELSE(op) });
+      return;
+    }
+
+    auto &old = value[op];
+    auto result = meet(old, evaluate(op));
+    if (result == old)
+      return;
+    old = result;
+    for (auto use : op->getUses())
+      ssaWorklist.push_back(use);
+  };
+
+  auto entry = region->getFirstBlock();
+  reachable.insert(entry);
+  for (auto op : entry->getOps())
+    visit(op);
+
+  while (!cfgWorklist.empty() || !ssaWorklist.empty()) {
+    while (!cfgWorklist.empty()) {
+      auto edge = cfgWorklist.back();
+      cfgWorklist.pop_back();
+      if (!executable.insert(edge).second)
+        continue;
+
+      auto bb = edge.second;
+      if (reachable.insert(bb).second) {
+        for (auto op : bb->getOps())
+          visit(op);
+      } else {
+        // Only phis can see the new edge.
+        for (auto phi : bb->getPhis())
+          visit(phi);
+      }
+    }
+
+    while (!ssaWorklist.empty()) {
+      auto op = ssaWorklist.back();
+      ssaWorklist.pop_back();
+      if (reachable.count(op->getParent()))
+        visit(op);
+    }
+  }
+
+  if (!rewrite) {
+    auto &ret = nextReturns[NAME(func)];
+    for (auto bb : reachable) {
+      for (auto op : bb->getOps()) {
+        if (isa<ReturnOp>(op))
+          ret = meet(ret, op->getOperandCount() ? value[op->DEF(0)] : bottom());
+
+        if (!isa<CallOp>(op) || !nextArgs.count(NAME(op)))
+          continue;
+        auto &callee = nextArgs[NAME(op)];
+        for (int i = 0; i < callee.size(); i++)
+          callee[i] = meet(callee[i], value[op->DEF(i)]);
+      }
+    }
+    return;
+  }
+
+  // Branches go first, while their conditions still have a lattice value.
+  Builder builder;
+  for (auto bb : region->getBlocks()) {
+    auto term = bb->getLastOp();
+    if (!reachable.count(bb) || !isa<BranchOp>(term))
+      continue;
+
+    auto cond = value[term->DEF(0)];
+    if (cond.kind != Lattice::Const)
+      continue;
+
+    auto taken = cond.vi ? TARGET(term) : ELSE(term);
+    auto dropped = cond.vi ? ELSE(term) : TARGET(term);
+    if (dropped != taken) {
+      for (auto phi : dropped->getPhis())
+        removeIncoming(phi, bb);
+    }
+    builder.replace<GotoOp>(term, { new TargetAttr(taken) });
+    foldedBranches++;
+  }
+
+  // Blocks never reached are left for DCE, which removes blocks without predecessors.
+  for (auto bb : region->getBlocks()) {
+    if (!reachable.count(bb))
+      continue;
+
+    auto ops = bb->getOps();
+    for (auto op : ops) {
+      if (isa<IntOp>(op) || isa<FloatOp>(op) || !value.count(op))
+        continue;
+
+      const auto &x = value[op];
+      if (x.kind != Lattice::Const || (isa<CallOp>(op) && op->getUses().empty()))
+        continue;
+
+      builder.setBeforeOp(isa<PhiOp>(op) ? nonphi(bb) : op);
+      Op *replacement;
+      if (x.fp)
+        replacement = builder.create<FloatOp>({ new FloatAttr(x.vf) });
+      else
+        replacement = builder.create<IntOp>({ new IntAttr(x.vi) });
+      op->replaceAllUsesWith(replacement);
+      if (!isa<CallOp>(op))
+        op->erase();
+      folded++;
+    }
+  }
+}
+
+void SCCP::run() {
+  auto funcs = collectFuncs();
+
+  // Start from the optimistic assumption that all arguments and return values are constants,
+  // and lower them round by round until nothing changes.
+  for (auto func : funcs) {
+    const auto &name = NAME(func);
+    std::vector<Lattice> init(func->get<ArgCountAttr>()->count);
+    // Nothing is known about what main() is called with.
+    // Parallel workers get their range from the runtime, and the rest through memory.
+    if (name == "main" || func->has<ParallelAttr>())
+      init.assign(init.size(), bottom());
+    args[name] = init;
+    returns[name] = Lattice();
+  }
+
+  bool changed;
+  do {
+    nextArgs.clear();
+    nextReturns.clear();
+    for (auto func : funcs) {
+      const auto &name = NAME(func);
+      nextReturns[name] = Lattice();
+      // These are never changed by call sites.
+      if (name == "main" || func->has<ParallelAttr>())
+        continue;
+      nextArgs[name] = std::vector<Lattice>(func->get<ArgCountAttr>()->count);
+    }
+
+    for (auto func : funcs)
+      runImpl(func, /*rewrite=*/ false);
+
+    changed = false;
+    for (auto func : funcs) {
+      const auto &name = NAME(func);
+      if (nextArgs.count(name) && nextArgs[name] != args[name]) {
+        args[name] = nextArgs[name];
+        changed = true;
+      }
+      if (!(nextReturns[name] == returns[name])) {
+        returns[name] = nextReturns[name];
+        changed = true;
+      }
+    }
+  } while (changed);
+
+  for (auto func : funcs)
+    runImpl(func, /*rewrite=*/ true);
+}
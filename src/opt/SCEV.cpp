@@ -1,12 +1,16 @@
 #include "LoopPasses.h"
 #include "CleanupPasses.h"
 #include "../utils/Matcher.h"
+#include <functional>
+#include <optional>
 
 using namespace sys;
 
 std::map<std::string, int> SCEV::stats() {
   return {
-    { "expanded", expanded }
+    { "expanded", expanded },
+    { "final-values", replaced },
+    { "deleted-loops", deleted },
   };
 }
 
@@ -58,17 +62,23 @@ void SCEV::rewrite(BasicBlock *bb, LoopInfo *info) {
     if (isa<SubIOp>(op)) {
       auto x = op->DEF(0);
       auto y = op->DEF(1);
+      bool negated = false;
       if (!x->has<IncreaseAttr>()) {
         if (y->has<IncreaseAttr>())
-          std::swap(x, y);
+          std::swap(x, y), negated = true;
         else
           continue;
       }
 
-      // Case 1. x - <invariant>
+      // Case 1. x - <invariant>, or <invariant> - x which goes the other way.
       if (y->getParent()->dominates(preheader)) {
         start[y] = y;
-        op->add<IncreaseAttr>(INCR(x)->amt);
+        auto amt = INCR(x)->amt;
+        if (negated) {
+          for (auto &v : amt)
+            v = -v;
+        }
+        op->add<IncreaseAttr>(amt);
         continue;
       }
     }
@@ -167,7 +177,11 @@ void SCEV::rewrite(BasicBlock *bb, LoopInfo *info) {
       assert(false);
     }
 
-    builder.setBeforeOp(op);
+    // The increment must reach the latch, even if `op` is only run conditionally.
+    if (op->getParent()->dominates(latch))
+      builder.setBeforeOp(op);
+    else
+      builder.setBeforeOp(latch->getLastOp());
     auto vi = builder.create<IntOp>({ new IntAttr(amt[0]) });
 
     Op *add = builder.create<AddLOp>({ phi, vi });
@@ -286,7 +300,10 @@ void SCEV::runImpl(LoopInfo *info) {
     mod->replaceAllUsesWith(addl);
 
     // Create a mod at the beginning of exit.
+    // A constant modulus might be inside the loop, which doesn't dominate the exit.
     builder.setBeforeOp(insert);
+    if (isa<IntOp>(v))
+      v = builder.create<IntOp>({ new IntAttr(V(v)) });
     auto modl = builder.create<ModLOp>(mod->getAttrs());
     latchphi->replaceAllUsesWith(modl);
     // We must push operands later, otherwise the operand itself will also be replaced.
@@ -373,13 +390,441 @@ void SCEV::discardIv(LoopInfo *info) {
   auto mul = builder.create<MulIOp>({ diff, vi });
   auto end = builder.create<AddLOp>({ start, mul });
 
-  // Replace the operand of the `br` to test (phi < end) instead.
+  // Replace the operand of the `br` to test (phi < end) instead,
+  // or (end < phi) if the candidate goes down.
   auto term = latch->getLastOp();
   builder.setBeforeOp(term);
-  auto cond = builder.create<LtOp>({ after, end });
+  Op *cond;
+  if (V(vi) > 0)
+    cond = builder.create<LtOp>({ after, end });
+  else
+    cond = builder.create<LtOp>({ end, after });
   term->setOperand(0, cond);
 }
 
+// Loops running longer than this aren't summed up at compile time.
+static constexpr int maxSimulated = 1 << 22;
+
+// Looks through single-operand phis.
+static Op *strip(Op *op) {
+  while (isa<PhiOp>(op) && op->getOperandCount() == 1)
+    op = op->DEF(0);
+  return op;
+}
+
+bool sys::guarded(LoopInfo *info) {
+  auto preheader = info->getPreheader();
+  if (!info->getStart() || !info->getStop() || preheader->preds.size() != 1)
+    return false;
+
+  // Skip the blocks that only pass control on, like the ones CanonicalizeLoop inserts.
+  auto bb = preheader;
+  auto guard = *bb->preds.begin();
+  while (isa<GotoOp>(guard->getLastOp()) && guard->preds.size() == 1) {
+    bb = guard;
+    guard = *bb->preds.begin();
+  }
+
+  auto term = guard->getLastOp();
+  if (!isa<BranchOp>(term) || TARGET(term) != bb || ELSE(term) == bb)
+    return false;
+
+  auto cond = term->DEF(0);
+  return isa<LtOp>(cond)
+    && strip(cond->DEF(0)) == strip(info->getStart())
+    && strip(cond->DEF(1)) == strip(info->getStop());
+}
+
+namespace {
+
+// A polynomial of the iteration number, with loop-invariant coefficients.
+// Null coefficients are zeros.
+using Poly = std::vector<Op*>;
+
+// Emits arithmetic on invariants before `before`, folding constants on the way.
+// All of it wraps around like the i32 arithmetic in the loop.
+// Whatever ends up unused, e.g. because the rewrite bails out halfway, is erased on destruction.
+class Emitter {
+  Builder builder;
+  std::vector<Op*> emitted;
+
+  template<class T>
+  Op *create(const std::vector<Value> &v, const std::vector<Attr*> &attrs = {}) {
+    auto op = builder.create<T>(v, attrs);
+    emitted.push_back(op);
+    return op;
+  }
+public:
+  Emitter(Op *before) { builder.setBeforeOp(before); }
+
+  // Users are emitted after their operands, so go backwards.
+  ~Emitter() {
+    for (auto it = emitted.rbegin(); it != emitted.rend(); it++) {
+      if ((*it)->getUses().empty())
+        (*it)->erase();
+    }
+  }
+
+  Op *constant(int v) {
+    return create<IntOp>({}, { new IntAttr(v) });
+  }
+
+  Op *add(Op *a, Op *b) {
+    if (!a || !b)
+      return a ? a : b;
+    if (isa<IntOp>(a) && isa<IntOp>(b))
+      return constant((unsigned) V(a) + (unsigned) V(b));
+    return create<AddIOp>({ (Value) a, (Value) b });
+  }
+
+  Op *sub(Op *a, Op *b) {
+    if (!b)
+      return a;
+    if (!a)
+      a = constant(0);
+    if (isa<IntOp>(a) && isa<IntOp>(b))
+      return constant((unsigned) V(a) - (unsigned) V(b));
+    return create<SubIOp>({ (Value) a, (Value) b });
+  }
+
+  Op *mul(Op *a, Op *b) {
+    if (!a || !b)
+      return nullptr;
+    if (isa<IntOp>(a) && isa<IntOp>(b))
+      return constant((unsigned) V(a) * (unsigned) V(b));
+    if (isa<IntOp>(a) && V(a) == 1)
+      return b;
+    if (isa<IntOp>(b) && V(b) == 1)
+      return a;
+    return create<MulIOp>({ (Value) a, (Value) b });
+  }
+
+  Op *andi(Op *a, int v) {
+    Value mask = constant(v);
+    return create<AndIOp>({ (Value) a, mask });
+  }
+
+  Op *shr(Op *a, int v) {
+    Value amount = constant(v);
+    return create<RShiftOp>({ (Value) a, amount });
+  }
+
+  Op *addl(Op *a, Op *b) {
+    if (isa<IntOp>(a) && V(a) == 0)
+      return b;
+    return create<AddLOp>({ (Value) a, (Value) b });
+  }
+
+  // Builds an i64 constant out of non-negative 30-bit pieces,
+  // as the backends differ in how they extend i32 operands.
+  Op *constantL(int64_t v) {
+    uint64_t u = v;
+    if (u < (1u << 30))
+      return constant(u);
+
+    Op *result = nullptr;
+    Value unit = constant(1 << 30);
+    for (int shift = 60; shift >= 0; shift -= 30) {
+      if (result)
+        result = create<MulLOp>({ (Value) result, unit });
+      int piece = (u >> shift) & ((1 << 30) - 1);
+      if (piece)
+        result = result ? addl(result, constant(piece)) : constant(piece);
+    }
+    return result;
+  }
+};
+
+Poly add(Emitter &em, const Poly &a, const Poly &b) {
+  Poly result(std::max(a.size(), b.size()));
+  for (int i = 0; i < result.size(); i++)
+    result[i] = em.add(i < a.size() ? a[i] : nullptr, i < b.size() ? b[i] : nullptr);
+  return result;
+}
+
+Poly neg(Emitter &em, const Poly &a) {
+  Poly result;
+  for (auto x : a)
+    result.push_back(em.sub(nullptr, x));
+  return result;
+}
+
+// Only products up to quadratic ones are kept.
+std::optional<Poly> mul(Emitter &em, const Poly &a, const Poly &b) {
+  if (a.size() + b.size() - 1 > 3)
+    return std::nullopt;
+
+  Poly result(a.size() + b.size() - 1);
+  for (int i = 0; i < a.size(); i++) {
+    for (int j = 0; j < b.size(); j++)
+      result[i + j] = em.add(result[i + j], em.mul(a[i], b[j]));
+  }
+  return result;
+}
+
+Op *evaluate(Emitter &em, const Poly &a, Op *k) {
+  Op *result = nullptr;
+  for (int i = a.size() - 1; i >= 0; i--)
+    result = em.add(em.mul(result, k), a[i]);
+  return result ? result : em.constant(0);
+}
+
+// The sum of k over [0, n).
+Op *sum1(Emitter &em, Op *n) {
+  if (isa<IntOp>(n)) {
+    uint64_t x = (unsigned) V(n);
+    return em.constant(x * (x - 1) / 2);
+  }
+
+  // One of n and n - 1 is even. Halve that one, so nothing is lost to wrapping.
+  auto half = em.andi(em.shr(n, 1), INT_MAX);
+  auto other = em.add(em.sub(n, em.constant(1)), em.andi(n, 1));
+  return em.mul(half, other);
+}
+
+// The sum of k^2 over [0, n), which is sum1(n) * (2n - 1) / 3.
+Op *sum2(Emitter &em, Op *n) {
+  if (isa<IntOp>(n)) {
+    __int128 x = (unsigned) V(n);
+    return em.constant((uint32_t) (x * (x - 1) * (2 * x - 1) / 6));
+  }
+
+  // The division is exact, so it's a multiplication by the inverse of 3 modulo 2^32.
+  auto twice = em.sub(em.mul(n, em.constant(2)), em.constant(1));
+  return em.mul(em.mul(sum1(em, n), twice), em.constant(0xAAAAAAAB));
+}
+
+// The sum of `a` over the iterations [0, n).
+Op *sum(Emitter &em, const Poly &a, Op *n) {
+  Op *terms[] = { n, sum1(em, n), sum2(em, n) };
+  Op *result = nullptr;
+  for (int i = 0; i < a.size(); i++)
+    result = em.add(result, em.mul(a[i], terms[i]));
+  return result;
+}
+
+// A phi at the header that adds `incr` in every iteration.
+struct Accumulator {
+  Op *init;
+  Poly incr;
+  // Whether it's an i64, whose increments are sign-extended.
+  bool wide;
+};
+
+}
+
+// Replaces
+//
+//   for (i = start; i < stop; i++) s += f(i)
+//
+// with the closed form of `s` after the loop, where `f` is at most quadratic.
+// The loop is deleted if nothing else in it matters.
+bool SCEV::finalValues(LoopInfo *info) {
+  if (info->getLatches().size() > 1 || info->getExits().size() != 1 || info->getExitingBlocks().size() != 1)
+    return false;
+
+  auto preheader = info->getPreheader();
+  auto header = info->getHeader();
+  auto latch = info->getLatch();
+  auto iv = info->getInduction();
+  if (!preheader || !iv || !isa<GotoOp>(preheader->getLastOp()))
+    return false;
+
+  // The loop must be rotated and only exit at the latch,
+  // which checks `(lt (addi iv step) stop)`.
+  auto term = latch->getLastOp();
+  auto start = info->getStart(), stop = info->getStop();
+  int step = info->getStep();
+  if (!isa<BranchOp>(term) || TARGET(term) != header || step <= 0 || !stop)
+    return false;
+  if (info->contains(stop->getParent()) || !stop->getParent()->dominates(preheader))
+    return false;
+
+  auto cond = term->DEF(0);
+  auto next = Op::getPhiFrom(iv, latch);
+  if (!isa<LtOp>(cond) || cond->DEF(0) != next || cond->DEF(1) != stop)
+    return false;
+  if (!isa<AddIOp>(next) || next->DEF(0) != iv || !isa<IntOp>(next->DEF(1)) || V(next->DEF(1)) != step)
+    return false;
+
+  // Find out the trip count. A rotated loop runs at least once.
+  Emitter em(preheader->getLastOp());
+  Op *n;
+  std::optional<int64_t> count;
+  auto s = strip(start), e = strip(stop);
+  if (isa<IntOp>(s) && isa<IntOp>(e)) {
+    count = std::max<int64_t>(1, ((int64_t) V(e) - V(s) + step - 1) / step);
+    n = em.constant(*count);
+  } else if (step == 1 && guarded(info))
+    n = em.sub(stop, start);
+  else
+    return false;
+
+  std::map<Op*, std::optional<Poly>> polys;
+  std::function<std::optional<Poly>(Op*)> poly = [&](Op *op) -> std::optional<Poly> {
+    if (polys.count(op))
+      return polys[op];
+
+    std::optional<Poly> result;
+    if (!info->contains(op->getParent())) {
+      if (isa<IntOp>(strip(op)))
+        result = Poly { em.constant(V(strip(op))) };
+      else if (op->getResultType() == Value::i32 && op->getParent()->dominates(preheader))
+        result = Poly { op };
+    } else if (isa<IntOp>(op))
+      result = Poly { em.constant(V(op)) };
+    else if (op == iv) {
+      if (auto init = poly(start))
+        result = Poly { (*init)[0], em.constant(step) };
+    }
+    else if (isa<AddIOp>(op) || isa<SubIOp>(op) || isa<MulIOp>(op)) {
+      auto x = poly(op->DEF(0)), y = poly(op->DEF(1));
+      if (x && y && isa<AddIOp>(op))
+        result = add(em, *x, *y);
+      if (x && y && isa<SubIOp>(op))
+        result = add(em, *x, neg(em, *y));
+      if (x && y && isa<MulIOp>(op))
+        result = mul(em, *x, *y);
+    }
+    return polys[op] = result;
+  };
+
+  // Finds `incr` such that `op = phi + incr`.
+  std::function<std::optional<Poly>(Op*, Op*)> offset = [&](Op *op, Op *phi) -> std::optional<Poly> {
+    if (op == phi)
+      return Poly {};
+    if (!isa<AddIOp>(op) && !isa<SubIOp>(op))
+      return std::nullopt;
+
+    Op *x = op->DEF(0), *y = op->DEF(1);
+    auto incr = offset(x, phi);
+    if (!incr && !isa<SubIOp>(op)) {
+      std::swap(x, y);
+      incr = offset(x, phi);
+    }
+    auto rest = poly(y);
+    if (!incr || !rest)
+      return std::nullopt;
+    return add(em, *incr, isa<SubIOp>(op) ? neg(em, *rest) : *rest);
+  };
+
+  // Find the accumulators, and the updates to them.
+  std::map<Op*, Accumulator> accs;
+  std::map<Op*, Op*> updates;
+  for (auto phi : header->getPhis()) {
+    if (phi == iv || phi->getOperandCount() != 2)
+      continue;
+
+    // An i64 accumulator must be updated by a single `addl`,
+    // otherwise its increments aren't simply extended.
+    auto update = Op::getPhiFrom(phi, latch);
+    bool wide = isa<AddLOp>(update);
+    if (wide && update->DEF(0) != phi)
+      continue;
+
+    auto incr = wide ? poly(update->DEF(1)) : offset(update, phi);
+    if (!incr || update == phi)
+      continue;
+
+    accs[phi] = { Op::getPhiFrom(phi, preheader), *incr, wide };
+    updates[update] = phi;
+  }
+
+  // The value of an accumulator after `iters` iterations.
+  auto accumulate = [&](const Accumulator &acc, Op *iters, std::optional<int64_t> known) -> Op* {
+    if (!acc.wide)
+      return em.add(acc.init, sum(em, acc.incr, iters));
+
+    // Each increment is truncated to i32 before being extended.
+    // No closed form for that, so just add them up when possible.
+    if (!known || *known > maxSimulated)
+      return nullptr;
+    int c[3] = { 0, 0, 0 };
+    for (int i = 0; i < acc.incr.size(); i++) {
+      if (acc.incr[i] && !isa<IntOp>(acc.incr[i]))
+        return nullptr;
+      c[i] = acc.incr[i] ? V(acc.incr[i]) : 0;
+    }
+    uint64_t total = 0;
+    for (uint32_t k = 0; k < *known; k++)
+      total += (int64_t) (int32_t) (c[0] + c[1] * k + c[2] * k * k);
+    return em.addl(acc.init, em.constantL(total));
+  };
+
+  // The values in the last iteration.
+  auto last = em.sub(n, em.constant(1));
+  std::optional<int64_t> lastCount;
+  if (count)
+    lastCount = *count - 1;
+
+  auto finalValue = [&](Op *op) -> Op* {
+    if (accs.count(op))
+      return accumulate(accs[op], last, lastCount);
+    if (updates.count(op))
+      return accumulate(accs[updates[op]], n, count);
+    if (!op->getParent()->dominates(latch))
+      return nullptr;
+    if (auto p = poly(op))
+      return evaluate(em, *p, last);
+    return nullptr;
+  };
+
+  // Replace the uses outside the loop. Go in the order of blocks to keep the output stable.
+  bool dead = true;
+  for (auto bb : header->getParent()->getBlocks()) {
+    if (!info->contains(bb))
+      continue;
+
+    for (auto op : bb->getOps()) {
+      std::vector<Op*> outside;
+      for (auto use : op->getUses()) {
+        if (!info->contains(use->getParent()))
+          outside.push_back(use);
+      }
+      if (outside.empty())
+        continue;
+
+      auto value = finalValue(op);
+      if (!value) {
+        dead = false;
+        continue;
+      }
+
+      for (auto use : outside) {
+        for (int i = 0; i < use->getOperandCount(); i++) {
+          if (use->DEF(i) == op)
+            use->setOperand(i, value);
+        }
+      }
+      replaced++;
+    }
+  }
+
+  if (!dead)
+    return false;
+
+  for (auto bb : info->getBlocks()) {
+    for (auto op : bb->getOps()) {
+      if (isa<StoreOp>(op) || isa<VStoreOp>(op) || (isa<CallOp>(op) && op->has<ImpureAttr>()))
+        return false;
+    }
+  }
+
+  // Nothing in the loop is needed anymore. Jump over it.
+  auto exit = info->getExit();
+  Builder builder;
+  builder.replace<GotoOp>(preheader->getLastOp(), { new TargetAttr(exit) });
+  for (auto phi : exit->getPhis()) {
+    for (auto attr : phi->getAttrs()) {
+      auto &from = cast<FromAttr>(attr)->bb;
+      if (from == latch)
+        from = preheader;
+    }
+  }
+  deleted++;
+  return true;
+}
+
 void SCEV::run() {
   LoopAnalysis analysis(module);
   analysis.run();
@@ -400,12 +845,28 @@ void SCEV::run() {
 
   // return;
   AggressiveDCE(module).run();
+
+  std::set<LoopInfo*> removed;
   for (auto func : funcs) {
     const auto &forest = forests[func];
 
     for (auto loop : forest.getLoops()) {
-      if (!loop->getSubloops().size())
+      if (!loop->getSubloops().size() && finalValues(loop))
+        removed.insert(loop);
+    }
+    func->getRegion()->updatePreds();
+  }
+
+  for (auto func : funcs) {
+    const auto &forest = forests[func];
+
+    for (auto loop : forest.getLoops()) {
+      if (!loop->getSubloops().size() && !removed.count(loop))
         discardIv(loop);
     }
   }
+
+  // Clean up the deleted loops.
+  if (deleted)
+    DCE(module).run();
 }
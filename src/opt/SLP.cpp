@@ -0,0 +1,398 @@
+#include "LowerPasses.h"
+#include "Analysis.h"
+#include <deque>
+
+using namespace sys;
+
+std::map<std::string, int> SLP::stats() {
+  return {
+    { "packs", packed },
+  };
+}
+
+namespace {
+
+constexpr int lanes = 4;
+
+// A pack of 4 scalars that becomes one vector value.
+struct Node {
+  enum Kind { Arith, Load, Splat } kind;
+  std::vector<Op*> scalars;
+  std::vector<Node*> operands;
+};
+
+// A memory access. `base` and `offset` come from the address arithmetic;
+// `alias` is used when the bases differ.
+struct Access {
+  Op *base;
+  int offset;
+  int size;
+  AliasAttr *alias;
+};
+
+bool isArith(Op *op) {
+  return isa<AddIOp>(op) || isa<SubIOp>(op) || isa<MulIOp>(op) ||
+    isa<AddFOp>(op) || isa<SubFOp>(op) || isa<MulFOp>(op);
+}
+
+bool isCommutative(Op *op) {
+  return isa<AddIOp>(op) || isa<MulIOp>(op) || isa<AddFOp>(op) || isa<MulFOp>(op);
+}
+
+bool isScalar(Op *op) {
+  auto ty = op->getResultType();
+  return ty == Value::i32 || ty == Value::f32;
+}
+
+// Splits `addr` into `base + constant`.
+std::pair<Op*, int> locate(Op *addr) {
+  int offset = 0;
+  while (isa<AddLOp>(addr)) {
+    auto x = addr->DEF(0), y = addr->DEF(1);
+    if (isa<IntOp>(x))
+      std::swap(x, y);
+    if (!isa<IntOp>(y))
+      break;
+    offset += V(y);
+    addr = x;
+  }
+  return { addr, offset };
+}
+
+Op *addressOf(Op *op) {
+  return isa<StoreOp>(op) || isa<VStoreOp>(op) ? op->DEF(1) : op->DEF(0);
+}
+
+Access accessOf(Op *op) {
+  bool vector = isa<VLoadOp>(op) || isa<VStoreOp>(op);
+  auto addr = addressOf(op);
+  auto [base, offset] = locate(addr);
+  // A vector access carries the alias of all its lanes.
+  auto alias = vector ? op->find<AliasAttr>() : addr->find<AliasAttr>();
+  return { base, offset, vector ? 16 : (int) SIZE(op), alias };
+}
+
+bool mayConflict(const Access &a, const Access &b) {
+  if (a.base == b.base)
+    return a.offset < b.offset + b.size && b.offset < a.offset + a.size;
+  return !(a.alias && b.alias && a.alias->neverAlias(b.alias));
+}
+
+bool isMemory(Op *op) {
+  return isa<LoadOp>(op) || isa<StoreOp>(op) || isa<VLoadOp>(op) || isa<VStoreOp>(op);
+}
+
+bool isWrite(Op *op) {
+  return isa<StoreOp>(op) || isa<VStoreOp>(op);
+}
+
+// What an operand must agree on across lanes to be packed with its neighbours.
+std::pair<int, Op*> shape(Op *op, BasicBlock *bb) {
+  if (isa<LoadOp>(op))
+    return { op->opid, locate(op->DEF()).first };
+  if (op->getParent() != bb || isa<IntOp>(op) || isa<FloatOp>(op))
+    return { op->opid, op };
+  return { op->opid, nullptr };
+}
+
+Value::Type vectorType(Op *op) {
+  return op->getResultType() == Value::f32 ? Value::f128 : Value::i128;
+}
+
+Op *createVector(Builder &builder, Op *op, const std::vector<Value> &operands) {
+  if (isa<AddIOp>(op))
+    return builder.create<VAddIOp>(operands);
+  if (isa<SubIOp>(op))
+    return builder.create<VSubIOp>(operands);
+  if (isa<MulIOp>(op))
+    return builder.create<VMulIOp>(operands);
+  if (isa<AddFOp>(op))
+    return builder.create<VAddFOp>(operands);
+  if (isa<SubFOp>(op))
+    return builder.create<VSubFOp>(operands);
+  if (isa<MulFOp>(op))
+    return builder.create<VMulFOp>(operands);
+  assert(false);
+  return nullptr;
+}
+
+// The alias of a vector access is the union of its lanes.
+// If any lane is unknown, so is the whole.
+AliasAttr *unionAlias(const std::vector<Op*> &accesses) {
+  decltype(AliasAttr::location) location;
+  for (auto op : accesses) {
+    auto lane = addressOf(op)->find<AliasAttr>();
+    if (!lane || lane->unknown)
+      return new AliasAttr();
+    for (auto &[base, offsets] : lane->location) {
+      auto &merged = location[base];
+      merged.insert(merged.end(), offsets.begin(), offsets.end());
+    }
+  }
+  return new AliasAttr(location);
+}
+
+class Packer {
+  BasicBlock *bb;
+  std::map<std::vector<Op*>, Node*> nodes;
+  // Deque keeps the addresses stable.
+  std::deque<Node> owned;
+
+  Node *make(Node::Kind kind, const std::vector<Op*> &scalars) {
+    owned.push_back(Node { kind, scalars, {} });
+    return nodes[scalars] = &owned.back();
+  }
+public:
+  Packer(BasicBlock *bb): bb(bb) {}
+
+  // Builds the tree of packs bottom-up, from the values being stored.
+  // Returns null if the scalars can't be packed.
+  Node *build(const std::vector<Op*> &scalars);
+};
+
+Node *Packer::build(const std::vector<Op*> &scalars) {
+  if (nodes.count(scalars))
+    return nodes[scalars];
+
+  auto first = scalars[0];
+  if (!isScalar(first))
+    return nullptr;
+  if (std::all_of(scalars.begin(), scalars.end(), [&](Op *op) { return op == first; }))
+    return make(Node::Splat, scalars);
+
+  for (auto op : scalars) {
+    if (op->opid != first->opid || op->getParent() != bb || op->getResultType() != first->getResultType())
+      return nullptr;
+  }
+  if (std::set<Op*>(scalars.begin(), scalars.end()).size() != lanes)
+    return nullptr;
+
+  // Adjacent loads from the same base.
+  if (isa<LoadOp>(first)) {
+    auto [base, offset] = locate(first->DEF());
+    for (int i = 0; i < lanes; i++) {
+      if (SIZE(scalars[i]) != 4 || locate(scalars[i]->DEF()) != std::make_pair(base, offset + 4 * i))
+        return nullptr;
+    }
+    return make(Node::Load, scalars);
+  }
+
+  if (!isArith(first))
+    return nullptr;
+
+  // Swap the operands of commutative ops if that makes the lanes look alike.
+  std::vector<Op*> lhs, rhs;
+  auto l0 = shape(first->DEF(0), bb), r0 = shape(first->DEF(1), bb);
+  for (auto op : scalars) {
+    auto x = op->DEF(0), y = op->DEF(1);
+    if (isCommutative(op) && (shape(x, bb) != l0 || shape(y, bb) != r0) &&
+        shape(y, bb) == l0 && shape(x, bb) == r0)
+      std::swap(x, y);
+    lhs.push_back(x);
+    rhs.push_back(y);
+  }
+
+  auto left = build(lhs);
+  if (!left)
+    return nullptr;
+  auto right = build(rhs);
+  if (!right)
+    return nullptr;
+
+  auto node = make(Node::Arith, scalars);
+  node->operands = { left, right };
+  return node;
+}
+
+// Post-order, with each node visited once.
+void collect(Node *node, std::set<Node*> &visited, std::vector<Node*> &order) {
+  if (!visited.insert(node).second)
+    return;
+  for (auto operand : node->operands)
+    collect(operand, visited, order);
+  order.push_back(node);
+}
+
+}
+
+// Packs 4 stores to adjacent addresses, and whatever computes the stored values, into vector ops.
+//
+//   store (add (load b+0) (load c+0)) a+0
+//   ...
+//   store (add (load b+12) (load c+12)) a+12
+//
+// becomes
+//
+//   vstore (vadd (vload b) (vload c)) a
+//
+// The vector ops are placed at the last of the stores.
+// So the loads are delayed and the stores are sunk; neither may cross an access that might overlap.
+// Scalars used outside the tree are not packed, as there's no way to extract a lane.
+bool SLP::tryPack(BasicBlock *bb, const std::vector<Op*> &stores) {
+  std::vector<Op*> values;
+  for (auto store : stores)
+    values.push_back(store->DEF(0));
+
+  Packer packer(bb);
+  auto root = packer.build(values);
+  if (!root)
+    return false;
+
+  std::set<Node*> visited;
+  std::vector<Node*> order;
+  collect(root, visited, order);
+
+  // Cost model: each scalar op removed saves 1, each vector op costs 1,
+  // and a splat costs 2 as it moves a value across register files.
+  int scalarCost = lanes, vectorCost = 1;
+  std::set<Op*> removed(stores.begin(), stores.end());
+  for (auto node : order) {
+    if (node->kind == Node::Splat) {
+      vectorCost += 2;
+      continue;
+    }
+    scalarCost += lanes;
+    vectorCost++;
+    // A scalar in two packs would have to be erased twice.
+    for (auto op : node->scalars) {
+      if (!removed.insert(op).second)
+        return false;
+    }
+  }
+  if (vectorCost >= scalarCost - 1)
+    return false;
+
+  for (auto op : removed) {
+    for (auto use : op->getUses()) {
+      if (!removed.count(use))
+        return false;
+    }
+  }
+
+  std::map<Op*, int> pos;
+  int i = 0;
+  for (auto op : bb->getOps())
+    pos[op] = i++;
+
+  Op *last = stores[0];
+  for (auto store : stores) {
+    if (pos[store] > pos[last])
+      last = store;
+  }
+
+  const auto conflicts = [&](Op *x, Op *y) {
+    return mayConflict(accessOf(x), accessOf(y));
+  };
+
+  std::vector<Op*> ops(bb->getOps().begin(), bb->getOps().end());
+  for (auto node : order) {
+    if (node->kind != Node::Load)
+      continue;
+
+    // A load now reads memory at `last`, before any of the packed stores.
+    for (auto load : node->scalars) {
+      for (auto store : stores) {
+        if (pos[store] < pos[load] && conflicts(store, load))
+          return false;
+      }
+      for (int j = pos[load] + 1; j < pos[last]; j++) {
+        auto op = ops[j];
+        if (isa<CallOp>(op) || isWrite(op) && !removed.count(op) && conflicts(op, load))
+          return false;
+      }
+    }
+  }
+
+  for (auto store : stores) {
+    for (int j = pos[store] + 1; j < pos[last]; j++) {
+      auto op = ops[j];
+      if (isa<CallOp>(op))
+        return false;
+      if (!isMemory(op) || removed.count(op))
+        continue;
+      if (conflicts(op, store))
+        return false;
+    }
+  }
+
+  Builder builder;
+  builder.setBeforeOp(last);
+  std::map<Node*, Op*> vmap;
+  for (auto node : order) {
+    auto first = node->scalars[0];
+    switch (node->kind) {
+    case Node::Splat:
+      vmap[node] = builder.create<VSplatOp>(vectorType(first), { first });
+      break;
+    case Node::Load:
+      vmap[node] = builder.create<VLoadOp>(vectorType(first), { first->DEF() }, { unionAlias(node->scalars) });
+      break;
+    case Node::Arith: {
+      std::vector<Value> operands;
+      for (auto operand : node->operands)
+        operands.push_back(vmap[operand]);
+      vmap[node] = createVector(builder, first, operands);
+      break;
+    }
+    }
+  }
+  builder.create<VStoreOp>({ (Value) vmap[root], stores[0]->DEF(1) }, { unionAlias(stores) });
+
+  // Users go before what they use.
+  for (auto store : stores)
+    store->erase();
+  for (auto it = order.rbegin(); it != order.rend(); it++) {
+    if ((*it)->kind == Node::Splat)
+      continue;
+    for (auto op : (*it)->scalars)
+      op->erase();
+  }
+  return true;
+}
+
+// Finds runs of 4 stores at base+k, base+k+4, base+k+8 and base+k+12.
+void SLP::runImpl(BasicBlock *bb) {
+  std::map<Op*, std::map<int, std::vector<Op*>>> byBase;
+  for (auto op : bb->getOps()) {
+    if (!isa<StoreOp>(op) || SIZE(op) != 4 || !isScalar(op->DEF(0)))
+      continue;
+    auto [base, offset] = locate(op->DEF(1));
+    byBase[base][offset].push_back(op);
+  }
+
+  // Stores that have been packed, and are thus erased.
+  std::set<Op*> done;
+  for (const auto &[base, byOffset] : byBase) {
+    for (const auto &[offset, _] : byOffset) {
+      std::vector<Op*> stores;
+      for (int i = 0; i < lanes; i++) {
+        auto it = byOffset.find(offset + 4 * i);
+        // Two stores to the same address leave it unclear which one to pack.
+        if (it == byOffset.end() || it->second.size() != 1 || done.count(it->second[0]))
+          break;
+        stores.push_back(it->second[0]);
+      }
+      if (stores.size() != lanes)
+        continue;
+
+      auto ty = stores[0]->DEF(0)->getResultType();
+      if (std::any_of(stores.begin(), stores.end(), [&](Op *op) { return op->DEF(0)->getResultType() != ty; }))
+        continue;
+
+      if (tryPack(bb, stores)) {
+        packed++;
+        done.insert(stores.begin(), stores.end());
+      }
+    }
+  }
+}
+
+void SLP::run() {
+  Alias(module).run();
+
+  auto funcs = collectFuncs();
+  for (auto func : funcs) {
+    for (auto bb : func->getRegion()->getBlocks())
+      runImpl(bb);
+  }
+}
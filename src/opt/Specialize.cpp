@@ -0,0 +1,260 @@
+#include "Passes.h"
+#include <cstring>
+
+using namespace sys;
+
+std::map<std::string, int> Specialize::stats() {
+  return {
+    { "cloned-functions", cloned },
+    { "specialized-calls", specialized },
+  };
+}
+
+namespace {
+
+// Functions larger than this aren't cloned.
+constexpr int maxFuncSize = 400;
+// The total number of ops the module can grow by.
+constexpr int maxGrowth = 1500;
+// The number of copies made of a single function.
+constexpr int maxClones = 4;
+// A copy must simplify at least this many ops.
+constexpr int minBenefit = 2;
+
+int size(FuncOp *func) {
+  int count = 0;
+  for (auto bb : func->getRegion()->getBlocks())
+    count += bb->getOpCount();
+  return count;
+}
+
+void remap(Op *op, std::map<Op*, Op*> &cloneMap) {
+  auto operands = op->getOperands();
+  op->removeAllOperands();
+  for (auto operand : operands) {
+    auto def = operand.defining;
+    op->pushOperand(cloneMap.count(def) ? cloneMap[def] : def);
+  }
+}
+
+// Ops that fold when all their operands are constants.
+bool foldable(Op *op) {
+  return !(
+    isa<PhiOp>(op) || isa<LoadOp>(op) || isa<StoreOp>(op) ||
+    isa<CallOp>(op) || isa<AllocaOp>(op) || isa<GetArgOp>(op) ||
+    isa<GetGlobalOp>(op) || isa<BranchOp>(op) || isa<GotoOp>(op) ||
+    isa<ReturnOp>(op)
+  );
+}
+
+// Estimates how many ops in `func` get simpler once the arguments in `indices` are constants:
+// those computed from constants alone fold away, and those using them get a constant operand.
+int benefit(FuncOp *func, const std::set<int> &indices) {
+  std::set<Op*> known;
+  for (auto getarg : func->findAll<GetArgOp>()) {
+    if (indices.count(V(getarg)))
+      known.insert(getarg);
+  }
+
+  const auto isConst = [&](Op *def) {
+    return known.count(def) || isa<IntOp>(def) || isa<FloatOp>(def);
+  };
+
+  // Blocks aren't in dominance order, so go until nothing changes.
+  bool changed;
+  do {
+    changed = false;
+    for (auto bb : func->getRegion()->getBlocks()) {
+      for (auto op : bb->getOps()) {
+        if (known.count(op) || !foldable(op) || isa<IntOp>(op) || isa<FloatOp>(op))
+          continue;
+
+        bool all = true;
+        for (auto operand : op->getOperands())
+          all &= isConst(operand.defining);
+        if (all && op->getOperandCount()) {
+          known.insert(op);
+          changed = true;
+        }
+      }
+    }
+  } while (changed);
+
+  int result = 0;
+  for (auto bb : func->getRegion()->getBlocks()) {
+    for (auto op : bb->getOps()) {
+      if (known.count(op)) {
+        result += !isa<GetArgOp>(op);
+        continue;
+      }
+      for (auto operand : op->getOperands()) {
+        if (known.count(operand.defining)) {
+          result++;
+          break;
+        }
+      }
+    }
+  }
+  return result;
+}
+
+// The value of a constant, as its bits.
+int bits(Op *op) {
+  if (isa<IntOp>(op))
+    return V(op);
+  float f = F(op);
+  int v;
+  memcpy(&v, &f, sizeof(int));
+  return v;
+}
+
+}
+
+FuncOp *Specialize::cloneFunc(FuncOp *func, const std::string &name) {
+  Builder builder;
+  builder.setAfterOp(func);
+  auto copy = cast<FuncOp>(builder.copy(func));
+  copy->remove<NameAttr>();
+  copy->add<NameAttr>(name);
+
+  auto region = copy->appendRegion();
+  std::map<BasicBlock*, BasicBlock*> blockMap;
+  std::map<Op*, Op*> cloneMap;
+  for (auto bb : func->getRegion()->getBlocks())
+    blockMap[bb] = region->appendBlock();
+
+  for (auto bb : func->getRegion()->getBlocks()) {
+    builder.setToBlockEnd(blockMap[bb]);
+    for (auto op : bb->getOps())
+      cloneMap[op] = builder.copy(op);
+  }
+
+  // Phis might refer to ops defined later, so operands are only fixed when everything is copied.
+  for (auto [_, op] : cloneMap) {
+    remap(op, cloneMap);
+
+    if (auto target = op->find<TargetAttr>())
+      target->bb = blockMap[target->bb];
+    if (auto ifnot = op->find<ElseAttr>())
+      ifnot->bb = blockMap[ifnot->bb];
+    if (isa<PhiOp>(op)) {
+      for (auto attr : op->getAttrs())
+        FROM(attr) = blockMap[FROM(attr)];
+    }
+
+    // Local arrays of the copy are its own.
+    if (auto alias = op->find<AliasAttr>()) {
+      decltype(alias->location) location;
+      for (const auto &[base, offsets] : alias->location)
+        location[cloneMap.count(base) ? cloneMap[base] : base] = offsets;
+      alias->location = location;
+    }
+  }
+  return copy;
+}
+
+// Gives call sites that pass constants a copy of the callee of their own,
+// so that SCCP can fold those arguments in it.
+// Call sites passing the same constants share a copy.
+void Specialize::run() {
+  auto fnMap = getFunctionMap();
+  auto calls = module->findAll<CallOp>();
+
+  // The key is made of the callee, and the indices and values of the constant arguments.
+  using Key = std::pair<std::string, std::vector<std::pair<int, int>>>;
+  std::map<Key, std::vector<Op*>> sites;
+
+  for (auto call : calls) {
+    const auto &name = NAME(call);
+    if (isExtern(name) || call->has<ParallelAttr>())
+      continue;
+
+    auto func = fnMap[name];
+    // Recursive calls are redirected when their caller is cloned.
+    if (name == "main" || func->has<ParallelAttr>() || call->getParentOp<FuncOp>() == func)
+      continue;
+
+    // Only arguments still used in the callee matter.
+    // Those SCCP has already proved constant are gone.
+    std::set<int> used;
+    for (auto getarg : func->findAll<GetArgOp>()) {
+      if (!getarg->getUses().empty())
+        used.insert(V(getarg));
+    }
+
+    std::vector<std::pair<int, int>> consts;
+    for (int i = 0; i < call->getOperandCount(); i++) {
+      auto def = call->DEF(i);
+      if (used.count(i) && (isa<IntOp>(def) || isa<FloatOp>(def)))
+        consts.push_back({ i, bits(def) });
+    }
+    if (!consts.empty())
+      sites[{ name, consts }].push_back(call);
+  }
+
+  // Prefer the copies that simplify the most for their size.
+  struct Candidate {
+    const Key *key;
+    int benefit;
+    int cost;
+  };
+  std::vector<Candidate> candidates;
+  for (const auto &[key, _] : sites) {
+    auto func = fnMap[key.first];
+    int cost = size(func);
+    if (cost > maxFuncSize)
+      continue;
+
+    std::set<int> indices;
+    for (auto [i, _] : key.second)
+      indices.insert(i);
+    int gain = benefit(func, indices);
+    if (gain >= minBenefit)
+      candidates.push_back({ &key, gain, cost });
+  }
+  std::sort(candidates.begin(), candidates.end(), [](const Candidate &a, const Candidate &b) {
+    return (int64_t) a.benefit * b.cost > (int64_t) b.benefit * a.cost;
+  });
+
+  int growth = 0;
+  std::map<std::string, int> copies;
+  for (auto [key, _, cost] : candidates) {
+    const auto &name = key->first;
+    if (growth + cost > maxGrowth || copies[name] >= maxClones)
+      continue;
+    growth += cost;
+
+    auto func = fnMap[name];
+    auto cloneName = name + ".spec" + std::to_string(copies[name]++);
+    auto copy = cloneFunc(func, cloneName);
+    cloned++;
+
+    for (auto call : sites[*key]) {
+      call->remove<NameAttr>();
+      call->add<NameAttr>(cloneName);
+      specialized++;
+    }
+
+    // Recursive calls in the copy that pass the same constants, or pass the arguments on unchanged,
+    // stay in the copy.
+    std::map<int, Op*> getargs;
+    for (auto getarg : copy->findAll<GetArgOp>())
+      getargs[V(getarg)] = getarg;
+
+    for (auto call : copy->findAll<CallOp>()) {
+      if (NAME(call) != name)
+        continue;
+
+      bool same = true;
+      for (auto [i, v] : key->second) {
+        auto def = call->DEF(i);
+        bool constant = (isa<IntOp>(def) || isa<FloatOp>(def)) && bits(def) == v;
+        same &= constant || def == getargs[i];
+      }
+      if (same) {
+        call->remove<NameAttr>();
+        call->add<NameAttr>(cloneName);
+      }
+    }
+  }
+}
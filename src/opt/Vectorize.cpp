@@ -0,0 +1,447 @@
+#include "LoopPasses.h"
+
+using namespace sys;
+
+std::map<std::string, int> Vectorize::stats() {
+  return {
+    { "vectorized-loops", vectorized },
+  };
+}
+
+namespace {
+
+// Vectors are 128 bits, i.e. 4 lanes of i32 or f32.
+constexpr int lanes = 4;
+// Vector values are never spilled. Both targets have 32 vector registers;
+// leave some of them alone.
+constexpr int maxVectors = 24;
+
+// The value that comes into `phi` from `bb`.
+Op *incoming(Op *phi, BasicBlock *bb) {
+  const auto &attrs = phi->getAttrs();
+  for (size_t i = 0; i < attrs.size(); i++) {
+    if (cast<FromAttr>(attrs[i])->bb == bb)
+      return phi->DEF(i);
+  }
+  return nullptr;
+}
+
+bool isArith(Op *op) {
+  return isa<AddIOp>(op) || isa<SubIOp>(op) || isa<MulIOp>(op) ||
+    isa<AddFOp>(op) || isa<SubFOp>(op) || isa<MulFOp>(op);
+}
+
+// Returns the amount of `inc` if it is `phi + constant`, or 0 otherwise.
+int stepOf(Op *phi, Op *inc) {
+  if (!isa<AddIOp>(inc) && !isa<AddLOp>(inc))
+    return 0;
+
+  auto x = inc->DEF(0), y = inc->DEF(1);
+  if (x != phi)
+    std::swap(x, y);
+  if (x != phi || !isa<IntOp>(y))
+    return 0;
+  return V(y);
+}
+
+// Two pointers walking through different arrays.
+// Offsets don't matter, because the pointers move.
+bool disjoint(Op *a, Op *b) {
+  // The ranges have been checked at runtime.
+  auto na = a->find<NoAliasAttr>(), nb = b->find<NoAliasAttr>();
+  if (na && nb && na->scope == nb->scope && na->group != nb->group)
+    return true;
+
+  auto aa = a->find<AliasAttr>(), ab = b->find<AliasAttr>();
+  if (!aa || !ab || aa->unknown || ab->unknown)
+    return false;
+
+  for (auto [base, _] : aa->location) {
+    if (ab->location.count(base))
+      return false;
+  }
+  return true;
+}
+
+Op *createVector(Builder &builder, Op *op, const std::vector<Value> &operands) {
+  if (isa<AddIOp>(op))
+    return builder.create<VAddIOp>(operands);
+  if (isa<SubIOp>(op))
+    return builder.create<VSubIOp>(operands);
+  if (isa<MulIOp>(op))
+    return builder.create<VMulIOp>(operands);
+  if (isa<AddFOp>(op))
+    return builder.create<VAddFOp>(operands);
+  if (isa<SubFOp>(op))
+    return builder.create<VSubFOp>(operands);
+  if (isa<MulFOp>(op))
+    return builder.create<VMulFOp>(operands);
+  assert(false);
+  return nullptr;
+}
+
+Value::Type vectorType(Op *op) {
+  return op->getResultType() == Value::f32 ? Value::f128 : Value::i128;
+}
+
+}
+
+// Only handles the form after SCEV, where the loop is a single block
+// and each array is walked by its own pointer:
+//
+//   bb1:
+//     %1 = phi %start <from = bb0>, %2 <from = bb1>
+//     %3 = load %1
+//     ...
+//     %2 = addl %1, 4
+//     %4 = lt %2, %end
+//     branch %4 <bb1> <else = bb2>
+//
+// becomes
+//
+//   bb0:
+//     %lim = addl %end, -12
+//     branch (lt %start, %lim) <vbb> <else = bb1>
+//   vbb:
+//     %v1 = phi %start <from = bb0>, %v2 <from = vbb>
+//     %v3 = vload %v1
+//     ...
+//     %v2 = addl %v1, 16
+//     branch (lt %v2, %lim) <vbb> <else = mid>
+//   mid:
+//     branch (lt %v2, %end) <bb1> <else = bb2>
+//   bb1:
+//     %1 = phi %start <from = bb0>, %2 <from = bb1>, %v2 <from = mid>
+//     ...
+//
+// The original loop becomes the epilogue.
+// An integer sum is kept as 4 partial sums in the vector loop, which are added up in `mid`.
+bool Vectorize::runImpl(LoopInfo *info) {
+  if (!info->getSubloops().empty() || info->getBlocks().size() != 1)
+    return false;
+
+  auto bb = info->getHeader();
+  auto preheader = info->getPreheader();
+  if (!preheader || info->getExits().size() != 1)
+    return false;
+
+  auto exit = info->getExit();
+  auto term = bb->getLastOp();
+  if (!isa<BranchOp>(term) || TARGET(term) != bb || ELSE(term) != exit)
+    return false;
+
+  auto preterm = preheader->getLastOp();
+  if (!isa<GotoOp>(preterm))
+    return false;
+
+  // Each phi must be either an induction variable,
+  // i.e. a pointer moving by 4 bytes or an integer moving by 1,
+  // or an integer sum that nothing else in the loop reads.
+  auto found = findReductions(info, /*fastMath=*/ false);
+  std::map<Op*, Op*> incOf, reductions;
+  std::set<Op*> incs, sums;
+  // The value a sum adds (or subtracts) in each iteration.
+  std::map<Op*, Op*> addend;
+  for (auto phi : bb->getPhis()) {
+    if (phi->getOperandCount() != 2)
+      return false;
+
+    auto inc = incoming(phi, bb);
+    if (!inc)
+      return false;
+
+    if (found.count(phi) && (isa<AddIOp>(inc) || isa<SubIOp>(inc))) {
+      reductions[phi] = inc;
+      sums.insert(inc);
+      addend[inc] = found[phi].operand;
+      continue;
+    }
+
+    int step = stepOf(phi, inc);
+    if (isa<AddLOp>(inc) ? step != 4 : step != 1)
+      return false;
+
+    incOf[phi] = inc;
+    incs.insert(inc);
+  }
+
+  // Nothing but the sums may escape the loop, as the vector loop can skip it entirely.
+  // A sum that is used directly (rather than through a phi at the exit) needs a new phi there.
+  std::map<Op*, std::vector<Op*>> escapes;
+  for (auto op : bb->getOps()) {
+    for (auto use : op->getUses()) {
+      if (use->getParent() == bb)
+        continue;
+      if (!sums.count(op))
+        return false;
+      if (use->getParent() == exit && isa<PhiOp>(use))
+        continue;
+      if (exit->preds.size() != 1)
+        return false;
+      escapes[op].push_back(use);
+    }
+  }
+
+  auto cond = term->DEF(0);
+  if (!isa<LtOp>(cond) || cond->getParent() != bb || cond->getUses().size() != 1)
+    return false;
+
+  auto bound = cond->DEF(1);
+  if (!incs.count(cond->DEF(0)) || bound->getParent() == bb)
+    return false;
+
+  Op *control = nullptr;
+  for (auto [phi, inc] : incOf) {
+    if (inc == cond->DEF(0))
+      control = phi;
+  }
+
+  // Check the body.
+  std::set<Op*> vectors;
+  std::vector<Op*> invariants;
+  std::vector<std::pair<Op*, bool>> accesses;
+  bool hasStore = false;
+
+  const auto isPointer = [&](Op *op) {
+    return incOf.count(op) && isa<AddLOp>(incOf[op]);
+  };
+  const auto addInvariant = [&](Op *op) {
+    if (vectors.count(op))
+      return true;
+    if (op->getParent() == bb && !isa<IntOp>(op) && !isa<FloatOp>(op))
+      return false;
+    if (std::find(invariants.begin(), invariants.end(), op) == invariants.end())
+      invariants.push_back(op);
+    return true;
+  };
+
+  for (auto op : bb->getOps()) {
+    if (isa<PhiOp>(op) || op == term || op == cond || incs.count(op))
+      continue;
+    if (isa<IntOp>(op) || isa<FloatOp>(op))
+      continue;
+
+    if (sums.count(op)) {
+      if (!addInvariant(addend[op]))
+        return false;
+      continue;
+    }
+
+    if (isa<LoadOp>(op)) {
+      auto ty = op->getResultType();
+      if (!isPointer(op->DEF()) || (ty != Value::i32 && ty != Value::f32))
+        return false;
+      vectors.insert(op);
+      accesses.push_back({ op->DEF(), false });
+      continue;
+    }
+
+    if (isa<StoreOp>(op)) {
+      auto value = op->DEF(0);
+      auto ty = value->getResultType();
+      if (!isPointer(op->DEF(1)) || (ty != Value::i32 && ty != Value::f32))
+        return false;
+      if (!addInvariant(value))
+        return false;
+      accesses.push_back({ op->DEF(1), true });
+      hasStore = true;
+      continue;
+    }
+
+    if (isArith(op)) {
+      for (auto operand : op->getOperands()) {
+        if (!addInvariant(operand.defining))
+          return false;
+      }
+      vectors.insert(op);
+      continue;
+    }
+
+    return false;
+  }
+
+  if (!hasStore && reductions.empty())
+    return false;
+  if (vectors.size() + invariants.size() + reductions.size() > maxVectors)
+    return false;
+
+  // Induction variables are only for addresses.
+  for (auto [phi, inc] : incOf) {
+    for (auto use : phi->getUses()) {
+      if (use == inc)
+        continue;
+      if (isPointer(phi) && isa<LoadOp>(use))
+        continue;
+      if (isPointer(phi) && isa<StoreOp>(use) && use->DEF(0) != phi)
+        continue;
+      return false;
+    }
+    for (auto use : inc->getUses()) {
+      if (use != phi && use != cond)
+        return false;
+    }
+  }
+
+  // Different pointers must walk through different arrays.
+  for (auto [p, store] : accesses) {
+    for (auto [q, store2] : accesses) {
+      if (p == q || (!store && !store2))
+        continue;
+      if (!disjoint(incoming(p, preheader), incoming(q, preheader)))
+        return false;
+    }
+  }
+
+  Builder builder;
+  auto region = bb->getParent();
+  // Put the vector loop after the original one.
+  // RegAlloc prefers to coalesce with the phis it sees last, and the vector loop is hotter.
+  auto mid = region->insertAfter(bb);
+  auto vbb = region->insertAfter(bb);
+
+  // Set up the invariants and the bound in the preheader.
+  // The vector loop runs while 4 more iterations are left.
+  builder.setBeforeOp(preterm);
+  std::map<Op*, Op*> vmap;
+  for (auto op : invariants) {
+    Op *scalar = op;
+    if (op->getParent() == bb)
+      scalar = builder.copy(op);
+    vmap[op] = builder.create<VSplatOp>(vectorType(op), { scalar });
+  }
+  Op *zero = nullptr;
+  if (!reductions.empty()) {
+    auto scalar = builder.create<IntOp>({ new IntAttr(0) });
+    zero = builder.create<VSplatOp>(Value::i128, { scalar });
+  }
+
+  int controlStep = stepOf(control, incOf[control]);
+  Op *lim;
+  auto back = builder.create<IntOp>({ new IntAttr(-(lanes - 1) * controlStep) });
+  if (isPointer(control))
+    lim = builder.create<AddLOp>({ (Value) bound, back });
+  else
+    lim = builder.create<AddIOp>({ (Value) bound, back });
+  auto enter = builder.create<LtOp>({ (Value) incoming(control, preheader), lim });
+  builder.replace<BranchOp>(preterm, { enter }, { new TargetAttr(vbb), new ElseAttr(bb) });
+
+  // The vector loop.
+  builder.setToBlockEnd(vbb);
+  std::map<Op*, Op*> vphis;
+  for (auto [phi, inc] : incOf) {
+    auto vphi = builder.create<PhiOp>({ incoming(phi, preheader) }, { new FromAttr(preheader) });
+    vphi->setResultType(phi->getResultType());
+    vphis[phi] = vphi;
+  }
+  for (auto [phi, sum] : reductions) {
+    auto vphi = builder.create<PhiOp>({ zero }, { new FromAttr(preheader) });
+    vphi->setResultType(Value::i128);
+    vphis[phi] = vphi;
+  }
+
+  for (auto op : bb->getOps()) {
+    if (sums.count(op)) {
+      auto x = addend[op];
+      Value partial = vphis[op->DEF(0) == x ? op->DEF(1) : op->DEF(0)];
+      if (isa<SubIOp>(op))
+        vmap[op] = builder.create<VSubIOp>({ partial, vmap[x] });
+      else
+        vmap[op] = builder.create<VAddIOp>({ partial, vmap[x] });
+      continue;
+    }
+    if (isa<LoadOp>(op)) {
+      vmap[op] = builder.create<VLoadOp>(vectorType(op), { vphis[op->DEF()] });
+      continue;
+    }
+    if (isa<StoreOp>(op)) {
+      builder.create<VStoreOp>({ (Value) vmap[op->DEF(0)], vphis[op->DEF(1)] });
+      continue;
+    }
+    if (vectors.count(op)) {
+      std::vector<Value> operands;
+      for (auto operand : op->getOperands())
+        operands.push_back(vmap[operand.defining]);
+      vmap[op] = createVector(builder, op, operands);
+    }
+  }
+
+  std::map<Op*, Op*> vincs;
+  for (auto [phi, inc] : incOf) {
+    auto amt = builder.create<IntOp>({ new IntAttr(lanes * stepOf(phi, inc)) });
+    Op *vinc;
+    if (isPointer(phi))
+      vinc = builder.create<AddLOp>({ (Value) vphis[phi], amt });
+    else
+      vinc = builder.create<AddIOp>({ (Value) vphis[phi], amt });
+    vphis[phi]->pushOperand(vinc);
+    vphis[phi]->add<FromAttr>(vbb);
+    vincs[phi] = vinc;
+  }
+  for (auto [phi, sum] : reductions) {
+    vphis[phi]->pushOperand(vmap[sum]);
+    vphis[phi]->add<FromAttr>(vbb);
+  }
+  auto again = builder.create<LtOp>({ (Value) vincs[control], lim });
+  builder.create<BranchOp>({ again }, { new TargetAttr(vbb), new ElseAttr(mid) });
+
+  // Run the rest with the original loop, if there's anything left.
+  // The partial sums are added up first.
+  builder.setToBlockEnd(mid);
+  std::map<Op*, Op*> totals;
+  for (auto [phi, sum] : reductions) {
+    auto lanesum = builder.create<VReduceAddIOp>({ vmap[sum] });
+    totals[sum] = builder.create<AddIOp>({ (Value) incoming(phi, preheader), lanesum });
+  }
+  auto rest = builder.create<LtOp>({ (Value) vincs[control], bound });
+  builder.create<BranchOp>({ rest }, { new TargetAttr(bb), new ElseAttr(exit) });
+
+  for (auto [phi, inc] : incOf) {
+    phi->pushOperand(vincs[phi]);
+    phi->add<FromAttr>(mid);
+  }
+  for (auto [phi, sum] : reductions) {
+    phi->pushOperand(totals[sum]);
+    phi->add<FromAttr>(mid);
+  }
+  for (auto phi : exit->getPhis()) {
+    auto value = incoming(phi, bb);
+    if (totals.count(value))
+      value = totals[value];
+    phi->pushOperand(value);
+    phi->add<FromAttr>(mid);
+  }
+
+  builder.setToBlockStart(exit);
+  for (const auto &[sum, uses] : escapes) {
+    auto phi = builder.create<PhiOp>({ (Value) sum, totals[sum] }, { new FromAttr(bb), new FromAttr(mid) });
+    phi->setResultType(sum->getResultType());
+    for (auto use : uses) {
+      for (int i = 0; i < use->getOperandCount(); i++) {
+        if (use->DEF(i) == sum)
+          use->setOperand(i, phi);
+      }
+    }
+  }
+  return true;
+}
+
+void Vectorize::run() {
+  LoopAnalysis loop(module);
+  loop.run();
+  auto forests = loop.getResult();
+
+  auto funcs = collectFuncs();
+  for (auto func : funcs) {
+    const auto &forest = forests[func];
+    bool changed = false;
+    for (auto info : forest.getLoops()) {
+      if (runImpl(info)) {
+        vectorized++;
+        changed = true;
+      }
+    }
+
+    if (changed)
+      func->getRegion()->updatePreds();
+  }
+}
@@ -69,9 +69,25 @@ void ArrayAccess::runImpl(Op *loop, std::vector<Op*> outer) {
       continue;
     }
 
+    if (isa<SubIOp>(op)) {
+      auto x = op->DEF(0);
+      auto y = op->DEF(1);
+      if (!x->has<SubscriptAttr>() || !y->has<SubscriptAttr>())
+        continue;
+
+      auto vx = lengthened(x, outer);
+      auto vy = lengthened(y, outer);
+      for (int i = 0; i < vx.size(); i++)
+        vx[i] -= vy[i];
+      op->add<SubscriptAttr>(vx);
+      continue;
+    }
+
     if (isa<MulIOp>(op)) {
       auto x = op->DEF(0);
       auto y = op->DEF(1);
+      if (isa<IntOp>(x))
+        std::swap(x, y);
       if (!isa<IntOp>(y) || !x->has<SubscriptAttr>())
         continue;
 
@@ -92,7 +108,14 @@ void ArrayAccess::runImpl(Op *loop, std::vector<Op*> outer) {
         else continue;
       }
 
-      op->add<SubscriptAttr>(lengthened(x, outer));
+      // The base might be loop-variant as well, e.g. a row of a 2D array.
+      auto val = lengthened(x, outer);
+      if (y->has<SubscriptAttr>()) {
+        auto vy = lengthened(y, outer);
+        for (int i = 0; i < val.size(); i++)
+          val[i] += vy[i];
+      }
+      op->add<SubscriptAttr>(val);
     }
   }
 }
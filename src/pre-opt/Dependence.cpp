@@ -0,0 +1,423 @@
+#include "PreAnalysis.h"
+#include <numeric>
+
+using namespace sys;
+
+namespace {
+
+// Resizes `x` to have `n` coefficients plus the constant.
+AffineExpr resized(AffineExpr x, int n) {
+  auto back = x.back();
+  x.pop_back();
+  x.resize(n);
+  x.push_back(back);
+  return x;
+}
+
+int floorDiv(int x, int y) {
+  return x / y - (x % y != 0 && (x < 0) != (y < 0));
+}
+
+// Distributes the constant offset into dimensions in `strides`, largest first.
+// This assumes all indices are in bounds.
+std::map<int, AffineExpr> delinearize(const Dependence::Access &acc, const std::set<int> &strides) {
+  int n = acc.loops.size();
+  auto dims = acc.dims;
+  int rem = acc.offset;
+  for (auto it = strides.rbegin(); it != strides.rend(); it++) {
+    auto &dim = dims[*it];
+    if (dim.empty())
+      dim.resize(n + 1);
+    int q = floorDiv(rem, *it);
+    dim.back() += q;
+    rem -= q * *it;
+  }
+  if (rem) {
+    auto &dim = dims[1];
+    if (dim.empty())
+      dim.resize(n + 1);
+    dim.back() += rem;
+  }
+  return dims;
+}
+
+// Values taken by the induction variable of `loop`, when known.
+bool range(Op *loop, long long &lo, long long &hi) {
+  auto init = loop->DEF(0);
+  auto stop = loop->DEF(1);
+  auto step = loop->DEF(2);
+  if (!isa<IntOp>(init) || !isa<IntOp>(stop) || !isa<IntOp>(step) || V(step) <= 0)
+    return false;
+
+  lo = V(init);
+  hi = std::max<long long>(V(stop) - 1, lo);
+  return true;
+}
+
+// Adds the bounds of `coeff * iv` to [lo, hi].
+void accumulate(Op *loop, long long coeff, long long &lo, long long &hi, bool &bounded) {
+  if (!coeff)
+    return;
+
+  long long l, h;
+  if (!range(loop, l, h)) {
+    bounded = false;
+    return;
+  }
+  lo += std::min(coeff * l, coeff * h);
+  hi += std::max(coeff * l, coeff * h);
+}
+
+}
+
+Dependence::Dependence(ModuleOp *module) {
+  for (auto global : module->findAll<GlobalOp>())
+    globals[NAME(global)] = global;
+}
+
+int Dependence::depth(Op *loop) {
+  int result = 0;
+  for (auto runner = loop->getParentOp(); !isa<FuncOp>(runner); runner = runner->getParentOp()) {
+    if (isa<ForOp>(runner))
+      result++;
+  }
+  return result;
+}
+
+Op *Dependence::resolve(Op *addr) {
+  if (isa<GetGlobalOp>(addr))
+    return globals.at(NAME(addr));
+  if (isa<AllocaOp>(addr))
+    return addr;
+  return nullptr;
+}
+
+bool Dependence::isScalar(Op *op) {
+  auto addr = isa<StoreOp>(op) ? op->DEF(1) : op->DEF(0);
+  auto base = resolve(addr);
+  return base && SIZE(base) == 4;
+}
+
+Dependence::Access Dependence::get(Op *op) {
+  Access acc;
+  acc.op = op;
+  acc.write = isa<StoreOp>(op);
+  for (auto runner = op->getParentOp(); !isa<FuncOp>(runner); runner = runner->getParentOp()) {
+    if (isa<ForOp>(runner))
+      acc.loops.insert(acc.loops.begin(), runner);
+  }
+
+  int n = acc.loops.size();
+  auto addr = acc.write ? op->DEF(1) : op->DEF(0);
+
+  // The address is a chain of `addl`, each adding `index * stride` to the base.
+  while (isa<AddLOp>(addr)) {
+    auto term = addr->DEF(1);
+    addr = addr->DEF(0);
+
+    if (isa<IntOp>(term)) {
+      acc.offset += V(term);
+      continue;
+    }
+
+    int stride = 1;
+    Op *index = term;
+    if (isa<MulIOp>(term) && isa<IntOp>(term->DEF(1))) {
+      stride = V(term->DEF(1));
+      index = term->DEF(0);
+    }
+    if (!index->has<SubscriptAttr>() || SUBSCRIPT(index).size() > n + 1) {
+      acc.affine = false;
+      continue;
+    }
+
+    auto expr = resized(SUBSCRIPT(index), n);
+    auto &dim = acc.dims[stride];
+    if (dim.empty())
+      dim = expr;
+    else for (int i = 0; i <= n; i++)
+      dim[i] += expr[i];
+  }
+
+  acc.base = resolve(addr);
+  return acc;
+}
+
+bool Dependence::test(const Access &a, const Access &b, int common, int fixed, Distance &dist) {
+  dist.assign(common, std::nullopt);
+  for (int q = 0; q < fixed; q++)
+    dist[q] = 0;
+
+  if (!a.base || !b.base)
+    return true;
+  if (a.base != b.base)
+    return false;
+  if (!a.affine || !b.affine)
+    return true;
+
+  std::set<int> strides;
+  for (auto &[stride, _] : a.dims)
+    strides.insert(stride);
+  for (auto &[stride, _] : b.dims)
+    strides.insert(stride);
+  auto da = delinearize(a, strides);
+  auto db = delinearize(b, strides);
+
+  int na = a.loops.size();
+  int nb = b.loops.size();
+  // The remainder might end up in only one of them.
+  for (auto &[stride, _] : da) {
+    if (!db.count(stride))
+      db[stride].resize(nb + 1);
+  }
+  for (auto &[stride, _] : db) {
+    if (!da.count(stride))
+      da[stride].resize(na + 1);
+  }
+
+  // With `x` and `y` being the iterations of `a` and `b`, each dimension gives
+  //   sum(a[q] * x[q]) + a.const = sum(b[q] * y[q]) + b.const.
+  // When the coefficients of `a` and `b` agree (the dimension is uniform),
+  // it becomes an equation of distances `y - x`.
+  // Otherwise we can only check it with GCD and Banerjee tests.
+  std::vector<std::vector<long long>> eqs;
+  for (auto &[stride, x] : da) {
+    const auto &y = db[stride];
+    long long rhs = x[na] - y[nb];
+    bool uniform = true;
+    bool bounded = true;
+    long long g = 0, lo = 0, hi = 0;
+
+    for (int q = 0; q < common; q++) {
+      if (x[q] != y[q])
+        uniform = false;
+      if (q < fixed) {
+        g = std::gcd(g, (long long) y[q] - x[q]);
+        accumulate(a.loops[q], y[q] - x[q], lo, hi, bounded);
+        continue;
+      }
+      g = std::gcd(g, std::gcd((long long) x[q], (long long) y[q]));
+      accumulate(a.loops[q], -x[q], lo, hi, bounded);
+      accumulate(b.loops[q], y[q], lo, hi, bounded);
+    }
+    for (int q = common; q < na; q++) {
+      if (x[q])
+        uniform = false;
+      g = std::gcd(g, (long long) x[q]);
+      accumulate(a.loops[q], -x[q], lo, hi, bounded);
+    }
+    for (int q = common; q < nb; q++) {
+      if (y[q])
+        uniform = false;
+      g = std::gcd(g, (long long) y[q]);
+      accumulate(b.loops[q], y[q], lo, hi, bounded);
+    }
+
+    if (!uniform) {
+      if (g ? rhs % g : rhs)
+        return false;
+      if (bounded && (rhs < lo || rhs > hi))
+        return false;
+      continue;
+    }
+
+    std::vector<long long> eq(common + 1);
+    for (int q = fixed; q < common; q++)
+      eq[q] = x[q];
+    eq[common] = rhs;
+    eqs.push_back(eq);
+  }
+
+  // Solve distances one by one, from equations with a single unknown.
+  for (int round = 0; round <= common; round++) {
+    for (auto eq : eqs) {
+      int unknowns = 0, last = -1;
+      long long g = 0;
+      for (int q = 0; q < common; q++) {
+        if (!eq[q])
+          continue;
+        if (dist[q]) {
+          eq[common] -= eq[q] * *dist[q];
+          continue;
+        }
+        unknowns++;
+        last = q;
+        g = std::gcd(g, eq[q]);
+      }
+
+      if (!unknowns) {
+        if (eq[common])
+          return false;
+        continue;
+      }
+      if (eq[common] % g)
+        return false;
+      if (unknowns == 1)
+        dist[last] = eq[common] / eq[last];
+    }
+  }
+
+  // A distance can't exceed the span of the loops.
+  for (int q = fixed; q < common; q++) {
+    long long la, ha, lb, hb;
+    if (dist[q] && range(a.loops[q], la, ha) && range(b.loops[q], lb, hb)
+     && std::abs(*dist[q]) > std::max(ha, hb) - std::min(la, lb))
+      return false;
+  }
+  return true;
+}
+
+bool Dependence::collect(Op *loop, std::vector<Access> &arrays, std::map<Op*, std::vector<Op*>> &scalars) {
+  for (auto region : loop->getRegions()) {
+    for (auto bb : region->getBlocks()) {
+      for (auto op : bb->getOps()) {
+        // Even pure functions might write to arrays passed to them.
+        if (isa<CallOp>(op) || isa<BreakOp>(op) || isa<ContinueOp>(op) || isa<ReturnOp>(op))
+          return false;
+
+        if (isa<LoadOp>(op) || isa<StoreOp>(op)) {
+          if (isScalar(op)) {
+            auto addr = isa<StoreOp>(op) ? op->DEF(1) : op->DEF(0);
+            scalars[resolve(addr)].push_back(op);
+          } else
+            arrays.push_back(get(op));
+        }
+
+        if (!collect(op, arrays, scalars))
+          return false;
+      }
+    }
+  }
+  return true;
+}
+
+// A scalar carries no dependence if it's only read, or if it is always
+// written before read in each iteration. When `allowSum` is set, an integer
+// sum is also fine, since the order of additions doesn't matter.
+bool Dependence::scalarsOk(Op *loop, const std::map<Op*, std::vector<Op*>> &scalars, bool allowSum) {
+  auto body = loop->getRegion()->getFirstBlock();
+
+  for (auto &[base, uses] : scalars) {
+    bool written = false;
+    for (auto use : uses)
+      written |= isa<StoreOp>(use);
+    if (!written)
+      continue;
+
+    if (allowSum && uses.size() == 2 && isa<LoadOp>(uses[0]) && isa<StoreOp>(uses[1])) {
+      auto load = uses[0];
+      auto store = uses[1];
+      auto add = store->DEF(0);
+      if (load->getParent() == store->getParent() && isa<AddIOp>(add)
+       && load->getUses().size() == 1 && add->getUses().size() == 1
+       && (add->DEF(0) == load || add->DEF(1) == load))
+        continue;
+    }
+
+    if (!isa<AllocaOp>(base) || !isa<StoreOp>(uses[0]) || uses[0]->getParent() != body)
+      return false;
+    for (auto use : base->getUses()) {
+      if (!use->inside(loop))
+        return false;
+    }
+  }
+  return true;
+}
+
+std::vector<Dependence::Access> Dependence::accesses(Op *loop) {
+  std::vector<Access> arrays;
+  std::map<Op*, std::vector<Op*>> scalars;
+  collect(loop, arrays, scalars);
+  return arrays;
+}
+
+bool Dependence::parallel(Op *loop) {
+  std::vector<Access> arrays;
+  std::map<Op*, std::vector<Op*>> scalars;
+  if (!collect(loop, arrays, scalars) || !scalarsOk(loop, scalars, false))
+    return false;
+
+  int d = depth(loop);
+  for (size_t i = 0; i < arrays.size(); i++) {
+    for (size_t j = i; j < arrays.size(); j++) {
+      const auto &a = arrays[i];
+      const auto &b = arrays[j];
+      if (!a.write && !b.write)
+        continue;
+
+      int common = 0;
+      while (common < a.loops.size() && common < b.loops.size() && a.loops[common] == b.loops[common])
+        common++;
+
+      Distance dist;
+      if (test(a, b, common, d, dist) && dist[d] != 0)
+        return false;
+    }
+  }
+  return true;
+}
+
+bool Dependence::interchangeable(Op *outer, Op *inner) {
+  std::vector<Access> arrays;
+  std::map<Op*, std::vector<Op*>> scalars;
+  if (!collect(inner, arrays, scalars) || !scalarsOk(inner, scalars, true))
+    return false;
+
+  // A dependence forbids interchange if its distances along the two loops
+  // have opposite signs, because the interchange would reverse it.
+  int p = depth(outer);
+  for (size_t i = 0; i < arrays.size(); i++) {
+    for (size_t j = i; j < arrays.size(); j++) {
+      const auto &a = arrays[i];
+      const auto &b = arrays[j];
+      if (!a.write && !b.write)
+        continue;
+
+      Distance dist;
+      if (!test(a, b, p + 2, p, dist))
+        continue;
+      if (dist[p] && dist[p + 1] && *dist[p] * *dist[p + 1] >= 0)
+        continue;
+      if (dist[p] == 0 || dist[p + 1] == 0)
+        continue;
+      return false;
+    }
+  }
+  return true;
+}
+
+bool Dependence::fusible(Op *first, Op *second) {
+  std::vector<Access> arrays1, arrays2;
+  std::map<Op*, std::vector<Op*>> scalars1, scalars2;
+  if (!collect(first, arrays1, scalars1) || !collect(second, arrays2, scalars2))
+    return false;
+
+  // Scalars written in one loop can't be accessed in the other.
+  for (auto &[base, uses] : scalars1) {
+    if (!scalars2.count(base))
+      continue;
+
+    bool written = false;
+    for (auto use : uses)
+      written |= isa<StoreOp>(use);
+    for (auto use : scalars2[base])
+      written |= isa<StoreOp>(use);
+    if (written)
+      return false;
+  }
+
+  // After fusion, iteration `y` of `second` runs before iteration `x` of `first`
+  // whenever y < x. A dependence with such a distance would be reversed.
+  int p = depth(first);
+  for (auto &a : arrays1) {
+    for (auto &b : arrays2) {
+      if (!a.write && !b.write)
+        continue;
+
+      Distance dist;
+      if (test(a, b, p + 1, p, dist) && !(dist[p] && *dist[p] >= 0))
+        return false;
+    }
+  }
+  return true;
+}
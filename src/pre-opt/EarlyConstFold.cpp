@@ -5,7 +5,8 @@ using namespace sys;
 
 #define INT(op) isa<IntOp>(op)
 
-static bool hasStoresTo(Op *op) {
+// Calls that the address (or one derived from it) is passed to are put into `calls`.
+static bool hasStoresTo(Op *op, std::vector<Op*> &calls) {
   for (auto use : op->getUses()) {
     // This checks both the case when the address is stored elsewhere,
     // and the value at the address is mutated.
@@ -15,7 +16,7 @@ static bool hasStoresTo(Op *op) {
 
     // It's a new address. Find all stores there.
     if (isa<AddIOp>(use) || isa<AddLOp>(use)) {
-      if (hasStoresTo(use))
+      if (hasStoresTo(use, calls))
         return true;
       continue;
     }
@@ -23,6 +24,11 @@ static bool hasStoresTo(Op *op) {
     if (isa<LoadOp>(use))
       continue;
 
+    if (isa<CallOp>(use)) {
+      calls.push_back(use);
+      continue;
+    }
+
     // If something else happens, then it isn't an address.
     return false;
   }
@@ -90,15 +96,16 @@ void EarlyConstFold::run() {
 
   for (auto op : getglobs) {
     const auto &name = NAME(op);
-    if (hasStoresTo(op)) {
+    std::vector<Op*> calls;
+    if (hasStoresTo(op, calls)) {
       nonConst.insert(gMap[name]);
       continue;
     }
 
-    for (auto use : op->getUses()) {
+    for (auto use : calls) {
       // If we do this before Pureness, we must assume all calls are impure.
       // Moreover, we haven't marked ImpureAttr for CallOps yet, so check the FuncOp instead.
-      if (isa<CallOp>(use) && (beforePureness || isExtern(NAME(use)) || fMap[NAME(use)]->has<ImpureAttr>())) {
+      if (beforePureness || isExtern(NAME(use)) || fMap[NAME(use)]->has<ImpureAttr>()) {
         nonConst.insert(gMap[name]);
         break;
       }
@@ -5,28 +5,80 @@ using namespace sys;
 std::map<std::string, int> Fusion::stats() {
   return {
     { "fused-loops", fused },
+    { "peeled-loops", peeled },
   };
 }
 
 namespace {
 
-bool identical(Op *a, Op *b) {
+// At most this many iterations are peeled off either end.
+constexpr int maxPeel = 4;
+
+bool sameBase(Op *x, Op *y) {
+  if (isa<GetGlobalOp>(x) && isa<GetGlobalOp>(y))
+    return NAME(x) == NAME(y);
+  return x == y;
+}
+
+// Whether `op` is a load of a scalar that isn't written in `loop`.
+bool invariantLoad(Op *op, Op *loop) {
+  if (!isa<LoadOp>(op))
+    return false;
+
+  auto addr = op->DEF(0);
+  if (!isa<AllocaOp>(addr) && !isa<GetGlobalOp>(addr))
+    return false;
+
+  for (auto store : loop->findAll<StoreOp>()) {
+    if (sameBase(store->DEF(1), addr))
+      return false;
+  }
+  return true;
+}
+
+// Whether `a` and `b` (before and after `loop`) always hold the same value.
+bool identical(Op *a, Op *b, Op *loop) {
+  if (a == b)
+    return true;
+
   if (a->opid != b->opid)
     return false;
 
   if (isa<IntOp>(a))
     return V(a) == V(b);
 
-  return a == b;
+  if (isa<LoadOp>(a))
+    return sameBase(a->DEF(0), b->DEF(0)) && invariantLoad(a, loop);
+
+  if (isa<AddIOp>(a) || isa<SubIOp>(a))
+    return identical(a->DEF(0), b->DEF(0), loop) && identical(a->DEF(1), b->DEF(1), loop);
+
+  return false;
 }
 
-// We only combine for loops with identical start, stop and step for now.
-// We might do peeling in the future, but I don't feel like it currently.
-bool fusible(Op *a, Op *b) {
-  return identical(a->DEF(0), b->DEF(0))
-      && identical(a->DEF(1), b->DEF(1))
-      && identical(a->DEF(2), b->DEF(2))
-      && identical(a->DEF(3), b->DEF(3));
+// Finds `k` such that `a = b + k`.
+bool offset(Op *a, Op *b, Op *loop, int &k) {
+  if (identical(a, b, loop)) {
+    k = 0;
+    return true;
+  }
+
+  if (isa<IntOp>(a) && isa<IntOp>(b)) {
+    k = V(a) - V(b);
+    return true;
+  }
+
+  if ((isa<AddIOp>(a) || isa<SubIOp>(a)) && isa<IntOp>(a->DEF(1)) && identical(a->DEF(0), b, loop)) {
+    k = isa<AddIOp>(a) ? V(a->DEF(1)) : -V(a->DEF(1));
+    return true;
+  }
+
+  if ((isa<AddIOp>(b) || isa<SubIOp>(b)) && isa<IntOp>(b->DEF(1)) && identical(a, b->DEF(0), loop)) {
+    k = isa<AddIOp>(b) ? -V(b->DEF(1)) : V(b->DEF(1));
+    return true;
+  }
+
+  return false;
 }
 
 // Ops that can't be hoisted to before the loop.
@@ -46,6 +98,69 @@ bool pinned(Op *op) {
 
 }
 
+// Deep-copies `op` at the builder's position.
+Op *sys::clone(Builder &builder, Op *op, std::map<Op*, Op*> &cloned) {
+  auto copy = builder.copy(op);
+  for (int i = 0; i < op->getOperandCount(); i++) {
+    if (cloned.count(op->DEF(i)))
+      copy->setOperand(i, cloned[op->DEF(i)]);
+  }
+  cloned[op] = copy;
+
+  for (auto region : op->getRegions()) {
+    auto copied = copy->appendRegion();
+    for (auto bb : region->getBlocks()) {
+      auto block = copied->appendBlock();
+      Builder::Guard guard(builder);
+      builder.setToBlockEnd(block);
+      for (auto x : bb->getOps())
+        clone(builder, x, cloned);
+    }
+  }
+  return copy;
+}
+
+// Computes min(x, y), or max(x, y) if `max` is set, before `before`.
+// Goes through memory instead of a select, which ARM doesn't lower.
+Op *sys::extremum(Op *x, Op *y, bool max, Op *before) {
+  Builder builder;
+  if (isa<IntOp>(x) && isa<IntOp>(y)) {
+    builder.setBeforeOp(before);
+    int value = max ? std::max(V(x), V(y)) : std::min(V(x), V(y));
+    return builder.create<IntOp>({ new IntAttr(value) });
+  }
+
+  auto func = before->getParentOp<FuncOp>();
+  builder.setToBlockEnd(func->getRegion()->getFirstBlock());
+  auto addr = builder.create<AllocaOp>({ new SizeAttr(4) });
+
+  builder.setBeforeOp(before);
+  builder.create<StoreOp>({ x, addr }, { new SizeAttr(4), new ImpureAttr });
+  Value lhs = max ? x : y;
+  Value rhs = max ? y : x;
+  auto cond = builder.create<LtOp>({ lhs, rhs });
+  auto branch = builder.create<IfOp>({ cond }, { new ImpureAttr });
+  auto ifso = branch->createFirstBlock();
+  builder.setToBlockStart(ifso);
+  builder.create<StoreOp>({ y, addr }, { new SizeAttr(4), new ImpureAttr });
+
+  builder.setBeforeOp(before);
+  return builder.create<LoadOp>(Value::i32, { addr }, { new SizeAttr(4) });
+}
+
+// Runs the iterations of `loop` in [start, stop) as a separate loop.
+// The copy is put before `before`.
+void Fusion::peel(Op *loop, Op *start, Op *stop, Op *before) {
+  Builder builder;
+  builder.setBeforeOp(before);
+  std::map<Op*, Op*> cloned;
+  auto copy = clone(builder, loop, cloned);
+  copy->setOperand(0, start);
+  copy->setOperand(1, stop);
+  copies.insert(copy);
+  peeled++;
+}
+
 void Fusion::runImpl(FuncOp *func) {
   bool changed;
   do {
@@ -53,7 +168,7 @@ void Fusion::runImpl(FuncOp *func) {
     auto loops = func->findAll<ForOp>();
 
     for (auto loop : loops) {
-      if (loop->atBack())
+      if (loop->atBack() || copies.count(loop))
         continue;
 
       std::vector<Op*> hoisted;
@@ -64,25 +179,64 @@ void Fusion::runImpl(FuncOp *func) {
         if (isa<ForOp>(next))
           break;
 
-        if (pinned(next)) {
+        if (pinned(next) && !invariantLoad(next, loop)) {
           good = false;
           break;
         }
         hoisted.push_back(next);
       }
-      if (!good || (next->atBack() && !isa<ForOp>(next)))
+      if (!good || !isa<ForOp>(next) || copies.count(next))
+        continue;
+
+      // Two consecutive for's. They must have the same step,
+      // and their bounds can only differ by a constant.
+      auto step = loop->DEF(2);
+      if (!isa<IntOp>(step) || V(step) <= 0 || !identical(step, next->DEF(2), loop))
+        continue;
+
+      int ds, de;
+      if (!offset(next->DEF(0), loop->DEF(0), loop, ds) || !offset(next->DEF(1), loop->DEF(1), loop, de))
+        continue;
+      if (ds % V(step) || std::abs(ds) > maxPeel * V(step) || std::abs(de) > maxPeel * V(step))
         continue;
 
-      // Two consecutive for's. Check whether they can get combined.
-      if (!fusible(next, loop))
-        return;
+      // With constant bounds, make sure most iterations get fused.
+      if (isa<IntOp>(loop->DEF(0)) && isa<IntOp>(loop->DEF(1))) {
+        int common = V(loop->DEF(1)) - std::max(ds, 0) + std::min(de, 0) - V(loop->DEF(0));
+        if (common <= std::abs(ds) + std::abs(de))
+          continue;
+      }
 
-      // TODO: Check dependency.
+      // After lowering, the final values of induction variables are stored
+      // to their addresses. Fusing might change those values.
+      bool loaded = false;
+      for (auto x : { loop, next }) {
+        for (auto use : x->DEF(3)->getUses())
+          loaded |= isa<LoadOp>(use);
+      }
+      if (loaded || !dep->fusible(loop, next))
+        continue;
 
       // Hoist the ops between `next` and `loop` to before `loop`.
       for (auto op : hoisted)
         op->moveBefore(loop);
 
+      // Peel the extra iterations on both ends. The fused loop runs in
+      // [max(start), min(stop)); each peeled part is clamped to its own
+      // loop's range, in case the fused loop is empty.
+      Op *start = ds > 0 ? next->DEF(0) : loop->DEF(0);
+      Op *stop = de > 0 ? loop->DEF(1) : next->DEF(1);
+      if (ds) {
+        auto early = ds > 0 ? loop : next;
+        peel(early, early->DEF(0), extremum(start, early->DEF(1), false, loop), loop);
+      }
+      if (de) {
+        auto late = de > 0 ? next : loop;
+        peel(late, extremum(stop, start, true, next), late->DEF(1), next);
+      }
+      loop->setOperand(0, start);
+      loop->setOperand(1, stop);
+
       // Move all ops in `next` to `loop`.
       auto region = next->getRegion();
       auto bb = region->getFirstBlock();
@@ -94,7 +248,7 @@ void Fusion::runImpl(FuncOp *func) {
 
       // Erase the now-empty `next`.
       next->erase();
-      
+
       fused++;
       changed = true;
       break;
@@ -103,6 +257,9 @@ void Fusion::runImpl(FuncOp *func) {
 }
 
 void Fusion::run() {
+  Dependence analysis(module);
+  dep = &analysis;
+
   auto funcs = collectFuncs();
 
   for (auto func : funcs)
@@ -0,0 +1,312 @@
+#include "PreLoopPasses.h"
+
+using namespace sys;
+
+std::map<std::string, int> LoopNest::stats() {
+  return {
+    { "interchanged", interchanged },
+    { "tiled", tiled },
+  };
+}
+
+namespace {
+
+// Size of the L1 data cache and its lines, in bytes.
+constexpr int L1 = 32 * 1024;
+constexpr int lineSize = 64;
+// Number of iterations in a tile.
+constexpr int tileSize = 32;
+
+struct Nest {
+  // Ops in the outer loop's body, which must be hoisted before interchanging.
+  std::vector<Op*> prelude;
+  // Array accesses in the inner loop.
+  std::vector<Dependence::Access> accesses;
+};
+
+bool sameBase(Op *x, Op *y) {
+  if (isa<GetGlobalOp>(x) && isa<GetGlobalOp>(y))
+    return NAME(x) == NAME(y);
+  return x == y;
+}
+
+// Checks that `outer` and `inner` form a perfect nest that can be interchanged.
+bool analyzeNest(Op *outer, Op *inner, Dependence &dep, Nest &nest) {
+  if (outer->getRegion()->getBlocks().size() != 1 || inner->getRegion()->getBlocks().size() != 1)
+    return false;
+
+  auto bb = outer->getRegion()->getFirstBlock();
+  if (bb->getLastOp() != inner)
+    return false;
+
+  // Everything before `inner` must be invariant in `outer`.
+  auto stores = outer->findAll<StoreOp>();
+  for (auto op : bb->getOps()) {
+    if (op == inner)
+      break;
+
+    if (op->getRegions().size() || isa<StoreOp>(op) || isa<CallOp>(op))
+      return false;
+
+    if (isa<LoadOp>(op)) {
+      auto addr = op->DEF(0);
+      if (!isa<AllocaOp>(addr) && !isa<GetGlobalOp>(addr))
+        return false;
+      for (auto store : stores) {
+        if (sameBase(store->DEF(1), addr))
+          return false;
+      }
+    }
+
+    for (auto operand : op->getOperands()) {
+      if (operand.defining == outer)
+        return false;
+    }
+    nest.prelude.push_back(op);
+  }
+
+  for (int i = 0; i < 3; i++) {
+    if (inner->DEF(i) == outer)
+      return false;
+  }
+
+  // After lowering, the final values of induction variables are stored
+  // to their addresses. Interchanging might change those values.
+  for (auto loop : { outer, inner }) {
+    for (auto use : loop->DEF(3)->getUses()) {
+      if (isa<LoadOp>(use))
+        return false;
+    }
+  }
+
+  if (!dep.interchangeable(outer, inner))
+    return false;
+
+  nest.accesses = dep.accesses(inner);
+  return true;
+}
+
+// The bytes an access moves by when the `q`-th loop advances by one.
+int bytes(const Dependence::Access &acc, int q) {
+  int result = 0;
+  for (auto &[stride, index] : acc.dims)
+    result += stride * index[q];
+  return std::abs(result);
+}
+
+// Estimated cache lines touched by making `q` the innermost loop.
+int cost(const Nest &nest, int q) {
+  int total = 0;
+  for (auto &acc : nest.accesses) {
+    if (acc.affine)
+      total += std::min(bytes(acc, q), lineSize);
+  }
+  return total;
+}
+
+// Inserts a zero coefficient at column `p` into all subscripts inside `op`.
+void shift(Op *op, int p) {
+  for (auto region : op->getRegions()) {
+    for (auto bb : region->getBlocks()) {
+      for (auto x : bb->getOps()) {
+        if (auto attr = x->find<SubscriptAttr>()) {
+          auto &expr = attr->subscript;
+          if (expr.size() > p + 1)
+            expr.insert(expr.begin() + p, 0);
+        }
+        shift(x, p);
+      }
+    }
+  }
+}
+
+// Swaps columns `p` and `p + 1` of all subscripts inside `op`.
+void swapColumns(Op *op, int p) {
+  for (auto region : op->getRegions()) {
+    for (auto bb : region->getBlocks()) {
+      for (auto x : bb->getOps()) {
+        if (auto attr = x->find<SubscriptAttr>())
+          std::swap(attr->subscript[p], attr->subscript[p + 1]);
+        swapColumns(x, p);
+      }
+    }
+  }
+}
+
+}
+
+// Swaps `outer` and `inner`, which must be a legal perfect nest.
+void LoopNest::interchange(Op *outer, Op *inner, int depth) {
+  // Swap the operands and induction variables.
+  for (int i = 0; i < 4; i++) {
+    auto x = outer->getOperand(i);
+    auto y = inner->getOperand(i);
+    outer->setOperand(i, y);
+    inner->setOperand(i, x);
+  }
+
+  std::vector<std::pair<Op*, int>> outerUses, innerUses;
+  for (auto use : outer->getUses()) {
+    for (int i = 0; i < use->getOperandCount(); i++) {
+      if (use->DEF(i) == outer)
+        outerUses.push_back({ use, i });
+    }
+  }
+  for (auto use : inner->getUses()) {
+    for (int i = 0; i < use->getOperandCount(); i++) {
+      if (use->DEF(i) == inner)
+        innerUses.push_back({ use, i });
+    }
+  }
+  for (auto [use, i] : outerUses)
+    use->setOperand(i, inner);
+  for (auto [use, i] : innerUses)
+    use->setOperand(i, outer);
+
+  // Swap the columns of subscripts as well.
+  swapColumns(inner, depth);
+  interchanged++;
+}
+
+// Strip-mines `inner` and moves the strips outside `outer`:
+//
+//   for (jj = init; jj < stop; jj += T * step) {
+//     e = min(jj + T * step, stop);
+//     for (i ...)
+//       for (j = jj; j < e; j += step)
+//   }
+void LoopNest::tile(Op *outer, Op *inner, int depth) {
+  auto func = outer->getParentOp<FuncOp>();
+  auto entry = func->getRegion()->getFirstBlock();
+
+  Builder builder;
+  builder.setToBlockEnd(entry);
+  auto ivAddr = builder.create<AllocaOp>({ new SizeAttr(4) });
+  auto endAddr = builder.create<AllocaOp>({ new SizeAttr(4) });
+
+  auto init = inner->getOperand(0);
+  auto stop = inner->getOperand(1);
+  builder.setBeforeOp(outer);
+  auto width = builder.create<IntOp>({ new IntAttr(tileSize * V(inner->DEF(2))) });
+  auto strip = builder.create<ForOp>({ init, stop, width, ivAddr }, { new ImpureAttr });
+  strip->createFirstBlock();
+  outer->moveToEnd(strip->getRegion()->getFirstBlock());
+
+  // Fix up subscripts for the new depth.
+  auto &sub = SUBSCRIPT(outer);
+  sub.insert(sub.begin() + depth, 0);
+  shift(outer, depth);
+
+  AffineExpr expr(depth + 2);
+  expr[depth] = 1;
+  strip->add<SubscriptAttr>(expr);
+
+  builder.setBeforeOp(outer);
+  auto end = builder.create<AddIOp>({ strip, width });
+  builder.create<StoreOp>({ end, endAddr }, { new SizeAttr(4), new ImpureAttr });
+  auto cond = builder.create<LtOp>({ stop, end });
+  auto branch = builder.create<IfOp>({ cond }, { new ImpureAttr });
+  auto ifso = branch->createFirstBlock();
+  builder.setToBlockStart(ifso);
+  builder.create<StoreOp>({ stop, endAddr }, { new SizeAttr(4), new ImpureAttr });
+
+  builder.setBeforeOp(outer);
+  auto limit = builder.create<LoadOp>(Value::i32, { endAddr }, { new SizeAttr(4) });
+  inner->setOperand(0, strip);
+  inner->setOperand(1, limit);
+  tiled++;
+}
+
+void LoopNest::runImpl(Op *loop, int depth) {
+  auto bb = loop->getRegion()->getFirstBlock();
+  std::vector<Op*> inner;
+  for (auto op : bb->getOps()) {
+    if (isa<ForOp>(op))
+      inner.push_back(op);
+  }
+
+  for (auto op : inner)
+    runImpl(op, depth + 1);
+
+  // Only look at the innermost pair of loops.
+  if (inner.size() != 1 || inner[0]->findAll<ForOp>().size() != 1)
+    return;
+
+  auto x = inner[0];
+  Nest nest;
+  if (!analyzeNest(loop, x, *dep, nest))
+    return;
+
+  // Hoist the invariant ops out, so that the nest is perfect.
+  for (auto op : nest.prelude) {
+    op->moveBefore(loop);
+    if (!op->has<SubscriptAttr>())
+      continue;
+
+    auto &expr = SUBSCRIPT(op);
+    if (depth == 0)
+      op->remove<SubscriptAttr>();
+    else
+      expr.erase(expr.begin() + depth);
+  }
+
+  // Put the loop with smaller strides inside.
+  if (cost(nest, depth) < cost(nest, depth + 1)) {
+    interchange(loop, x, depth);
+    for (auto &acc : nest.accesses) {
+      for (auto &[_, index] : acc.dims)
+        std::swap(index[depth], index[depth + 1]);
+    }
+  }
+
+  // Tiling needs a known positive step.
+  auto step = x->DEF(2);
+  if (!isa<IntOp>(step) || V(step) <= 0)
+    return;
+
+  // Don't bother if everything fits into the cache.
+  int footprint = 0;
+  std::set<Op*> bases;
+  for (auto &acc : nest.accesses) {
+    if (!acc.base)
+      return;
+    if (bases.insert(acc.base).second)
+      footprint += SIZE(acc.base);
+  }
+  if (footprint <= L1)
+    return;
+
+  // Tiling helps when the inner loop walks down a column, but the outer one
+  // goes along a row; the lines loaded by the inner loop are reused
+  // by the next few outer iterations, as long as a tile fits into cache.
+  bool walking = false;
+  for (auto &acc : nest.accesses) {
+    if (acc.affine && bytes(acc, depth + 1) >= lineSize && bytes(acc, depth) < lineSize)
+      walking = true;
+  }
+  if (!walking)
+    return;
+
+  tile(loop, x, depth);
+}
+
+void LoopNest::run() {
+  Dependence analysis(module);
+  dep = &analysis;
+
+  auto funcs = collectFuncs();
+
+  for (auto func : funcs) {
+    // Only top-level loops are marked by ArrayAccess.
+    std::vector<Op*> loops;
+    for (auto bb : func->getRegion()->getBlocks()) {
+      for (auto op : bb->getOps()) {
+        if (isa<ForOp>(op) && op->has<SubscriptAttr>())
+          loops.push_back(op);
+      }
+    }
+
+    for (auto loop : loops)
+      runImpl(loop, 0);
+  }
+}
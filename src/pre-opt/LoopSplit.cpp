@@ -0,0 +1,322 @@
+#include "PreLoopPasses.h"
+#include <optional>
+
+using namespace sys;
+
+std::map<std::string, int> LoopSplit::stats() {
+  return {
+    { "split-loops", split },
+    { "peeled-loops", peeled },
+    { "folded-ifs", folded },
+  };
+}
+
+namespace {
+
+// Loops larger than this aren't copied.
+constexpr int maxLoopSize = 200;
+// The total number of ops a function can grow by.
+constexpr int maxGrowth = 600;
+
+bool sameBase(Op *x, Op *y) {
+  if (isa<GetGlobalOp>(x) && isa<GetGlobalOp>(y))
+    return NAME(x) == NAME(y);
+  return x == y;
+}
+
+int size(Op *op) {
+  int total = 1;
+  for (auto region : op->getRegions()) {
+    for (auto bb : region->getBlocks()) {
+      for (auto x : bb->getOps())
+        total += size(x);
+    }
+  }
+  return total;
+}
+
+// Whether `op` is a load of a scalar that isn't written in `loop`.
+bool invariantLoad(Op *op, Op *loop) {
+  auto addr = op->DEF(0);
+  if (!isa<AllocaOp>(addr) && !isa<GetGlobalOp>(addr))
+    return false;
+
+  for (auto store : loop->findAll<StoreOp>()) {
+    if (sameBase(store->DEF(1), addr))
+      return false;
+  }
+
+  // Calls might write to globals.
+  if (isa<GetGlobalOp>(addr)) {
+    for (auto call : loop->findAll<CallOp>()) {
+      if (call->has<ImpureAttr>())
+        return false;
+    }
+  }
+  return true;
+}
+
+// Whether `op` has the same value in every iteration of `loop`.
+bool invariant(Op *op, Op *loop) {
+  if (!op->inside(loop) || isa<IntOp>(op))
+    return true;
+
+  if (isa<LoadOp>(op))
+    return invariantLoad(op, loop);
+
+  if (isa<AddIOp>(op) || isa<SubIOp>(op) || isa<MulIOp>(op))
+    return invariant(op->DEF(0), loop) && invariant(op->DEF(1), loop);
+
+  return false;
+}
+
+// Whether memory can't change between `op` and the start of `loop`.
+bool quiet(Op *op, Op *loop) {
+  if (op->inside(loop))
+    return true;
+  if (op->getParent() != loop->getParent())
+    return false;
+
+  for (auto runner = op; runner != loop; runner = runner->nextOp()) {
+    if (isa<StoreOp>(runner) || runner->getRegionCount())
+      return false;
+    if (isa<CallOp>(runner) && runner->has<ImpureAttr>())
+      return false;
+  }
+  return true;
+}
+
+// Whether the invariants `a` and `b` of `loop` always hold the same value.
+bool same(Op *a, Op *b, Op *loop) {
+  if (a == b)
+    return true;
+  if (isa<IntOp>(a) && isa<IntOp>(b))
+    return V(a) == V(b);
+  if (isa<LoadOp>(a) && isa<LoadOp>(b))
+    return sameBase(a->DEF(0), b->DEF(0)) && quiet(a, loop) && quiet(b, loop);
+  return false;
+}
+
+// Whether `a` is always `b - 1`.
+bool predecessor(Op *a, Op *b, Op *loop) {
+  if (isa<IntOp>(a) && isa<IntOp>(b))
+    return (int64_t) V(a) + 1 == V(b);
+  if (isa<SubIOp>(a) && isa<IntOp>(a->DEF(1)) && V(a->DEF(1)) == 1)
+    return same(a->DEF(0), b, loop);
+  if (isa<AddIOp>(a) && isa<IntOp>(a->DEF(1)) && V(a->DEF(1)) == -1)
+    return same(a->DEF(0), b, loop);
+  return false;
+}
+
+// A condition that holds exactly on one side of `bound + delta`
+// in the iteration space of a loop.
+struct Split {
+  Op *bound;
+  int delta;
+  // Whether the condition holds below the split point.
+  bool below;
+  // Whether only a single iteration is split off.
+  bool peel;
+};
+
+std::optional<Split> analyze(Op *cond, Op *loop) {
+  if (!isa<LtOp>(cond) && !isa<LeOp>(cond) && !isa<EqOp>(cond) && !isa<NeOp>(cond))
+    return std::nullopt;
+
+  auto lhs = cond->DEF(0), rhs = cond->DEF(1);
+  if ((lhs == loop) == (rhs == loop))
+    return std::nullopt;
+
+  bool left = lhs == loop;
+  auto k = left ? rhs : lhs;
+  if (!invariant(k, loop))
+    return std::nullopt;
+
+  // i < k, i <= k, k < i, k <= i.
+  if (isa<LtOp>(cond))
+    return Split { k, left ? 0 : 1, left, false };
+  if (isa<LeOp>(cond))
+    return Split { k, left ? 1 : 0, left, false };
+
+  // i == k holds in a single iteration. That's only worth copying at either end.
+  bool eq = isa<EqOp>(cond);
+  auto start = loop->DEF(0), stop = loop->DEF(1);
+  if (same(k, start, loop))
+    return Split { start, 1, eq, true };
+  if (predecessor(k, stop, loop))
+    return Split { stop, -1, !eq, true };
+  return std::nullopt;
+}
+
+// Recomputes the invariant `op` at the builder's position.
+Op *hoist(Builder &builder, Op *op, Op *loop) {
+  if (!op->inside(loop))
+    return op;
+
+  std::vector<Op*> operands;
+  for (auto operand : op->getOperands())
+    operands.push_back(hoist(builder, operand.defining, loop));
+
+  auto copy = builder.copy(op);
+  for (int i = 0; i < operands.size(); i++)
+    copy->setOperand(i, operands[i]);
+  return copy;
+}
+
+// min(stop, k + 1), built like `extremum`.
+// k + 1 wraps around when k is INT_MAX, so it's only computed when k < stop.
+Op *successor(Op *k, Op *stop, Op *before) {
+  Builder builder;
+  auto func = before->getParentOp<FuncOp>();
+  builder.setToBlockEnd(func->getRegion()->getFirstBlock());
+  auto addr = builder.create<AllocaOp>({ new SizeAttr(4) });
+
+  builder.setBeforeOp(before);
+  builder.create<StoreOp>({ stop, addr }, { new SizeAttr(4), new ImpureAttr });
+  Value lhs = k, rhs = stop;
+  auto cond = builder.create<LtOp>({ lhs, rhs });
+  auto branch = builder.create<IfOp>({ cond }, { new ImpureAttr });
+  auto ifso = branch->createFirstBlock();
+  builder.setToBlockStart(ifso);
+  Value one = builder.create<IntOp>({ new IntAttr(1) });
+  auto next = builder.create<AddIOp>({ lhs, one });
+  builder.create<StoreOp>({ next, addr }, { new SizeAttr(4), new ImpureAttr });
+
+  builder.setBeforeOp(before);
+  return builder.create<LoadOp>(Value::i32, { addr }, { new SizeAttr(4) });
+}
+
+// Replaces `branch` with the region that `value` selects.
+void fold(Op *branch, bool value) {
+  int region = value ? 0 : 1;
+  // Note that the else clause can be empty.
+  if (branch->getRegions().size() > region) {
+    for (auto bb : branch->getRegion(region)->getBlocks()) {
+      auto ops = bb->getOps();
+      for (auto inner : ops)
+        inner->moveBefore(branch);
+    }
+  }
+  branch->erase();
+}
+
+}
+
+// Turns
+//
+//   for (i = start; i < stop; i++) { if (i < k) A else B }
+//
+// into
+//
+//   mid = max(start, min(stop, k))
+//   for (i = start; i < mid; i++) A
+//   for (i = mid; i < stop; i++) B
+//
+bool LoopSplit::runImpl(Op *loop, int &budget) {
+  // With larger steps the second part wouldn't start at an iteration of the first.
+  auto step = loop->DEF(2);
+  if (!isa<IntOp>(step) || V(step) != 1)
+    return false;
+
+  // After lowering, the final value of the induction variable is stored
+  // to its address. Splitting might change that value.
+  for (auto use : loop->DEF(3)->getUses()) {
+    if (isa<LoadOp>(use))
+      return false;
+  }
+
+  // Leaving the first part early must skip the second one as well.
+  if (!loop->findAll<BreakOp>().empty() || !loop->findAll<ReturnOp>().empty())
+    return false;
+
+  Op *branch = nullptr;
+  std::optional<Split> found;
+  for (auto op : loop->findAll<IfOp>()) {
+    if ((found = analyze(op->DEF(0), loop))) {
+      branch = op;
+      break;
+    }
+  }
+  if (!branch)
+    return false;
+
+  auto [bound, delta, below, peel] = *found;
+  auto start = loop->DEF(0), stop = loop->DEF(1);
+
+  // When the bounds are known, one of the parts might be empty.
+  if (isa<IntOp>(bound)) {
+    int64_t value = (int64_t) V(bound) + delta;
+    if (isa<IntOp>(start) && value <= V(start)) {
+      fold(branch, !below);
+      folded++;
+      return true;
+    }
+    if (isa<IntOp>(stop) && value >= V(stop)) {
+      fold(branch, below);
+      folded++;
+      return true;
+    }
+    if (value < INT_MIN || value > INT_MAX)
+      return false;
+  }
+
+  int cost = size(loop);
+  if (cost > maxLoopSize || cost > budget)
+    return false;
+  budget -= cost;
+
+  Builder builder;
+  builder.setBeforeOp(loop);
+  Op *point = hoist(builder, bound, loop);
+  Op *lim;
+  if (delta > 0 && !isa<IntOp>(point))
+    lim = successor(point, stop, loop);
+  else {
+    if (delta && isa<IntOp>(point))
+      point = builder.create<IntOp>({ new IntAttr(V(point) + delta) });
+    else if (delta) {
+      // This is `stop - 1`, which only wraps around when the loop doesn't run at all.
+      // Then `mid` below is `start` anyway.
+      Value base = point;
+      Value offset = builder.create<IntOp>({ new IntAttr(delta) });
+      point = builder.create<AddIOp>({ base, offset });
+    }
+    lim = extremum(point, stop, false, loop);
+  }
+
+  // The first part runs in [start, mid), and the second one in [mid, stop).
+  auto mid = extremum(lim, start, true, loop);
+
+  std::map<Op*, Op*> cloned;
+  auto copy = clone(builder, loop, cloned);
+  copy->setOperand(1, mid);
+  loop->setOperand(0, mid);
+  fold(cloned[branch], below);
+  fold(branch, !below);
+
+  if (peel)
+    peeled++;
+  else
+    split++;
+  return true;
+}
+
+void LoopSplit::run() {
+  auto funcs = collectFuncs();
+
+  for (auto func : funcs) {
+    int budget = maxGrowth;
+
+    // Every change removes a branch, so this terminates.
+    bool changed;
+    do {
+      changed = false;
+      for (auto loop : func->findAll<ForOp>()) {
+        if (runImpl(loop, budget)) {
+          changed = true;
+          break;
+        }
+      }
+    } while (changed);
+  }
+}
@@ -0,0 +1,158 @@
+#include "PrePasses.h"
+
+using namespace sys;
+
+std::map<std::string, int> Memoize::stats() {
+  return {
+    { "memoized-functions", memoized },
+  };
+}
+
+namespace {
+
+// Number of entries in the cache of each function. Must be a power of two.
+constexpr int cacheSize = 1 << 16;
+// Arguments are mixed with this multiplier to get the index into the cache.
+constexpr unsigned hashMul = 0x9e3779b1;
+// Each argument needs a table of its own.
+constexpr int maxArgs = 4;
+
+void createTable(ModuleOp *module, const std::string &name, bool fp) {
+  Builder builder;
+  builder.setToRegionStart(module->getRegion());
+  auto global = builder.create<GlobalOp>({ new NameAttr(name), new SizeAttr(cacheSize * 4) });
+  if (fp)
+    global->add<FloatArrayAttr>(new float[cacheSize](), cacheSize);
+  else
+    global->add<IntArrayAttr>(new int[cacheSize](), cacheSize);
+}
+
+}
+
+// Turns
+//
+//   int f(int x, int y) { body }
+//
+// into
+//
+//   int f(int x, int y) {
+//     h = (x * K + y) % N;
+//     if (valid[h] && key0[h] == x && key1[h] == y)
+//       return value[h];
+//     body
+//   }
+//
+// where every `return r` in the body is replaced with
+//
+//   key0[h] = x; key1[h] = y; value[h] = r; valid[h] = 1;
+//   return r;
+//
+// The cache is direct-mapped, so a collision just overwrites the older entry.
+void Memoize::runImpl(FuncOp *func) {
+  const auto &name = NAME(func);
+
+  // A single self call makes a chain of calls, each with different arguments.
+  // It takes at least two for the same arguments to come up again.
+  int selfCalls = 0;
+  for (auto call : func->findAll<CallOp>()) {
+    if (NAME(call) == name)
+      selfCalls++;
+  }
+  if (selfCalls < 2)
+    return;
+
+  int argcnt = func->get<ArgCountAttr>()->count;
+  auto getargs = func->findAll<GetArgOp>();
+  if (argcnt == 0 || argcnt > maxArgs || getargs.size() != argcnt)
+    return;
+
+  std::vector<Op*> args(argcnt);
+  for (auto getarg : getargs) {
+    if (getarg->getResultType() != Value::i32)
+      return;
+    // Pointers are also i32 here, but they're stored with size 8.
+    for (auto use : getarg->getUses()) {
+      if (!isa<StoreOp>(use) || SIZE(use) != 4)
+        return;
+    }
+    args[V(getarg)] = getarg;
+  }
+
+  auto rets = func->findAll<ReturnOp>();
+  for (auto ret : rets) {
+    if (ret->getOperandCount() == 0)
+      return;
+  }
+  bool fp = rets[0]->DEF(0)->getResultType() == Value::f32;
+
+  auto prefix = name + ".memo.";
+  for (int i = 0; i < argcnt; i++)
+    createTable(module, prefix + "key" + std::to_string(i), false);
+  createTable(module, prefix + "value", fp);
+  createTable(module, prefix + "valid", false);
+
+  // Look up the cache right after the arguments are read.
+  Builder builder;
+  builder.setAfterOp(getargs.back());
+
+  Value hash = args[0];
+  for (int i = 1; i < argcnt; i++) {
+    auto mul = builder.create<IntOp>({ new IntAttr((int) hashMul) });
+    hash = builder.create<MulIOp>({ hash, mul });
+    hash = builder.create<AddIOp>({ hash, args[i] });
+  }
+  auto mask = builder.create<IntOp>({ new IntAttr(cacheSize - 1) });
+  hash = builder.create<AndIOp>({ hash, mask });
+  auto four = builder.create<IntOp>({ new IntAttr(4) });
+  auto offset = builder.create<MulIOp>({ hash, four });
+
+  const auto entry = [&](const std::string &table) -> Op* {
+    auto base = builder.create<GetGlobalOp>({ new NameAttr(prefix + table) });
+    return builder.create<AddLOp>({ base, offset });
+  };
+
+  auto valid = entry("valid");
+  Value hit = builder.create<LoadOp>(Value::i32, { valid }, { new SizeAttr(4) });
+  std::vector<Op*> keys;
+  for (int i = 0; i < argcnt; i++) {
+    auto key = entry("key" + std::to_string(i));
+    auto loaded = builder.create<LoadOp>(Value::i32, { key }, { new SizeAttr(4) });
+    auto eq = builder.create<EqOp>({ loaded, args[i] });
+    hit = builder.create<AndIOp>({ hit, eq });
+    keys.push_back(key);
+  }
+  auto value = entry("value");
+  auto resultTy = fp ? Value::f32 : Value::i32;
+
+  auto branch = builder.create<IfOp>({ hit }, { new ImpureAttr });
+  auto ifso = branch->createFirstBlock();
+  builder.setToBlockStart(ifso);
+  auto cached = builder.create<LoadOp>(resultTy, { value }, { new SizeAttr(4) });
+  builder.create<ReturnOp>({ cached });
+
+  // Fill the cache on each return.
+  for (auto ret : rets) {
+    builder.setBeforeOp(ret);
+    for (int i = 0; i < argcnt; i++)
+      builder.create<StoreOp>({ args[i], keys[i] }, { new SizeAttr(4), new ImpureAttr });
+    builder.create<StoreOp>({ ret->DEF(0), value }, { new SizeAttr(4), new ImpureAttr });
+    auto one = builder.create<IntOp>({ new IntAttr(1) });
+    builder.create<StoreOp>({ one, valid }, { new SizeAttr(4), new ImpureAttr });
+  }
+
+  // The function now writes to memory.
+  func->add<ImpureAttr>();
+  memoized++;
+}
+
+void Memoize::run() {
+  auto funcs = collectFuncs();
+
+  for (auto func : funcs) {
+    // The cache can't skip side effects, so only pure functions qualify.
+    if (func->has<ImpureAttr>() || NAME(func) == "main")
+      continue;
+
+    runImpl(func);
+  }
+}
@@ -0,0 +1,236 @@
+#include "PreLoopPasses.h"
+
+using namespace sys;
+
+std::map<std::string, int> Parallelize::stats() {
+  return {
+    { "parallelized-loops", parallelized },
+  };
+}
+
+namespace {
+
+// The runtime passes all argument registers through to the worker, but nothing on the stack.
+// Two of the integer registers hold the range of iterations.
+constexpr int maxIntArgs = 8;
+constexpr int maxFloatArgs = 8;
+
+// Whether `addr` holds a scalar (or a pointer) rather than an array.
+bool scalar(Op *addr) {
+  for (auto use : addr->getUses()) {
+    if (!isa<LoadOp>(use) && !isa<StoreOp>(use) && !isa<ForOp>(use))
+      return false;
+  }
+  return true;
+}
+
+// Whether the scalar `addr` is written in `loop`, either by a store or as an induction variable.
+bool written(Op *addr, Op *loop) {
+  for (auto use : addr->getUses()) {
+    if (!use->inside(loop))
+      continue;
+    if (isa<StoreOp>(use) && use->DEF(1) == addr)
+      return true;
+    if (isa<ForOp>(use) && use->DEF(3) == addr)
+      return true;
+  }
+  return false;
+}
+
+// Collects values defined outside `loop` but used by the ops in `op`.
+void collectOutside(Op *op, Op *loop, std::vector<Op*> &outside, std::set<Op*> &seen) {
+  for (auto region : op->getRegions()) {
+    for (auto bb : region->getBlocks()) {
+      for (auto x : bb->getOps()) {
+        for (auto operand : x->getOperands()) {
+          auto def = operand.defining;
+          if (!def->inside(loop) && seen.insert(def).second)
+            outside.push_back(def);
+        }
+        collectOutside(x, loop, outside, seen);
+      }
+    }
+  }
+}
+
+// Makes `loop` and the ops inside it use `with` in place of `def`.
+void replaceInside(Op *def, Op *with, Op *loop) {
+  auto uses = def->getUses();
+  for (auto use : uses) {
+    if (!use->inside(loop))
+      continue;
+    for (int i = 0; i < use->getOperandCount(); i++) {
+      if (use->DEF(i) == def)
+        use->setOperand(i, with);
+    }
+  }
+}
+
+}
+
+// Turns
+//
+//   for (i = start; i < stop; i++) body
+//
+// into
+//
+//   f.par0(start, stop, x, y)   <parallel>
+//
+//   void f.par0(lo, hi, x, y) {
+//     for (i = lo; i < hi; i++) body
+//   }
+//
+// where `x` and `y` are the values `body` takes from outside the loop.
+// Scalars written in the body are temporaries of each iteration, so they become locals of the worker.
+bool Parallelize::runImpl(FuncOp *func, Op *loop, int &count) {
+  auto start = loop->DEF(0), stop = loop->DEF(1), step = loop->DEF(2);
+  auto ivAddr = loop->DEF(3);
+
+  // Each thread runs a contiguous part of the range.
+  if (!isa<IntOp>(step) || V(step) != 1)
+    return false;
+
+  // Starting threads only pays off if every iteration runs a loop of its own.
+  if (loop->findAll<ForOp>().size() == 1 && loop->findAll<WhileOp>().empty())
+    return false;
+  if (isa<IntOp>(start) && isa<IntOp>(stop) && (int64_t) V(stop) - V(start) < parallelMinTrips)
+    return false;
+
+  // After lowering, the final value of the induction variable is stored to its address.
+  // The workers don't agree on that value.
+  for (auto use : ivAddr->getUses()) {
+    if (isa<LoadOp>(use))
+      return false;
+  }
+
+  if (!dep->parallel(loop))
+    return false;
+
+  std::vector<Op*> outside;
+  std::set<Op*> seen { ivAddr };
+  collectOutside(loop, loop, outside, seen);
+
+  // Outside values are either recomputed in the worker,
+  // kept on the worker's own stack, or passed as arguments.
+  std::vector<Op*> cloned, locals { ivAddr }, params;
+  int ints = 2, floats = 0;
+  for (auto def : outside) {
+    if (isa<IntOp>(def) || isa<FloatOp>(def) || isa<GetGlobalOp>(def)) {
+      cloned.push_back(def);
+      continue;
+    }
+
+    bool fp = def->getResultType() == Value::f32;
+    if (isa<AllocaOp>(def) && scalar(def)) {
+      if (written(def, loop)) {
+        locals.push_back(def);
+        continue;
+      }
+      fp = def->has<FPAttr>();
+    }
+
+    params.push_back(def);
+    fp ? floats++ : ints++;
+  }
+  if (ints > maxIntArgs || floats > maxFloatArgs)
+    return false;
+
+  Builder builder;
+  auto name = NAME(func) + ".par" + std::to_string(count++);
+  builder.setAfterOp(func);
+  auto worker = builder.create<FuncOp>({
+    new NameAttr(name),
+    new ArgCountAttr(params.size() + 2),
+    new ImpureAttr,
+    new ParallelAttr,
+  });
+  auto allocas = worker->createFirstBlock();
+  auto entry = worker->getRegion()->appendBlock();
+
+  // Read-only scalars are passed by value.
+  builder.setBeforeOp(loop);
+  std::vector<Value> args { start, stop };
+  for (auto def : params) {
+    if (!isa<AllocaOp>(def) || !scalar(def)) {
+      args.push_back(def);
+      continue;
+    }
+    auto ty = def->has<FPAttr>() ? Value::f32 : SIZE(def) == 8 ? Value::i64 : Value::i32;
+    args.push_back(builder.create<LoadOp>(ty, { def }, { new SizeAttr(SIZE(def)) }));
+  }
+  builder.create<CallOp>(Value::i32, args, {
+    new NameAttr(name),
+    new ImpureAttr,
+    new ParallelAttr,
+  });
+
+  builder.setToBlockEnd(allocas);
+  for (auto addr : locals)
+    replaceInside(addr, builder.copy(addr), loop);
+
+  builder.setToBlockEnd(entry);
+  Op *lo = builder.create<GetArgOp>(Value::i32, { new IntAttr(0) });
+  Op *hi = builder.create<GetArgOp>(Value::i32, { new IntAttr(1) });
+  for (int i = 0; i < params.size(); i++) {
+    auto def = params[i];
+    auto ty = args[i + 2].defining->getResultType() == Value::f32 ? Value::f32 : Value::i32;
+    Op *arg = builder.create<GetArgOp>(ty, { new IntAttr(i + 2) });
+    if (!isa<AllocaOp>(def) || !scalar(def)) {
+      replaceInside(def, arg, loop);
+      continue;
+    }
+
+    // Like ordinary arguments, the value is stored to a local variable.
+    Op *addr;
+    {
+      Builder::Guard guard(builder);
+      builder.setToBlockEnd(allocas);
+      addr = builder.copy(def);
+    }
+    builder.create<StoreOp>({ arg, addr }, { new SizeAttr(SIZE(def)) });
+    replaceInside(def, addr, loop);
+  }
+  for (auto def : cloned)
+    replaceInside(def, builder.copy(def), loop);
+  auto one = builder.copy(step);
+
+  loop->moveToEnd(entry);
+  loop->setOperand(0, lo);
+  loop->setOperand(1, hi);
+  loop->setOperand(2, one);
+  builder.create<ReturnOp>();
+
+  parallelized++;
+  return true;
+}
+
+void Parallelize::run() {
+  Dependence analysis(module);
+  dep = &analysis;
+
+  auto funcs = collectFuncs();
+
+  for (auto func : funcs) {
+    int count = 0;
+    // Outer loops go first; a parallelized loop isn't looked into.
+    std::vector<Op*> worklist;
+    for (auto bb : func->getRegion()->getBlocks()) {
+      for (auto op : bb->getOps()) {
+        if (isa<ForOp>(op))
+          worklist.push_back(op);
+      }
+    }
+
+    while (!worklist.empty()) {
+      auto loop = worklist.back();
+      worklist.pop_back();
+      if (runImpl(func, loop, count))
+        continue;
+
+      for (auto op : loop->getRegion()->getFirstBlock()->getOps()) {
+        if (isa<ForOp>(op))
+          worklist.push_back(op);
+      }
+    }
+  }
+}
@@ -4,6 +4,8 @@
 #include "../opt/Pass.h"
 #include "../codegen/Ops.h"
 #include "../codegen/Attrs.h"
+#include "PreAttrs.h"
+#include <optional>
 
 namespace sys {
 
@@ -21,6 +23,64 @@ public:
   void run() override;
 };
 
+// Dependence analysis between loads and stores in for-nests,
+// based on `SubscriptAttr` given by ArrayAccess.
+class Dependence {
+public:
+  // A load or store. Its address is delinearized into `dims`, which maps the
+  // stride of a dimension (in bytes) to its index. `offset` holds the constant
+  // bytes that don't belong to any dimension, as with constant-folded indices.
+  struct Access {
+    Op *op;
+    // The enclosing fors, outermost first.
+    std::vector<Op*> loops;
+    // A GlobalOp or an AllocaOp. Null when it comes from a pointer argument.
+    Op *base = nullptr;
+    bool write;
+    // False if the index of some dimension isn't affine.
+    bool affine = true;
+    std::map<int, AffineExpr> dims;
+    int offset = 0;
+  };
+
+  // Distance along each common loop, from an iteration of the first access
+  // to an iteration of the second touching the same element.
+  // Unknown distances are left empty.
+  using Distance = std::vector<std::optional<int>>;
+
+private:
+  std::map<std::string, Op*> globals;
+
+  Op *resolve(Op *addr);
+  bool isScalar(Op *op);
+  // Collects accesses to arrays and to scalars in `loop`.
+  bool collect(Op *loop, std::vector<Access> &arrays, std::map<Op*, std::vector<Op*>> &scalars);
+  // Whether scalars don't carry dependences across iterations of `loop`.
+  bool scalarsOk(Op *loop, const std::map<Op*, std::vector<Op*>> &scalars, bool allowSum);
+public:
+  Dependence(ModuleOp *module);
+
+  Access get(Op *op);
+  // Array accesses in `loop`, including its inner loops.
+  std::vector<Access> accesses(Op *loop);
+
+  // Returns false if `a` and `b` never touch the same element.
+  // They share the first `common` loops, among which the first `fixed` loops
+  // run the same iteration; `dist` is filled for the common loops.
+  bool test(const Access &a, const Access &b, int common, int fixed, Distance &dist);
+
+  // Whether no dependence is carried by `loop`, so its iterations can run in any order.
+  // Scalars written in `loop` must be temporaries that are written before read.
+  bool parallel(Op *loop);
+  // Whether `outer` and `inner`, the only loop directly inside it, can be interchanged.
+  bool interchangeable(Op *outer, Op *inner);
+  // Whether `second`, a loop at the same depth after `first`, can be fused into it
+  // so that each of its iterations runs right after the same iteration of `first`.
+  bool fusible(Op *first, Op *second);
+
+  static int depth(Op *loop);
+};
+
 }
 
 #endif
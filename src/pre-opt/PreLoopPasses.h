@@ -5,9 +5,15 @@
 #include "../codegen/CodeGen.h"
 #include "../codegen/Ops.h"
 #include "../codegen/Attrs.h"
+#include "PreAnalysis.h"
 
 namespace sys {
 
+// Deep-copies `op` at the builder's position. `cloned` maps ops to their copies.
+Op *clone(Builder &builder, Op *op, std::map<Op*, Op*> &cloned);
+// Computes min(x, y), or max(x, y) if `max` is set, before `before`.
+Op *extremum(Op *x, Op *y, bool max, Op *before);
+
 // Raise whiles to fors whenever possible.
 class RaiseToFor : public Pass {
   int raised = 0;
@@ -19,10 +25,16 @@ public:
   void run() override;
 };
 
-// Loop fusion.
+// Loop fusion. Loops with slightly different bounds are fused after peeling.
 class Fusion : public Pass {
   int fused = 0;
+  int peeled = 0;
+
+  Dependence *dep;
+  // Peeled loops. They aren't fused again.
+  std::set<Op*> copies;
 
+  void peel(Op *loop, Op *start, Op *stop, Op *before);
   void runImpl(FuncOp *func);
 public:
   Fusion(ModuleOp *module): Pass(module) {}
@@ -32,6 +44,58 @@ public:
   void run() override;
 };
 
+// Loop interchange and tiling for perfectly nested fors.
+// Relies on `SubscriptAttr` given by ArrayAccess.
+class LoopNest : public Pass {
+  int interchanged = 0;
+  int tiled = 0;
+
+  Dependence *dep;
+
+  void runImpl(Op *loop, int depth);
+  void interchange(Op *outer, Op *inner, int depth);
+  void tile(Op *outer, Op *inner, int depth);
+public:
+  LoopNest(ModuleOp *module): Pass(module) {}
+
+  std::string name() override { return "loop-nest"; }
+  std::map<std::string, int> stats() override;
+  void run() override;
+};
+
+// Splits fors at the point where a comparison on the induction variable flips,
+// so that neither part has to test it. Peels the first or last iteration for `==`.
+class LoopSplit : public Pass {
+  int split = 0;
+  int peeled = 0;
+  int folded = 0;
+
+  bool runImpl(Op *loop, int &budget);
+public:
+  LoopSplit(ModuleOp *module): Pass(module) {}
+
+  std::string name() override { return "loop-split"; }
+  std::map<std::string, int> stats() override;
+  void run() override;
+};
+
+// Runs outer fors without loop-carried dependences on several threads.
+// The body is outlined into a worker function taking a range of iterations,
+// and the loop is replaced by a `<parallel>` call to it.
+class Parallelize : public Pass {
+  int parallelized = 0;
+
+  Dependence *dep;
+
+  bool runImpl(FuncOp *func, Op *loop, int &count);
+public:
+  Parallelize(ModuleOp *module): Pass(module) {}
+
+  std::string name() override { return "parallelize"; }
+  std::map<std::string, int> stats() override;
+  void run() override;
+};
+
 // Lower operations back to its original form.
 class Lower : public Pass {
 public:
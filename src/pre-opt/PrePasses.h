@@ -56,6 +56,19 @@ public:
   void run() override;
 };
 
+// Caches the results of pure recursive functions with integer arguments.
+class Memoize : public Pass {
+  int memoized = 0;
+
+  void runImpl(FuncOp *func);
+public:
+  Memoize(ModuleOp *module): Pass(module) {}
+    
+  std::string name() override { return "memoize"; };
+  std::map<std::string, int> stats() override;
+  void run() override;
+};
+
 // Remerge basic blocks.
 // It is always possible to ensure each region has one block (except allocas),
 // since before FlattenCFG there's no jumps.
@@ -38,6 +38,14 @@ void dumpOp(Op *op, std::ostream &os) {
     { "fcvtsw", "fcvt.s.w" },
     { "fmvwx", "fmv.w.x" },
     { "fmv", "fmv.s" },
+    { "vaddvv", "vadd.vv" },
+    { "vsubvv", "vsub.vv" },
+    { "vmulvv", "vmul.vv" },
+    { "vfaddvv", "vfadd.vv" },
+    { "vfsubvv", "vfsub.vv" },
+    { "vfmulvv", "vfmul.vv" },
+    { "vmvvx", "vmv.v.x" },
+    { "vfmvvf", "vfmv.v.f" },
   };
 
   // Skip the initial "rv."
@@ -103,6 +111,30 @@ void dumpOp(Op *op, std::ostream &os) {
     return;
   }
 
+  if (isa<Vle32Op>(op)) {
+    auto rd = op->get<RdAttr>()->reg;
+    auto rs = op->get<RsAttr>()->reg;
+    os << "vle32.v " << rd << ", (" << rs << ")\n";
+    return;
+  }
+
+  if (isa<Vse32Op>(op)) {
+    auto rs = op->get<RsAttr>()->reg;
+    auto rs2 = op->get<Rs2Attr>()->reg;
+    os << "vse32.v " << rs << ", (" << rs2 << ")\n";
+    return;
+  }
+
+  // v0 is never allocated, so it is free to hold the scalar sum.
+  if (isa<VredsumOp>(op)) {
+    auto rd = op->get<RdAttr>()->reg;
+    auto rs = op->get<RsAttr>()->reg;
+    os << "vmv.s.x v0, zero\n";
+    os << "  vredsum.vs v0, " << rs << ", v0\n";
+    os << "  vmv.x.s " << rd << ", v0\n";
+    return;
+  }
+
   if (isa<FcvtwsRtzOp>(op)) {
     auto rd = op->get<RdAttr>()->reg;
     auto rs = op->get<RsAttr>()->reg;
@@ -152,24 +184,239 @@ void dumpOp(Op *op, std::ostream &os) {
   os << str << "\n";
 }
 
+// Whether `op` reads or writes a vector register.
+static bool usesVector(Op *op) {
+  return isa<Vse32Op>(op) || isa<VredsumOp>(op) || (op->has<RdAttr>() && isVec(op->get<RdAttr>()->reg));
+}
+
+// Fork-join runtime for calls with ParallelAttr. It runs on raw clone/futex syscalls,
+// so the output doesn't need to link against anything beyond the usual runtime.
+//
+// `NAME.fork` puts the worker in t0 and jumps here, with the worker's arguments untouched;
+// [a0, a1) is the iteration range. The range is split into `parallelThreads` chunks.
+// Helper threads are cloned on the first call, and afterwards sleep on `gen` until the next one.
+// `pending` counts helpers that haven't finished their chunk.
+//
+// Layout of __sysc_par_state:
+//   0: worker, 8-64: a0-a7, 72-100: fa0-fa7, 104: gen, 108: pending, 112: started
+static const char *parallelRuntime = R"(
+.text
+__sysc_parallel_for:
+  sext.w t1, a0
+  sext.w t2, a1
+  sub t1, t2, t1
+  li t2, $MIN
+  bge t1, t2, __sysc_par_fork
+  jr t0
+__sysc_par_fork:
+  addi sp, sp, -32
+  sd ra, 0(sp)
+  sd s0, 8(sp)
+  sd s1, 16(sp)
+  la s0, __sysc_par_state
+  sd t0, 0(s0)
+  sd a0, 8(s0)
+  sd a1, 16(s0)
+  sd a2, 24(s0)
+  sd a3, 32(s0)
+  sd a4, 40(s0)
+  sd a5, 48(s0)
+  sd a6, 56(s0)
+  sd a7, 64(s0)
+  fsw fa0, 72(s0)
+  fsw fa1, 76(s0)
+  fsw fa2, 80(s0)
+  fsw fa3, 84(s0)
+  fsw fa4, 88(s0)
+  fsw fa5, 92(s0)
+  fsw fa6, 96(s0)
+  fsw fa7, 100(s0)
+  lw t1, 112(s0)
+  bnez t1, __sysc_par_start
+  li t1, 1
+  sw t1, 112(s0)
+  li s1, 1
+__sysc_par_spawn:
+  la a1, __sysc_par_stacks
+  li t1, $STACK
+  mul t1, t1, s1
+  add a1, a1, t1
+  li a0, 0x50f00
+  li a2, 0
+  li a3, 0
+  li a4, 0
+  li a7, 220
+  ecall
+  beqz a0, __sysc_par_thread
+  addi s1, s1, 1
+  li t1, $T
+  blt s1, t1, __sysc_par_spawn
+__sysc_par_start:
+  li t1, $HELPERS
+  sw t1, 108(s0)
+  fence rw, rw
+  addi a0, s0, 104
+  li t1, 1
+  amoadd.w zero, t1, (a0)
+  li a1, 129
+  li a2, $HELPERS
+  li a7, 98
+  ecall
+  li a0, 0
+  call __sysc_par_run
+__sysc_par_wait:
+  lw a2, 108(s0)
+  beqz a2, __sysc_par_done
+  addi a0, s0, 108
+  li a1, 128
+  li a3, 0
+  li a7, 98
+  ecall
+  j __sysc_par_wait
+__sysc_par_done:
+  fence rw, rw
+  ld ra, 0(sp)
+  ld s0, 8(sp)
+  ld s1, 16(sp)
+  addi sp, sp, 32
+  ret
+
+__sysc_par_thread:
+  li s2, 0
+__sysc_par_idle:
+  lw t1, 104(s0)
+  bne t1, s2, __sysc_par_work
+  addi a0, s0, 104
+  li a1, 128
+  mv a2, s2
+  li a3, 0
+  li a7, 98
+  ecall
+  j __sysc_par_idle
+__sysc_par_work:
+  mv s2, t1
+  fence rw, rw
+  mv a0, s1
+  call __sysc_par_run
+  fence rw, rw
+  addi a0, s0, 108
+  li t1, -1
+  amoadd.w t1, t1, (a0)
+  li t2, 1
+  bne t1, t2, __sysc_par_idle
+  li a1, 129
+  li a2, 1
+  li a7, 98
+  ecall
+  j __sysc_par_idle
+
+__sysc_par_run:
+  addi sp, sp, -16
+  sd ra, 0(sp)
+  ld t1, 8(s0)
+  sext.w t1, t1
+  ld t2, 16(s0)
+  sext.w t2, t2
+  sub t3, t2, t1
+  addi t3, t3, $HELPERS
+  li t4, $T
+  div t3, t3, t4
+  mul t4, t3, a0
+  add a0, t1, t4
+  add a1, a0, t3
+  ble a1, t2, __sysc_par_clamped
+  mv a1, t2
+__sysc_par_clamped:
+  bge a0, a1, __sysc_par_empty
+  ld a2, 24(s0)
+  ld a3, 32(s0)
+  ld a4, 40(s0)
+  ld a5, 48(s0)
+  ld a6, 56(s0)
+  ld a7, 64(s0)
+  flw fa0, 72(s0)
+  flw fa1, 76(s0)
+  flw fa2, 80(s0)
+  flw fa3, 84(s0)
+  flw fa4, 88(s0)
+  flw fa5, 92(s0)
+  flw fa6, 96(s0)
+  flw fa7, 100(s0)
+  ld t0, 0(s0)
+  jalr t0
+__sysc_par_empty:
+  ld ra, 0(sp)
+  addi sp, sp, 16
+  ret
+
+.bss
+  .align 4
+__sysc_par_state:
+  .space 128
+__sysc_par_stacks:
+  .space $STACKS
+)";
+
+// Each helper thread gets a stack of this many bytes.
+constexpr int parallelStack = 256 * 1024;
+
+static void dumpParallelRuntime(std::ostream &os) {
+  std::string text = parallelRuntime;
+  std::map<std::string, int> values = {
+    { "$MIN", parallelMinTrips },
+    { "$STACKS", (parallelThreads - 1) * parallelStack },
+    { "$STACK", parallelStack },
+    { "$HELPERS", parallelThreads - 1 },
+    { "$T", parallelThreads },
+  };
+  // `values` is sorted so that "$STACKS" is replaced before "$STACK".
+  for (auto it = values.rbegin(); it != values.rend(); it++) {
+    const auto &[key, value] = *it;
+    for (size_t pos; (pos = text.find(key)) != std::string::npos;)
+      text.replace(pos, key.size(), std::to_string(value));
+  }
+  os << text << "\n";
+}
+
 void Dump::dump(std::ostream &os) {
   os << ".global main\n";
 
   auto funcs = module->findAll<FuncOp>();
+  bool parallel = false;
 
   for (auto func : funcs) {
     os << NAME(func) << ":\n";
     for (auto bb : func->getRegion()->getBlocks()) {
       os << "bb" << getCount(bb) << ":\n";
 
+      // All vector ops have the same type. Set it once for each block,
+      // and again after calls, which might change it.
+      bool vtype = false;
       for (auto op : bb->getOps()) {
+        if (!vtype && usesVector(op)) {
+          os << "  vsetivli zero, 4, e32, m1, ta, ma\n";
+          vtype = true;
+        }
+        if (isa<sys::rv::CallOp>(op))
+          vtype = false;
+
         os << "  ";
         dumpOp(op, os);
       }
     }
     os << "\n\n";
+
+    if (func->has<ParallelAttr>()) {
+      os << NAME(func) << ".fork:\n";
+      os << "  la t0, " << NAME(func) << "\n";
+      os << "  j __sysc_parallel_for\n\n\n";
+      parallel = true;
+    }
   }
 
+  if (parallel)
+    dumpParallelRuntime(os);
+
   auto globals = module->findAll<GlobalOp>();
   // Arrays of all zeros should be put in .bss segment.
   std::vector<Op*> bss;
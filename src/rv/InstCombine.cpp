@@ -210,6 +210,20 @@ void InstCombine::run() {
     return false;
   });
 
+  // An `andi` that clears only bits already known to be 0 does nothing.
+  // Values are sign-extended, so the low 32 bits decide it.
+  runRewriter([&](AndiOp *op) {
+    auto x = op->getOperand().defining;
+    auto known = x->find<KnownBitsAttr>();
+    if (!known || (~(uint32_t) V(op) & ~known->zeros))
+      return false;
+
+    combined++;
+    op->replaceAllUsesWith(x);
+    op->erase();
+    return true;
+  });
+
   runRewriter([&](AddiwOp *op) {
     if (V(op) == 0) {
       op->replaceAllUsesWith(op->getOperand().defining);
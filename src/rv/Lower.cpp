@@ -233,23 +233,23 @@ void Lower::run() {
   runRewriter([&](EqOp *op) {
     builder.setBeforeOp(op);
     // 'xor' is a keyword of C++.
-    auto xorOp = builder.create<XorOp>(op->getOperands(), op->getAttrs());
-    builder.replace<SeqzOp>(op,{ xorOp });
+    auto xorOp = builder.create<XorOp>(op->getOperands());
+    builder.replace<SeqzOp>(op, { xorOp }, op->getAttrs());
     return true;
   });
 
   runRewriter([&](NeOp *op) {
     builder.setBeforeOp(op);
     // 'xor' is a keyword of C++.
-    auto xorOp = builder.create<XorOp>(op->getOperands(), op->getAttrs());
-    builder.replace<SnezOp>(op,{ xorOp });
+    auto xorOp = builder.create<XorOp>(op->getOperands());
+    builder.replace<SnezOp>(op, { xorOp }, op->getAttrs());
     return true;
   });
 
   runRewriter([&](NeFOp *op) {
     builder.setBeforeOp(op);
-    auto feq = builder.create<FeqOp>(op->getOperands(), op->getAttrs());
-    builder.replace<SeqzOp>(op, { feq });
+    auto feq = builder.create<FeqOp>(op->getOperands());
+    builder.replace<SeqzOp>(op, { feq }, op->getAttrs());
     return true;
   });
 
@@ -258,20 +258,62 @@ void Lower::run() {
     auto l = op->getOperand(0);
     auto r = op->getOperand(1);
     // Turn (l <= r) into !(r < l).
-    auto xorOp = builder.create<SltOp>({ r, l }, op->getAttrs());
-    builder.replace<SeqzOp>(op,{ xorOp });
+    auto xorOp = builder.create<SltOp>({ r, l });
+    builder.replace<SeqzOp>(op, { xorOp }, op->getAttrs());
     return true;
   });
 
+  // The addresses are lowered to plain arithmetic, so alias info is lost afterwards.
+  // Keep it on the memory access itself for the post-RA scheduler.
+  const auto keepAlias = [](Op *access, Op *addr) {
+    auto alias = addr->find<AliasAttr>();
+    if (alias && !alias->unknown && !access->has<AliasAttr>())
+      access->add<AliasAttr>(alias->location);
+  };
+
   runRewriter([&](sys::LoadOp *op) {
+    auto addr = op->DEF(0);
     auto load = builder.replace<sys::rv::LoadOp>(op, op->getResultType(), op->getOperands(), op->getAttrs());
     load->add<IntAttr>(0);
+    keepAlias(load, addr);
     return true;
   });
 
   runRewriter([&](sys::StoreOp *op) {
+    auto addr = op->DEF(1);
     auto store = builder.replace<sys::rv::StoreOp>(op, op->getOperands(), op->getAttrs());
     store->add<IntAttr>(0);
+    keepAlias(store, addr);
+    return true;
+  });
+
+  REPLACE(VAddIOp, VaddvvOp);
+  REPLACE(VSubIOp, VsubvvOp);
+  REPLACE(VMulIOp, VmulvvOp);
+  REPLACE(VAddFOp, VfaddvvOp);
+  REPLACE(VSubFOp, VfsubvvOp);
+  REPLACE(VMulFOp, VfmulvvOp);
+  REPLACE(VReduceAddIOp, VredsumOp);
+
+  runRewriter([&](VSplatOp *op) {
+    if (op->DEF()->getResultType() == Value::f32)
+      builder.replace<VfmvvfOp>(op, op->getOperands(), op->getAttrs());
+    else
+      builder.replace<VmvvxOp>(op, op->getOperands(), op->getAttrs());
+    return true;
+  });
+
+  runRewriter([&](VLoadOp *op) {
+    auto addr = op->DEF(0);
+    auto load = builder.replace<Vle32Op>(op, op->getResultType(), op->getOperands(), op->getAttrs());
+    keepAlias(load, addr);
+    return true;
+  });
+
+  runRewriter([&](VStoreOp *op) {
+    auto addr = op->DEF(1);
+    auto store = builder.replace<Vse32Op>(op, op->getOperands(), op->getAttrs());
+    keepAlias(store, addr);
     return true;
   });
 
@@ -337,8 +379,10 @@ void Lower::run() {
       builder.create<StoreOp>({ spilled[i], sp }, { new SizeAttr(8), new IntAttr(i * 8) });
     }
 
+    // Parallel calls go through a stub that hands the callee to the runtime (see Dump).
+    auto name = op->has<ParallelAttr>() ? new NameAttr(NAME(op) + ".fork") : op->get<NameAttr>();
     builder.create<sys::rv::CallOp>(argsNew, { 
-      op->get<NameAttr>(),
+      name,
       new ArgCountAttr(args.size())
     });
 
@@ -0,0 +1,266 @@
+#include "RvPasses.h"
+#include "Regs.h"
+#include <unordered_set>
+
+using namespace sys::rv;
+using namespace sys;
+
+std::map<std::string, int> PostSchedule::stats() {
+  return {
+    { "reordered-regions", reordered },
+  };
+}
+
+namespace {
+
+// Latencies of SiFive U74 (the cores on JH7110).
+// Ops not listed here have a latency of 1.
+const std::unordered_map<int, int> u74 = {
+  { sys::rv::LoadOp::id, 3 },
+
+  { MulOp::id, 3 },
+  { MulwOp::id, 3 },
+  { MulhOp::id, 3 },
+  { MulhuOp::id, 3 },
+
+  { DivOp::id, 20 },
+  { DivwOp::id, 20 },
+  { RemOp::id, 20 },
+  { RemwOp::id, 20 },
+
+  { FaddOp::id, 5 },
+  { FsubOp::id, 5 },
+  { FmulOp::id, 5 },
+  { FdivOp::id, 20 },
+  { FeqOp::id, 4 },
+  { FltOp::id, 4 },
+  { FleOp::id, 4 },
+  { FcvtswOp::id, 4 },
+  { FcvtwsRtzOp::id, 4 },
+  { FmvwxOp::id, 2 },
+};
+
+int latency(Op *op) {
+  auto it = u74.find(op->opid);
+  return it == u74.end() ? 1 : it->second;
+}
+
+// Nothing can move across these ops.
+bool isBarrier(Op *op) {
+  return isa<sys::rv::CallOp>(op) || isa<RetOp>(op) || isa<JOp>(op) ||
+    isa<BeqOp>(op) || isa<BneOp>(op) || isa<BltOp>(op) ||
+    isa<BgeOp>(op) || isa<BleOp>(op) || isa<BgtOp>(op);
+}
+
+void getDefUse(Op *op, std::vector<Reg> &defs, std::vector<Reg> &uses) {
+  if (hasRd(op) && op->has<RdAttr>())
+    defs.push_back(RD(op));
+  if (op->has<RsAttr>())
+    uses.push_back(RS(op));
+  if (op->has<Rs2Attr>())
+    uses.push_back(RS2(op));
+}
+
+struct Access {
+  Op *op;
+  int index;
+  bool store;
+  // The base register, and how many times it has been written before this access.
+  // Two accesses with the same (base, version) are relative to the same address.
+  Reg base;
+  int version;
+  int offset;
+  int size;
+};
+
+bool mayConflict(const Access &a, const Access &b) {
+  if (!a.store && !b.store)
+    return false;
+
+  if (a.base == b.base && a.version == b.version)
+    return a.offset < b.offset + b.size && b.offset < a.offset + a.size;
+
+  auto aa = a.op->find<AliasAttr>();
+  auto ab = b.op->find<AliasAttr>();
+  if (aa && ab && aa->neverAlias(ab))
+    return false;
+  return true;
+}
+
+}
+
+// A list scheduler on a single region between barriers,
+// assuming an in-order core that issues one instruction per cycle.
+// The priority is the length of the critical path to the end of the region.
+bool PostSchedule::runImpl(const std::vector<Op*> &ops, Op *stop, BasicBlock *bb) {
+  if (ops.size() <= 2)
+    return false;
+
+  int n = ops.size();
+  // Edges with latencies.
+  std::vector<std::vector<std::pair<int, int>>> succs(n);
+  std::vector<int> degree(n);
+
+  const auto addEdge = [&](int from, int to, int lat) {
+    succs[from].push_back({ to, lat });
+    degree[to]++;
+  };
+
+  std::unordered_map<Reg, int> lastDef, version;
+  std::unordered_map<Reg, std::vector<int>> lastUses;
+  std::vector<Access> accesses;
+
+  for (int i = 0; i < n; i++) {
+    auto op = ops[i];
+    std::vector<Reg> defs, uses;
+    getDefUse(op, defs, uses);
+
+    for (auto reg : uses) {
+      if (reg == Reg::zero)
+        continue;
+      // Read after write.
+      if (lastDef.count(reg))
+        addEdge(lastDef[reg], i, latency(ops[lastDef[reg]]));
+    }
+
+    if (isa<LoadOp>(op) || isa<StoreOp>(op)) {
+      bool store = isa<StoreOp>(op);
+      Reg base = store ? RS2(op) : RS(op);
+      Access access { op, i, store, base, version[base], V(op), (int) SIZE(op) };
+      for (const auto &other : accesses) {
+        if (mayConflict(other, access))
+          addEdge(other.index, i, 1);
+      }
+      accesses.push_back(access);
+    }
+
+    // Vector accesses have no offset, and cover all 4 lanes.
+    if (isa<Vle32Op>(op) || isa<Vse32Op>(op)) {
+      bool store = isa<Vse32Op>(op);
+      Reg base = store ? RS2(op) : RS(op);
+      Access access { op, i, store, base, version[base], 0, 16 };
+      for (const auto &other : accesses) {
+        if (mayConflict(other, access))
+          addEdge(other.index, i, 1);
+      }
+      accesses.push_back(access);
+    }
+
+    for (auto reg : defs) {
+      if (reg == Reg::zero)
+        continue;
+      // Write after read.
+      for (auto use : lastUses[reg]) {
+        if (use != i)
+          addEdge(use, i, 0);
+      }
+      // Write after write.
+      if (lastDef.count(reg))
+        addEdge(lastDef[reg], i, 1);
+
+      lastDef[reg] = i;
+      lastUses[reg].clear();
+      version[reg]++;
+    }
+
+    for (auto reg : uses)
+      lastUses[reg].push_back(i);
+  }
+
+  // Length of the critical path, computed in reverse order.
+  std::vector<int> height(n);
+  for (int i = n - 1; i >= 0; i--) {
+    height[i] = latency(ops[i]);
+    for (auto [succ, lat] : succs[i])
+      height[i] = std::max(height[i], height[succ] + lat);
+  }
+
+  // The earliest cycle that an op can be issued.
+  std::vector<int> earliest(n);
+  std::vector<int> ready;
+  for (int i = 0; i < n; i++) {
+    if (!degree[i])
+      ready.push_back(i);
+  }
+
+  std::vector<int> order;
+  int cycle = 0;
+  while (!ready.empty()) {
+    // Prefer ops that can issue now; among them, the one on the critical path.
+    // If nothing can issue now, pick the one that stalls the least.
+    int best = -1;
+    for (auto i : ready) {
+      if (best == -1) {
+        best = i;
+        continue;
+      }
+
+      bool issuable = earliest[i] <= cycle;
+      bool bestIssuable = earliest[best] <= cycle;
+      if (issuable != bestIssuable) {
+        if (issuable)
+          best = i;
+        continue;
+      }
+
+      if (!issuable && earliest[i] != earliest[best]) {
+        if (earliest[i] < earliest[best])
+          best = i;
+        continue;
+      }
+
+      // Keep the original order when tied.
+      if (height[i] > height[best] || (height[i] == height[best] && i < best))
+        best = i;
+    }
+
+    ready.erase(std::find(ready.begin(), ready.end(), best));
+    order.push_back(best);
+    cycle = std::max(cycle, earliest[best]) + 1;
+
+    for (auto [succ, lat] : succs[best]) {
+      earliest[succ] = std::max(earliest[succ], cycle - 1 + lat);
+      if (!--degree[succ])
+        ready.push_back(succ);
+    }
+  }
+  assert(order.size() == ops.size());
+
+  bool changed = false;
+  for (int i = 0; i < n; i++) {
+    if (order[i] != i)
+      changed = true;
+  }
+  if (!changed)
+    return false;
+
+  for (auto i : order) {
+    if (stop)
+      ops[i]->moveBefore(stop);
+    else
+      ops[i]->moveToEnd(bb);
+  }
+  return true;
+}
+
+void PostSchedule::run() {
+  auto funcs = collectFuncs();
+
+  for (auto func : funcs) {
+    for (auto bb : func->getRegion()->getBlocks()) {
+      std::vector<Op*> ops;
+      // Copy the list, as the ops are moved around.
+      auto all = bb->getOps();
+      for (auto op : all) {
+        if (!isBarrier(op)) {
+          ops.push_back(op);
+          continue;
+        }
+
+        reordered += runImpl(ops, op, bb);
+        ops.clear();
+      }
+      reordered += runImpl(ops, nullptr, bb);
+    }
+  }
+}
@@ -106,6 +106,17 @@ void dumpAssignment(Region *region, const std::unordered_map<Op*, Reg> &assignme
   }
 }
 
+// Integers, floats and vectors use different registers.
+enum class RegClass {
+  Int, Float, Vector,
+};
+
+RegClass regClass(Op *op) {
+  if (isVector(op))
+    return RegClass::Vector;
+  return op->getResultType() == Value::f32 ? RegClass::Float : RegClass::Int;
+}
+
 // Used in constructing interference graph.
 struct Event {
   int timestamp;
@@ -113,6 +124,141 @@ struct Event {
   Op *op;
 };
 
+//   bb1:
+//     j bb3
+//   bb3:
+//     %1 = phi %a <from = bb1>, %b <from = bb2>
+//     %2 = writereg %1 <reg = a0>
+//     ret %2
+// becomes
+//   bb1:
+//     %3 = writereg %a <reg = a0>
+//     ret %3
+//
+// A return shared by several paths is dominated by none of them,
+// which would force the frame to be set up at the entry.
+void RegAlloc::splitReturns(Region *region) {
+  Builder builder;
+  region->updatePreds();
+
+  std::vector<BasicBlock*> rets;
+  for (auto bb : region->getBlocks()) {
+    if (!isa<RetOp>(bb->getLastOp()))
+      continue;
+
+    bool simple = true;
+    for (auto op : bb->getOps()) {
+      if (!isa<PhiOp>(op) && !isa<WriteRegOp>(op) && !isa<RetOp>(op))
+        simple = false;
+    }
+    if (simple)
+      rets.push_back(bb);
+  }
+
+  for (auto bb : rets) {
+    auto phis = bb->getPhis();
+    auto preds = bb->preds;
+    for (auto pred : preds) {
+      auto term = pred->getLastOp();
+      if (!isa<JOp>(term))
+        continue;
+
+      std::unordered_map<Op*, Op*> phiValue;
+      for (auto phi : phis) {
+        const auto &attrs = phi->getAttrs();
+        for (size_t i = 0; i < attrs.size(); i++) {
+          if (FROM(attrs[i]) == pred) {
+            phiValue[phi] = phi->getOperand(i).defining;
+            phi->removeOperand(i);
+            phi->removeAttribute(i);
+            break;
+          }
+        }
+      }
+
+      builder.setBeforeOp(term);
+      std::vector<Value> writes;
+      for (auto op : bb->getOps()) {
+        if (!isa<WriteRegOp>(op))
+          continue;
+
+        auto def = op->DEF(0);
+        if (phiValue.count(def))
+          def = phiValue[def];
+        writes.push_back(builder.create<WriteRegOp>({ def }, { new RegAttr(REG(op)) }));
+      }
+      builder.create<RetOp>(writes);
+      term->erase();
+    }
+
+    region->updatePreds();
+    if (bb->preds.empty())
+      bb->forceErase();
+  }
+  region->updatePreds();
+}
+
+// After `splitReturns`, the frame often needs to be set up only on some paths.
+// However, a value that is live into those paths and lives across a call
+// would be assigned a callee-saved register before the branch,
+// which forces the frame back to the entry.
+//
+// Give these values a fresh copy at the start of the frame region,
+// so that the original one only lives in a caller-saved register.
+void RegAlloc::splitLiveIns(Region *region) {
+  auto entry = region->getFirstBlock();
+  auto save = findSaveBlock(region, [](BasicBlock *bb) {
+    for (auto op : bb->getOps()) {
+      if (isa<CallOp>(op) || isa<GetArgOp>(op))
+        return true;
+      if (isa<ReadRegOp>(op) && REG(op) == Reg::sp)
+        return true;
+    }
+    return false;
+  });
+  if (!save || save == entry)
+    return;
+
+  region->updateLiveness();
+  Builder builder;
+  auto phis = save->getPhis();
+  if (phis.size())
+    builder.setAfterOp(phis.back());
+  else
+    builder.setToBlockStart(save);
+
+  auto liveIn = save->getLiveIn();
+  for (auto def : liveIn) {
+    // Vectors never live across calls.
+    if (isa<PlaceHolderOp>(def) || isVector(def))
+      continue;
+
+    Op *copy;
+    if (isa<LiOp>(def) || isa<LaOp>(def))
+      copy = builder.copy(def);
+    else if (def->getResultType() == Value::f32)
+      copy = builder.create<FmvOp>({ def });
+    else {
+      copy = builder.create<MvOp>({ def });
+      copy->setResultType(def->getResultType());
+    }
+
+    auto uses = def->getUses();
+    for (auto use : uses) {
+      if (use == copy || !use->getParent()->dominatedBy(save))
+        continue;
+      // Phis at `save` take values from outside.
+      if (use->getParent() == save && isa<PhiOp>(use))
+        continue;
+
+      for (int i = 0; i < use->getOperandCount(); i++) {
+        if (use->getOperand(i).defining == def)
+          use->setOperand(i, copy);
+      }
+    }
+  }
+}
+
 void RegAlloc::runImpl(Region *region, bool isLeaf) {
   const Reg *order = isLeaf ? leafOrder : normalOrder;
   const Reg *orderf = isLeaf ? leafOrderf : normalOrderf;
@@ -125,13 +271,17 @@ void RegAlloc::runImpl(Region *region, bool isLeaf) {
 
   auto funcOp = region->getParent();
 
+  splitReturns(region);
+
   // First of all, add 35 precolored placeholders before each call.
   // This denotes that a CallOp clobbers those registers.
+  std::unordered_set<Op*> clobbers;
   runRewriter(funcOp, [&](CallOp *op) {
     builder.setBeforeOp(op);
     for (auto reg : callerSaved) {
       auto placeholder = builder.create<PlaceHolderOp>();
       assignment[placeholder] = reg;
+      clobbers.insert(placeholder);
       // Make floating point respect the placeholders.
       if (isFP(reg))
         placeholder->setResultType(Value::f32);
@@ -191,6 +341,9 @@ void RegAlloc::runImpl(Region *region, bool isLeaf) {
     // Spilled to stack; don't do anything.
   }
 
+  if (!isLeaf)
+    splitLiveIns(region);
+
   region->updateLiveness();
 
   // Interference graph.
@@ -280,10 +433,10 @@ void RegAlloc::runImpl(Region *region, bool isLeaf) {
 
       if (event.start) {
         for (Op* activeOp : active) {
-          // FP and int are using different registers.
+          // FP, int and vectors are using different registers.
           // However, they are using the same stack,
           // so that must be taken into account when spilling.
-          if (activeOp->getResultType() == Value::f32 ^ op->getResultType() == Value::f32) {
+          if (regClass(activeOp) != regClass(op)) {
             spillInterf[op].insert(activeOp);
             spillInterf[activeOp].insert(op);
             continue;
@@ -313,6 +466,28 @@ void RegAlloc::runImpl(Region *region, bool isLeaf) {
     return pa == pb ? interf[a].size() > interf[b].size() : pa > pb;
   });
 
+  // Phis would like to share the register with their operands,
+  // so group them together to see whether any one of them lives across a call.
+  std::unordered_map<Op*, Op*> group;
+  std::function<Op*(Op*)> find = [&](Op *x) {
+    if (!group.count(x) || group[x] == x)
+      return x;
+    return group[x] = find(group[x]);
+  };
+  for (auto [phi, operands] : phiOperand) {
+    for (auto x : operands)
+      group[find(x)] = find(phi);
+  }
+  std::unordered_set<Op*> acrossCall;
+  for (auto [op, v] : interf) {
+    for (auto x : v) {
+      if (clobbers.count(x)) {
+        acrossCall.insert(find(op));
+        break;
+      }
+    }
+  }
+
   std::unordered_map<Op*, int> spillOffset;
   int currentOffset = STACKOFF(funcOp);
   int highest = 0;
@@ -375,6 +550,16 @@ void RegAlloc::runImpl(Region *region, bool isLeaf) {
     auto rcnt = op->getResultType() != Value::f32 ? regcount : regcountf;
     auto rorder = op->getResultType() != Value::f32 ? order : orderf;
 
+    // A value that doesn't live across any call had better use temporaries,
+    // so that it doesn't need to be preserved.
+    if (!acrossCall.count(find(op)))
+      rorder = op->getResultType() != Value::f32 ? leafOrder : leafOrderf;
+
+    if (isVector(op)) {
+      rcnt = regCntv;
+      rorder = orderv;
+    }
+
     for (int i = 0; i < rcnt; i++) {
       if (!bad.count(rorder[i]) && !unpreferred.count(rorder[i])) {
         assignment[op] = rorder[i];
@@ -395,6 +580,8 @@ void RegAlloc::runImpl(Region *region, bool isLeaf) {
     if (assignment.count(op))
       continue;
 
+    // Vectorize makes sure this never happens.
+    assert(!isVector(op));
     spilled++;
     // Spilled. Try to see all spill offsets of conflicting ops.
     int desired = currentOffset;
@@ -439,6 +626,7 @@ void RegAlloc::runImpl(Region *region, bool isLeaf) {
 
   const auto getReg = [&](Op *op) {
     return assignment.count(op) ? assignment[op] :
+      isVector(op) ? orderv[0] :
       op->getResultType() == Value::f32 ? orderf[0] : order[0];
   };
 
@@ -477,6 +665,13 @@ void RegAlloc::runImpl(Region *region, bool isLeaf) {
   LOWER(SraOp, BINARY);
   LOWER(SllOp, BINARY);
   LOWER(SrlOp, BINARY);
+  LOWER(Vse32Op, BINARY);
+  LOWER(VaddvvOp, BINARY);
+  LOWER(VsubvvOp, BINARY);
+  LOWER(VmulvvOp, BINARY);
+  LOWER(VfaddvvOp, BINARY);
+  LOWER(VfsubvvOp, BINARY);
+  LOWER(VfmulvvOp, BINARY);
   
   LOWER(LoadOp, UNARY);
   LOWER(AddiwOp, UNARY);
@@ -496,6 +691,12 @@ void RegAlloc::runImpl(Region *region, bool isLeaf) {
   LOWER(FcvtswOp, UNARY);
   LOWER(FcvtwsRtzOp, UNARY);
   LOWER(FmvwxOp, UNARY);
+  LOWER(MvOp, UNARY);
+  LOWER(FmvOp, UNARY);
+  LOWER(Vle32Op, UNARY);
+  LOWER(VmvvxOp, UNARY);
+  LOWER(VfmvvfOp, UNARY);
+  LOWER(VredsumOp, UNARY);
 
   // Note that some ops are dealt with later.
   // We can't remove all operands here.
@@ -639,6 +840,8 @@ void RegAlloc::runImpl(Region *region, bool isLeaf) {
   // Detect circular copies and calculate a correct order.
   std::unordered_map<BasicBlock*, std::vector<std::pair<Reg, Reg>>> moveMap;
   std::unordered_map<BasicBlock*, std::map<std::pair<Reg, Reg>, Op*>> revMap;
+  // Moves of rematerialized constants into a phi that shares their spill slot.
+  std::unordered_map<BasicBlock*, std::vector<Op*>> remats;
   for (auto bb : bbs) {
     auto phis = bb->getPhis();
 
@@ -675,6 +878,13 @@ void RegAlloc::runImpl(Region *region, bool isLeaf) {
       auto dst = SPILLABLE(mv, Rd);
       auto src = SPILLABLE(mv, Rs);
       if (src == dst) {
+        // The slot never holds a rematerialized constant, so the move is still needed.
+        // It doesn't read anything, so it goes after all other moves.
+        auto rs = mv->find<SpilledRsAttr>();
+        if (rs && (isa<LiOp>(rs->ref) || isa<LaOp>(rs->ref))) {
+          remats[mv->getParent()].push_back(mv);
+          continue;
+        }
         mv->erase();
         continue;
       }
@@ -748,13 +958,37 @@ void RegAlloc::runImpl(Region *region, bool isLeaf) {
       emitted.insert(dst);
     }
 
-    if (members.empty())
-      continue;
+    // Break each cycle with a scratch register:
+    //   tmp = header; header = m1; m1 = m2; ...; last = tmp
+    // The moves are reused, so spilled operands stay as they are.
+    for (const auto &[header, cycle] : members) {
+      auto last = revMap[bb][{ cycle.back(), header }];
+      bool fp = isa<FmvOp>(last);
+      Reg tmp = fp ? fspillReg2 : spillReg2;
+
+      builder.setBeforeOp(term);
+      auto save = builder.copy(last);
+      save->remove<RdAttr>();
+      save->remove<SpilledRdAttr>();
+      save->add<RdAttr>(tmp);
+
+      for (size_t i = 0; i + 1 < cycle.size(); i++) {
+        auto mv = revMap[bb][{ cycle[i], cycle[i + 1] }];
+        // Spilling to a far offset computes the address in `spillReg2`, which holds `tmp`.
+        assert(fp || !mv->has<SpilledRdAttr>() || mv->get<SpilledRdAttr>()->offset < 2048);
+        mv->moveBefore(term);
+      }
+
+      last->remove<RsAttr>();
+      last->remove<SpilledRsAttr>();
+      last->add<RsAttr>(tmp);
+      last->moveBefore(term);
+    }
+  }
 
-    // Looks like still buggy? No idea why.
-    // Anyway, disable it for now.
-    std::cerr << "remark: cycle detected\n";
-    assert(false);
+  for (const auto &[bb, mvs] : remats) {
+    for (auto mv : mvs)
+      mv->moveBefore(bb->getLastOp());
   }
 
   // Erase all phi's properly. There might be cross-reference across blocks,
@@ -292,6 +292,9 @@ void RegAlloc::tidyup(Region *region) {
     }
     return false;
   });
+
+  // A block that held nothing but such a jump is empty now.
+  removeEmptyBlocks(region);
 }
 
 void save(Builder builder, const std::vector<Reg> &regs, int offset) {
@@ -333,6 +336,93 @@ void load(Builder builder, const std::vector<Reg> &regs, int offset) {
   }
 }
 
+// A block needs the stack frame if it touches `sp` or a callee-saved register,
+// or if it calls another function (which clobbers `ra`).
+static bool needsFrame(BasicBlock *bb) {
+  const auto touches = [](Reg reg) {
+    return reg == Reg::sp || calleeSaved.count(reg);
+  };
+
+  for (auto op : bb->getOps()) {
+    if (isa<sys::rv::CallOp>(op) || isa<SubSpOp>(op) || isa<GetArgOp>(op))
+      return true;
+
+    if (op->has<RdAttr>() && touches(RD(op)))
+      return true;
+    if (op->has<RsAttr>() && touches(RS(op)))
+      return true;
+    if (op->has<Rs2Attr>() && touches(RS2(op)))
+      return true;
+  }
+  return false;
+}
+
+// Shrink-wrapping. Finds the block where the prologue should be placed.
+// Returns nullptr if no block needs the frame at all.
+// This is also used by the register allocator, before registers are known.
+//
+// The block must:
+//   1) dominate every block that needs the frame;
+//   2) not be in a cycle, otherwise we'd set up the frame for multiple times;
+//   3) for each return, either dominate it or be unable to reach it.
+//
+// Returns dominated by the block restore the frame before leaving,
+// and the others return directly without ever touching the stack.
+// If nothing better can be found, we fall back to the entry.
+BasicBlock *RegAlloc::findSaveBlock(Region *region, const std::function<bool(BasicBlock*)> &needsFrame) {
+  auto entry = region->getFirstBlock();
+  region->updateDoms();
+
+  std::vector<BasicBlock*> exits;
+  BasicBlock *save = nullptr;
+  for (auto bb : region->getBlocks()) {
+    if (isa<RetOp>(bb->getLastOp()))
+      exits.push_back(bb);
+
+    // Unreachable blocks don't matter.
+    if (!needsFrame(bb) || (bb != entry && !bb->getIdom()))
+      continue;
+
+    if (!save) {
+      save = bb;
+      continue;
+    }
+    // Find the nearest common dominator.
+    while (!bb->dominatedBy(save))
+      save = save->getIdom();
+  }
+
+  if (!save)
+    return nullptr;
+
+  while (save != entry) {
+    // Find all blocks reachable from `save`.
+    std::set<BasicBlock*> reachable;
+    std::vector<BasicBlock*> worklist(save->succs.begin(), save->succs.end());
+    while (!worklist.empty()) {
+      auto bb = worklist.back();
+      worklist.pop_back();
+      if (reachable.count(bb))
+        continue;
+
+      reachable.insert(bb);
+      for (auto succ : bb->succs)
+        worklist.push_back(succ);
+    }
+
+    bool good = !reachable.count(save);
+    for (auto exit : exits) {
+      if (reachable.count(exit) && !exit->dominatedBy(save))
+        good = false;
+    }
+
+    if (good)
+      break;
+    save = save->getIdom();
+  }
+  return save;
+}
+
 void RegAlloc::proEpilogue(FuncOp *funcOp, bool isLeaf) {
   Builder builder;
   auto usedRegs = usedRegisters[funcOp];
@@ -357,19 +447,27 @@ void RegAlloc::proEpilogue(FuncOp *funcOp, bool isLeaf) {
     offset = offset / 16 * 16 + 16;
 
   // Add function prologue, preserving the regs.
-  auto entry = region->getFirstBlock();
-  builder.setToBlockStart(entry);
-  if (offset != 0)
+  // If no block needs the frame, then we don't need to set it up at all.
+  auto saveBlock = findSaveBlock(region, needsFrame);
+  if (!saveBlock)
+    offset = 0;
+
+  if (offset != 0) {
+    builder.setToBlockStart(saveBlock);
     builder.create<SubSpOp>({ new IntAttr(offset) });
-  
-  save(builder, preserve, offset);
+    save(builder, preserve, offset);
+  }
 
   // Similarly add function epilogue.
   if (offset != 0) {
     auto rets = funcOp->findAll<RetOp>();
     auto bb = region->appendBlock();
-    for (auto ret : rets)
+    for (auto ret : rets) {
+      // This return never sees the frame. Leave it as-is.
+      if (!ret->getParent()->dominatedBy(saveBlock))
+        continue;
       builder.replace<JOp>(ret, { new TargetAttr(bb) });
+    }
 
     builder.setToBlockStart(bb);
 
@@ -98,6 +98,20 @@ const Reg fargRegs[] = {
 constexpr int leafRegCntf = 30;
 constexpr int normalRegCntf = 30;
 
+// All vector registers are caller-saved, and vectors never live across calls.
+// `v0` is left for masks.
+const Reg orderv[] = {
+  Reg::v1, Reg::v2, Reg::v3, Reg::v4,
+  Reg::v5, Reg::v6, Reg::v7, Reg::v8,
+  Reg::v9, Reg::v10, Reg::v11, Reg::v12,
+  Reg::v13, Reg::v14, Reg::v15, Reg::v16,
+  Reg::v17, Reg::v18, Reg::v19, Reg::v20,
+  Reg::v21, Reg::v22, Reg::v23, Reg::v24,
+  Reg::v25, Reg::v26, Reg::v27, Reg::v28,
+  Reg::v29, Reg::v30, Reg::v31,
+};
+constexpr int regCntv = 31;
+
 }
 
 #endif
@@ -13,7 +13,7 @@ bool RvDCE::isImpure(Op *op) {
   if (isa<SubSpOp>(op) || isa<JOp>(op) ||
       isa<BneOp>(op) || isa<BltOp>(op) ||
       isa<BgeOp>(op) || isa<BeqOp>(op) || isa<WriteRegOp>(op) ||
-      isa<StoreOp>(op) || isa<RetOp>(op) ||
+      isa<StoreOp>(op) || isa<Vse32Op>(op) || isa<RetOp>(op) ||
       isa<CallOp>(op))
     return true;
 
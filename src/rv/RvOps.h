@@ -42,6 +42,8 @@
 #define RVOP(Ty) RVOPBASE(Value::i32, Ty)
 #define RVOPL(Ty) RVOPBASE(Value::i64, Ty)
 #define RVOPF(Ty) RVOPBASE(Value::f32, Ty)
+#define RVOPV(Ty) RVOPBASE(Value::i128, Ty)
+#define RVOPVF(Ty) RVOPBASE(Value::f128, Ty)
 
 namespace sys {
 
@@ -117,9 +119,82 @@ RVOPF(FmulOp);
 RVOPF(FdivOp);
 RVOPF(FmvOp);
 
+// RVV ops, always with e32 and 4 lanes. See Dump for `vsetivli`.
+RVOPE(Vle32Op); // Unit-stride load.
+RVOP(Vse32Op); // Unit-stride store.
+RVOPV(VaddvvOp);
+RVOPV(VsubvvOp);
+RVOPV(VmulvvOp);
+RVOPVF(VfaddvvOp);
+RVOPVF(VfsubvvOp);
+RVOPVF(VfmulvvOp);
+RVOPV(VmvvxOp); // Splat an integer register.
+RVOPVF(VfmvvfOp); // Splat a float register.
+RVOP(VredsumOp); // Sum of all lanes into an integer register. Uses v0 as scratch.
+
+inline bool isVector(Op *op) {
+  auto ty = op->getResultType();
+  return ty == Value::i128 || ty == Value::f128;
+}
+
+// Ops that only compute a value from their operands and attributes,
+// so that they can be freely merged or moved before register allocation.
+inline bool isPure(Op *op) {
+  return
+    isa<LiOp>(op) ||
+    isa<LaOp>(op) ||
+    isa<AddOp>(op) ||
+    isa<AddwOp>(op) ||
+    isa<AddiwOp>(op) ||
+    isa<AddiOp>(op) ||
+    isa<SubOp>(op) ||
+    isa<SubwOp>(op) ||
+    isa<MulwOp>(op) ||
+    isa<MulOp>(op) ||
+    isa<DivwOp>(op) ||
+    isa<DivOp>(op) ||
+    isa<RemwOp>(op) ||
+    isa<RemOp>(op) ||
+    isa<SlliwOp>(op) ||
+    isa<SlliOp>(op) ||
+    isa<SrliwOp>(op) ||
+    isa<SrliOp>(op) ||
+    isa<SraiwOp>(op) ||
+    isa<SraiOp>(op) ||
+    isa<SllwOp>(op) ||
+    isa<SllOp>(op) ||
+    isa<SrlwOp>(op) ||
+    isa<SrlOp>(op) ||
+    isa<SrawOp>(op) ||
+    isa<SraOp>(op) ||
+    isa<MulhOp>(op) ||
+    isa<MulhuOp>(op) ||
+    isa<AndOp>(op) ||
+    isa<OrOp>(op) ||
+    isa<XorOp>(op) ||
+    isa<AndiOp>(op) ||
+    isa<OriOp>(op) ||
+    isa<XoriOp>(op) ||
+    isa<SeqzOp>(op) ||
+    isa<SnezOp>(op) ||
+    isa<SltOp>(op) ||
+    isa<SltiOp>(op) ||
+    isa<FcvtswOp>(op) ||
+    isa<FcvtwsRtzOp>(op) ||
+    isa<FmvwxOp>(op) ||
+    isa<FeqOp>(op) ||
+    isa<FltOp>(op) ||
+    isa<FleOp>(op) ||
+    isa<FaddOp>(op) ||
+    isa<FsubOp>(op) ||
+    isa<FmulOp>(op) ||
+    isa<FdivOp>(op);
+}
+
 inline bool hasRd(Op *op) {
   return !(
     isa<StoreOp>(op) ||
+    isa<Vse32Op>(op) ||
     isa<RetOp>(op) ||
     isa<JOp>(op) ||
     isa<BeqOp>(op) ||
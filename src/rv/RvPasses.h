@@ -2,6 +2,7 @@
 #define RV_PASSES_H
 
 #include "../opt/Pass.h"
+#include "../opt/MachineCSE.h"
 #include "RvAttrs.h"
 #include "RvOps.h"
 #include "../codegen/Ops.h"
@@ -10,6 +11,8 @@
 
 namespace sys {
 
+class LoopInfo;
+
 namespace rv {
 
 class Lower : public Pass {
@@ -59,6 +62,28 @@ public:
   void run() override;
 };
 
+class MachineCSE : public MachineCSEImpl<isPure> {
+public:
+  MachineCSE(ModuleOp *module): MachineCSEImpl(module) {}
+
+  std::string name() override { return "rv-cse"; };
+};
+
+// Hoists loop invariants out of loops, unless the loop is running out of registers.
+class MachineLICM : public Pass {
+  int hoisted = 0;
+  int kept = 0;
+
+  std::pair<int, int> pressure(LoopInfo *info);
+  void runImpl(LoopInfo *info);
+public:
+  MachineLICM(ModuleOp *module): Pass(module) {}
+
+  std::string name() override { return "rv-licm"; };
+  std::map<std::string, int> stats() override;
+  void run() override;
+};
+
 class RegAlloc : public Pass {
   int spilled = 0;
   int convertedTotal = 0;
@@ -69,6 +94,12 @@ class RegAlloc : public Pass {
   void runImpl(Region *region, bool isLeaf);
   // Create both prologue and epilogue of a function.
   void proEpilogue(FuncOp *funcOp, bool isLeaf);
+  // Shrink-wrapping; finds the block to set up the stack frame.
+  static BasicBlock *findSaveBlock(Region *region, const std::function<bool(BasicBlock*)> &needsFrame);
+  // Duplicates return blocks into their predecessors.
+  void splitReturns(Region *region);
+  // Splits live ranges that flow into the frame region (see `findSaveBlock`).
+  void splitLiveIns(Region *region);
   int latePeephole(Op *funcOp);
   void tidyup(Region *region);
 public:
@@ -79,6 +110,40 @@ public:
   void run() override;
 };
 
+// Global copy propagation on physical registers after register allocation.
+// Removes moves whose destination already holds the source (mostly from phi resolution),
+// and reloads of stack slots whose value is still in a register.
+class CopyProp : public Pass {
+  int removedMv = 0;
+  int removedFmv = 0;
+  int removedLoad = 0;
+
+  void runImpl(FuncOp *func);
+public:
+  CopyProp(ModuleOp *module): Pass(module) {}
+
+  std::string name() override { return "rv-copy-prop"; };
+  std::map<std::string, int> stats() override;
+  void run() override;
+};
+
+// Defined in CopyProp.cpp. Erases empty blocks, which fall through to the next one.
+void removeEmptyBlocks(Region *region);
+
+// A list scheduler after register allocation.
+// Spill reloads, address arithmetic and constants are all visible here.
+class PostSchedule : public Pass {
+  int reordered = 0;
+
+  bool runImpl(const std::vector<Op*> &ops, Op *stop, BasicBlock *bb);
+public:
+  PostSchedule(ModuleOp *module): Pass(module) {}
+
+  std::string name() override { return "rv-post-schedule"; };
+  std::map<std::string, int> stats() override;
+  void run() override;
+};
+
 // Dumps the output.
 class Dump : public Pass {
   std::string out;
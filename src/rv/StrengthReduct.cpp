@@ -37,6 +37,29 @@ Multiplier chooseMultiplier(int d) {
   return { shPost, mHigh, l };
 }
 
+// Whether the range analysis proved `op` is never negative.
+// Rounding toward zero then agrees with rounding down, so no sign fixup is needed.
+// Division by powers of two is already turned into shifts in that case.
+static bool nonNegative(Op *op, std::set<Op*> &visited) {
+  if (isa<LiOp>(op))
+    return V(op) >= 0;
+
+  // Phis can't carry a range, but they're never negative if none of their inputs are.
+  // A phi seen again is part of a cycle, which brings no new values in.
+  if (isa<PhiOp>(op)) {
+    if (!visited.insert(op).second)
+      return true;
+    for (auto operand : op->getOperands()) {
+      if (!nonNegative(operand.defining, visited))
+        return false;
+    }
+    return true;
+  }
+
+  auto range = op->find<RangeAttr>();
+  return range && range->range.first >= 0;
+}
+
 int StrengthReduct::runImpl() {
   Builder builder;
 
@@ -192,7 +215,16 @@ int StrengthReduct::runImpl() {
     converted++;
     auto [shPost, m, l] = chooseMultiplier(i);
     auto n = x.defining;
+    std::set<Op*> visited;
+    bool positive = nonNegative(n, visited);
     builder.setBeforeOp(op);
+    if (m < (1ull << 31) && positive) {
+      // XSIGN(n) is zero, and the 64-bit product doesn't overflow.
+      Value mVal = builder.create<LiOp>({ new IntAttr(m) });
+      Value mulsh = builder.create<MulOp>({ n, mVal });
+      builder.replace<SraiOp>(op, { mulsh }, { new IntAttr(32 + shPost) });
+      return true;
+    }
     if (m < (1ull << 31)) {
       // Issue q = SRA(MULSH(m, n), shPost) − XSIGN(n);
       // Note that this `mulsh` is for 32 bit; for 64 bit, the result is there.
@@ -212,6 +244,11 @@ int StrengthReduct::runImpl() {
       Value sra = add;
       if (shPost > 0)
         sra = builder.create<SraiwOp>({ add }, { new IntAttr(shPost) });
+      if (positive) {
+        op->replaceAllUsesWith(sra.defining);
+        op->erase();
+        return true;
+      }
       
       Value xsign = builder.create<SraiwOp>({ n }, { new IntAttr(31) });
       builder.replace<SubwOp>(op, { sra, xsign });
@@ -297,7 +334,7 @@ int StrengthReduct::runImpl() {
     //   x - %mul
     converted++;
     builder.setBeforeOp(op);
-    auto quot = builder.create<DivwOp>(op->getOperands(), op->getAttrs());
+    auto quot = builder.create<DivwOp>(op->getOperands());
     auto mul = builder.create<MulwOp>({ quot, y });
     builder.replace<SubwOp>(op, { x, mul });
 
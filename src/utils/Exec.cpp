@@ -65,6 +65,15 @@ float Interpreter::evalf(Op *op) {
   return value[op].vf;
 }
 
+Interpreter::Value Interpreter::evalv(Op *op) {
+  if (!value.count(op))
+    sys_unreachable("undefined op" << op);
+  auto ty = op->getResultType();
+  if (ty != sys::Value::i128 && ty != sys::Value::f128)
+    sys_unreachable("op of non-vector type: " << op);
+  return value[op];
+}
+
 void Interpreter::store(Op *op, intptr_t v) {
   value[op] = Value { .vi = v };
 }
@@ -74,9 +83,11 @@ void Interpreter::store(Op *op, float v) {
 }
 
 // The registers are in fact 64-bit.
+// i32 results are kept sign-extended, so that division, remainder and comparison
+// see negative values as negative.
 #define EXEC_BINARY(Ty, sign) \
   case Ty::id: \
-    store(op, (intptr_t) ((eval(op->DEF(0)) sign eval(op->DEF(1))) & 0xffffffff)); \
+    store(op, (intptr_t) (int32_t) (eval(op->DEF(0)) sign eval(op->DEF(1)))); \
     break
 
 #define EXEC_BINARY_L(Ty, sign) \
@@ -96,7 +107,7 @@ void Interpreter::store(Op *op, float v) {
 
 #define EXEC_UNARY(Ty, sign) \
   case Ty::id: \
-    store(op, (intptr_t) (sign eval(op->DEF()))); \
+    store(op, (intptr_t) (int32_t) (sign eval(op->DEF()))); \
     break
 
 #define EXEC_UNARY_F(Ty, sign) \
@@ -104,6 +115,28 @@ void Interpreter::store(Op *op, float v) {
     store(op, sign evalf(op->DEF())); \
     break
 
+// Tests against zero. The operand can be a float, as in `!f`.
+#define EXEC_UNARY_TEST(Ty, sign) \
+  case Ty::id: { \
+    auto x = op->DEF(); \
+    if (x->getResultType() == sys::Value::f32) \
+      store(op, (intptr_t) (sign evalf(x))); \
+    else \
+      store(op, (intptr_t) (int32_t) (sign eval(x))); \
+    break; \
+  }
+
+// Integer lanes wrap around like the scalar ops.
+#define EXEC_VECTOR(Ty, sign, lanes) \
+  case Ty::id: { \
+    auto x = evalv(op->DEF(0)), y = evalv(op->DEF(1)); \
+    Value v; \
+    for (int i = 0; i < 4; i++) \
+      v.lanes[i] = x.lanes[i] sign y.lanes[i]; \
+    value[op] = v; \
+    break; \
+  }
+
 // Defined in Pass.cpp
 namespace sys {
   bool isExtern(const std::string &name);
@@ -139,6 +172,8 @@ void Interpreter::exec(Op *op) {
   
   EXEC_BINARY_L(AddLOp, +);
   EXEC_BINARY_L(MulLOp, *);
+  EXEC_BINARY_L(ModLOp, %);
+  EXEC_BINARY_L(LShiftLOp, <<);
   EXEC_BINARY_L(RShiftLOp, >>);
 
   EXEC_BINARY_F(AddFOp, +);
@@ -150,8 +185,8 @@ void Interpreter::exec(Op *op) {
   EXEC_BINARY_FCOMP(LtFOp, <);
   EXEC_BINARY_FCOMP(NeFOp, !=);
 
-  EXEC_UNARY(NotOp, !);
-  EXEC_UNARY(SetNotZeroOp, !!);
+  EXEC_UNARY_TEST(NotOp, !);
+  EXEC_UNARY_TEST(SetNotZeroOp, !!);
   EXEC_UNARY(MinusOp, -);
 
   EXEC_UNARY_F(MinusFOp, -);
@@ -217,6 +252,43 @@ void Interpreter::exec(Op *op) {
       assert(false);
     break;
   }
+  EXEC_VECTOR(VAddIOp, +, vi4);
+  EXEC_VECTOR(VSubIOp, -, vi4);
+  EXEC_VECTOR(VMulIOp, *, vi4);
+  EXEC_VECTOR(VAddFOp, +, vf4);
+  EXEC_VECTOR(VSubFOp, -, vf4);
+  EXEC_VECTOR(VMulFOp, *, vf4);
+  case VSplatOp::id: {
+    Value v;
+    Op *def = op->DEF();
+    for (int i = 0; i < 4; i++) {
+      if (def->getResultType() == sys::Value::f32)
+        v.vf4[i] = evalf(def);
+      else
+        v.vi4[i] = eval(def);
+    }
+    value[op] = v;
+    break;
+  }
+  case VReduceAddIOp::id: {
+    auto x = evalv(op->DEF());
+    uint32_t sum = 0;
+    for (int i = 0; i < 4; i++)
+      sum += x.vi4[i];
+    store(op, (intptr_t) (int32_t) sum);
+    break;
+  }
+  case VLoadOp::id: {
+    Value v;
+    memcpy(v.vi4, (void*) eval(op->DEF()), 16);
+    value[op] = v;
+    break;
+  }
+  case VStoreOp::id: {
+    auto v = evalv(op->DEF(0));
+    memcpy((void*) eval(op->DEF(1)), v.vi4, 16);
+    break;
+  }
   case SelectOp::id: {
     Op *cond = op->DEF(0);
     store(op, eval(cond) ? eval(op->DEF(1)) : eval(op->DEF(2)));
@@ -273,6 +345,15 @@ Interpreter::Value Interpreter::applyExtern(const std::string &name, const std::
     outbuf << args[0].vf;
     return Value();
   }
+  if (name == "putarray") {
+    int n = args[0].vi;
+    int *ptr = (int*) args[1].vi;
+    outbuf << n << ":";
+    for (int i = 0; i < n; i++)
+      outbuf << " " << ptr[i];
+    outbuf << "\n";
+    return Value();
+  }
   if (name == "putfarray") {
     int n = args[0].vi;
     float *ptr = (float*) args[1].vi;
@@ -306,6 +387,20 @@ Interpreter::Value Interpreter::execf(Region *region, const std::vector<Value> &
       ip = dest->getFirstOp();
       break;
     }
+    // The phis of a block read their operands before any of them is assigned,
+    // as they might refer to each other.
+    case PhiOp::id: {
+      std::vector<std::pair<Op*, Value>> results;
+      for (; isa<PhiOp>(ip); ip = ip->nextOp()) {
+        Value old = value[ip];
+        exec(ip);
+        results.push_back({ ip, value[ip] });
+        value[ip] = old;
+      }
+      for (auto [phi, v] : results)
+        value[phi] = v;
+      break;
+    }
     // Note that we need the stack space to live long enough,
     // till we exit this interpreted function.
     case AllocaOp::id: {
@@ -13,6 +13,9 @@ class Interpreter {
   union Value {
     intptr_t vi;
     float vf;
+    // Vectors of 4 lanes.
+    uint32_t vi4[4];
+    float vf4[4];
   };
 
   using SymbolTable = std::unordered_map<Op*, Value>;
@@ -30,6 +33,7 @@ class Interpreter {
 
   intptr_t eval(Op *op);
   float evalf(Op *op);
+  Value evalv(Op *op);
 
   void store(Op *op, float v);
   void store(Op *op, intptr_t v);
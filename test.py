@@ -267,6 +267,10 @@ def run(full_file: str, no_exec: bool):
     if input.exists():
       command.extend(["-i", str(input)])
 
+  flags = Path(full_file).with_name(f"{basename}.flags")
+  if flags.exists():
+    command.extend(flags.read_text().split())
+
   command.extend(["-o", f"temp/{basename}.s"])
   
   # Invoke SysY compiler.
@@ -294,6 +298,10 @@ def run_test_case(sy_path: Path, in_path: Path, out_path: Path):
       commands.append("--arm")
     if args.verify:
       commands.append("--verify")
+    # Tests for optional passes list the options they need in a .flags file.
+    flags_path = sy_path.with_name(f"{sy_path.stem}.flags")
+    if flags_path.exists():
+      commands.extend(flags_path.read_text().split())
     
     try:
       proc.run(